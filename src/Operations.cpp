@@ -5,6 +5,7 @@
 #include "core/DataSources.h"
 #include "core/FileUtils.h"
 #include "core/Modifiers.h"
+#include "core/Parallel.h"
 #include "core/Project.h"
 #include "core/ProjectFile.h"
 #include "dialogs/CsvConfigDialog.h"
@@ -19,10 +20,21 @@
 #include "widgets/OriPopupMessage.h"
 
 #include <QApplication>
+#include <QCheckBox>
+#include <QComboBox>
 #include <QDebug>
 #include <QGroupBox>
+#include <QLabel>
+#include <QLineEdit>
 #include <QMessageBox>
 #include <QProcess>
+#include <QRadioButton>
+#include <QRegularExpression>
+#include <QSpinBox>
+#include <QVBoxLayout>
+
+#include <limits>
+#include <optional>
 
 #define SELECTED_GRAPHS \
     auto graphs = getSelectedGraphs(); \
@@ -95,10 +107,14 @@ void Operations::openPrjFile(const QString& fileName)
         return;
     }
     
-    QString err = ProjectFile::loadProject(fileName, _project);
+    QString err;
+    {
+        EventBus::Batch batch;
+        err = ProjectFile::loadProject(fileName, _project);
+    }
     if (!err.isEmpty()) {
         QString msg = tr("Failed to load project: %1").arg(err);
-        BusEvent::ErrorMessage::send({{"error", msg}});
+        EventBus::send({ .type = BusEvent::ErrorMessage, .message = &msg });
         return;
     }
     
@@ -117,7 +133,7 @@ bool Operations::savePrjFile(const QString& fileName)
     QString err = ProjectFile::saveProject(data);
     if (!err.isEmpty()) {
         QString msg = tr("Failed to save project: %1").arg(err);
-        BusEvent::ErrorMessage::send({{"error", msg}});
+        EventBus::send({ .type = BusEvent::ErrorMessage, .message = &msg });
         return false;
     }
 
@@ -298,13 +314,25 @@ void Operations::modifyScale() { modifyGraph(new ScaleModifier); }
 void Operations::modifyNormalize() { modifyGraph(new NormalizeModifier); }
 void Operations::modifyInvert() { modifyGraph(new InvertModifier); }
 void Operations::modifyDecimate() { modifyGraph(new DecimateModifier); }
+void Operations::modifyResample() { modifyGraph(new ResampleModifier); }
 void Operations::modifyAverage() { modifyGraph(new AverageModifier); }
 void Operations::modifyMavgSimple() { modifyGraph(new MavgSimpleModifier); }
 void Operations::modifyMavgCumul() { modifyGraph(new MavgCumulModifier); }
 void Operations::modifyMavgExp() { modifyGraph(new MavgExpModifier); }
 void Operations::modifyFitLimits() { modifyGraph(new FitLimitsModifier); }
 void Operations::modifyDespike() { modifyGraph(new DespikeModifier); }
+void Operations::modifyMedian() { modifyGraph(new MedianModifier); }
 void Operations::modifyDerivative() { modifyGraph(new DerivativeModifier); }
+void Operations::modifySavGol() { modifyGraph(new SavGolModifier); }
+void Operations::modifySpectrum() { modifyGraph(new SpectrumModifier); }
+void Operations::modifyConvolve() { modifyGraph(new ConvolveModifier); }
+void Operations::modifyFormula() { modifyGraph(new FormulaModifier); }
+void Operations::modifyArithmetic()
+{
+    auto mod = new ArithmeticModifier;
+    mod->setProject(_project);
+    modifyGraph(mod);
+}
 
 bool Operations::addGraph(DataSource* dataSource, DoConfig doConfig, DoLoad doLoad)
 {
@@ -344,18 +372,52 @@ void Operations::modifyGraph(Modifier *modParams)
         return;
     }
     QList<QPair<QString, QString>> report;
-    for (auto graph : std::as_const(graphs))
+
+    // Graph can't be calculated from itself, even through other graphs
+    if (auto ref = _project->graph(modParams->reference()); ref)
+    {
+        QVector<Graph*> validGraphs;
+        for (auto graph : std::as_const(graphs))
+            if (graph == ref || _project->dependentGraphs(graph).contains(ref))
+                report << qMakePair(graph->title(), tr("Graph can't refer to itself"));
+            else
+                validGraphs << graph;
+        graphs = validGraphs;
+    }
+
+    // Results are calculated for all graphs at once, then applied in the main thread
+    QVector<Modifier*> mods;
+    for (int i = 0; i < graphs.size(); i++)
     {
         auto mod = makeModifier(modParams->type());
         mod->copyParams(modParams);
-        auto res = graph->modify(mod);
-        if (!res.isEmpty())
+        mods << mod;
+    }
+    QVector<std::optional<GraphResult>> results(graphs.size());
+    auto calc = [&](qsizetype begin, qsizetype end){
+        for (qsizetype i = begin; i < end; i++)
+            results[i] = mods[i]->modify(graphs[i]->data());
+    };
+    if (modParams->isThreadSafe())
+        Z::parallelFor(graphs.size(), 1, calc);
+    else
+        calc(0, graphs.size());
+
+    {
+        // Plots are redrawn once when all graphs are done
+        EventBus::Batch batch;
+        for (int i = 0; i < graphs.size(); i++)
         {
-            report << qMakePair(graph->title(), res);
-            delete mod;
-            continue;
+            auto graph = graphs.at(i);
+            auto res = graph->modify(mods[i], *results[i]);
+            if (!res.isEmpty())
+            {
+                report << qMakePair(graph->title(), res);
+                delete mods[i];
+                continue;
+            }
+            _project->updateGraph(graph);
         }
-        _project->updateGraph(graph);
     }
     delete modParams;
     if (!report.isEmpty())
@@ -378,27 +440,37 @@ void Operations::graphRefresh()
 {
     SELECTED_GRAPHS
 
+    // Formulas can take long, they are calculated all together in parallel
+    QVector<FormulaDataSource*> formulas;
+    for (auto graph : std::as_const(graphs))
+        if (graph->dataSource()->type() == FormulaDataSource::_type_() && graph->canRefreshData().isEmpty())
+            formulas << static_cast<FormulaDataSource*>(graph->dataSource());
+    FormulaDataSource::prefetch(formulas);
+
     bool hasErrors = false;
     QList<QPair<QString, QString>> report;
-    for (auto graph : std::as_const(graphs))
     {
-        auto res = graph->canRefreshData();
-        if (!res.isEmpty())
+        EventBus::Batch batch;
+        for (auto graph : std::as_const(graphs))
         {
-            report <<qMakePair(graph->title(), res);
-            continue;
-        }
-        // TODO: check if graph has no data anymore
-        // (e.g. file was deleted or its content changed unexpectedly)
-        // and add an ability to cancel and keep old data
-        res = graph->refreshData();
-        if (!res.isEmpty())
-        {
-            hasErrors = true;
-            report <<qMakePair(graph->title(), res);
-            continue;
+            auto res = graph->canRefreshData();
+            if (!res.isEmpty())
+            {
+                report <<qMakePair(graph->title(), res);
+                continue;
+            }
+            // TODO: check if graph has no data anymore
+            // (e.g. file was deleted or its content changed unexpectedly)
+            // and add an ability to cancel and keep old data
+            res = graph->refreshData();
+            if (!res.isEmpty())
+            {
+                hasErrors = true;
+                report <<qMakePair(graph->title(), res);
+                continue;
+            }
+            _project->updateGraph(graph);
         }
-        _project->updateGraph(graph);
     }
     if (!report.isEmpty())
     {
@@ -467,16 +539,32 @@ void Operations::graphReopen()
     // TODO: check if new config issues no data (e.g. wrong file selected)
     // and add an ability to rollback the config
 
-    for (auto graph : std::as_const(graphs))
+    if (dataSource->type() == FormulaDataSource::_type_())
     {
-        graph->dataSource()->copySourceFrom(dataSource);
-        res = graph->refreshData();
-        if (!res.isEmpty())
+        QVector<FormulaDataSource*> formulas;
+        for (auto graph : std::as_const(graphs))
         {
-            report << qMakePair(graph->title(), res);
-            continue;
+            // The first source has already calculated its data when verifying the code
+            if (graph->dataSource() == dataSource) continue;
+            graph->dataSource()->copySourceFrom(dataSource);
+            formulas << static_cast<FormulaDataSource*>(graph->dataSource());
+        }
+        FormulaDataSource::prefetch(formulas);
+    }
+
+    {
+        EventBus::Batch batch;
+        for (auto graph : std::as_const(graphs))
+        {
+            graph->dataSource()->copySourceFrom(dataSource);
+            res = graph->refreshData();
+            if (!res.isEmpty())
+            {
+                report << qMakePair(graph->title(), res);
+                continue;
+            }
+            _project->updateGraph(graph);
         }
-        _project->updateGraph(graph);
     }
     if (!report.isEmpty())
     {
@@ -493,3 +581,252 @@ void Operations::graphReopen()
         Ori::Dlg::error(msg);
     }
 }
+
+void Operations::graphSweep()
+{
+    SELECTED_GRAPHS
+
+    auto graph = graphs.first();
+    if (graph->dataSource()->type() != FormulaDataSource::_type_())
+    {
+        Ori::Dlg::info(tr("Parameter sweep is only available for formula graphs"));
+        return;
+    }
+    auto source = static_cast<FormulaDataSource*>(graph->dataSource());
+
+    auto root = CustomDataHelpers::loadDataSourceStates();
+    auto state = root["formula_sweep"].toObject();
+
+    auto editorParam = new QComboBox;
+    editorParam->setEditable(true);
+    editorParam->addItems(source->params().keys());
+    editorParam->setCurrentText(state["param"].toString());
+
+    PlottingRange range;
+    range.load(state);
+    if (state.isEmpty())
+    {
+        range.start = 1;
+        range.stop = 10;
+        range.step = 1;
+        range.points = 10;
+    }
+    auto editorRange = new RangeEditor;
+    editorRange->setRange(range);
+
+    auto editor = Ori::Layouts::LayoutV({
+        Ori::Layouts::LayoutV({editorParam}).makeGroupBox(tr("Parameter")),
+        Ori::Layouts::LayoutV({editorRange}).makeGroupBox(tr("Values")),
+    }).setMargin(0).makeWidgetAuto();
+
+    if (!Ori::Dlg::Dialog(editor.get(), false)
+        .withTitle(tr("Parameter Sweep"))
+        .withContentToButtonsSpacingFactor(3)
+        .withVerification([editorParam, editorRange]{
+            auto err = FormulaDataSource::verifyParamName(editorParam->currentText().trimmed());
+            if (!err.isEmpty())
+                return err;
+            return editorRange->range().verify();
+        })
+        .exec())
+        return;
+
+    QString param = editorParam->currentText().trimmed();
+    range = editorRange->range();
+
+    state = QJsonObject();
+    state["param"] = param;
+    range.save(state);
+    root["formula_sweep"] = state;
+    CustomDataHelpers::saveDataSourceStates(root);
+
+    // All graphs are calculated together in parallel
+    const auto sources = source->sweep(param, range.calcValues());
+    FormulaDataSource::prefetch(sources);
+
+    QStringList report;
+    {
+        EventBus::Batch batch;
+        for (auto ds : sources)
+        {
+            auto g = new Graph(ds);
+            auto res = g->refreshData();
+            if (!res.isEmpty())
+            {
+                report << QString("<b>%1</b>: %2").arg(ds->makeTitle(), res);
+                delete g;
+                continue;
+            }
+            emit graphCreated(g);
+        }
+    }
+    if (!report.isEmpty())
+        Ori::Dlg::error(tr("There are errors while calculating some graphs:<br>") + report.join("<br>"));
+}
+
+static QVector<double> parsePercents(const QString &text, QString &error)
+{
+    QVector<double> res;
+    static QRegularExpression separators("[\\s,;]+");
+    for (const auto &s : text.split(separators, Qt::SkipEmptyParts))
+    {
+        bool ok;
+        double p = s.toDouble(&ok);
+        if (!ok || p < 0 || p > 100)
+        {
+            error = qApp->tr("Percentile must be a number from 0 to 100: %1").arg(s);
+            return {};
+        }
+        res << p;
+    }
+    return res;
+}
+
+void Operations::graphEnsemble()
+{
+    SELECTED_GRAPHS
+
+    if (graphs.size() < 2)
+    {
+        Ori::Dlg::info(tr("Select at least two graphs to calculate statistics over them"));
+        return;
+    }
+
+    auto root = CustomDataHelpers::loadDataSourceStates();
+    auto state = root["ensemble"].toObject();
+
+    auto editorMean = new QCheckBox(tr("Mean"));
+    editorMean->setChecked(state["mean"].toBool(true));
+    auto editorStd = new QCheckBox(tr("Standard deviation band (mean ± std)"));
+    editorStd->setChecked(state["std"].toBool(true));
+    auto editorMinMax = new QCheckBox(tr("Min/max envelope"));
+    editorMinMax->setChecked(state["minMax"].toBool(false));
+    auto editorPercents = new QLineEdit;
+    editorPercents->setText(state["percentiles"].toString("5, 95"));
+    editorPercents->setPlaceholderText(tr("e.g. 5, 50, 95"));
+
+    int maxPoints = 0;
+    for (auto g : std::as_const(graphs))
+        maxPoints = qMax(maxPoints, g->pointsCount());
+    auto editorPoints = new QSpinBox;
+    editorPoints->setRange(2, std::numeric_limits<int>::max());
+    editorPoints->setValue(qMax(2, maxPoints));
+
+    auto editor = Ori::Layouts::LayoutV({
+        Ori::Layouts::LayoutV({editorMean, editorStd, editorMinMax}).makeGroupBox(tr("Statistics")),
+        Ori::Layouts::LayoutV({editorPercents}).makeGroupBox(tr("Percentiles")),
+        Ori::Layouts::LayoutV({editorPoints}).makeGroupBox(tr("Points")),
+    }).setMargin(0).makeWidgetAuto();
+
+    if (!Ori::Dlg::Dialog(editor.get(), false)
+        .withTitle(tr("Ensemble Statistics"))
+        .withContentToButtonsSpacingFactor(3)
+        .withVerification([editorMean, editorStd, editorMinMax, editorPercents]{
+            QString error;
+            auto percents = parsePercents(editorPercents->text(), error);
+            if (!error.isEmpty())
+                return error;
+            if (!editorMean->isChecked() && !editorStd->isChecked() && !editorMinMax->isChecked() && percents.isEmpty())
+                return tr("Select at least one statistic");
+            return QString();
+        })
+        .exec())
+        return;
+
+    QString error;
+    const auto percents = parsePercents(editorPercents->text(), error);
+
+    state = QJsonObject();
+    state["mean"] = editorMean->isChecked();
+    state["std"] = editorStd->isChecked();
+    state["minMax"] = editorMinMax->isChecked();
+    state["percentiles"] = editorPercents->text();
+    root["ensemble"] = state;
+    CustomDataHelpers::saveDataSourceStates(root);
+
+    QVector<Z::Ensemble::Output> outputs;
+    if (editorMean->isChecked())
+        outputs << Z::Ensemble::Output{ Z::Ensemble::MEAN };
+    if (editorStd->isChecked())
+        outputs << Z::Ensemble::Output{ Z::Ensemble::MEAN_MINUS_STD } << Z::Ensemble::Output{ Z::Ensemble::MEAN_PLUS_STD };
+    if (editorMinMax->isChecked())
+        outputs << Z::Ensemble::Output{ Z::Ensemble::MIN } << Z::Ensemble::Output{ Z::Ensemble::MAX };
+    for (double p : percents)
+        outputs << Z::Ensemble::Output{ Z::Ensemble::PERCENTILE, p };
+
+    // All statistics are calculated by the first graph in a single pass over the source graphs
+    QStringList ids;
+    for (auto g : std::as_const(graphs))
+        ids << g->id();
+    const int points = editorPoints->value() == maxPoints ? 0 : editorPoints->value();
+    const auto sources = EnsembleDataSource::makeSet(_project, ids, outputs, points);
+    bool failed = false;
+    for (auto ds : sources)
+    {
+        if (failed)
+        {
+            delete ds;
+            continue;
+        }
+        auto g = new Graph(ds);
+        auto res = g->refreshData();
+        if (!res.isEmpty())
+        {
+            Ori::Dlg::error(res);
+            delete g;
+            failed = true;
+            continue;
+        }
+        emit graphCreated(g);
+    }
+}
+
+void Operations::graphStorage()
+{
+    SELECTED_GRAPHS
+
+    QVector<QPair<ValueStorage::Type, QString>> types = {
+        { ValueStorage::Auto, tr("Automatic (most compact lossless)") },
+        { ValueStorage::F64, tr("Double precision (64-bit)") },
+        { ValueStorage::F32, tr("Single precision (32-bit)") },
+        { ValueStorage::I32, tr("Integer 32-bit, scaled to data range") },
+        { ValueStorage::I16, tr("Integer 16-bit, scaled to data range") },
+    };
+    auto group = new QGroupBox(tr("Keep points as"));
+    auto layout = new QVBoxLayout(group);
+    QMap<ValueStorage::Type, QRadioButton*> buttons;
+    for (const auto &t : std::as_const(types)) {
+        auto button = new QRadioButton(t.second);
+        buttons[t.first] = button;
+        layout->addWidget(button);
+    }
+    buttons[graphs.first()->storageType()]->setChecked(true);
+
+    qint64 bytes = 0;
+    for (auto g : std::as_const(graphs))
+        bytes += g->packedData().xs.bytes().size() + g->packedData().ys.bytes().size();
+    auto info = new QLabel(tr("Memory used by points: %1 KiB\n"
+        "Integer and single precision types can lose precision,\n"
+        "calculations are always done in double precision.").arg(bytes / 1024));
+
+    auto editor = Ori::Layouts::LayoutV({group, info}).setMargin(0).makeWidgetAuto();
+    if (!Ori::Dlg::Dialog(editor.get(), false)
+        .withTitle(tr("Graph Data Storage"))
+        .withContentToButtonsSpacingFactor(3)
+        .exec())
+        return;
+
+    ValueStorage::Type type = ValueStorage::Auto;
+    for (auto it = buttons.cbegin(); it != buttons.cend(); it++)
+        if (it.value()->isChecked())
+            type = it.key();
+
+    EventBus::Batch batch;
+    for (auto graph : std::as_const(graphs))
+    {
+        if (graph->storageType() == type)
+            continue;
+        graph->setStorageType(type);
+        _project->updateGraph(graph);
+    }
+}
@@ -59,15 +59,25 @@ public slots:
     void modifyNormalize();
     void modifyInvert();
     void modifyDecimate();
+    void modifyResample();
     void modifyAverage();
     void modifyMavgSimple();
     void modifyMavgCumul();
     void modifyMavgExp();
     void modifyFitLimits();
     void modifyDespike();
+    void modifyMedian();
     void modifyDerivative();
+    void modifySavGol();
+    void modifySpectrum();
+    void modifyConvolve();
+    void modifyFormula();
+    void modifyArithmetic();
     void graphRefresh();
     void graphReopen();
+    void graphSweep();
+    void graphEnsemble();
+    void graphStorage();
 
 signals:
     void graphCreated(Graph* g);
@@ -51,6 +51,9 @@ void AppSettings::load()
     LOAD(highlightAxesOfSelectedGraphs, Bool, true);
     LOAD(selectNewGraph, Bool, true);
     LOAD(lockPanZoomToSelectedGraphs, Bool, true);
+    LOAD(formulaTimeLimitSec, Int, 60);
+    LOAD(formulaInstructionLimitM, Int, 0);
+    LOAD(formulaMemoryLimitMb, Int, 1024);
 }
 
 void AppSettings::save()
@@ -63,6 +66,9 @@ void AppSettings::save()
     SAVE(highlightAxesOfSelectedGraphs);
     SAVE(selectNewGraph);
     SAVE(lockPanZoomToSelectedGraphs);
+    SAVE(formulaTimeLimitSec);
+    SAVE(formulaInstructionLimitM);
+    SAVE(formulaMemoryLimitMb);
 }
 
 bool AppSettings::edit()
@@ -82,6 +88,12 @@ bool AppSettings::edit()
         new ConfigItemBool(0, tr("Autolimit axes after they was assigned to graph"), &autolitmAfterAxesChanged),
         new ConfigItemBool(0, tr("Highlight axes of selected graphs"), &highlightAxesOfSelectedGraphs),
         new ConfigItemBool(0, tr("Use only selected graphs' axes for pan and zoom"), &lockPanZoomToSelectedGraphs),
+        new ConfigItemSpace(0, 12),
+        (new ConfigItemSection(0, tr("Formulas")))
+            ->withHint(tr("Execution of formula code is stopped when it exceeds any of these limits, zero means unlimited")),
+        new ConfigItemInt(0, tr("Time limit, seconds"), &formulaTimeLimitSec),
+        new ConfigItemInt(0, tr("Instructions limit, millions"), &formulaInstructionLimitM),
+        new ConfigItemInt(0, tr("Memory limit, MB"), &formulaMemoryLimitMb),
     };
     if (ConfigDlg::edit(opts))
     {
@@ -27,6 +27,11 @@ public:
     bool selectNewGraph = true;
     bool lockPanZoomToSelectedGraphs = true;
 
+    // Limits for user formulas, zero means unlimited
+    int formulaTimeLimitSec = 60;
+    int formulaInstructionLimitM = 0;
+    int formulaMemoryLimitMb = 1024;
+
     bool isDevMode = false;
 
     void load();
@@ -0,0 +1,49 @@
+#include "BackgroundTask.h"
+
+#include <QApplication>
+#include <QEventLoop>
+#include <QProgressDialog>
+#include <QThread>
+
+namespace BackgroundTask {
+
+// Most tasks are done faster, don't flash the dialog for them
+static const int DIALOG_DELAY_MS = 250;
+
+void run(const QString &title, const Task &task)
+{
+    std::atomic<bool> cancel{false};
+
+    if (!qApp || QThread::currentThread() != qApp->thread())
+    {
+        task(cancel);
+        return;
+    }
+
+    QEventLoop loop;
+    QScopedPointer<QThread> thread(QThread::create([&task, &cancel]{ task(cancel); }));
+    QObject::connect(thread.get(), &QThread::finished, &loop, &QEventLoop::quit);
+    thread->start();
+
+    if (thread->wait(DIALOG_DELAY_MS))
+        return;
+
+    QProgressDialog dlg(title, qApp->tr("Cancel"), 0, 0, qApp->activeWindow());
+    dlg.setWindowModality(Qt::ApplicationModal);
+    dlg.setMinimumDuration(0);
+    QObject::connect(&dlg, &QProgressDialog::canceled, &dlg, [&dlg, &cancel]{
+        cancel = true;
+        dlg.setLabelText(qApp->tr("Cancelling..."));
+        // Keep it visible until the task has really stopped
+        dlg.show();
+    });
+    dlg.show();
+
+    // Finished signal is queued to this thread,
+    // so it is delivered by the loop even if the thread has just stopped
+    if (!thread->isFinished())
+        loop.exec();
+    thread->wait();
+}
+
+} // namespace BackgroundTask
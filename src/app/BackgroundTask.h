@@ -0,0 +1,21 @@
+#ifndef BACKGROUND_TASK_H
+#define BACKGROUND_TASK_H
+
+#include <QString>
+
+#include <atomic>
+#include <functional>
+
+namespace BackgroundTask {
+
+using Task = std::function<void(const std::atomic<bool> &cancel)>;
+
+/// Runs a task in a worker thread and waits for it while GUI keeps responding.
+/// If the task takes noticeable time, a modal progress dialog is shown,
+/// its Cancel button raises the `cancel` flag which the task should check from time to time.
+/// When called not from the GUI thread, the task is just run in place.
+void run(const QString &title, const Task &task);
+
+} // namespace BackgroundTask
+
+#endif // BACKGROUND_TASK_H
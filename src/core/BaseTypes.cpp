@@ -3,6 +3,34 @@
 #include <QApplication>
 #include <QJsonObject>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+
+//------------------------------------------------------------------------------
+//                               GraphPoints
+//------------------------------------------------------------------------------
+
+Values GraphPoints::xValues() const
+{
+    if (!uniformX)
+        return xs;
+    const int count = ys.size();
+    Values res(count);
+    for (int i = 0; i < count; i++)
+        res[i] = x0 + double(i) * dx;
+    return res;
+}
+
+GraphPoints GraphPoints::explicitX() const
+{
+    if (!uniformX)
+        return *this;
+    return {xValues(), ys};
+}
+
 //------------------------------------------------------------------------------
 //                              CsvGraphParams
 //------------------------------------------------------------------------------
@@ -133,3 +161,241 @@ void RandomSampleParams::load(const QJsonObject &obj)
     rangeX.load(obj["rangeX"].toObject());
     rangeY.load(obj["rangeY"].toObject());
 }
+
+//------------------------------------------------------------------------------
+//                               ValueStorage
+//------------------------------------------------------------------------------
+
+// The minimal integer is reserved for NaN, so ranges are symmetric
+static const qint64 I16_MAX = std::numeric_limits<qint16>::max();
+static const qint64 I32_MAX = std::numeric_limits<qint32>::max();
+
+int ValueStorage::bytesPerValue() const
+{
+    switch (type) {
+    case F32: return sizeof(float);
+    case I16: return sizeof(qint16);
+    case I32: return sizeof(qint32);
+    default: return sizeof(double);
+    }
+}
+
+static bool fitIntegers(ValueStorage &s, double min, double max, qint64 limit)
+{
+    double offset = 0;
+    if (min < -limit || max > limit)
+        offset = std::round((min + max) / 2.0);
+    if (min - offset < -limit || max - offset > limit)
+        return false;
+    s.scale = 1;
+    s.offset = offset;
+    return true;
+}
+
+ValueStorage ValueStorage::fit(Type type, const Values &vs)
+{
+    double min = std::numeric_limits<double>::max();
+    double max = std::numeric_limits<double>::lowest();
+    bool allInt = true, allFloat = true;
+    for (auto v : vs) {
+        if (std::isnan(v)) continue;
+        if (v < min) min = v;
+        if (v > max) max = v;
+        if (allInt && (std::isinf(v) || v != std::floor(v) || qAbs(v) > 9e15))
+            allInt = false;
+        if (allFloat && double(float(v)) != v)
+            allFloat = false;
+    }
+    bool hasValues = min <= max;
+
+    ValueStorage s;
+    switch (type) {
+    case Auto:
+        s.type = I16;
+        if (hasValues && allInt && fitIntegers(s, min, max, I16_MAX))
+            return s;
+        s.type = I32;
+        if (hasValues && allInt && fitIntegers(s, min, max, I32_MAX))
+            return s;
+        s.type = hasValues && allFloat ? F32 : F64;
+        return s;
+
+    case I16:
+    case I32: {
+        s.type = type;
+        if (!hasValues || std::isinf(min) || std::isinf(max))
+            return s;
+        qint64 limit = type == I16 ? I16_MAX : I32_MAX;
+        if (allInt && fitIntegers(s, min, max, limit))
+            return s;
+        s.offset = (min + max) / 2.0;
+        s.scale = max > min ? (max - min) / double(2 * limit) : 1;
+        return s;
+    }
+
+    default:
+        s.type = type;
+        return s;
+    }
+}
+
+QString ValueStorage::typeName(Type type)
+{
+    switch (type) {
+    case Auto: return QStringLiteral("auto");
+    case F64: return QStringLiteral("f64");
+    case F32: return QStringLiteral("f32");
+    case I16: return QStringLiteral("i16");
+    case I32: return QStringLiteral("i32");
+    }
+    return QString();
+}
+
+ValueStorage::Type ValueStorage::typeByName(const QString &name)
+{
+    if (name == QStringLiteral("f64")) return F64;
+    if (name == QStringLiteral("f32")) return F32;
+    if (name == QStringLiteral("i16")) return I16;
+    if (name == QStringLiteral("i32")) return I32;
+    return Auto;
+}
+
+//------------------------------------------------------------------------------
+//                               PackedValues
+//------------------------------------------------------------------------------
+
+template <typename T> inline void storeLE(char *dst, T v)
+{
+    memcpy(dst, &v, sizeof(T));
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    std::reverse(dst, dst + sizeof(T));
+#endif
+}
+
+template <typename T> inline T loadLE(const char *src)
+{
+    T v;
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+    char tmp[sizeof(T)];
+    std::reverse_copy(src, src + sizeof(T), tmp);
+    memcpy(&v, tmp, sizeof(T));
+#else
+    memcpy(&v, src, sizeof(T));
+#endif
+    return v;
+}
+
+template <typename T> inline T encodeInt(double v, const ValueStorage &s, qint64 limit)
+{
+    if (std::isnan(v))
+        return std::numeric_limits<T>::min();
+    return T(qBound(-limit, qint64(std::llround((v - s.offset) / s.scale)), limit));
+}
+
+template <typename T> inline double decodeInt(T i, const ValueStorage &s)
+{
+    if (i == std::numeric_limits<T>::min())
+        return std::numeric_limits<double>::quiet_NaN();
+    return s.offset + double(i) * s.scale;
+}
+
+PackedValues::PackedValues(const Values &vs, ValueStorage::Type type) : PackedValues(vs, ValueStorage::fit(type, vs))
+{
+}
+
+// Largest buffer QByteArray can hold
+#if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+static const qint64 MAX_PACKED_BYTES = std::numeric_limits<int>::max() - 64;
+#else
+static const qint64 MAX_PACKED_BYTES = std::numeric_limits<qsizetype>::max() / 2;
+#endif
+
+PackedValues::PackedValues(const Values &vs, const ValueStorage &storage) : _storage(storage)
+{
+    const int sz = _storage.bytesPerValue();
+    // Values not fitting into the buffer are not packed at all, the caller checks the size
+    if (qint64(vs.size()) > std::numeric_limits<int>::max() || qint64(vs.size()) * sz > MAX_PACKED_BYTES)
+        return;
+    try
+    {
+        _bytes.resize(qsizetype(vs.size()) * sz);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return;
+    }
+    _size = int(vs.size());
+    char *dst = _bytes.data();
+    const double *src = vs.constData();
+    switch (_storage.type) {
+    case ValueStorage::F32:
+        for (int i = 0; i < _size; i++, dst += sz)
+            storeLE<float>(dst, float(src[i]));
+        break;
+    case ValueStorage::I16:
+        for (int i = 0; i < _size; i++, dst += sz)
+            storeLE<qint16>(dst, encodeInt<qint16>(src[i], _storage, I16_MAX));
+        break;
+    case ValueStorage::I32:
+        for (int i = 0; i < _size; i++, dst += sz)
+            storeLE<qint32>(dst, encodeInt<qint32>(src[i], _storage, I32_MAX));
+        break;
+    default:
+        _storage.type = ValueStorage::F64;
+        for (int i = 0; i < _size; i++, dst += sz)
+            storeLE<double>(dst, src[i]);
+        break;
+    }
+}
+
+bool PackedValues::assign(const QByteArray &bytes, int size, const ValueStorage &storage)
+{
+    if (storage.type == ValueStorage::Auto || size < 0 || bytes.size() < qint64(size) * storage.bytesPerValue())
+        return false;
+    _storage = storage;
+    _size = size;
+    _bytes = bytes.left(qsizetype(size) * storage.bytesPerValue());
+    return true;
+}
+
+double PackedValues::at(int i) const
+{
+    const char *p = _bytes.constData() + qsizetype(i) * _storage.bytesPerValue();
+    switch (_storage.type) {
+    case ValueStorage::F32: return loadLE<float>(p);
+    case ValueStorage::I16: return decodeInt(loadLE<qint16>(p), _storage);
+    case ValueStorage::I32: return decodeInt(loadLE<qint32>(p), _storage);
+    default: return loadLE<double>(p);
+    }
+}
+
+Values PackedValues::unpack() const
+{
+    Values vs(_size);
+    double *dst = vs.data();
+    const char *src = _bytes.constData();
+    const int sz = _storage.bytesPerValue();
+    switch (_storage.type) {
+    case ValueStorage::F32:
+        for (int i = 0; i < _size; i++, src += sz)
+            dst[i] = loadLE<float>(src);
+        break;
+    case ValueStorage::I16:
+        for (int i = 0; i < _size; i++, src += sz)
+            dst[i] = decodeInt(loadLE<qint16>(src), _storage);
+        break;
+    case ValueStorage::I32:
+        for (int i = 0; i < _size; i++, src += sz)
+            dst[i] = decodeInt(loadLE<qint32>(src), _storage);
+        break;
+    default:
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        for (int i = 0; i < _size; i++, src += sz)
+            dst[i] = loadLE<double>(src);
+#else
+        memcpy(dst, src, _bytes.size());
+#endif
+        break;
+    }
+    return vs;
+}
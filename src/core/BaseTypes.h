@@ -1,9 +1,11 @@
 #ifndef BASE_TYPES_H
 #define BASE_TYPES_H
 
+#include "EventBus.h"
+
 #include "core/OriResult.h"
-#include "tools/OriMessageBus.h"
 
+#include <QByteArray>
 #include <QVector>
 
 class QJsonObject;
@@ -15,11 +17,108 @@ struct GraphPoints
     Values xs;
     Values ys;
 
-    int size() const { return xs.size(); }
+    /// When X is uniform, xs is empty and X values are defined
+    /// analytically as `x0 + i * dx`, see uniform()
+    bool uniformX = false;
+    double x0 = 0;
+    double dx = 1;
+
+    int size() const { return ys.size(); }
+
+    double x(int i) const { return uniformX ? x0 + double(i) * dx : xs.at(i); }
+
+    /// Returns X values, they are calculated for uniform X.
+    Values xValues() const;
+
+    /// Returns points having X values stored explicitly.
+    GraphPoints explicitX() const;
+
+    static GraphPoints uniform(double x0, double dx, const Values &ys) { return {{}, ys, true, x0, dx}; }
 };
 
 using GraphResult = Ori::Result<GraphPoints>;
 
+/// Describes how values are kept in memory and in project files.
+/// Integer types store values as `offset + i * scale`.
+struct ValueStorage
+{
+    enum Type
+    {
+        /// Not an actual storage type, it's a request
+        /// to select the most compact type that keeps values exactly
+        Auto,
+        F64,
+        F32,
+        I16,
+        I32,
+    };
+
+    Type type = F64;
+    double scale = 1;
+    double offset = 0;
+
+    int bytesPerValue() const;
+
+    bool operator==(const ValueStorage &s) const { return type == s.type && scale == s.scale && offset == s.offset; }
+    bool operator!=(const ValueStorage &s) const { return !(*this == s); }
+
+    /// Selects storage parameters of the given type suitable for the values.
+    /// Integer types get scale and offset making the value range fit into them.
+    static ValueStorage fit(Type type, const Values &vs);
+
+    static QString typeName(Type type);
+    static Type typeByName(const QString &name);
+};
+
+/// Values converted into compact binary form according to some storage type.
+/// Buffer is always little-endian so it can be written to files as is.
+class PackedValues
+{
+public:
+    PackedValues() {}
+    PackedValues(const Values &vs, ValueStorage::Type type = ValueStorage::Auto);
+    /// Values that can't be packed into a single buffer, or not enough memory for it,
+    /// make empty result, the caller should compare sizes.
+    PackedValues(const Values &vs, const ValueStorage &storage);
+
+    /// Makes values from raw buffer, returns false if buffer is too short.
+    bool assign(const QByteArray &bytes, int size, const ValueStorage &storage);
+
+    int size() const { return _size; }
+    bool isEmpty() const { return _size == 0; }
+    const ValueStorage& storage() const { return _storage; }
+    const QByteArray& bytes() const { return _bytes; }
+
+    double at(int i) const;
+    Values unpack() const;
+
+private:
+    ValueStorage _storage;
+    QByteArray _bytes;
+    int _size = 0;
+};
+
+/// Graph points kept in compact form.
+/// All calculations are done on unpacked double-precision values.
+struct PackedPoints
+{
+    PackedValues xs;
+    PackedValues ys;
+
+    /// Uniform X is not stored at all, see GraphPoints::uniform()
+    bool uniformX = false;
+    double x0 = 0;
+    double dx = 1;
+
+    PackedPoints() {}
+    PackedPoints(const GraphPoints &data, ValueStorage::Type type = ValueStorage::Auto) :
+        xs(data.xs, type), ys(data.ys, type), uniformX(data.uniformX), x0(data.x0), dx(data.dx) {}
+
+    int size() const { return ys.size(); }
+    double x(int i) const { return uniformX ? x0 + double(i) * dx : xs.at(i); }
+    GraphPoints unpack() const { return {xs.unpack(), ys.unpack(), uniformX, x0, dx}; }
+};
+
 struct CsvGraphParams
 {
     QString title;
@@ -65,30 +164,4 @@ struct RandomSampleParams
     void load(const QJsonObject &obj);
 };
 
-#define BUS_EVENT(name) \
-    struct name { \
-        static const int id = __COUNTER__; \
-        static void send(const QMap<QString, QVariant>& params = {}) {\
-            Ori::MessageBus::send(id, params); \
-        } \
-    };
-struct BusEvent
-{
-    BUS_EVENT(ErrorMessage)
-    BUS_EVENT(ProjectModified)
-    BUS_EVENT(ProjectUnmodified)
-    BUS_EVENT(DiagramAdded)
-    BUS_EVENT(DiagramDeleted)
-    BUS_EVENT(DiagramRenamed)
-    BUS_EVENT(DiagramFormatLoaded)
-    BUS_EVENT(DiagramLoaded)
-    BUS_EVENT(GraphAdded)
-    BUS_EVENT(GraphLoaded)
-    BUS_EVENT(GraphDeleting)
-    BUS_EVENT(GraphDeleted)
-    BUS_EVENT(GraphUpdated)
-    BUS_EVENT(GraphRenamed)
-};
-#undef BUS_EVENT
-
 #endif // BASE_TYPES_H
@@ -11,9 +11,9 @@ void copyToClipboard(const GraphPoints& data)
 {
     QString text;
     QTextStream stream(&text);
-    int count = data.xs.size();
+    int count = data.size();
     for (int i = 0; i < count; i++)
-        stream << QString::number(data.xs.at(i), 'g', 10)
+        stream << QString::number(data.x(i), 'g', 10)
                << '\t'
                << QString::number(data.ys.at(i), 'g', 10)
                << '\n';
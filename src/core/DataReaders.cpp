@@ -341,13 +341,19 @@ QString TextReader::read()
 
     if (onlyY.size() > ys.size())
     {
-        // treat data as single column
+        // treat data as single column, X is point index
         ys = onlyY;
-        xs.resize(ys.size());
-        for (int i = 0; i < xs.size(); i++)
-            xs[i] = i;
+        xs.clear();
+        uniformX = true;
     }
 
-    Q_ASSERT(xs.size() == ys.size());
+    Q_ASSERT(uniformX || xs.size() == ys.size());
     return QString();
 }
+
+GraphPoints TextReader::points() const
+{
+    if (uniformX)
+        return GraphPoints::uniform(0, 1, ys);
+    return {xs, ys};
+}
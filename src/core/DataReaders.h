@@ -79,8 +79,13 @@ struct TextReader
     QString text;
     QVector<double> xs, ys;
 
+    /// Set for single column data, xs is empty then
+    bool uniformX = false;
+
     QString readFromFile();
     QString read();
+
+    GraphPoints points() const;
 };
 
 #endif // DATA_READERS_H
@@ -2,6 +2,11 @@
 
 #include "CustomPrefs.h"
 #include "LuaHelper.h"
+#include "NativeFormula.h"
+#include "Parallel.h"
+#include "Project.h"
+#include "app/AppSettings.h"
+#include "app/BackgroundTask.h"
 #include "core/DataReaders.h"
 #include "widgets/CodeEditor.h"
 
@@ -10,10 +15,17 @@
 
 #include <QApplication>
 #include <QClipboard>
+#include <QDebug>
+#include <QElapsedTimer>
 #include <QFileDialog>
 #include <QFileInfo>
+#include <QJsonArray>
 #include <QJsonObject>
 #include <QMimeData>
+#include <QMutex>
+#include <QRegularExpression>
+
+#include <optional>
 
 #define CAST_OTHER_TYPE(this_type) \
     auto ds = dynamic_cast<this_type*>(other); \
@@ -36,6 +48,8 @@ DataSource* makeDataSource(const QString &type)
         return new ClipboardCsvDataSource;
     if (type == FormulaDataSource::_type_())
         return new FormulaDataSource;
+    if (type == EnsembleDataSource::_type_())
+        return new EnsembleDataSource;
     return nullptr;
 }
 
@@ -99,8 +113,7 @@ GraphResult TextFileDataSource::read()
     if (!res.isEmpty())
         return GraphResult::fail(res);
 
-    _data = {reader.xs, reader.ys};
-    return GraphResult::ok(_data);
+    return cacheData(reader.points());
 }
 
 QString TextFileDataSource::makeTitle() const
@@ -154,8 +167,7 @@ GraphResult CsvFileDataSource::read()
     if (!res.isEmpty())
         return GraphResult::fail(res);
 
-    _data = {reader.xs, reader.ys};
-    return GraphResult::ok(_data);
+    return cacheData({reader.xs, reader.ys});
 }
 
 QString CsvFileDataSource::makeTitle() const
@@ -239,8 +251,7 @@ GraphResult RandomSampleDataSource::read()
             y = Y - double(Ori::Tools::rand())/max*H;
         ys[i] = y + _params.rangeY.min;
     }
-    _data = {xs, ys};
-    return GraphResult::ok(_data);
+    return cacheData({xs, ys});
 }
 
 QString RandomSampleDataSource::canRefresh() const
@@ -289,8 +300,7 @@ GraphResult ClipboardDataSource::read()
     if (!res.isEmpty())
         return GraphResult::fail(res);
 
-    _data = {reader.xs, reader.ys};
-    return GraphResult::ok(_data);
+    return cacheData(reader.points());
 }
 
 QString ClipboardDataSource::canRefresh() const
@@ -350,6 +360,56 @@ void ClipboardCsvDataSource::load(const QJsonObject &obj)
 
 static int __formulaIndex = 0;
 
+// Minimal number of points calculated in a separate Lua state
+static const qsizetype FUNCTION_CHUNK = 64;
+
+/// Calculates Y declared as a function of X by code executed in the given state.
+/// Points are split into chunks calculated concurrently, each in its own state
+/// getting globals made by the code, so the code itself is not executed again.
+/// When the globals can't be copied, points are calculated in the given state.
+static GraphResult calcFunctionY(Z::Lua &lua, const Values &xs, const Z::Lua::Limits &limits)
+{
+    Values ys(xs.size());
+    double *py = ys.data();
+    auto globals = xs.size() >= 2 * FUNCTION_CHUNK ? lua.exportGlobals({"X"}) : nullptr;
+    if (!globals)
+    {
+        QString err = lua.callGlobalFunction("Y", xs.constData(), py, xs.size());
+        if (!err.isEmpty())
+            return GraphResult::fail(err);
+        return GraphResult::ok({xs, ys});
+    }
+    QMutex mutex;
+    qsizetype errorPos = -1;
+    QString error;
+    Z::parallelFor(xs.size(), FUNCTION_CHUNK, [&](qsizetype begin, qsizetype end){
+        Z::Lua chunk(true);
+        chunk.setLimits(limits);
+        QString err = chunk.open();
+        if (err.isEmpty())
+            err = chunk.importGlobals(*globals);
+        if (err.isEmpty())
+        {
+            // Shared with the result, not copied
+            chunk.setGlobalArray("X", xs);
+            err = chunk.callGlobalFunction("Y", xs.constData() + begin, py + begin, end - begin);
+        }
+        if (!err.isEmpty())
+        {
+            // Report the same error as serial calculation would do
+            QMutexLocker locker(&mutex);
+            if (errorPos < 0 || begin < errorPos)
+            {
+                errorPos = begin;
+                error = err;
+            }
+        }
+    });
+    if (errorPos >= 0)
+        return GraphResult::fail(error);
+    return GraphResult::ok({xs, ys});
+}
+
 FormulaDataSource::FormulaDataSource()
 {
     _index = ++__formulaIndex;
@@ -364,6 +424,7 @@ DataSource::BoolResult FormulaDataSource::selectSource()
 {
     QSharedPointer<CodeEditor> editor(new CodeEditor);
     editor->setCode(_code);
+    editor->setVerifier([this](const QString &code, Z::Lua::Stats *stats){ return exec(code, _params, stats); });
     
     if (Ori::Dlg::Dialog(editor)
         .windowModal()
@@ -376,7 +437,7 @@ DataSource::BoolResult FormulaDataSource::selectSource()
             auto res = editor->verify();
             if (!res.ok())
                 return res.error();
-            _data = res.result();
+            cacheData(res.result());
             _dataReady = true;
             return QString();
         })
@@ -393,24 +454,108 @@ GraphResult FormulaDataSource::read()
     if (_dataReady)
     {
         _dataReady = false;
-        return GraphResult::ok(_data);
+        if (!_readError.isEmpty())
+            return GraphResult::fail(std::exchange(_readError, QString()));
+        return GraphResult::ok(data());
     }
 
-    auto res = exec(_code);
+    auto res = exec(_code, _params);
     if (res.ok())
-        _data = res.result();
+        cacheData(res.result());
 
     return res;
 }
 
-GraphResult FormulaDataSource::exec(const QString &code)
+Z::Lua::Limits FormulaDataSource::limits()
+{
+    const auto &s = AppSettings::instance();
+    return {
+        .instructions = qint64(s.formulaInstructionLimitM) * 1000000,
+        .timeMs = qint64(s.formulaTimeLimitSec) * 1000,
+        .memoryMb = s.formulaMemoryLimitMb,
+    };
+}
+
+GraphResult FormulaDataSource::exec(const QString &code, const QMap<QString, double> &params, Z::Lua::Stats *stats)
+{
+    const bool devMode = AppSettings::instance().isDevMode;
+    Z::Lua::Stats devStats;
+    if (devMode && !stats)
+        stats = &devStats;
+
+    auto limits = FormulaDataSource::limits();
+    limits.stats = stats;
+    std::optional<GraphResult> res;
+    QElapsedTimer timer;
+    timer.start();
+    BackgroundTask::run(qApp->tr("Calculating formula..."), [&](const std::atomic<bool> &cancel){
+        limits.cancel = &cancel;
+        res = exec(code, params, limits);
+    });
+    if (devMode)
+    {
+        auto dbg = qDebug().noquote() << "Formula calculated" << (stats->native ? "natively" : "in Lua")
+            << "in" << timer.elapsed() << "ms, peak memory" << stats->peakMemory / 1024 << "KB";
+        if (!res->ok())
+            dbg << "with error:" << res->error();
+    }
+    return *res;
+}
+
+void FormulaDataSource::prefetch(const QVector<FormulaDataSource*> &sources)
 {
-    // TODO: run in a separate thread to avoid blocking the app if user code started an infinite loop
+    if (sources.isEmpty()) return;
+
+    auto limits = FormulaDataSource::limits();
+    QVector<std::optional<GraphResult>> results(sources.size());
+    BackgroundTask::run(qApp->tr("Calculating formulas..."), [&](const std::atomic<bool> &cancel){
+        limits.cancel = &cancel;
+        Z::parallelFor(sources.size(), 1, [&](qsizetype begin, qsizetype end){
+            for (auto i = begin; i < end; i++)
+                results[i] = exec(sources.at(i)->_code, sources.at(i)->_params, limits);
+        });
+    });
+    for (int i = 0; i < sources.size(); i++)
+    {
+        auto source = sources.at(i);
+        const auto &res = *results.at(i);
+        if (res.ok())
+            source->cacheData(res.result());
+        else
+            source->_readError = res.error();
+        source->_dataReady = true;
+    }
+}
 
-    Z::Lua lua;
+GraphResult FormulaDataSource::exec(const QString &code, const QMap<QString, double> &params, const Z::Lua::Limits &limits)
+{
+    // Simple formulas are calculated much faster without Lua
+    Z::NativeFormula native;
+    native.setParams(params);
+    if (native.compile(code))
+    {
+        // The memory limit is for the interpreter heap, result arrays of native code
+        // are only limited by available memory, failed allocation is reported by calc()
+        if (limits.stats)
+        {
+            limits.stats->native = true;
+            limits.stats->addPeakMemory(native.size() * 2 * qsizetype(sizeof(double)));
+        }
+        return native.calc(limits.cancel);
+    }
+
+    // Limits apply to the code and all calls of its function together
+    Z::Lua::Job job;
+    auto jobLimits = limits;
+    jobLimits.job = &job;
+
+    Z::Lua lua(true);
+    lua.setLimits(jobLimits);
     QString err = lua.open();
     if (!err.isEmpty())
         return GraphResult::fail(err);
+
+    lua.setGlobalVars(params);
         
     err = lua.setCode(code);
     if (!err.isEmpty())
@@ -424,6 +569,10 @@ GraphResult FormulaDataSource::exec(const QString &code)
     if (!resX.ok())
         return GraphResult::fail(resX.error());
 
+    // Pure function of X doesn't need serial calculation
+    if (lua.isGlobalFunction("Y"))
+        return calcFunctionY(lua, resX.result(), jobLimits);
+
     auto resY = lua.getGlobalArray("Y");
     if (!resY.ok())
         return GraphResult::fail(resY.error());
@@ -438,7 +587,12 @@ GraphResult FormulaDataSource::exec(const QString &code)
 
 QString FormulaDataSource::makeTitle() const
 {
-    return QString("formula (%1)").arg(_index);
+    QStringList params;
+    for (auto it = _params.constBegin(); it != _params.constEnd(); it++)
+        params << QString("%1=%2").arg(it.key()).arg(it.value());
+    if (params.isEmpty())
+        return QString("formula (%1)").arg(_index);
+    return QString("formula (%1) %2").arg(_index).arg(params.join(' '));
 }
 
 void FormulaDataSource::save(QJsonObject &obj) const
@@ -446,17 +600,185 @@ void FormulaDataSource::save(QJsonObject &obj) const
     obj["type"] = type();
     obj["index"] = _index;
     obj["code"] = _code;
+    if (!_params.isEmpty())
+    {
+        QJsonObject params;
+        for (auto it = _params.constBegin(); it != _params.constEnd(); it++)
+            params[it.key()] = it.value();
+        obj["params"] = params;
+    }
 }
 
 void FormulaDataSource::load(const QJsonObject &obj)
 {
     _index = obj["index"].toInt();
     _code = obj["code"].toString();
+    _params.clear();
+    const auto params = obj["params"].toObject();
+    for (auto it = params.constBegin(); it != params.constEnd(); it++)
+        _params[it.key()] = it.value().toDouble();
+}
+
+QString FormulaDataSource::verifyParamName(const QString &name)
+{
+    static QRegularExpression identifier("^[A-Za-z_][A-Za-z0-9_]*$");
+    if (!identifier.match(name).hasMatch())
+        return qApp->tr("Parameter name must be a valid variable name");
+    static const QStringList keywords {
+        "and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if",
+        "in", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while",
+    };
+    if (keywords.contains(name))
+        return qApp->tr("Parameter name can't be a keyword: %1").arg(name);
+    // X and Y are results of the code
+    if (name == QLatin1String("X") || name == QLatin1String("Y") || Z::Lua::globalNames().contains(name))
+        return qApp->tr("Parameter name is reserved for formulas: %1").arg(name);
+    return QString();
+}
+
+QVector<FormulaDataSource*> FormulaDataSource::sweep(const QString &param, const QVector<double> &values) const
+{
+    QVector<FormulaDataSource*> sources;
+    for (double value : values)
+    {
+        auto ds = new FormulaDataSource(_code);
+        ds->_params = _params;
+        ds->_params[param] = value;
+        sources << ds;
+    }
+    return sources;
 }
 
 void FormulaDataSource::copySourceFrom(DataSource *other)
 {
     CAST_OTHER_TYPE(FormulaDataSource)
-    // don't copy _index
+    // don't copy _index and _params, they distinguish graphs made by the same code
     _code = ds->_code;
 }
+
+//------------------------------------------------------------------------------
+//                              EnsembleDataSource
+//------------------------------------------------------------------------------
+
+struct EnsembleDataSource::Set
+{
+    QVector<Z::Ensemble::Output> outputs;
+    // Graphs and their revisions the results are calculated from
+    QVector<Graph*> graphs;
+    QVector<quint64> revisions;
+    int points = 0;
+    double x0 = 0;
+    double dx = 1;
+    QVector<Values> results;
+};
+
+EnsembleDataSource::EnsembleDataSource() : _set(std::make_shared<Set>())
+{
+    _set->outputs << _output;
+}
+
+QVector<EnsembleDataSource*> EnsembleDataSource::makeSet(Project *project, const QStringList &graphIds, const QVector<Z::Ensemble::Output> &outputs, int points)
+{
+    auto set = std::make_shared<Set>();
+    set->outputs = outputs;
+    QVector<EnsembleDataSource*> sources;
+    for (int i = 0; i < outputs.size(); i++)
+    {
+        auto ds = new EnsembleDataSource;
+        ds->_project = project;
+        ds->_graphIds = graphIds;
+        ds->_output = outputs.at(i);
+        ds->_points = points;
+        ds->_index = i;
+        ds->_set = set;
+        sources << ds;
+    }
+    return sources;
+}
+
+GraphResult EnsembleDataSource::read()
+{
+    QVector<Graph*> graphs;
+    QVector<quint64> revisions;
+    for (const auto &id : std::as_const(_graphIds))
+    {
+        auto g = _project ? _project->graph(id) : nullptr;
+        if (!g)
+            return GraphResult::fail(qApp->tr("Source graph not found, it could be deleted from the project"));
+        graphs << g;
+        revisions << g->revision();
+    }
+    if (graphs.isEmpty())
+        return GraphResult::fail(qApp->tr("No source graphs"));
+
+    // The first source of a set calculates all statistics, others just take their results
+    auto &set = *_set;
+    if (set.results.isEmpty() || set.graphs != graphs || set.revisions != revisions || set.points != _points)
+    {
+        QVector<const PackedPoints*> packed;
+        int maxCount = 0;
+        for (auto g : std::as_const(graphs))
+        {
+            packed << &g->packedData();
+            maxCount = qMax(maxCount, g->pointsCount());
+        }
+        double minX, maxX;
+        if (!Z::Ensemble::commonRange(packed, minX, maxX))
+            return GraphResult::fail(qApp->tr("Graphs don't have a common range of X"));
+        int count = _points > 0 ? _points : maxCount;
+        if (minX == maxX)
+            count = 1;
+        const double dx = count > 1 ? (maxX - minX) / double(count - 1) : 1;
+
+        QElapsedTimer timer;
+        timer.start();
+        set.results = Z::Ensemble::calc(packed, minX, dx, count, set.outputs);
+        if (AppSettings::instance().isDevMode)
+            qDebug() << "Ensemble of" << graphs.size() << "graphs calculated in" << timer.elapsed() << "ms";
+
+        set.graphs = graphs;
+        set.revisions = revisions;
+        set.points = _points;
+        set.x0 = minX;
+        set.dx = dx;
+    }
+    return cacheData(GraphPoints::uniform(set.x0, set.dx, set.results.at(_index)));
+}
+
+QString EnsembleDataSource::makeTitle() const
+{
+    QString stat;
+    switch (_output.statistic)
+    {
+    case Z::Ensemble::MEAN: stat = QStringLiteral("mean"); break;
+    case Z::Ensemble::MEAN_MINUS_STD: stat = QStringLiteral("mean-std"); break;
+    case Z::Ensemble::MEAN_PLUS_STD: stat = QStringLiteral("mean+std"); break;
+    case Z::Ensemble::MIN: stat = QStringLiteral("min"); break;
+    case Z::Ensemble::MAX: stat = QStringLiteral("max"); break;
+    case Z::Ensemble::PERCENTILE: stat = QString("p%1").arg(_output.percent); break;
+    }
+    return QString("%1 of %2 graphs").arg(stat).arg(_graphIds.size());
+}
+
+void EnsembleDataSource::save(QJsonObject &obj) const
+{
+    obj["type"] = type();
+    obj["graphs"] = QJsonArray::fromStringList(_graphIds);
+    obj["statistic"] = _output.statistic;
+    obj["percent"] = _output.percent;
+    obj["points"] = _points;
+}
+
+void EnsembleDataSource::load(const QJsonObject &obj)
+{
+    _graphIds.clear();
+    for (const auto &id : obj["graphs"].toArray())
+        _graphIds << id.toString();
+    _output.statistic = Z::Ensemble::Statistic(obj["statistic"].toInt());
+    _output.percent = obj["percent"].toDouble(50);
+    _points = obj["points"].toInt();
+    // Sets are not stored, each loaded source calculates its own statistic
+    _set = std::make_shared<Set>();
+    _set->outputs << _output;
+    _index = 0;
+}
@@ -2,7 +2,12 @@
 #define DATA_SOURCES_H
 
 #include "BaseTypes.h"
+#include "Ensemble.h"
+#include "LuaHelper.h"
 
+#include <memory>
+
+class Project;
 class QJsonObject;
 
 class DataSource
@@ -33,11 +38,23 @@ public:
     virtual void save(QJsonObject &obj) const = 0;
     virtual void load(const QJsonObject &obj) = 0;
     
-    const GraphPoints& data() { return _data; }
+    /// Returns the last read data. They are cached in packed form
+    /// so a copy of source data costs less than the data itself.
+    GraphPoints data() const { return _data.unpack(); }
     virtual void copySourceFrom(DataSource *other) {}
     virtual bool hasSameSourceAs(DataSource *other) { return type() == other->type(); }
+
+    /// Ids of graphs whose points the source is calculated from,
+    /// it's reread when any of them changes.
+    virtual QStringList references() const { return {}; }
 protected:
-    GraphPoints _data;
+    PackedPoints _data;
+
+    GraphResult cacheData(const GraphPoints &data)
+    {
+        _data = PackedPoints(data);
+        return GraphResult::ok(data);
+    }
 };
 
 
@@ -150,13 +167,69 @@ public:
     static QString _type_() { return QStringLiteral("Formula"); }
     void copySourceFrom(DataSource *other) override;
     QString code() const { return _code; }
+
+    /// Named parameters are global variables set before the code is executed.
+    /// The code can provide default values for them like `tau = tau or 2.5`.
+    QMap<QString, double> params() const { return _params; }
+    void setParams(const QMap<QString, double> &params) { _params = params; }
+
+    /// Returns an error when the name can't be used for a parameter: it's not an identifier,
+    /// or it's a Lua keyword, or it's predefined in formulas like X, Y, sin, or math.
+    static QString verifyParamName(const QString &name);
+
+    /// Makes sources calculating the same code with the parameter set to each of the values,
+    /// other parameters are kept. The caller takes ownership on the sources.
+    QVector<FormulaDataSource*> sweep(const QString &param, const QVector<double> &values) const;
     
-    static GraphResult exec(const QString &code);
-    
+    /// Executes code in a worker thread, GUI stays responsive and the calculation can be cancelled.
+    /// Resources used by the code are collected into `stats` when given.
+    static GraphResult exec(const QString &code, const QMap<QString, double> &params = {}, Z::Lua::Stats *stats = nullptr);
+    /// Executes code in the calling thread.
+    static GraphResult exec(const QString &code, const QMap<QString, double> &params, const Z::Lua::Limits &limits);
+    /// Execution limits configured in the app settings.
+    static Z::Lua::Limits limits();
+    /// Calculates several formulas concurrently, results are returned by the next call of read().
+    static void prefetch(const QVector<FormulaDataSource*> &sources);
+
 private:
     int _index;
     QString _code;
+    QMap<QString, double> _params;
     bool _dataReady = false;
+    QString _readError;
+};
+
+/// One statistic over points of several graphs of the project, see Z::Ensemble.
+class EnsembleDataSource : public DataSource
+{
+public:
+    EnsembleDataSource();
+
+    /// Makes sources for several statistics over the same graphs.
+    /// They share the calculation, so all of them are calculated by a single pass over the graphs.
+    /// `points` is the number of points of the common grid, zero means the largest number of graph points.
+    static QVector<EnsembleDataSource*> makeSet(Project *project, const QStringList &graphIds, const QVector<Z::Ensemble::Output> &outputs, int points);
+
+    GraphResult read() override;
+    QString makeTitle() const override;
+    QString displayStr() const override { return QStringLiteral("Ensemble"); }
+    void save(QJsonObject &obj) const override;
+    void load(const QJsonObject &obj) override;
+    QString type() const override { return _type_(); }
+    static QString _type_() { return QStringLiteral("Ensemble"); }
+    QStringList references() const override { return _graphIds; }
+
+    /// Project where source graphs are looked for, it must be set before the source is read.
+    void setProject(Project *project) { _project = project; }
+
+private:
+    struct Set;
+    Project *_project = nullptr;
+    QStringList _graphIds;
+    Z::Ensemble::Output _output;
+    int _points = 0;
+    int _index = 0;
+    std::shared_ptr<Set> _set;
 };
 
 DataSource* makeDataSource(const QString &type);
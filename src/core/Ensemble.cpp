@@ -0,0 +1,206 @@
+#include "Ensemble.h"
+
+#include "Parallel.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+namespace Z {
+namespace Ensemble {
+
+namespace {
+
+// Number of grid points whose values of all graphs are kept together,
+// for a thousand of graphs a block takes about 2MB per thread
+const qsizetype BLOCK = 256;
+
+bool isSorted(const PackedPoints &p)
+{
+    if (p.uniformX)
+        return p.dx >= 0;
+    const int n = p.size();
+    for (int i = 1; i < n; i++)
+        if (p.xs.at(i) < p.xs.at(i-1))
+            return false;
+    return true;
+}
+
+PackedPoints sortedCopy(const PackedPoints &p)
+{
+    const GraphPoints data = p.unpack();
+    const Values xs = data.xValues();
+    QVector<int> indexes(xs.size());
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::stable_sort(indexes.begin(), indexes.end(), [&xs](int a, int b){ return xs[a] < xs[b]; });
+    GraphPoints sorted;
+    sorted.xs.reserve(xs.size());
+    sorted.ys.reserve(xs.size());
+    for (int i : std::as_const(indexes)) {
+        sorted.xs << xs[i];
+        sorted.ys << data.ys[i];
+    }
+    return PackedPoints(sorted, p.ys.storage().type);
+}
+
+// Interpolates graph `p` at grid points [start, start+len) into `out` with the given stride.
+// The first interval is searched for, then graph points are walked through along with the grid.
+void fillColumn(const PackedPoints &p, double x0, double dx, qsizetype start, qsizetype len, double *out, int stride)
+{
+    const int n = p.size();
+    if (n == 1) {
+        const double y = p.ys.at(0);
+        for (qsizetype j = 0; j < len; j++)
+            out[j * stride] = y;
+        return;
+    }
+    double x = x0 + double(start) * dx;
+    int lo = 0, hi = n - 1;
+    while (hi - lo > 1) {
+        const int mid = (lo + hi) / 2;
+        if (p.x(mid) <= x)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    int k = lo;
+    double xa = p.x(k), xb = p.x(k+1);
+    double ya = p.ys.at(k), yb = p.ys.at(k+1);
+    for (qsizetype j = 0; j < len; j++) {
+        x = x0 + double(start + j) * dx;
+        while (k < n - 2 && xb <= x) {
+            k++;
+            xa = xb;
+            ya = yb;
+            xb = p.x(k+1);
+            yb = p.ys.at(k+1);
+        }
+        double y;
+        if (x <= xa)
+            y = ya;
+        else if (x >= xb)
+            y = yb;
+        else
+            y = ya + (yb - ya) * (x - xa) / (xb - xa);
+        out[j * stride] = y;
+    }
+}
+
+// Value at `percent` of sorted values interpolated between the nearest ranks.
+// Values are partially reordered.
+double percentile(double *v, int n, double percent)
+{
+    const double pos = qBound(0.0, percent, 100.0) / 100.0 * double(n - 1);
+    const int rank = qMin(int(pos), n - 1);
+    std::nth_element(v, v + rank, v + n);
+    const double lower = v[rank];
+    if (rank == n - 1)
+        return lower;
+    // The next value is the smallest of ones after the nth element
+    const double upper = *std::min_element(v + rank + 1, v + n);
+    return lower + (upper - lower) * (pos - double(rank));
+}
+
+} // namespace
+
+bool commonRange(const QVector<const PackedPoints*> &graphs, double &minX, double &maxX)
+{
+    if (graphs.isEmpty())
+        return false;
+    minX = -qInf();
+    maxX = qInf();
+    for (auto g : graphs) {
+        const int n = g->size();
+        if (n == 0)
+            return false;
+        double gMin = g->x(0), gMax = g->x(n-1);
+        if (!isSorted(*g)) {
+            for (int i = 0; i < n; i++) {
+                const double x = g->x(i);
+                gMin = qMin(gMin, x);
+                gMax = qMax(gMax, x);
+            }
+        }
+        minX = qMax(minX, qMin(gMin, gMax));
+        maxX = qMin(maxX, qMax(gMin, gMax));
+    }
+    return minX <= maxX;
+}
+
+QVector<Values> calc(const QVector<const PackedPoints*> &graphs, double x0, double dx, int count, const QVector<Output> &outputs)
+{
+    QVector<Values> res(outputs.size());
+    // Each output is made separately, so writing into them doesn't detach shared data in threads
+    QVector<double*> outs;
+    for (auto &r : res) {
+        r = Values(count);
+        outs << r.data();
+    }
+    const int n = graphs.size();
+    if (n == 0 || count <= 0)
+        return res;
+
+    // Only graphs with unsorted X are copied, other ones are read in place
+    std::vector<PackedPoints> copies;
+    copies.reserve(n);
+    QVector<const PackedPoints*> sources(n);
+    for (int g = 0; g < n; g++) {
+        if (isSorted(*graphs[g]))
+            sources[g] = graphs[g];
+        else {
+            copies.push_back(sortedCopy(*graphs[g]));
+            sources[g] = &copies.back();
+        }
+    }
+    for (auto s : std::as_const(sources))
+        if (s->size() == 0) {
+            for (auto out : std::as_const(outs))
+                std::fill(out, out + count, Q_QNAN);
+            return res;
+        }
+
+    parallelFor(count, BLOCK, [&](qsizetype begin, qsizetype end){
+        // Values of all graphs at a grid point are contiguous
+        std::vector<double> block(BLOCK * n);
+        for (qsizetype start = begin; start < end; start += BLOCK) {
+            const qsizetype len = qMin(BLOCK, end - start);
+            for (int g = 0; g < n; g++)
+                fillColumn(*sources[g], x0, dx, start, len, block.data() + g, n);
+
+            for (qsizetype j = 0; j < len; j++) {
+                double *v = block.data() + j * n;
+                double sum = 0, min = v[0], max = v[0];
+                for (int g = 0; g < n; g++) {
+                    sum += v[g];
+                    min = qMin(min, v[g]);
+                    max = qMax(max, v[g]);
+                }
+                const double mean = sum / double(n);
+                double sq = 0;
+                for (int g = 0; g < n; g++)
+                    sq += (v[g] - mean) * (v[g] - mean);
+                const double std = n > 1 ? qSqrt(sq / double(n - 1)) : 0;
+
+                const qsizetype i = start + j;
+                for (int o = 0; o < outputs.size(); o++) {
+                    double r = 0;
+                    switch (outputs[o].statistic) {
+                    case MEAN: r = mean; break;
+                    case MEAN_MINUS_STD: r = mean - std; break;
+                    case MEAN_PLUS_STD: r = mean + std; break;
+                    case MIN: r = min; break;
+                    case MAX: r = max; break;
+                    case PERCENTILE: r = percentile(v, n, outputs[o].percent); break;
+                    }
+                    outs[o][i] = r;
+                }
+            }
+        }
+    });
+    return res;
+}
+
+} // namespace Ensemble
+} // namespace Z
@@ -0,0 +1,40 @@
+#ifndef Z_ENSEMBLE_H
+#define Z_ENSEMBLE_H
+
+#include "BaseTypes.h"
+
+namespace Z {
+
+/// Statistics over many graphs at each point of a common X grid, e.g. over runs of a simulation.
+///
+/// Graphs are linearly interpolated on the grid right from their packed points, they are not unpacked.
+/// The grid is processed in small blocks using all available threads, a block holds one value
+/// of each graph per grid point, so memory doesn't grow with the number of graphs beyond that.
+namespace Ensemble {
+
+enum Statistic {
+    MEAN,
+    MEAN_MINUS_STD, ///< Lower edge of the standard deviation band
+    MEAN_PLUS_STD,  ///< Upper edge of the standard deviation band
+    MIN,
+    MAX,
+    PERCENTILE,
+};
+
+struct Output
+{
+    Statistic statistic = MEAN;
+    double percent = 50; ///< Only for PERCENTILE, from 0 to 100
+};
+
+/// X range covered by all the graphs. Returns false when there is no such range.
+bool commonRange(const QVector<const PackedPoints*> &graphs, double &minX, double &maxX);
+
+/// Calculates all outputs in a single pass over the graphs at `count` points starting from `x0` with step `dx`.
+/// Standard deviation is the sample one, percentiles are interpolated between the nearest values.
+QVector<Values> calc(const QVector<const PackedPoints*> &graphs, double x0, double dx, int count, const QVector<Output> &outputs);
+
+} // namespace Ensemble
+} // namespace Z
+
+#endif // Z_ENSEMBLE_H
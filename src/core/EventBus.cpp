@@ -0,0 +1,134 @@
+#include "EventBus.h"
+
+#include <QSet>
+
+namespace {
+
+struct BusState
+{
+    QVector<IEventBusListener*> listeners[BusEvent::TYPE_COUNT];
+    int removals = 0;
+
+    int batchLevel = 0;
+    QVector<Graph*> batchGraphs;
+    QSet<Graph*> batchGraphSet;
+    bool batchProjectState = false;
+    BusEvent::Type projectState;
+};
+
+BusState& busState()
+{
+    static BusState state;
+    return state;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+//                            IEventBusListener
+//------------------------------------------------------------------------------
+
+IEventBusListener::IEventBusListener(std::initializer_list<BusEvent::Type> events) : _events(events)
+{
+    for (auto type : std::as_const(_events))
+        EventBus::subscribe(this, type);
+}
+
+IEventBusListener::~IEventBusListener()
+{
+    for (auto type : std::as_const(_events))
+        EventBus::unsubscribe(this, type);
+}
+
+//------------------------------------------------------------------------------
+//                                EventBus
+//------------------------------------------------------------------------------
+
+void EventBus::subscribe(IEventBusListener *listener, BusEvent::Type type)
+{
+    auto &listeners = busState().listeners[type];
+    if (!listeners.contains(listener))
+        listeners.append(listener);
+}
+
+void EventBus::unsubscribe(IEventBusListener *listener, BusEvent::Type type)
+{
+    auto &s = busState();
+    if (s.listeners[type].removeOne(listener))
+        s.removals++;
+}
+
+void EventBus::dispatch(const BusEvent &e)
+{
+    auto &s = busState();
+    // Implicitly shared copy, it's not detached unless a listener
+    // subscribes or unsubscribes while the event is being dispatched
+    const auto listeners = s.listeners[e.type];
+    const int removals = s.removals;
+    for (auto listener : listeners)
+    {
+        // Listener could be deleted while handling of the event by previous one
+        // (e.g. PlotWindow is closed when its diagram deleted)
+        if (s.removals != removals && !s.listeners[e.type].contains(listener))
+            continue;
+        listener->busEvent(e);
+    }
+}
+
+void EventBus::send(const BusEvent &e)
+{
+    auto &s = busState();
+    if (s.batchLevel > 0)
+    {
+        switch (e.type)
+        {
+        case BusEvent::GraphUpdated:
+            if (!s.batchGraphSet.contains(e.graph))
+            {
+                s.batchGraphSet.insert(e.graph);
+                s.batchGraphs.append(e.graph);
+            }
+            return;
+        case BusEvent::ProjectModified:
+        case BusEvent::ProjectUnmodified:
+            s.batchProjectState = true;
+            s.projectState = e.type;
+            return;
+        case BusEvent::GraphDeleting:
+            if (s.batchGraphSet.remove(e.graph))
+                s.batchGraphs.removeOne(e.graph);
+            break;
+        default:
+            break;
+        }
+    }
+    dispatch(e);
+}
+
+EventBus::Batch::Batch()
+{
+    busState().batchLevel++;
+}
+
+EventBus::Batch::~Batch()
+{
+    auto &s = busState();
+    if (--s.batchLevel > 0)
+        return;
+
+    if (!s.batchGraphs.isEmpty())
+    {
+        QVector<Graph*> graphs;
+        graphs.swap(s.batchGraphs);
+        s.batchGraphSet.clear();
+        if (graphs.size() == 1)
+            dispatch({ .type = BusEvent::GraphUpdated, .graph = graphs.first() });
+        else
+            dispatch({ .type = BusEvent::GraphsUpdated, .graphs = &graphs });
+    }
+    if (s.batchProjectState)
+    {
+        s.batchProjectState = false;
+        dispatch({ .type = s.projectState });
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <QVector>
+
+class QJsonObject;
+class QString;
+
+class Diagram;
+class Graph;
+
+/// An event delivered to bus listeners.
+/// Payload is passed via pointers so that sending doesn't allocate anything,
+/// it's only valid while the event is being dispatched.
+struct BusEvent
+{
+    enum Type
+    {
+        ErrorMessage,
+        ProjectModified,
+        ProjectUnmodified,
+        DiagramAdded,
+        DiagramDeleted,
+        DiagramRenamed,
+        DiagramFormatLoaded,
+        DiagramLoaded,
+        GraphAdded,
+        GraphsLoaded,
+        GraphDeleting,
+        GraphDeleted,
+        GraphUpdated,
+        GraphsUpdated,
+        GraphRenamed,
+
+        TYPE_COUNT
+    };
+
+    Type type;
+
+    /// A diagram the event is related to.
+    /// For graph events it's the diagram owning the graph, when known.
+    Diagram *diagram = nullptr;
+
+    /// A graph the event is related to.
+    /// In GraphDeleted it's already deleted and can be used only for comparison.
+    Graph *graph = nullptr;
+
+    /// All graphs updated during a batch in GraphsUpdated,
+    /// or all graphs of the diagram in GraphsLoaded.
+    const QVector<Graph*> *graphs = nullptr;
+
+    /// Loaded format, only in DiagramFormatLoaded.
+    const QJsonObject *format = nullptr;
+
+    /// Loaded formats of graphs in the same order as graphs, only in GraphsLoaded.
+    const QVector<QJsonObject> *formats = nullptr;
+
+    /// Error text, only in ErrorMessage.
+    const QString *message = nullptr;
+};
+
+class IEventBusListener
+{
+public:
+    /// The listener gets only events of the given types.
+    IEventBusListener(std::initializer_list<BusEvent::Type> events);
+    virtual ~IEventBusListener();
+
+    virtual void busEvent(const BusEvent &e) = 0;
+
+private:
+    QVector<BusEvent::Type> _events;
+};
+
+class EventBus
+{
+public:
+    static void send(const BusEvent &e);
+
+    /// While a batch exists, graph updates are not delivered one by one.
+    /// When the outermost batch ends, listeners get a single GraphsUpdated event
+    /// (or GraphUpdated if there was only one graph). Project modification
+    /// notifications are collapsed into a single one at the end of batch too.
+    /// Other events are delivered immediately.
+    class Batch
+    {
+    public:
+        Batch();
+        ~Batch();
+        Batch(const Batch&) = delete;
+        Batch& operator=(const Batch&) = delete;
+    };
+
+private:
+    static void subscribe(IEventBusListener *listener, BusEvent::Type type);
+    static void unsubscribe(IEventBusListener *listener, BusEvent::Type type);
+    static void dispatch(const BusEvent &e);
+
+    friend class IEventBusListener;
+};
+
+#endif // EVENT_BUS_H
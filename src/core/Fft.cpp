@@ -0,0 +1,421 @@
+#include "Fft.h"
+
+#include "Parallel.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QtMath>
+
+#include <algorithm>
+#include <memory>
+
+namespace Z {
+namespace Fft {
+
+namespace {
+
+// Transforms smaller than this are done in the calling thread
+const qsizetype PARALLEL_CHUNK = 1 << 14;
+
+// Cached plans take no more memory than this, a plan not fitting drops all of them.
+// Larger plans are not cached at all, e.g. a Bluestein's plan of 10M points takes about 900MB.
+const qint64 MAX_PLANS_BYTES = 128 * 1024 * 1024;
+
+// Larger kernels are applied via FFT
+const qsizetype DIRECT_KERNEL_MAX = 64;
+
+// Number of output values calculated by direct convolution in one chunk
+const qsizetype DIRECT_CHUNK = 4096;
+
+struct Plan
+{
+    qsizetype size = 0;
+
+    // Radix-2 transform
+    QVector<qint32> bitReversed;
+    ComplexValues twiddles; // exp(-2πi*k/N), k < N/2
+
+    // Bluestein's transform
+    ComplexValues chirp;    // exp(-πi*k²/N), k < N
+    ComplexValues kernel;   // transformed conjugated chirp wrapped around its radix-2 size
+    std::shared_ptr<const Plan> radix2;
+
+    bool isRadix2() const { return !radix2; }
+
+    // Memory taken by own data, the radix-2 plan is cached separately
+    qint64 bytes() const
+    {
+        return qint64(bitReversed.size()) * qint64(sizeof(qint32))
+            + qint64(twiddles.size() + chirp.size() + kernel.size()) * qint64(sizeof(Complex));
+    }
+};
+
+using PlanPtr = std::shared_ptr<const Plan>;
+
+bool isPowerOf2(qsizetype n)
+{
+    return (n & (n - 1)) == 0;
+}
+
+qsizetype nextPowerOf2(qsizetype n)
+{
+    qsizetype p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+PlanPtr getPlan(qsizetype size);
+
+void transformRadix2(const Plan &plan, Complex *d)
+{
+    const qsizetype n = plan.size;
+    const qint32 *rev = plan.bitReversed.constData();
+    parallelFor(n, PARALLEL_CHUNK, [d, rev](qsizetype begin, qsizetype end){
+        for (qsizetype i = begin; i < end; i++)
+            if (i < rev[i])
+                std::swap(d[i], d[rev[i]]);
+    });
+    const Complex *w = plan.twiddles.constData();
+    for (qsizetype half = 1; half < n; half <<= 1)
+    {
+        // Butterflies of a stage are independent, they are numbered
+        // by the group of size 2*half and the position inside of the group
+        const qsizetype step = n / (half * 2);
+        parallelFor(n / 2, PARALLEL_CHUNK, [d, w, half, step](qsizetype begin, qsizetype end){
+            for (qsizetype b = begin; b < end; b++)
+            {
+                const qsizetype j = b & (half - 1);
+                const qsizetype i = (b - j) * 2 + j;
+                const Complex t = d[i + half] * w[j * step];
+                d[i + half] = d[i] - t;
+                d[i] += t;
+            }
+        });
+    }
+}
+
+void transformBluestein(const Plan &plan, Complex *d)
+{
+    const qsizetype n = plan.size;
+    const qsizetype m = plan.radix2->size;
+    const Complex *chirp = plan.chirp.constData();
+    const Complex *kernel = plan.kernel.constData();
+    ComplexValues a(m);
+    Complex *pa = a.data();
+    parallelFor(n, PARALLEL_CHUNK, [pa, d, chirp](qsizetype begin, qsizetype end){
+        for (qsizetype k = begin; k < end; k++)
+            pa[k] = d[k] * chirp[k];
+    });
+    transformRadix2(*plan.radix2, pa);
+    // Convolution with the kernel, the inverse is made as the forward transform of conjugates
+    parallelFor(m, PARALLEL_CHUNK, [pa, kernel](qsizetype begin, qsizetype end){
+        for (qsizetype k = begin; k < end; k++)
+            pa[k] = std::conj(pa[k] * kernel[k]);
+    });
+    transformRadix2(*plan.radix2, pa);
+    const double scale = 1.0 / double(m);
+    parallelFor(n, PARALLEL_CHUNK, [pa, d, chirp, scale](qsizetype begin, qsizetype end){
+        for (qsizetype k = begin; k < end; k++)
+            d[k] = std::conj(pa[k]) * scale * chirp[k];
+    });
+}
+
+PlanPtr makePlan(qsizetype n)
+{
+    auto plan = std::make_shared<Plan>();
+    plan->size = n;
+    if (isPowerOf2(n))
+    {
+        int bits = 0;
+        while ((qsizetype(1) << bits) < n) bits++;
+        plan->bitReversed.resize(n);
+        plan->twiddles.resize(n / 2);
+        qint32 *rev = plan->bitReversed.data();
+        Complex *w = plan->twiddles.data();
+        for (qsizetype i = 0; i < n; i++)
+            rev[i] = bits ? qint32((rev[i >> 1] >> 1) | ((i & 1) << (bits - 1))) : 0;
+        for (qsizetype k = 0; k < n / 2; k++)
+            w[k] = std::polar(1.0, -2.0 * M_PI * double(k) / double(n));
+        return plan;
+    }
+
+    const qsizetype m = nextPowerOf2(2 * n - 1);
+    plan->radix2 = getPlan(m);
+    plan->chirp.resize(n);
+    plan->kernel.resize(m);
+    Complex *chirp = plan->chirp.data();
+    Complex *kernel = plan->kernel.data();
+    for (qsizetype k = 0; k < n; k++)
+    {
+        // k² grows fast, it's reduced by the period of the chirp to keep the angle precise
+        const qint64 k2 = (qint64(k) * qint64(k)) % (2 * qint64(n));
+        chirp[k] = std::polar(1.0, -M_PI * double(k2) / double(n));
+    }
+    kernel[0] = std::conj(chirp[0]);
+    for (qsizetype k = 1; k < n; k++)
+        kernel[k] = kernel[m - k] = std::conj(chirp[k]);
+    transformRadix2(*plan->radix2, kernel);
+    return plan;
+}
+
+QMutex __plansMutex;
+QHash<qsizetype, PlanPtr> __plans;
+qint64 __plansBytes = 0;
+
+PlanPtr getPlan(qsizetype size)
+{
+    {
+        QMutexLocker locker(&__plansMutex);
+        if (auto it = __plans.constFind(size); it != __plans.constEnd())
+            return it.value();
+    }
+    // The plan is made unlocked, concurrent callers of the same size can make it twice, it's harmless
+    auto plan = makePlan(size);
+    const qint64 bytes = plan->bytes();
+    if (bytes > MAX_PLANS_BYTES)
+        return plan;
+    QMutexLocker locker(&__plansMutex);
+    if (auto it = __plans.constFind(size); it != __plans.constEnd())
+        return it.value();
+    if (__plansBytes + bytes > MAX_PLANS_BYTES)
+    {
+        __plans.clear();
+        __plansBytes = 0;
+    }
+    __plans.insert(size, plan);
+    __plansBytes += bytes;
+    return plan;
+}
+
+void transform(ComplexValues &data)
+{
+    if (data.size() < 2) return;
+    auto plan = getPlan(data.size());
+    if (plan->isRadix2())
+        transformRadix2(*plan, data.data());
+    else
+        transformBluestein(*plan, data.data());
+}
+
+// exp(-2πi*k/N) for k < N/2, they are taken from the plan when it exists
+Complex twiddle(const Plan *plan, qsizetype k, qsizetype n)
+{
+    if (plan) return plan->twiddles.at(k);
+    return std::polar(1.0, -2.0 * M_PI * double(k) / double(n));
+}
+
+} // namespace
+
+void forward(ComplexValues &data)
+{
+    transform(data);
+}
+
+void inverse(ComplexValues &data)
+{
+    const qsizetype n = data.size();
+    if (n < 1) return;
+    for (auto &v : data)
+        v = std::conj(v);
+    transform(data);
+    const double scale = 1.0 / double(n);
+    for (auto &v : data)
+        v = std::conj(v) * scale;
+}
+
+ComplexValues forwardReal(const Values &data)
+{
+    const qsizetype n = data.size();
+    if (n % 2 != 0 || n < 4)
+    {
+        ComplexValues z(n);
+        for (qsizetype i = 0; i < n; i++)
+            z[i] = data.at(i);
+        transform(z);
+        z.resize(n / 2 + 1);
+        return z;
+    }
+
+    // Even and odd values are packed into a complex array of half size,
+    // its transform is split back into transforms of the even and odd parts
+    const qsizetype m = n / 2;
+    ComplexValues z(m);
+    const double *x = data.constData();
+    Complex *pz = z.data();
+    for (qsizetype i = 0; i < m; i++)
+        pz[i] = Complex(x[2*i], x[2*i+1]);
+    transform(z);
+
+    // Twiddles of the full size are available when it's a power of 2
+    PlanPtr plan;
+    if (isPowerOf2(n))
+        plan = getPlan(n);
+    ComplexValues r(m + 1);
+    Complex *pr = r.data();
+    parallelFor(m + 1, PARALLEL_CHUNK, [pz, pr, m, n, &plan](qsizetype begin, qsizetype end){
+        for (qsizetype k = begin; k < end; k++)
+        {
+            const Complex zk = pz[k == m ? 0 : k];
+            const Complex zc = std::conj(pz[k == 0 ? 0 : m - k]);
+            const Complex even = (zk + zc) * 0.5;
+            const Complex odd = (zk - zc) * Complex(0, -0.5);
+            const Complex w = k == m ? Complex(-1, 0) : twiddle(plan.get(), k, n);
+            pr[k] = even + w * odd;
+        }
+    });
+    return r;
+}
+
+Values inverseReal(const ComplexValues &spectrum, qsizetype size)
+{
+    const qsizetype n = size;
+    Q_ASSERT(spectrum.size() == n / 2 + 1);
+    if (n % 2 != 0 || n < 4)
+    {
+        // Restore negative frequencies as conjugates of positive ones
+        ComplexValues z(n);
+        for (qsizetype k = 0; k < n; k++)
+            z[k] = k <= n / 2 ? spectrum.at(k) : std::conj(spectrum.at(n - k));
+        inverse(z);
+        Values x(n);
+        for (qsizetype i = 0; i < n; i++)
+            x[i] = z.at(i).real();
+        return x;
+    }
+
+    const qsizetype m = n / 2;
+    PlanPtr plan;
+    if (isPowerOf2(n))
+        plan = getPlan(n);
+    ComplexValues z(m);
+    Complex *pz = z.data();
+    const Complex *s = spectrum.constData();
+    parallelFor(m, PARALLEL_CHUNK, [pz, s, m, n, &plan](qsizetype begin, qsizetype end){
+        for (qsizetype k = begin; k < end; k++)
+        {
+            const Complex xc = std::conj(s[m - k]);
+            const Complex even = (s[k] + xc) * 0.5;
+            const Complex odd = (s[k] - xc) * 0.5 * std::conj(twiddle(plan.get(), k, n));
+            pz[k] = even + Complex(0, 1) * odd;
+        }
+    });
+    inverse(z);
+    Values x(n);
+    double *px = x.data();
+    for (qsizetype i = 0; i < m; i++)
+    {
+        px[2*i] = pz[i].real();
+        px[2*i+1] = pz[i].imag();
+    }
+    return x;
+}
+
+namespace {
+
+Values convolveDirect(const Values &signal, const Values &kernel)
+{
+    const qsizetype n = signal.size();
+    const qsizetype m = kernel.size();
+    // Reversed kernel makes the inner loop run forward over both arrays
+    Values rk(m);
+    for (qsizetype j = 0; j < m; j++)
+        rk[j] = kernel[m - 1 - j];
+    Values r(n + m - 1);
+    const double *s = signal.constData();
+    const double *k = rk.constData();
+    double *pr = r.data();
+    parallelFor(r.size(), DIRECT_CHUNK, [s, k, pr, n, m](qsizetype begin, qsizetype end){
+        for (qsizetype i = begin; i < end; i++)
+        {
+            const qsizetype lo = qMax(qsizetype(0), i - m + 1);
+            const qsizetype hi = qMin(i, n - 1);
+            const double *ps = s + lo;
+            const double *pk = k + (m - 1 - i + lo);
+            const qsizetype len = hi - lo + 1;
+            // Independent partial sums let the compiler vectorize the loop
+            double a0 = 0, a1 = 0, a2 = 0, a3 = 0;
+            qsizetype t = 0;
+            for (; t + 4 <= len; t += 4)
+            {
+                a0 += ps[t] * pk[t];
+                a1 += ps[t+1] * pk[t+1];
+                a2 += ps[t+2] * pk[t+2];
+                a3 += ps[t+3] * pk[t+3];
+            }
+            for (; t < len; t++)
+                a0 += ps[t] * pk[t];
+            pr[i] = (a0 + a1) + (a2 + a3);
+        }
+    });
+    return r;
+}
+
+Values convolveFft(const Values &signal, const Values &kernel)
+{
+    const qsizetype n = signal.size();
+    const qsizetype m = kernel.size();
+    // Blocks of the signal are convolved separately and their results overlap by M-1 values.
+    // The transform size several times larger than the kernel keeps the overhead of overlaps low.
+    const qsizetype size = nextPowerOf2(4 * m);
+    const qsizetype block = size - m + 1;
+    const qsizetype blocks = (n + block - 1) / block;
+
+    Values padded(size, 0.0);
+    std::copy(kernel.cbegin(), kernel.cend(), padded.begin());
+    const ComplexValues kernelSpectrum = forwardReal(padded);
+
+    Values r(n + m - 1, 0.0);
+    double *pr = r.data();
+    auto convolveBlock = [&](qsizetype b){
+        const qsizetype begin = b * block;
+        const qsizetype len = qMin(block, n - begin);
+        Values x(size, 0.0);
+        std::copy(signal.cbegin() + begin, signal.cbegin() + begin + len, x.begin());
+        auto spectrum = forwardReal(x);
+        for (qsizetype k = 0; k < spectrum.size(); k++)
+            spectrum[k] *= kernelSpectrum[k];
+        const Values y = inverseReal(spectrum, size);
+        const qsizetype count = qMin(len + m - 1, r.size() - begin);
+        for (qsizetype i = 0; i < count; i++)
+            pr[begin + i] += y[i];
+    };
+    // A block only overlaps with the next one, so even and odd blocks
+    // are added in two passes without locking
+    for (qsizetype parity = 0; parity < 2; parity++)
+    {
+        const qsizetype count = (blocks - parity + 1) / 2;
+        parallelFor(count, 1, [&convolveBlock, parity](qsizetype begin, qsizetype end){
+            for (qsizetype i = begin; i < end; i++)
+                convolveBlock(i * 2 + parity);
+        });
+    }
+    return r;
+}
+
+} // namespace
+
+Values convolve(const Values &signal, const Values &kernel)
+{
+    if (signal.isEmpty() || kernel.isEmpty())
+        return {};
+    if (kernel.size() <= DIRECT_KERNEL_MAX || signal.size() <= DIRECT_KERNEL_MAX)
+        return convolveDirect(signal, kernel);
+    return convolveFft(signal, kernel);
+}
+
+Values correlate(const Values &signal, const Values &kernel)
+{
+    Values reversed(kernel.size());
+    std::reverse_copy(kernel.cbegin(), kernel.cend(), reversed.begin());
+    return convolve(signal, reversed);
+}
+
+void clearPlans()
+{
+    QMutexLocker locker(&__plansMutex);
+    __plans.clear();
+    __plansBytes = 0;
+}
+
+} // namespace Fft
+} // namespace Z
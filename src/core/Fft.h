@@ -0,0 +1,50 @@
+#ifndef Z_FFT_H
+#define Z_FFT_H
+
+#include "BaseTypes.h"
+
+#include <complex>
+
+namespace Z {
+
+using Complex = std::complex<double>;
+using ComplexValues = QVector<Complex>;
+
+/// Discrete Fourier transform of any size.
+///
+/// Sizes being powers of two are transformed by the iterative radix-2 algorithm,
+/// other sizes are reduced to a power of two by the Bluestein's algorithm.
+/// Precalculated data (twiddle factors, bit reversal tables, chirps) make plans
+/// that are cached by size and shared between threads, so repeated transforms
+/// of the same size don't pay for the preparation. The cache is limited by memory,
+/// plans of very large sizes are made for each transform. Large transforms use all available threads.
+namespace Fft {
+
+/// Forward transform in place: `X[k] = sum(x[j] * exp(-2πi*j*k/N))`, no normalization.
+void forward(ComplexValues &data);
+
+/// Inverse transform in place, normalized by 1/N, so `inverse(forward(x)) == x`.
+void inverse(ComplexValues &data);
+
+/// Forward transform of real values.
+/// Returns N/2+1 bins of non-negative frequencies, others are conjugates of them.
+ComplexValues forwardReal(const Values &data);
+
+/// Inverse of forwardReal(), `size` is the number of original real values.
+Values inverseReal(const ComplexValues &spectrum, qsizetype size);
+
+/// Linear convolution `r[i] = sum(signal[i-j] * kernel[j])`, the result has N+M-1 values.
+/// Small kernels are applied directly, large ones by the overlap-add method using FFT.
+Values convolve(const Values &signal, const Values &kernel);
+
+/// Cross-correlation `r[i] = sum(signal[i+j-M+1] * kernel[j])`, the result has N+M-1 values,
+/// the value at `M-1` corresponds to the kernel aligned with the beginning of the signal.
+Values correlate(const Values &signal, const Values &kernel);
+
+/// Releases all cached plans.
+void clearPlans();
+
+} // namespace Fft
+} // namespace Z
+
+#endif // Z_FFT_H
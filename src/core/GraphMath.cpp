@@ -1,21 +1,35 @@
 #include "GraphMath.h"
 
+#include "Fft.h"
+#include "Interpolator.h"
+#include "Parallel.h"
+
+#include <algorithm>
 #include <limits>
+#include <numeric>
+#include <random>
+#include <vector>
 
 #include <QDebug>
 #include <QtMath>
+#include <QJsonArray>
 #include <QJsonObject>
+#include <QHash>
+#include <QMutex>
 
 #define NEED_POINTS(cnt) \
-    if (data.xs.size() != data.ys.size()) return data; \
-    if (data.xs.size() < cnt) return data;
+    if (!data.uniformX && data.xs.size() != data.ys.size()) return data; \
+    if (data.size() < cnt) return data;
 
 namespace GraphMath {
 
-MinMax minMax(const GraphPoints& data)
+namespace {
+
+// Points of any kind providing size(), x(i) and ys.at(i)
+template <typename Points>
+MinMax minMaxOf(const Points& data)
 {
-    int count = data.xs.size();
-    Q_ASSERT(count == data.ys.size());
+    const int count = data.size();
     MinMax res;
     res.minX = std::numeric_limits<double>::max();
     res.maxX = -std::numeric_limits<double>::max();
@@ -27,7 +41,7 @@ MinMax minMax(const GraphPoints& data)
     res.maxY.index = -1;
     for (int i = 0; i < count; i++)
     {
-        auto x = data.xs.at(i);
+        auto x = data.x(i);
         auto y = data.ys.at(i);
         if (x > res.maxX) res.maxX = x;
         if (x < res.minX) res.minX = x;
@@ -47,6 +61,19 @@ MinMax minMax(const GraphPoints& data)
     return res;
 }
 
+} // namespace
+
+MinMax minMax(const GraphPoints& data)
+{
+    Q_ASSERT(data.uniformX || data.size() == data.xs.size());
+    return minMaxOf(data);
+}
+
+MinMax minMax(const PackedPoints& data)
+{
+    return minMaxOf(data);
+}
+
 double min(const Values& data)
 {
     double res = std::numeric_limits<double>::max();
@@ -294,9 +321,250 @@ void Invert::load(const QJsonObject &obj)
 //                                 Decimate
 //------------------------------------------------------------------------------
 
+namespace {
+
+// Sliding windows and buckets need sorted X, so points are sorted when they are not
+GraphPoints sortedByX(const GraphPoints &data)
+{
+    if (std::is_sorted(data.xs.cbegin(), data.xs.cend()))
+        return data;
+    const int count = data.size();
+    QVector<int> indexes(count);
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::stable_sort(indexes.begin(), indexes.end(), [&data](int a, int b){ return data.xs[a] < data.xs[b]; });
+    GraphPoints sorted;
+    sorted.xs.resize(count);
+    sorted.ys.resize(count);
+    for (int i = 0; i < count; i++) {
+        sorted.xs[i] = data.xs[indexes[i]];
+        sorted.ys[i] = data.ys[indexes[i]];
+    }
+    return sorted;
+}
+
+// Number of points processed in one thread when searching for bucket borders
+const qsizetype BUCKET_SCAN_CHUNK = 1 << 16;
+
+// Number of buckets processed in one thread
+const qsizetype BUCKET_CHUNK = 1 << 10;
+
+// Starts of non-empty buckets of points [first, last) followed by `last`.
+// A bucket has `points` points or covers `step` of X counting from the first point, X must be sorted.
+QVector<int> bucketStarts(const GraphPoints &data, int first, int last, int points, double step, bool useStep)
+{
+    QVector<int> starts;
+    if (!useStep) {
+        starts.reserve((last - first) / points + 2);
+        for (qint64 i = first; i < last; i += points)
+            starts << int(i);
+        starts << last;
+        return starts;
+    }
+    // Borders are points where the number of step changes, they are searched for in parallel chunks
+    const double x0 = data.x(first);
+    const auto bucket = [&data, x0, step](int i){ return std::floor((data.x(i) - x0) / step); };
+    const qsizetype chunks = (last - first + BUCKET_SCAN_CHUNK - 1) / BUCKET_SCAN_CHUNK;
+    QVector<QVector<int>> borders(chunks);
+    auto chunkBorders = borders.data();
+    Z::parallelFor(chunks, 1, [&](qsizetype begin, qsizetype end){
+        for (qsizetype c = begin; c < end; c++) {
+            const int from = first + int(c * BUCKET_SCAN_CHUNK);
+            const int to = int(qMin(qsizetype(from) + BUCKET_SCAN_CHUNK, qsizetype(last)));
+            double prev = from > first ? bucket(from - 1) : -1;
+            for (int i = from; i < to; i++) {
+                const double b = bucket(i);
+                if (b != prev)
+                    chunkBorders[c] << i;
+                prev = b;
+            }
+        }
+    });
+    for (const auto &b : std::as_const(borders))
+        starts << b;
+    starts << last;
+    return starts;
+}
+
+// Extreme points of each bucket: minimum and maximum, and also the first and the last points for M4.
+// Points are kept in their original order, the same point is not repeated.
+GraphPoints decimateExtremes(const GraphPoints &data, const QVector<int> &starts, bool m4)
+{
+    const int buckets = starts.size() - 1;
+    const int perBucket = m4 ? 4 : 2;
+    QVector<int> picked(buckets * perBucket);
+    QVector<int> counts(buckets);
+    int *pick = picked.data();
+    int *cnt = counts.data();
+    const double *y = data.ys.constData();
+    Z::parallelFor(buckets, BUCKET_CHUNK, [&](qsizetype begin, qsizetype end){
+        for (qsizetype b = begin; b < end; b++) {
+            const int first = starts[b], last = starts[b+1] - 1;
+            int lo = first, hi = first;
+            for (int i = first + 1; i <= last; i++) {
+                if (y[i] < y[lo]) lo = i;
+                if (y[i] > y[hi]) hi = i;
+            }
+            int *p = pick + b * perBucket;
+            int n = 0;
+            if (m4) p[n++] = first;
+            p[n++] = lo;
+            p[n++] = hi;
+            if (m4) p[n++] = last;
+            std::sort(p, p + n);
+            cnt[b] = int(std::unique(p, p + n) - p);
+        }
+    });
+
+    // Each bucket knows where its points go, so they are copied in parallel
+    QVector<int> offsets(buckets + 1);
+    for (int b = 0; b < buckets; b++)
+        offsets[b+1] = offsets[b] + counts[b];
+    Values xs(offsets[buckets]), ys(offsets[buckets]);
+    double *px = xs.data(), *py = ys.data();
+    Z::parallelFor(buckets, BUCKET_CHUNK, [&](qsizetype begin, qsizetype end){
+        for (qsizetype b = begin; b < end; b++)
+            for (int k = 0; k < cnt[b]; k++) {
+                const int i = pick[b * perBucket + k];
+                px[offsets[b] + k] = data.x(i);
+                py[offsets[b] + k] = y[i];
+            }
+    });
+    return {xs, ys};
+}
+
+// Largest-Triangle-Three-Buckets: the first and the last points are kept, and from each bucket between them
+// the point making the largest triangle with the point taken from the previous bucket and the average of the next one.
+//
+// The area is a linear function of the point's coordinates, so its maximum is at a vertex of the convex hull
+// of the bucket. Hulls and averages are found for all buckets in parallel, then only hull vertices are visited
+// when points are taken one after another. The result is the same as of the sequential algorithm.
+GraphPoints decimateLttb(const GraphPoints &data, int points, double step, bool useStep)
+{
+    const int count = data.size();
+    const QVector<int> starts = bucketStarts(data, 1, count - 1, points, step, useStep);
+    const int buckets = starts.size() - 1;
+    const double *y = data.ys.constData();
+
+    Values avgX(buckets), avgY(buckets);
+    double *ax = avgX.data(), *ay = avgY.data();
+    const qsizetype chunks = (buckets + BUCKET_CHUNK - 1) / BUCKET_CHUNK;
+    // Hull vertices of buckets of each chunk, a bucket ends at its `hullEnds` in the chunk's list
+    QVector<QVector<int>> hulls(chunks);
+    QVector<int> hullEnds(buckets);
+    auto chunkHulls = hulls.data();
+    int *ends = hullEnds.data();
+    Z::parallelFor(chunks, 1, [&](qsizetype begin, qsizetype end){
+        std::vector<int> order, hull;
+        // Positive when points `a`, `b`, `c` make a counter-clockwise turn
+        const auto cross = [&data, y](int a, int b, int c){
+            return (data.x(b) - data.x(a)) * (y[c] - y[a]) - (y[b] - y[a]) * (data.x(c) - data.x(a));
+        };
+        for (qsizetype c = begin; c < end; c++) {
+            auto &vertices = chunkHulls[c];
+            const qsizetype lastBucket = qMin((c + 1) * BUCKET_CHUNK, qsizetype(buckets));
+            for (qsizetype b = c * BUCKET_CHUNK; b < lastBucket; b++) {
+                const int first = starts[b], last = starts[b+1];
+                double sumX = 0, sumY = 0;
+                bool sameX = false;
+                order.clear();
+                for (int i = first; i < last; i++) {
+                    sumX += data.x(i);
+                    sumY += y[i];
+                    sameX = sameX || (i > first && data.x(i) == data.x(i-1));
+                    order.push_back(i);
+                }
+                ax[b] = sumX / double(last - first);
+                ay[b] = sumY / double(last - first);
+                // The monotone chain algorithm needs points ordered by Y too when they have the same X
+                if (sameX)
+                    std::sort(order.begin(), order.end(), [&data, y](int a, int b){
+                        const double xa = data.x(a), xb = data.x(b);
+                        return xa < xb || (xa == xb && (y[a] < y[b] || (y[a] == y[b] && a < b))); });
+                // Points laying on edges are kept too, any of them can be the first of equal triangles
+                for (int pass = 0; pass < 2; pass++) {
+                    hull.clear();
+                    for (int i : order) {
+                        while (hull.size() >= 2 && cross(hull[hull.size()-2], hull.back(), i) < 0)
+                            hull.pop_back();
+                        hull.push_back(i);
+                    }
+                    for (int i : hull)
+                        vertices << i;
+                    // The upper part of the hull is the lower part when going backwards
+                    std::reverse(order.begin(), order.end());
+                }
+                ends[b] = vertices.size();
+            }
+        }
+    });
+
+    Values xs(buckets + 2), ys(buckets + 2);
+    xs[0] = data.x(0);
+    ys[0] = y[0];
+    int a = 0;
+    for (int b = 0; b < buckets; b++) {
+        const double xa = data.x(a), ya = y[a];
+        const double xc = b + 1 < buckets ? avgX[b+1] : data.x(count - 1);
+        const double yc = b + 1 < buckets ? avgY[b+1] : y[count - 1];
+        const auto &vertices = hulls[b / BUCKET_CHUNK];
+        const int from = b % BUCKET_CHUNK == 0 ? 0 : hullEnds[b-1];
+        int best = -1;
+        double bestArea = -1;
+        for (int k = from; k < hullEnds[b]; k++) {
+            const int i = vertices[k];
+            const double area = qAbs((xa - xc) * (y[i] - ya) - (xa - data.x(i)) * (yc - ya));
+            // Of equal triangles the first point is taken like in the sequential algorithm
+            if (area > bestArea || (area == bestArea && i < best)) {
+                bestArea = area;
+                best = i;
+            }
+        }
+        xs[b+1] = data.x(best);
+        ys[b+1] = y[best];
+        a = best;
+    }
+    xs[buckets+1] = data.x(count - 1);
+    ys[buckets+1] = y[count - 1];
+    return {xs, ys};
+}
+
+} // namespace
+
 GraphPoints Decimate::calc(const GraphPoints& data) const
 {
     NEED_POINTS(2)
+    if (mode != MODE_NTH)
+    {
+        if ((useStep && step <= 0) || (!useStep && points <= 1))
+            return data;
+        const GraphPoints sorted = !data.uniformX ? sortedByX(data) : data.dx < 0 ? sortedByX(data.explicitX()) : data;
+        if (mode == MODE_LTTB)
+            return decimateLttb(sorted, points, step, useStep);
+        const auto starts = bucketStarts(sorted, 0, sorted.size(), points, step, useStep);
+        return decimateExtremes(sorted, starts, mode == MODE_M4);
+    }
+    if (data.uniformX && data.dx > 0)
+    {
+        // Points are taken with constant stride, so the result is uniform too
+        const int count = data.size();
+        if ((useStep && step >= data.dx * double(count - 1)) || points >= count)
+            return GraphPoints::uniform(data.x0, data.dx * double(count - 1), {data.ys.first(), data.ys.last()});
+        if ((useStep && step <= 0) || points <= 1)
+            return data;
+        // Step mode takes the last point still laying within the step,
+        // the last graph point is never taken
+        const int stride = useStep ? qFloor(step / data.dx) : points;
+        const int last = useStep ? count - 2 : count - 1;
+        if (stride >= 1)
+        {
+            Values ys(last / stride + 1);
+            for (int i = 0, j = 0; j < ys.size(); i += stride, j++)
+                ys[j] = data.ys.at(i);
+            return GraphPoints::uniform(data.x0, data.dx * double(stride), ys);
+        }
+    }
+    if (data.uniformX)
+        return calc(data.explicitX());
     Values xs, ys;
     xs << data.xs.first();
     ys << data.ys.first();
@@ -333,6 +601,7 @@ GraphPoints Decimate::calc(const GraphPoints& data) const
 
 void Decimate::save(QJsonObject &obj) const
 {
+    obj["mode"] = mode;
     obj["points"] = points;
     obj["step"] = step;
     obj["useStep"] = useStep;
@@ -340,6 +609,7 @@ void Decimate::save(QJsonObject &obj) const
 
 void Decimate::load(const QJsonObject &obj)
 {
+    mode = Mode(obj["mode"].toInt());
     points = obj["points"].toInt();
     step = obj["step"].toDouble();
     useStep = obj["useStep"].toBool();
@@ -432,32 +702,129 @@ void Average::load(const QJsonObject &obj)
 //                                  MavgSimple
 //------------------------------------------------------------------------------
 
+namespace {
+
+struct PlainSum
+{
+    double sum = 0;
+    void add(double v) { sum += v; }
+    double value() const { return sum; }
+};
+
+// Neumaier's variant of Kahan summation, it keeps the running sum exact enough
+// even when the values are added and subtracted millions of times
+struct CompensatedSum
+{
+    double sum = 0;
+    double c = 0;
+    void add(double v)
+    {
+        const double t = sum + v;
+        if (qAbs(sum) >= qAbs(v))
+            c += (sum - t) + v;
+        else
+            c += (v - t) + sum;
+        sum = t;
+    }
+    double value() const { return sum + c; }
+};
+
+// Averages over the given number of last points, the result starts from the point `cnt-1`
+template <typename Sum>
+Values mavgByPoints(const Values &y, int cnt)
+{
+    const int count = y.size();
+    Values ys(count - cnt + 1);
+    Sum sum;
+    for (int i = 0; i < cnt-1; i++)
+        sum.add(y[i]);
+    for (int i = cnt-1; i < count; i++)
+    {
+        sum.add(y[i]);
+        ys[i-cnt+1] = sum.value() / double(cnt);
+        sum.add(-y[i-cnt+1]);
+    }
+    return ys;
+}
+
+// Averages over points having X within `step` before the current point,
+// the result starts from the point `first`. X must be sorted.
+template <typename Sum>
+Values mavgByStep(const Values &x, const Values &y, double step, int first)
+{
+    const int count = y.size();
+    Values ys(count - first);
+    Sum sum;
+    int lo = 0;
+    for (int i = 0; i < count; i++)
+    {
+        sum.add(y[i]);
+        const double minX = x[i] - step;
+        while (lo < i && x[lo] <= minX)
+            sum.add(-y[lo++]);
+        if (i >= first)
+            ys[i-first] = sum.value() / double(i - lo + 1);
+    }
+    return ys;
+}
+
+// The output of a window of `step` length starts where the window is filled, i.e. it covers
+// the first point together with the interval that point represents, taken as the mean spacing.
+// X must be sorted.
+int firstFilledWindow(const Values &x, double step)
+{
+    const int count = x.size();
+    const double meanDx = (x.last() - x.first()) / double(count - 1);
+    const double startX = x.first() + step - meanDx;
+    int first = std::lower_bound(x.cbegin(), x.cend(), startX) - x.cbegin();
+    return qMin(first, count - 1);
+}
+
+// Number of whole intervals of regular graph with spacing `dx` fitting in the window of `step` length
+int regularWindowPoints(double dx, double step, int count)
+{
+    return dx > 0 ? qFloor(qMin(step / dx, double(count))) : 1;
+}
+
+// Spacing of equally spaced X, or 0 when points are not equally spaced
+double regularSpacing(const Values &x)
+{
+    const int count = x.size();
+    const double dx = (x.last() - x.first()) / double(count - 1);
+    if (!(dx > 0))
+        return 0;
+    for (int i = 1; i < count; i++)
+        if (qAbs(x[i] - x[i-1] - dx) > dx * 1e-9)
+            return 0;
+    return dx;
+}
+
+} // namespace
+
 GraphPoints MavgSimple::calc(const GraphPoints& data) const
 {
     NEED_POINTS(2)
-    Values xs, ys;
-    int cnt = points;
-    if (useStep) {
-        cnt = qFloor(step /  (data.xs[1] - data.xs[0]));
-    }
-    double avg = 0;
-    double firstI = 0;
-    for (int i = 0; i < data.ys.size(); i++) {
-        const double y = data.ys.at(i);
-        if (i < cnt-1) {
-            avg += y;
-            continue;
-        } else if (i == cnt-1) {
-            avg += y;
-            avg /= double(cnt);
-        } else {
-            avg += (y - data.ys.at(firstI)) / double(cnt);
-            firstI++;
-        }
-        xs << data.xs.at(i);
-        ys << avg;
+    const int count = data.size();
+    // Equally spaced explicit X is averaged over a fixed number of points like uniform X
+    const double dx = data.uniformX ? data.dx : useStep ? regularSpacing(data.xs) : 0;
+    if (data.uniformX || !useStep || dx > 0)
+    {
+        int cnt = points;
+        if (useStep)
+            cnt = regularWindowPoints(dx, step, count);
+        cnt = qBound(1, cnt, count);
+        auto ys = compensated ? mavgByPoints<CompensatedSum>(data.ys, cnt) : mavgByPoints<PlainSum>(data.ys, cnt);
+        if (data.uniformX)
+            return GraphPoints::uniform(data.x(cnt-1), data.dx, ys);
+        return {data.xs.mid(cnt-1), ys};
     }
-    return {data.xs, ys};
+
+    const auto sorted = sortedByX(data);
+    const int first = firstFilledWindow(sorted.xs, step);
+    auto ys = compensated
+        ? mavgByStep<CompensatedSum>(sorted.xs, sorted.ys, step, first)
+        : mavgByStep<PlainSum>(sorted.xs, sorted.ys, step, first);
+    return {sorted.xs.mid(first), ys};
 }
 
 void MavgSimple::save(QJsonObject &obj) const
@@ -465,6 +832,7 @@ void MavgSimple::save(QJsonObject &obj) const
     obj["points"] = points;
     obj["step"] = step;
     obj["useStep"] = useStep;
+    obj["compensated"] = compensated;
 }
 
 void MavgSimple::load(const QJsonObject &obj)
@@ -472,6 +840,7 @@ void MavgSimple::load(const QJsonObject &obj)
     points = obj["points"].toInt();
     step = obj["step"].toDouble();
     useStep = obj["useStep"].toBool();
+    compensated = obj["compensated"].toBool();
 }
 
 //------------------------------------------------------------------------------
@@ -562,20 +931,25 @@ void FitLimits::load(const QJsonObject &obj)
 
 GraphPoints Despike::calc(const GraphPoints& data) const
 {
-    NEED_POINTS(0)
-    Values ys(data.ys.size());
-    QVector<int> indexes;
-    for (int i = 0; i < ys.size(); i++)
-        indexes << i;
-    int i = indexes.takeAt(rand() % indexes.size());
-    double avg = data.ys.at(i);
-    ys[i] = avg;
+    NEED_POINTS(1)
+    // Points are visited in random order, so the running average doesn't follow the graph trend.
+    // The order is made by the seeded Fisher-Yates shuffle, so the same seed gives the same result.
+    // Plain modulo instead of std::uniform_int_distribution keeps the order the same on all platforms.
+    const int count = data.ys.size();
+    QVector<int> indexes(count);
+    std::iota(indexes.begin(), indexes.end(), 0);
+    std::mt19937 rng(seed);
+    for (int i = count-1; i > 0; i--)
+        std::swap(indexes[i], indexes[int(rng() % quint32(i+1))]);
+
+    const double *y = data.ys.constData();
+    Values ys(count);
+    double avg = y[indexes.at(0)];
     if (mode == MODE_REL) {
         const double min = 1.0 - this->min / 100.0;
         const double max = 1.0 + this->max / 100.0;
-        while (indexes.size() > 0) {
-            auto i = indexes.takeAt(rand() % indexes.size());
-            auto v = data.ys.at(i);
+        for (int i : std::as_const(indexes)) {
+            auto v = y[i];
             if (v < avg * min || v > avg * max) {
                 ys[i] = avg;
             } else {
@@ -584,20 +958,16 @@ GraphPoints Despike::calc(const GraphPoints& data) const
             }
         }
     } else {
-        while (indexes.size() > 0) {
-            auto i = indexes.takeAt(rand() % indexes.size());
-            auto v = data.ys.at(i);
-            // Skip cases when min-max are erroneously given
-            // as laying totally outside of the graph trend
-            if (avg >= min && avg <= max) {
-                if (v < min || v > max) {
-                    ys[i] = avg;
-                } else {
-                    ys[i] = v;
-                    avg = (avg + v) / 2.0;
-                }
+        // Skip cases when min-max are erroneously given
+        // as laying totally outside of the graph trend
+        const bool inRange = avg >= min && avg <= max;
+        for (int i : std::as_const(indexes)) {
+            auto v = y[i];
+            if (inRange && (v < min || v > max)) {
+                ys[i] = avg;
             } else {
                 ys[i] = v;
+                if (inRange) avg = (avg + v) / 2.0;
             }
         }
     }
@@ -609,6 +979,7 @@ void Despike::save(QJsonObject &obj) const
     obj["mode"] = mode;
     obj["min"] = min;
     obj["max"] = max;
+    obj["seed"] = double(seed);
 }
 
 void Despike::load(const QJsonObject &obj)
@@ -616,6 +987,204 @@ void Despike::load(const QJsonObject &obj)
     mode = Mode(obj["mode"].toInt());
     min = obj["min"].toDouble();
     max = obj["max"].toDouble();
+    seed = quint32(obj["seed"].toDouble());
+}
+
+//------------------------------------------------------------------------------
+//                                  Median
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Output points processed by a single thread, blocks overlap by the window size
+const qsizetype MEDIAN_CHUNK = 1 << 15;
+
+// Median of a sliding window kept in two heaps, the max-heap of the lower half of values
+// and the min-heap of the upper half. Heap positions of points are tracked, so a point
+// leaving the window is removed in O(log k) instead of searching for it.
+class RollingMedian
+{
+public:
+    // Points are identified by their indexes in `y`, from `offset` to `offset+size`
+    RollingMedian(const double *y, int offset, int size) : _y(y), _offset(offset), _where(size) {}
+
+    void add(int i)
+    {
+        const int h = (_heap[LO].empty() || _y[i] <= _y[_heap[LO].front()]) ? LO : HI;
+        push(h, i);
+        rebalance();
+    }
+
+    void remove(int i)
+    {
+        const int w = _where[i - _offset];
+        if (w >= 0)
+            erase(LO, w);
+        else
+            erase(HI, ~w);
+        rebalance();
+    }
+
+    double value() const
+    {
+        const double lo = _y[_heap[LO].front()];
+        if (_heap[LO].size() > _heap[HI].size())
+            return lo;
+        return (lo + _y[_heap[HI].front()]) / 2.0;
+    }
+
+private:
+    enum { LO, HI };
+    const double *_y;
+    const int _offset;
+    // Position of a point in its heap, it's stored inverted for the upper heap
+    QVector<int> _where;
+    std::vector<int> _heap[2];
+
+    bool above(int h, int a, int b) const
+    {
+        return h == LO ? _y[a] > _y[b] : _y[a] < _y[b];
+    }
+
+    void place(int h, int pos, int i)
+    {
+        _heap[h][pos] = i;
+        _where[i - _offset] = h == LO ? pos : ~pos;
+    }
+
+    void siftUp(int h, int pos)
+    {
+        auto &heap = _heap[h];
+        const int i = heap[pos];
+        while (pos > 0) {
+            const int parent = (pos - 1) / 2;
+            if (!above(h, i, heap[parent]))
+                break;
+            place(h, pos, heap[parent]);
+            pos = parent;
+        }
+        place(h, pos, i);
+    }
+
+    void siftDown(int h, int pos)
+    {
+        auto &heap = _heap[h];
+        const int size = heap.size();
+        const int i = heap[pos];
+        while (true) {
+            int child = 2*pos + 1;
+            if (child >= size)
+                break;
+            if (child + 1 < size && above(h, heap[child + 1], heap[child]))
+                child++;
+            if (!above(h, heap[child], i))
+                break;
+            place(h, pos, heap[child]);
+            pos = child;
+        }
+        place(h, pos, i);
+    }
+
+    void push(int h, int i)
+    {
+        _heap[h].push_back(i);
+        siftUp(h, _heap[h].size() - 1);
+    }
+
+    int erase(int h, int pos)
+    {
+        auto &heap = _heap[h];
+        const int i = heap[pos];
+        const int last = heap.back();
+        heap.pop_back();
+        if (pos < int(heap.size())) {
+            place(h, pos, last);
+            siftUp(h, pos);
+            const int w = _where[last - _offset];
+            siftDown(h, w >= 0 ? w : ~w);
+        }
+        return i;
+    }
+
+    // The lower half has the same number of points as the upper one or one more
+    void rebalance()
+    {
+        if (_heap[LO].size() > _heap[HI].size() + 1)
+            push(HI, erase(LO, 0));
+        else if (_heap[HI].size() > _heap[LO].size())
+            push(LO, erase(HI, 0));
+    }
+};
+
+// Medians over windows ending at points starting from `first`.
+// `windowStart(i)` gives the first point of the window ending at the point `i`,
+// it's only called at the beginning of each block, then the window is slid while
+// `leaves(j, i)` says the point `j` is out of the window ending at `i`.
+template <typename WindowStart, typename Leaves>
+Values rollingMedian(const Values &y, int first, WindowStart windowStart, Leaves leaves)
+{
+    const int count = y.size();
+    Values ys(count - first);
+    const double *py = y.constData();
+    double *out = ys.data();
+    Z::parallelFor(count - first, MEDIAN_CHUNK, [&](qsizetype begin, qsizetype end){
+        const int b = first + begin;
+        const int e = first + end;
+        int lo = windowStart(b);
+        RollingMedian median(py, lo, e - lo);
+        for (int i = lo; i < b; i++)
+            median.add(i);
+        for (int i = b; i < e; i++) {
+            median.add(i);
+            while (lo < i && leaves(lo, i))
+                median.remove(lo++);
+            out[i - first] = median.value();
+        }
+    });
+    return ys;
+}
+
+} // namespace
+
+GraphPoints Median::calc(const GraphPoints& data) const
+{
+    NEED_POINTS(2)
+    const int count = data.size();
+    if (data.uniformX || !useStep)
+    {
+        int cnt = points;
+        if (useStep)
+            cnt = regularWindowPoints(data.dx, step, count);
+        cnt = qBound(1, cnt, count);
+        auto ys = rollingMedian(data.ys, cnt-1,
+            [cnt](int i){ return i - cnt + 1; },
+            [cnt](int j, int i){ return j <= i - cnt; });
+        if (data.uniformX)
+            return GraphPoints::uniform(data.x(cnt-1), data.dx, ys);
+        return {data.xs.mid(cnt-1), ys};
+    }
+
+    const auto sorted = sortedByX(data);
+    const Values &x = sorted.xs;
+    const int first = firstFilledWindow(x, step);
+    auto ys = rollingMedian(sorted.ys, first,
+        [&x, this](int i){ return int(std::upper_bound(x.cbegin(), x.cbegin() + i, x[i] - step) - x.cbegin()); },
+        [&x, this](int j, int i){ return x[j] <= x[i] - step; });
+    return {x.mid(first), ys};
+}
+
+void Median::save(QJsonObject &obj) const
+{
+    obj["points"] = points;
+    obj["step"] = step;
+    obj["useStep"] = useStep;
+}
+
+void Median::load(const QJsonObject &obj)
+{
+    points = obj["points"].toInt();
+    step = obj["step"].toDouble();
+    useStep = obj["useStep"].toBool();
 }
 
 //------------------------------------------------------------------------------
@@ -625,6 +1194,28 @@ void Despike::load(const QJsonObject &obj)
 GraphPoints Derivative::calc(const GraphPoints& data) const
 {
     NEED_POINTS(2)
+    if (data.uniformX)
+    {
+        // Constant spacing, so there is no need in dividing by each X difference
+        const auto &y = data.ys;
+        const int count = y.size();
+        const bool useTau = mode == MODE_SIMPLE_TAU || mode == MODE_REFINED_TAU;
+        const double k = 1.0 / (useTau ? tau : data.dx);
+        if (mode == MODE_SIMPLE || mode == MODE_SIMPLE_TAU)
+        {
+            Values dy(count-1);
+            for (int i = 1; i < count; i++)
+                dy[i-1] = (y[i] - y[i-1]) * k;
+            return GraphPoints::uniform(data.x0, data.dx, dy);
+        }
+        Values dy(count);
+        const double k2 = k / 2.0;
+        dy[0] = (y[1] - y[0]) * k;
+        for (int i = 1; i < count-1; i++)
+            dy[i] = (y[i+1] - y[i-1]) * k2;
+        dy[count-1] = (y[count-1] - y[count-2]) * k;
+        return GraphPoints::uniform(data.x0, data.dx, dy);
+    }
     const auto &x = data.xs;
     const auto &y = data.ys;
     Values dx = x;
@@ -683,4 +1274,442 @@ void Derivative::load(const QJsonObject &obj)
     tau = obj["tau"].toDouble();
 }
 
+//------------------------------------------------------------------------------
+//                                  SavGol
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Output points of a graph with non-uniform X processed by a single thread
+const qsizetype SAVGOL_CHUNK = 1 << 12;
+const int MAX_SAVGOL_TABLES = 64;
+
+// Weights of points at positions `t` giving the `deriv`-th derivative at t=0 of the polynomial
+// of the given order fitted to the points by least squares. They are calculated as the row
+// of the pseudo-inverse of the Vandermonde matrix, solving normal equations for a single column.
+// Returns false when the points don't define the polynomial, e.g. when some of them coincide.
+bool fitWeights(const double *t, int size, int order, int deriv, double *weights)
+{
+    const int n = order + 1;
+    // Sums of powers of t make the Gram matrix of the normal equations
+    double powSums[2*SavGol::MAX_ORDER + 1] = {};
+    for (int j = 0; j < size; j++) {
+        double p = 1;
+        for (int k = 0; k <= 2*order; k++, p *= t[j])
+            powSums[k] += p;
+    }
+    double g[SavGol::MAX_ORDER + 1][SavGol::MAX_ORDER + 2];
+    for (int r = 0; r < n; r++) {
+        for (int c = 0; c < n; c++)
+            g[r][c] = powSums[r + c];
+        g[r][n] = r == deriv ? 1 : 0;
+    }
+    // Gaussian elimination with partial pivoting
+    const double eps = 1e-12 * powSums[0];
+    for (int c = 0; c < n; c++) {
+        int pivot = c;
+        for (int r = c + 1; r < n; r++)
+            if (qAbs(g[r][c]) > qAbs(g[pivot][c]))
+                pivot = r;
+        if (qAbs(g[pivot][c]) < eps)
+            return false;
+        if (pivot != c)
+            std::swap(g[pivot], g[c]);
+        for (int r = c + 1; r < n; r++) {
+            const double f = g[r][c] / g[c][c];
+            for (int k = c; k <= n; k++)
+                g[r][k] -= f * g[c][k];
+        }
+    }
+    double u[SavGol::MAX_ORDER + 1];
+    for (int r = n - 1; r >= 0; r--) {
+        double s = g[r][n];
+        for (int k = r + 1; k < n; k++)
+            s -= g[r][k] * u[k];
+        u[r] = s / g[r][r];
+    }
+    double factorial = 1;
+    for (int k = 2; k <= deriv; k++)
+        factorial *= k;
+    for (int j = 0; j < size; j++) {
+        double w = 0, p = 1;
+        for (int k = 0; k < n; k++, p *= t[j])
+            w += u[k] * p;
+        weights[j] = w * factorial;
+    }
+    return true;
+}
+
+QMutex __savgolMutex;
+QHash<quint64, Values> __savgolTables;
+
+} // namespace
+
+Values SavGol::coefficients(int halfWidth, int order, int deriv)
+{
+    const quint64 key = (quint64(halfWidth) << 16) | (quint64(order) << 8) | quint64(deriv);
+    {
+        QMutexLocker locker(&__savgolMutex);
+        if (auto it = __savgolTables.constFind(key); it != __savgolTables.constEnd())
+            return it.value();
+    }
+    // Positions are scaled to [-1, 1] to keep the normal equations well conditioned
+    const int m = 2*halfWidth + 1;
+    const double scale = qMax(1, halfWidth);
+    Values t(m), c(m);
+    for (int j = 0; j < m; j++)
+        t[j] = double(j - halfWidth) / scale;
+    if (!fitWeights(t.constData(), m, order, deriv, c.data()))
+        return {};
+    const double k = 1.0 / qPow(scale, deriv);
+    for (auto &v : c)
+        v *= k;
+    QMutexLocker locker(&__savgolMutex);
+    if (__savgolTables.size() >= MAX_SAVGOL_TABLES)
+        __savgolTables.clear();
+    __savgolTables.insert(key, c);
+    return c;
+}
+
+GraphPoints SavGol::calc(const GraphPoints& data) const
+{
+    NEED_POINTS(1)
+    const int d = qBound(0, deriv, MAX_DERIV);
+    const int p = qBound(d, order, MAX_ORDER);
+    // The window is made odd and long enough for the polynomial
+    const int h = qMax(qMax(0, points / 2), (p + 1) / 2);
+    const int m = 2*h + 1;
+    const int n = data.size();
+    if (m > n)
+        return data;
+    const int count = n - m + 1;
+
+    if (data.uniformX)
+    {
+        const Values c = coefficients(h, p, d);
+        if (c.isEmpty())
+            return data;
+        // Vectorized direct loop for usual windows, FFT for very long ones
+        Values ys = Z::Fft::correlate(data.ys, c).mid(m - 1, count);
+        if (d > 0) {
+            const double k = 1.0 / qPow(data.dx, d);
+            for (auto &v : ys)
+                v *= k;
+        }
+        return GraphPoints::uniform(data.x(h), data.dx, ys);
+    }
+
+    // Each window has its own spacing of points, so the fit is made for each point
+    const auto sorted = sortedByX(data);
+    const double *x = sorted.xs.constData();
+    const double *y = sorted.ys.constData();
+    Values ys(count);
+    double *out = ys.data();
+    Z::parallelFor(count, SAVGOL_CHUNK, [x, y, out, h, m, p, d](qsizetype begin, qsizetype end){
+        Values t(m), w(m);
+        for (qsizetype i = begin; i < end; i++) {
+            const qsizetype center = i + h;
+            const double scale = (x[i + m - 1] - x[i]) / 2.0;
+            if (scale <= 0) {
+                out[i] = d == 0 ? y[center] : Q_QNAN;
+                continue;
+            }
+            for (int j = 0; j < m; j++)
+                t[j] = (x[i + j] - x[center]) / scale;
+            if (!fitWeights(t.constData(), m, p, d, w.data())) {
+                out[i] = Q_QNAN;
+                continue;
+            }
+            double s = 0;
+            for (int j = 0; j < m; j++)
+                s += w[j] * y[i + j];
+            out[i] = s / qPow(scale, d);
+        }
+    });
+    return {sorted.xs.mid(h, count), ys};
+}
+
+void SavGol::save(QJsonObject &obj) const
+{
+    obj["points"] = points;
+    obj["order"] = order;
+    obj["deriv"] = deriv;
+}
+
+void SavGol::load(const QJsonObject &obj)
+{
+    points = obj["points"].toInt();
+    order = obj["order"].toInt();
+    deriv = obj["deriv"].toInt();
+}
+
+//------------------------------------------------------------------------------
+//                                  Resample
+//------------------------------------------------------------------------------
+
+GraphPoints Resample::calc(const GraphPoints& data) const
+{
+    NEED_POINTS(2)
+    // Methods are listed in the same order as in the interpolator
+    Z::Interpolator interp(data, Z::Interpolator::Method(method));
+    const double x0 = interp.minX();
+    const double range = interp.maxX() - x0;
+    if (!(range > 0))
+        return data;
+    int count;
+    double dx;
+    if (useStep) {
+        if (!(step > 0))
+            return data;
+        count = int(qMin(qFloor(range / step) + 1.0, double(std::numeric_limits<int>::max())));
+        dx = step;
+    } else {
+        count = qMax(2, points);
+        dx = range / double(count - 1);
+    }
+    return GraphPoints::uniform(x0, dx, interp.values(x0, dx, count));
+}
+
+void Resample::save(QJsonObject &obj) const
+{
+    obj["method"] = method;
+    obj["points"] = points;
+    obj["step"] = step;
+    obj["useStep"] = useStep;
+}
+
+void Resample::load(const QJsonObject &obj)
+{
+    method = Method(obj["method"].toInt());
+    points = obj["points"].toInt();
+    step = obj["step"].toDouble();
+    useStep = obj["useStep"].toBool();
+}
+
+//------------------------------------------------------------------------------
+//                                  Spectrum
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Linear interpolation of the graph at evenly spaced points between its first and last X
+GraphPoints resampleUniform(const GraphPoints &data)
+{
+    const int count = data.size();
+    Z::Interpolator interp(data, Z::Interpolator::LINEAR);
+    const double x0 = interp.minX();
+    const double dx = (interp.maxX() - x0) / double(count - 1);
+    return GraphPoints::uniform(x0, dx, interp.values(x0, dx, count));
+}
+
+double windowValue(Spectrum::Window window, int i, int count)
+{
+    // Periodic windows, they have better spectral properties than symmetric ones
+    const double t = 2.0 * M_PI * double(i) / double(count);
+    switch (window) {
+    case Spectrum::WINDOW_NONE: return 1;
+    case Spectrum::WINDOW_HANN: return 0.5 - 0.5 * qCos(t);
+    case Spectrum::WINDOW_HAMMING: return 0.54 - 0.46 * qCos(t);
+    case Spectrum::WINDOW_BLACKMAN: return 0.42 - 0.5 * qCos(t) + 0.08 * qCos(2.0 * t);
+    }
+    return 1;
+}
+
+} // namespace
+
+GraphPoints Spectrum::calc(const GraphPoints& data) const
+{
+    NEED_POINTS(2)
+    const GraphPoints src = data.uniformX ? data : resampleUniform(data);
+    if (!(src.dx > 0))
+        return data;
+
+    const int count = src.ys.size();
+    qsizetype size = count;
+    if (padding > 0) {
+        size = 1;
+        while (size < qsizetype(count) * padding)
+            size <<= 1;
+    }
+    Values xs(size, 0.0);
+    double windowSum = 0;
+    for (int i = 0; i < count; i++) {
+        const double w = windowValue(window, i, count);
+        xs[i] = src.ys[i] * w;
+        windowSum += w;
+    }
+
+    // One-sided spectrum normalized by the window gain,
+    // so a sine of amplitude A gives a peak of height A
+    const auto bins = Z::Fft::forwardReal(xs);
+    Values ys(bins.size());
+    for (int k = 0; k < bins.size(); k++) {
+        double a = std::abs(bins[k]) / windowSum;
+        if (k > 0 && k < size - k)
+            a *= 2;
+        ys[k] = mode == MODE_POWER ? a * a : a;
+    }
+    return GraphPoints::uniform(0, 1.0 / (double(size) * src.dx), ys);
+}
+
+void Spectrum::save(QJsonObject &obj) const
+{
+    obj["mode"] = mode;
+    obj["window"] = window;
+    obj["padding"] = padding;
+}
+
+void Spectrum::load(const QJsonObject &obj)
+{
+    mode = Mode(obj["mode"].toInt());
+    window = Window(obj["window"].toInt());
+    padding = obj["padding"].toInt();
+}
+
+//------------------------------------------------------------------------------
+//                                  Convolve
+//------------------------------------------------------------------------------
+
+Values Convolve::makeKernel() const
+{
+    Values k;
+    switch (kernel) {
+    case KERNEL_GAUSSIAN: {
+        const int m = qMax(1, points);
+        const double sigma = double(m - 1) / 6.0;
+        const double center = double(m - 1) / 2.0;
+        k.resize(m);
+        double sum = 0;
+        for (int i = 0; i < m; i++) {
+            const double t = sigma > 0 ? (double(i) - center) / sigma : 0;
+            sum += k[i] = qExp(-0.5 * t * t);
+        }
+        for (auto &v : k)
+            v /= sum;
+        break;
+    }
+    case KERNEL_SAVGOL:
+        // Smoothing by quadratic polynomial, the window is made odd
+        k = SavGol::coefficients(qMax(1, points / 2), 2, 0);
+        break;
+    case KERNEL_CUSTOM:
+        k = customKernel;
+        if (normalize) {
+            const double sum = std::accumulate(k.cbegin(), k.cend(), 0.0);
+            if (sum != 0)
+                for (auto &v : k)
+                    v /= sum;
+        }
+        break;
+    }
+    return k;
+}
+
+GraphPoints Convolve::calc(const GraphPoints& data) const
+{
+    NEED_POINTS(1)
+    const Values k = makeKernel();
+    const int n = data.size();
+    const int m = k.size();
+    if (m == 0 || m > n)
+        return data;
+    const auto r = operation == OP_CORRELATION ? Z::Fft::correlate(data.ys, k) : Z::Fft::convolve(data.ys, k);
+    // Values where the kernel entirely overlaps the graph
+    const int count = n - m + 1;
+    const Values ys = r.mid(m - 1, count);
+    const int center = (m - 1) / 2;
+    const int first = operation == OP_CORRELATION ? center : m - 1 - center;
+    if (data.uniformX)
+        return GraphPoints::uniform(data.x(first), data.dx, ys);
+    return {data.xs.mid(first, count), ys};
+}
+
+void Convolve::save(QJsonObject &obj) const
+{
+    obj["operation"] = operation;
+    obj["kernel"] = kernel;
+    obj["points"] = points;
+    obj["normalize"] = normalize;
+    QJsonArray values;
+    for (double v : customKernel)
+        values.append(v);
+    obj["customKernel"] = values;
+}
+
+void Convolve::load(const QJsonObject &obj)
+{
+    operation = Operation(obj["operation"].toInt());
+    kernel = Kernel(obj["kernel"].toInt());
+    points = obj["points"].toInt();
+    normalize = obj["normalize"].toBool();
+    customKernel.clear();
+    for (const auto &v : obj["customKernel"].toArray())
+        customKernel << v.toDouble();
+}
+
+//------------------------------------------------------------------------------
+//                                 Arithmetic
+//------------------------------------------------------------------------------
+
+namespace {
+
+template <typename Op>
+GraphPoints combine(const GraphPoints& data, const Z::Interpolator &reference, Op op)
+{
+    const Values xs = data.xValues();
+    const Values rs = reference.values(xs);
+    const double minX = reference.minX();
+    const double maxX = reference.maxX();
+    const int count = data.size();
+    Values resXs, resYs;
+    resXs.reserve(count);
+    resYs.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const double x = xs[i];
+        if (x < minX || x > maxX)
+            continue;
+        const double y = op(data.ys[i], rs[i]);
+        if (!qIsFinite(y))
+            continue;
+        resXs << x;
+        resYs << y;
+    }
+    // Uniform graph is kept uniform when the skipped points are only at its ends
+    if (data.uniformX && !resXs.isEmpty()) {
+        const int first = qRound((resXs.first() - data.x0) / data.dx);
+        if (resXs.size() == 1 || qRound((resXs.last() - data.x0) / data.dx) - first + 1 == resXs.size())
+            return GraphPoints::uniform(data.x(first), data.dx, resYs);
+    }
+    return {resXs, resYs};
+}
+
+} // namespace
+
+GraphPoints Arithmetic::calc(const GraphPoints& data, const Z::Interpolator &reference) const
+{
+    NEED_POINTS(1)
+    if (!reference.isValid())
+        return {};
+    switch (operation) {
+    case OP_ADD: return combine(data, reference, [](double y, double r){ return y + r; });
+    case OP_SUB: return combine(data, reference, [](double y, double r){ return y - r; });
+    case OP_MUL: return combine(data, reference, [](double y, double r){ return y * r; });
+    case OP_DIV: return combine(data, reference, [](double y, double r){ return y / r; });
+    case OP_RATIO: return combine(data, reference, [](double y, double r){ return (y - r) / r; });
+    }
+    return data;
+}
+
+void Arithmetic::save(QJsonObject &obj) const
+{
+    obj["operation"] = operation;
+    obj["interpolation"] = interpolation;
+}
+
+void Arithmetic::load(const QJsonObject &obj)
+{
+    operation = Operation(obj["operation"].toInt());
+    interpolation = Resample::Method(obj["interpolation"].toInt());
+}
+
 } // namespace GraphMath
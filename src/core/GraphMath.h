@@ -5,6 +5,10 @@
 
 class QJsonObject;
 
+namespace Z {
+class Interpolator;
+}
+
 namespace GraphMath {
 
 struct MinMax
@@ -20,6 +24,8 @@ struct MinMax
 };
 
 MinMax minMax(const GraphPoints& data);
+/// Values are read in place, the points are not unpacked.
+MinMax minMax(const PackedPoints& data);
 double min(const QVector<double>& data);
 double max(const QVector<double>& data);
 double avg(const QVector<double>& data);
@@ -85,11 +91,21 @@ struct Invert
     void load(const QJsonObject &obj);
 };
 
+/// Reduces the number of points. By default every Nth point is taken, or the last point before each X step.
+/// Other modes split the graph into buckets of N points or of X step length and keep points
+/// describing the shape of each bucket, so narrow peaks are not lost.
 struct Decimate
 {
+    enum Mode {
+        MODE_NTH,    ///< Every Nth point
+        MODE_MINMAX, ///< Minimum and maximum of each bucket
+        MODE_M4,     ///< First, minimum, maximum and last points of each bucket
+        MODE_LTTB,   ///< Largest-Triangle-Three-Buckets, one point of each bucket preserving the visual shape
+    } mode = MODE_NTH;
     int points;
     double step;
     bool useStep;
+    static constexpr bool supportsUniformX = true;
     GraphPoints calc(const GraphPoints& data) const;
     void save(QJsonObject &obj) const;
     void load(const QJsonObject &obj);
@@ -111,6 +127,9 @@ struct MavgSimple
     int points;
     double step;
     bool useStep;
+    /// Use compensated summation to avoid the drift of running sum on long graphs
+    bool compensated = false;
+    static constexpr bool supportsUniformX = true;
     GraphPoints calc(const GraphPoints& data) const;
     void save(QJsonObject &obj) const;
     void load(const QJsonObject &obj);
@@ -144,6 +163,21 @@ struct Despike
 {
     enum Mode {MODE_REL, MODE_ABS} mode;
     double min, max;
+    /// Defines the random order of processing points, the same seed gives the same result
+    quint32 seed = 0;
+    GraphPoints calc(const GraphPoints& data) const;
+    void save(QJsonObject &obj) const;
+    void load(const QJsonObject &obj);
+};
+
+/// Rolling median over a sliding window, it removes spikes not wider than a half of the window
+/// preserving sharp edges. The window is kept in two indexed heaps, so cost is O(n log k).
+struct Median
+{
+    int points;
+    double step;
+    bool useStep;
+    static constexpr bool supportsUniformX = true;
     GraphPoints calc(const GraphPoints& data) const;
     void save(QJsonObject &obj) const;
     void load(const QJsonObject &obj);
@@ -153,11 +187,101 @@ struct Derivative
 {
     enum Mode { MODE_SIMPLE, MODE_REFINED, MODE_SIMPLE_TAU, MODE_REFINED_TAU } mode;
     double tau;
+    static constexpr bool supportsUniformX = true;
+    GraphPoints calc(const GraphPoints& data) const;
+    void save(QJsonObject &obj) const;
+    void load(const QJsonObject &obj);
+};
+
+/// Savitzky–Golay filter: the polynomial fitted by least squares to the window around each point
+/// gives the smoothed value or a derivative of order 1–3 at the point. For uniform X the fit reduces
+/// to a convolution with constant coefficients which are calculated once and cached.
+struct SavGol
+{
+    static constexpr int MAX_ORDER = 10;
+    static constexpr int MAX_DERIV = 3;
+    /// Window size, it's made odd
+    int points;
+    /// Order of the polynomial, not less than the order of derivative
+    int order;
+    /// Order of derivative, zero means smoothing
+    int deriv;
+    static constexpr bool supportsUniformX = true;
+    /// Coefficients of the window of `2*halfWidth+1` points for unit spacing of X
+    static Values coefficients(int halfWidth, int order, int deriv);
+    GraphPoints calc(const GraphPoints& data) const;
+    void save(QJsonObject &obj) const;
+    void load(const QJsonObject &obj);
+};
+
+/// Interpolation of the graph at evenly spaced points covering its X range,
+/// the number of points or the distance between them is given.
+struct Resample
+{
+    enum Method { METHOD_LINEAR, METHOD_SPLINE, METHOD_AKIMA, METHOD_NEAREST } method;
+    int points;
+    double step;
+    bool useStep;
+    static constexpr bool supportsUniformX = true;
+    GraphPoints calc(const GraphPoints& data) const;
+    void save(QJsonObject &obj) const;
+    void load(const QJsonObject &obj);
+};
+
+/// Amplitude or power spectrum of the graph made by the FFT.
+/// Graphs with non-uniform X are linearly resampled to uniform X before the transform.
+struct Spectrum
+{
+    enum Mode { MODE_AMPLITUDE, MODE_POWER } mode;
+    enum Window { WINDOW_NONE, WINDOW_HANN, WINDOW_HAMMING, WINDOW_BLACKMAN } window;
+    /// Zero-padding factor, the number of points is multiplied by it
+    /// and rounded up to a power of two, 0 means no padding
+    int padding;
+    static constexpr bool supportsUniformX = true;
+    GraphPoints calc(const GraphPoints& data) const;
+    void save(QJsonObject &obj) const;
+    void load(const QJsonObject &obj);
+};
+
+/// Convolution or cross-correlation of the graph with a kernel.
+/// Points are considered equally spaced, the result only contains points
+/// where the kernel entirely overlaps the graph, the kernel center is taken as its origin.
+struct Convolve
+{
+    enum Operation { OP_CONVOLUTION, OP_CORRELATION } operation;
+    enum Kernel { KERNEL_GAUSSIAN, KERNEL_SAVGOL, KERNEL_CUSTOM } kernel;
+    /// Size of preset kernels, where ±3σ of the Gaussian kernel fit in
+    int points;
+    Values customKernel;
+    /// Scale the custom kernel to unit sum
+    bool normalize;
+    static constexpr bool supportsUniformX = true;
+    Values makeKernel() const;
     GraphPoints calc(const GraphPoints& data) const;
     void save(QJsonObject &obj) const;
     void load(const QJsonObject &obj);
 };
 
+/// Binary operation between the graph and a reference graph interpolated at X of the graph.
+/// Only points within X range of the reference are calculated,
+/// points where the reference is zero are skipped for division.
+struct Arithmetic
+{
+    enum Operation {
+        OP_ADD,   ///< Y + R
+        OP_SUB,   ///< Y - R
+        OP_MUL,   ///< Y * R
+        OP_DIV,   ///< Y / R
+        OP_RATIO, ///< (Y - R) / R, relative deviation from the reference
+    } operation;
+    /// How the reference is interpolated between its points
+    Resample::Method interpolation;
+    static constexpr bool supportsUniformX = true;
+    GraphPoints calc(const GraphPoints& data, const Z::Interpolator &reference) const;
+    void save(QJsonObject &obj) const;
+    void load(const QJsonObject &obj);
+};
+
 } // namespace GraphMath
 
 #endif // GRAPH_MATH_H
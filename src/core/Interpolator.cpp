@@ -0,0 +1,205 @@
+#include "Interpolator.h"
+
+#include "Parallel.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <numeric>
+
+namespace Z {
+
+namespace {
+
+// Grids smaller than this are interpolated in the calling thread
+const qsizetype PARALLEL_CHUNK = 1 << 14;
+
+} // namespace
+
+Interpolator::Interpolator(const GraphPoints &data, Method method) : _method(method)
+{
+    if (!data.uniformX && data.xs.size() != data.ys.size())
+        return;
+    const Values xs = data.xValues();
+    const Values &ys = data.ys;
+    const int count = ys.size();
+    if (count == 0)
+        return;
+
+    QVector<int> indexes(count);
+    std::iota(indexes.begin(), indexes.end(), 0);
+    if (!std::is_sorted(xs.cbegin(), xs.cend()))
+        std::stable_sort(indexes.begin(), indexes.end(), [&xs](int a, int b){ return xs[a] < xs[b]; });
+
+    // Points having the same X are replaced with their average
+    _xs.reserve(count);
+    _c0.reserve(count);
+    for (int i = 0; i < count; ) {
+        const double x = xs[indexes[i]];
+        double sum = 0;
+        int same = 0;
+        for (; i < count && xs[indexes[i]] == x; i++, same++)
+            sum += ys[indexes[i]];
+        _xs << x;
+        _c0 << sum / double(same);
+    }
+
+    const int n = _xs.size();
+    if (n < 2 || _method == NEAREST)
+        return;
+    _c1.resize(n - 1);
+    for (int k = 0; k < n - 1; k++)
+        _c1[k] = (_c0[k+1] - _c0[k]) / (_xs[k+1] - _xs[k]);
+    if (n < 3 || _method == LINEAR) {
+        _method = LINEAR;
+        return;
+    }
+    _c2.resize(n - 1);
+    _c3.resize(n - 1);
+    if (_method == SPLINE)
+        makeSpline();
+    else
+        makeAkima();
+}
+
+void Interpolator::makeSpline()
+{
+    // Second derivatives at points are found from the tridiagonal system
+    // h[i-1]*M[i-1] + 2*(h[i-1]+h[i])*M[i] + h[i]*M[i+1] = 6*(s[i] - s[i-1]),
+    // where s are slopes of intervals; the natural spline has M = 0 at the ends
+    const int n = _xs.size();
+    const auto &s = _c1;
+    Values h(n - 1), m(n, 0.0), diag(n), rhs(n);
+    for (int k = 0; k < n - 1; k++)
+        h[k] = _xs[k+1] - _xs[k];
+    // Forward sweep of the Thomas algorithm
+    for (int i = 1; i < n - 1; i++) {
+        diag[i] = 2.0 * (h[i-1] + h[i]);
+        rhs[i] = 6.0 * (s[i] - s[i-1]);
+        if (i > 1) {
+            const double f = h[i-1] / diag[i-1];
+            diag[i] -= f * h[i-1];
+            rhs[i] -= f * rhs[i-1];
+        }
+    }
+    for (int i = n - 2; i >= 1; i--)
+        m[i] = (rhs[i] - h[i] * m[i+1]) / diag[i];
+
+    for (int k = 0; k < n - 1; k++) {
+        _c1[k] = s[k] - h[k] * (2.0 * m[k] + m[k+1]) / 6.0;
+        _c2[k] = m[k] / 2.0;
+        _c3[k] = (m[k+1] - m[k]) / (6.0 * h[k]);
+    }
+}
+
+void Interpolator::makeAkima()
+{
+    // Slopes of intervals extended by two more at each end, so `mm[i+2]` is the slope after point `i`
+    const int n = _xs.size();
+    Values mm(n + 3);
+    for (int k = 0; k < n - 1; k++)
+        mm[k+2] = _c1[k];
+    mm[1] = 2.0 * mm[2] - mm[3];
+    mm[0] = 2.0 * mm[1] - mm[2];
+    mm[n+1] = 2.0 * mm[n] - mm[n-1];
+    mm[n+2] = 2.0 * mm[n+1] - mm[n];
+
+    // Derivatives at points are weighted by how the slopes change at each side,
+    // so a point next to a sharp change takes the slope of the smooth side
+    Values d(n);
+    for (int i = 0; i < n; i++) {
+        const double w1 = qAbs(mm[i+3] - mm[i+2]);
+        const double w2 = qAbs(mm[i+1] - mm[i]);
+        d[i] = w1 + w2 > 0
+            ? (w1 * mm[i+1] + w2 * mm[i+2]) / (w1 + w2)
+            : (mm[i+1] + mm[i+2]) / 2.0;
+    }
+
+    // Cubic Hermite polynomials through the points with these derivatives
+    for (int k = 0; k < n - 1; k++) {
+        const double h = _xs[k+1] - _xs[k];
+        const double s = _c1[k];
+        _c1[k] = d[k];
+        _c2[k] = (3.0 * s - 2.0 * d[k] - d[k+1]) / h;
+        _c3[k] = (d[k] + d[k+1] - 2.0 * s) / (h * h);
+    }
+}
+
+// Index of the interval containing `x`, i.e. x[k] <= x < x[k+1]
+int Interpolator::interval(double x) const
+{
+    const int n = _xs.size();
+    if (n < 2)
+        return 0;
+    const int k = int(std::upper_bound(_xs.cbegin(), _xs.cend(), x) - _xs.cbegin()) - 1;
+    return qBound(0, k, n - 2);
+}
+
+double Interpolator::eval(int k, double x) const
+{
+    if (x <= _xs.first())
+        return _c0.first();
+    if (x >= _xs.last())
+        return _c0.last();
+    const double t = x - _xs[k];
+    switch (_method) {
+    case NEAREST:
+        return 2.0 * t < _xs[k+1] - _xs[k] ? _c0[k] : _c0[k+1];
+    case LINEAR:
+        return _c0[k] + _c1[k] * t;
+    default:
+        return _c0[k] + t * (_c1[k] + t * (_c2[k] + t * _c3[k]));
+    }
+}
+
+double Interpolator::value(double x) const
+{
+    if (!isValid())
+        return Q_QNAN;
+    return eval(interval(x), x);
+}
+
+template <typename XAt>
+void Interpolator::fill(XAt xAt, qsizetype count, bool sorted, double *out) const
+{
+    parallelFor(count, PARALLEL_CHUNK, [this, xAt, sorted, out](qsizetype begin, qsizetype end){
+        if (!sorted) {
+            for (qsizetype i = begin; i < end; i++) {
+                const double x = xAt(i);
+                out[i] = eval(interval(x), x);
+            }
+            return;
+        }
+        // Only the first point of a chunk is searched for,
+        // then graph intervals are walked through along with the grid
+        const int last = qMax(0, int(_xs.size()) - 2);
+        int k = interval(xAt(begin));
+        for (qsizetype i = begin; i < end; i++) {
+            const double x = xAt(i);
+            while (k < last && _xs[k+1] <= x)
+                k++;
+            out[i] = eval(k, x);
+        }
+    });
+}
+
+Values Interpolator::values(const Values &xs) const
+{
+    if (!isValid())
+        return Values(xs.size(), Q_QNAN);
+    Values ys(xs.size());
+    const double *px = xs.constData();
+    fill([px](qsizetype i){ return px[i]; }, xs.size(), std::is_sorted(xs.cbegin(), xs.cend()), ys.data());
+    return ys;
+}
+
+Values Interpolator::values(double x0, double dx, int count) const
+{
+    if (!isValid())
+        return Values(count, Q_QNAN);
+    Values ys(count);
+    fill([x0, dx](qsizetype i){ return x0 + double(i) * dx; }, count, dx >= 0, ys.data());
+    return ys;
+}
+
+} // namespace Z
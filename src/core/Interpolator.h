@@ -0,0 +1,55 @@
+#ifndef Z_INTERPOLATOR_H
+#define Z_INTERPOLATOR_H
+
+#include "BaseTypes.h"
+
+namespace Z {
+
+/// Calculates values of a graph at arbitrary X, e.g. for putting graphs on a common grid.
+///
+/// Points are sorted by X and points having the same X are averaged when the interpolator is made,
+/// then the curve is stored as a cubic polynomial for each interval between points.
+/// Values outside of the graph's X range are equal to values at the nearest end point.
+class Interpolator
+{
+public:
+    enum Method {
+        LINEAR,  ///< Straight lines between points
+        SPLINE,  ///< Natural cubic spline, smooth second derivative
+        AKIMA,   ///< Akima spline, it doesn't overshoot near outliers and steps
+        NEAREST, ///< Value of the nearest point
+    };
+
+    Interpolator(const GraphPoints &data, Method method);
+
+    /// Returns false when the graph has no points.
+    bool isValid() const { return !_xs.isEmpty(); }
+
+    double minX() const { return _xs.first(); }
+    double maxX() const { return _xs.last(); }
+
+    double value(double x) const;
+
+    /// Values at the given X. Sorted X are traversed along with the graph points,
+    /// otherwise each X is searched for. Large grids are processed using all available threads.
+    Values values(const Values &xs) const;
+
+    /// Values at `count` points starting from `x0` with step `dx`.
+    Values values(double x0, double dx, int count) const;
+
+private:
+    Method _method;
+    Values _xs;
+    // Coefficients of polynomial y = c0 + c1*t + c2*t^2 + c3*t^3, t = x - x[k] for each interval k
+    Values _c0, _c1, _c2, _c3;
+
+    void makeSpline();
+    void makeAkima();
+    double eval(int k, double x) const;
+    int interval(double x) const;
+    template <typename XAt> void fill(XAt xAt, qsizetype count, bool sorted, double *out) const;
+};
+
+} // namespace Z
+
+#endif // Z_INTERPOLATOR_H
@@ -2,10 +2,17 @@
 
 #include <QApplication>
 #include <QDebug>
+#include <QMutex>
+#include <QThread>
 #include <QtMath>
 #include <QRegularExpression>
+#include <QSet>
 
 #include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <vector>
 
 extern "C" {
 #include <lua.h>
@@ -16,6 +23,539 @@ extern "C" {
 #define RESULT_VAR "ans"
 #define FORMULA_ID "formula"
 
+// Max number of compiled chunks kept by a state
+#define CHUNK_CACHE_SIZE 64
+
+// How often execution limits are checked, in VM instructions
+#define HOOK_INTERVAL 1000
+
+// Max memory reserved by a state to be returned into the pool
+#define POOLED_STATE_MEMORY (16 * 1024 * 1024)
+
+//------------------------------------------------------------------------------
+//                               State memory
+//------------------------------------------------------------------------------
+
+// Memory allocated by a state, it's the user data of the state's allocator.
+// Small blocks, which are the most of tables, strings and closures made by formulas,
+// are carved from the state's own pages and recycled via free lists of their size class.
+// States are used by one thread at a time, so allocation takes no locks,
+// and all pages are given back at once when the state is closed.
+struct LuaMemory
+{
+    static constexpr size_t GRANULE = 16; // keeps blocks aligned for any Lua object
+    static constexpr size_t SMALL_MAX = 256;
+    static constexpr size_t PAGE_SIZE = 64 * 1024;
+
+    // Changes of job memory are collected in portions,
+    // so states of the job don't contend for its counter on each allocation
+    static constexpr qint64 JOB_PORTION = 64 * 1024;
+
+    size_t used = 0;
+    size_t peak = 0;
+    size_t limit = 0;
+    bool exceeded = false;
+    // Memory of all states of a job, when the limit applies to them together
+    std::atomic<qint64> *jobUsed = nullptr;
+    qint64 jobPending = 0;
+
+    void* freeLists[SMALL_MAX / GRANULE] = {};
+    QVector<char*> pages;
+    char *page = nullptr;
+    size_t pageLeft = 0;
+
+    ~LuaMemory()
+    {
+        for (auto p : std::as_const(pages))
+            free(p);
+    }
+
+    static bool isSmall(size_t size) { return size <= SMALL_MAX; }
+    static size_t sizeClass(size_t size) { return (size - 1) / GRANULE; }
+
+    size_t reserved() const { return static_cast<size_t>(pages.size()) * PAGE_SIZE; }
+
+    void* allocSmall(size_t size)
+    {
+        const size_t c = sizeClass(size);
+        if (void *p = freeLists[c]; p)
+        {
+            freeLists[c] = *static_cast<void**>(p);
+            return p;
+        }
+        const size_t blockSize = (c + 1) * GRANULE;
+        if (pageLeft < blockSize)
+        {
+            page = static_cast<char*>(malloc(PAGE_SIZE));
+            if (!page)
+            {
+                pageLeft = 0;
+                return nullptr;
+            }
+            pages << page;
+            pageLeft = PAGE_SIZE;
+        }
+        void *p = page;
+        page += blockSize;
+        pageLeft -= blockSize;
+        return p;
+    }
+
+    void release(void *ptr, size_t size)
+    {
+        if (!isSmall(size))
+        {
+            free(ptr);
+            return;
+        }
+        const size_t c = sizeClass(size);
+        *static_cast<void**>(ptr) = freeLists[c];
+        freeLists[c] = ptr;
+    }
+
+    void account(qint64 delta)
+    {
+        used = static_cast<size_t>(static_cast<qint64>(used) + delta);
+        if (used > peak)
+            peak = used;
+        if (jobUsed)
+        {
+            jobPending += delta;
+            if (jobPending > JOB_PORTION || jobPending < -JOB_PORTION)
+            {
+                *jobUsed += jobPending;
+                jobPending = 0;
+            }
+        }
+    }
+
+    bool exceeds(size_t delta) const
+    {
+        const qint64 total = jobUsed ? qMax(qint64(0), jobUsed->load() + jobPending) : static_cast<qint64>(used);
+        return static_cast<size_t>(total) + delta > limit;
+    }
+
+    void attachJob(std::atomic<qint64> *counter)
+    {
+        jobUsed = counter;
+        jobPending = 0;
+        *jobUsed += static_cast<qint64>(used);
+    }
+
+    void detachJob()
+    {
+        if (!jobUsed) return;
+        *jobUsed += jobPending - static_cast<qint64>(used);
+        jobUsed = nullptr;
+        jobPending = 0;
+    }
+};
+
+static void* limitedAlloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    auto mem = static_cast<LuaMemory*>(ud);
+    // For new blocks osize is a type of the object being allocated
+    if (!ptr) osize = 0;
+    if (nsize == 0)
+    {
+        if (ptr)
+            mem->release(ptr, osize);
+        mem->account(-static_cast<qint64>(osize));
+        return nullptr;
+    }
+    if (mem->limit > 0 && nsize > osize && mem->exceeds(nsize - osize))
+    {
+        mem->exceeded = true;
+        return nullptr;
+    }
+    void *newPtr;
+    if (ptr && !LuaMemory::isSmall(osize) && !LuaMemory::isSmall(nsize))
+        newPtr = realloc(ptr, nsize);
+    else if (ptr && LuaMemory::isSmall(osize) && LuaMemory::isSmall(nsize)
+             && LuaMemory::sizeClass(osize) == LuaMemory::sizeClass(nsize))
+        newPtr = ptr;
+    else
+    {
+        newPtr = LuaMemory::isSmall(nsize) ? mem->allocSmall(nsize) : malloc(nsize);
+        if (!newPtr)
+        {
+            // Lua expects that shrinking never fails, the old block is big enough
+            if (ptr && nsize <= osize)
+                newPtr = ptr;
+            else return nullptr;
+        }
+        if (ptr && newPtr != ptr)
+        {
+            memcpy(newPtr, ptr, qMin(osize, nsize));
+            mem->release(ptr, osize);
+        }
+    }
+    if (newPtr)
+        mem->account(static_cast<qint64>(nsize) - static_cast<qint64>(osize));
+    return newPtr;
+}
+
+static LuaMemory* stateMemory(lua_State *L)
+{
+    void *ud;
+    lua_getallocf(L, &ud);
+    return static_cast<LuaMemory*>(ud);
+}
+
+//------------------------------------------------------------------------------
+//                               Numeric arrays
+//------------------------------------------------------------------------------
+
+// Userdata holding a contiguous buffer of doubles.
+// Being implicitly shared, the buffer goes to and from C++ code without copying.
+using LuaArray = QVector<double>;
+
+#define ARRAY_TYPE "Z.Array"
+
+static LuaArray* toArray(lua_State *L, int idx)
+{
+    return static_cast<LuaArray*>(luaL_testudata(L, idx, ARRAY_TYPE));
+}
+
+// Array buffers are allocated by QVector but counted as memory of the state,
+// so huge arrays are stopped by the memory limit just as huge tables are
+static void trackArray(lua_State *L, const LuaArray *a, qsizetype oldCapacity)
+{
+    stateMemory(L)->account((a->capacity() - oldCapacity) * static_cast<qint64>(sizeof(double)));
+}
+
+// Largest array QVector can hold, array kernels index elements with int
+#if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+static const qsizetype MAX_ARRAY_SIZE = (std::numeric_limits<int>::max() - 64) / static_cast<qsizetype>(sizeof(double));
+#else
+static const qsizetype MAX_ARRAY_SIZE = std::numeric_limits<int>::max();
+#endif
+
+static void reserveArray(lua_State *L, qsizetype size)
+{
+    if (size > MAX_ARRAY_SIZE)
+        luaL_error(L, "array size %I is too big", static_cast<lua_Integer>(size));
+    auto mem = stateMemory(L);
+    if (mem->limit > 0 && mem->exceeds(size * sizeof(double)))
+    {
+        mem->exceeded = true;
+        luaL_error(L, "not enough memory");
+    }
+}
+
+// QVector throws when it can't allocate a buffer, the exception must not go through
+// Lua's C frames, so it's turned into an ordinary Lua error. This happens outside
+// of the catch block because the error doesn't return, it's a longjmp in C builds of Lua.
+template <typename Op>
+static void allocArray(lua_State *L, Op op)
+{
+    bool failed = false;
+    try
+    {
+        op();
+    }
+    catch (const std::bad_alloc&)
+    {
+        failed = true;
+    }
+    if (failed)
+    {
+        stateMemory(L)->exceeded = true;
+        luaL_error(L, "not enough memory");
+    }
+}
+
+// Pushes a new array of the given size filled with zeros
+static LuaArray* newArray(lua_State *L, qsizetype size)
+{
+    reserveArray(L, size);
+    auto a = static_cast<LuaArray*>(lua_newuserdata(L, sizeof(LuaArray)));
+    new (a) LuaArray();
+    luaL_setmetatable(L, ARRAY_TYPE);
+    allocArray(L, [a, size]{ a->resize(size); });
+    trackArray(L, a, 0);
+    return a;
+}
+
+// Metamethods are only called for arrays because the metatable is hidden from user code
+static LuaArray* selfArray(lua_State *L)
+{
+    return static_cast<LuaArray*>(lua_touserdata(L, 1));
+}
+
+static int array_index(lua_State *L)
+{
+    auto a = selfArray(L);
+    int isInt;
+    lua_Integer i = lua_tointegerx(L, 2, &isInt);
+    if (isInt && i >= 1 && i <= a->size())
+        lua_pushnumber(L, a->at(i-1));
+    else
+        lua_pushnil(L);
+    return 1;
+}
+
+static int array_newindex(lua_State *L)
+{
+    auto a = selfArray(L);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    double v = luaL_checknumber(L, 3);
+    lua_Integer size = a->size();
+    if (i < 1 || i > size+1)
+        return luaL_error(L, "array index %I is out of range 1..%I", i, size+1);
+    // Appending or writing into a buffer shared with C++ code can reallocate it
+    auto capacity = a->capacity();
+    if (i == size+1 || !a->isDetached())
+        reserveArray(L, size+1);
+    allocArray(L, [a, i, size, v]{
+        if (i <= size)
+            (*a)[i-1] = v;
+        else
+            a->append(v);
+    });
+    trackArray(L, a, capacity);
+    return 0;
+}
+
+static int array_len(lua_State *L)
+{
+    lua_pushinteger(L, selfArray(L)->size());
+    return 1;
+}
+
+static int array_gc(lua_State *L)
+{
+    auto a = selfArray(L);
+    stateMemory(L)->account(-a->capacity() * static_cast<qint64>(sizeof(double)));
+    a->~LuaArray();
+    return 0;
+}
+
+// Pushes a new array made of numbers from the table at the given index
+static LuaArray* tableToArray(lua_State *L, int idx)
+{
+    idx = lua_absindex(L, idx);
+    auto size = lua_rawlen(L, idx);
+    auto a = newArray(L, static_cast<qsizetype>(size));
+    double *d = a->data();
+    for (lua_Integer i = 1; i <= static_cast<lua_Integer>(size); i++)
+    {
+        lua_rawgeti(L, idx, i);
+        int isNum;
+        d[i-1] = lua_tonumberx(L, -1, &isNum);
+        if (!isNum)
+            luaL_error(L, "array element %I is not a number", i);
+        lua_pop(L, 1);
+    }
+    return a;
+}
+
+// Returns the array argument, a table argument is replaced with an array made of it
+static const LuaArray* checkArray(lua_State *L, int idx)
+{
+    if (auto a = toArray(L, idx); a)
+        return a;
+    luaL_argcheck(L, lua_istable(L, idx), idx, "array expected");
+    auto a = tableToArray(L, idx);
+    lua_replace(L, idx);
+    return a;
+}
+
+static bool isArrayArg(lua_State *L, int idx)
+{
+    return lua_istable(L, idx) || toArray(L, idx);
+}
+
+// Pushes a new array of results of f applied to each element of the first argument
+template <typename F>
+static int mapArray(lua_State *L, F f)
+{
+    auto src = checkArray(L, 1);
+    const int n = src->size();
+    auto dst = newArray(L, n);
+    const double *s = src->constData();
+    double *d = dst->data();
+    for (int i = 0; i < n; i++)
+        d[i] = f(s[i]);
+    return 1;
+}
+
+// Arithmetic operand, either an array or a number
+struct ArrayOperand
+{
+    const double *data = nullptr;
+    int size = 0;
+    double value = 0;
+};
+
+static ArrayOperand arrayOperand(lua_State *L, int idx)
+{
+    ArrayOperand r;
+    if (auto a = toArray(L, idx); a)
+    {
+        r.data = a->constData();
+        r.size = a->size();
+    }
+    else r.value = luaL_checknumber(L, idx);
+    return r;
+}
+
+// Arithmetic metamethods work element by element,
+// a number operand is applied to each element
+template <typename F>
+static int arrayArith(lua_State *L, F f)
+{
+    auto a = arrayOperand(L, 1);
+    auto b = arrayOperand(L, 2);
+    if (a.data && b.data && a.size != b.size)
+        return luaL_error(L, "arrays have different sizes (%d vs %d)", a.size, b.size);
+    const int n = a.data ? a.size : b.size;
+    auto r = newArray(L, n);
+    double *d = r->data();
+    if (a.data && b.data)
+        for (int i = 0; i < n; i++) d[i] = f(a.data[i], b.data[i]);
+    else if (a.data)
+        for (int i = 0; i < n; i++) d[i] = f(a.data[i], b.value);
+    else
+        for (int i = 0; i < n; i++) d[i] = f(a.value, b.data[i]);
+    return 1;
+}
+
+static int array_add(lua_State *L) { return arrayArith(L, [](double a, double b){ return a + b; }); }
+static int array_sub(lua_State *L) { return arrayArith(L, [](double a, double b){ return a - b; }); }
+static int array_mul(lua_State *L) { return arrayArith(L, [](double a, double b){ return a * b; }); }
+static int array_div(lua_State *L) { return arrayArith(L, [](double a, double b){ return a / b; }); }
+static int array_pow(lua_State *L) { return arrayArith(L, [](double a, double b){ return std::pow(a, b); }); }
+static int array_unm(lua_State *L) { return mapArray(L, [](double a){ return -a; }); }
+
+// array(n [, value]) makes an array of n elements filled with value or zeros
+// array(t) makes an array from a table of numbers
+static int global_array(lua_State *L)
+{
+    if (lua_istable(L, 1))
+    {
+        tableToArray(L, 1);
+        return 1;
+    }
+    lua_Integer size = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, size >= 0, 1, "size must be non-negative");
+    double value = luaL_optnumber(L, 2, 0);
+    newArray(L, static_cast<qsizetype>(size))->fill(value);
+    return 1;
+}
+
+// linspace(a, b, n) makes an array of n values evenly spaced from a to b
+static int global_linspace(lua_State *L)
+{
+    double a = luaL_checknumber(L, 1);
+    double b = luaL_checknumber(L, 2);
+    lua_Integer n = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, n >= 0 && n <= MAX_ARRAY_SIZE, 3, "invalid size");
+    auto r = newArray(L, static_cast<qsizetype>(n));
+    double *d = r->data();
+    const double step = n > 1 ? (b - a) / double(n - 1) : 0;
+    for (int i = 0; i < n; i++)
+        d[i] = a + double(i) * step;
+    if (n > 1)
+        d[n-1] = b;
+    return 1;
+}
+
+// range(a, b [, step]) makes an array of values a, a+step, a+2*step, ... not going beyond b
+static int global_range(lua_State *L)
+{
+    double a = luaL_checknumber(L, 1);
+    double b = luaL_checknumber(L, 2);
+    double step = luaL_optnumber(L, 3, 1);
+    luaL_argcheck(L, step != 0, 3, "step must be non-zero");
+    double count = std::floor((b - a) / step);
+    int n = 0;
+    if (count >= 0)
+    {
+        luaL_argcheck(L, count < MAX_ARRAY_SIZE, 2, "too many values");
+        n = static_cast<int>(count) + 1;
+        // Rounding error can give an extra value
+        double last = a + double(n-1) * step;
+        if (step > 0 ? last > b : last < b)
+            n--;
+    }
+    auto r = newArray(L, n);
+    double *d = r->data();
+    for (int i = 0; i < n; i++)
+        d[i] = a + double(i) * step;
+    return 1;
+}
+
+// sum(a) returns the sum of array elements
+static int global_sum(lua_State *L)
+{
+    auto a = checkArray(L, 1);
+    double s = 0;
+    for (double v : *a)
+        s += v;
+    lua_pushnumber(L, s);
+    return 1;
+}
+
+// cumsum(a) makes an array of cumulative sums of array elements
+static int global_cumsum(lua_State *L)
+{
+    double s = 0;
+    return mapArray(L, [&s](double v){ return s += v; });
+}
+
+// diff(a) makes an array of differences between adjacent array elements
+static int global_diff(lua_State *L)
+{
+    auto src = checkArray(L, 1);
+    const int n = qMax(0, src->size() - 1);
+    auto r = newArray(L, n);
+    const double *s = src->constData();
+    double *d = r->data();
+    for (int i = 0; i < n; i++)
+        d[i] = s[i+1] - s[i];
+    return 1;
+}
+
+static void registerArrayType(lua_State *L)
+{
+    static const luaL_Reg meta[] = {
+        {"__index", array_index},
+        {"__newindex", array_newindex},
+        {"__len", array_len},
+        {"__gc", array_gc},
+        {"__add", array_add},
+        {"__sub", array_sub},
+        {"__mul", array_mul},
+        {"__div", array_div},
+        {"__pow", array_pow},
+        {"__unm", array_unm},
+        {nullptr, nullptr}
+    };
+    luaL_newmetatable(L, ARRAY_TYPE);
+    luaL_setfuncs(L, meta, 0);
+    lua_pushboolean(L, 0);
+    lua_setfield(L, -2, "__metatable");
+    lua_pop(L, 1);
+
+    static const luaL_Reg funcs[] = {
+        {"array", global_array},
+        {"linspace", global_linspace},
+        {"range", global_range},
+        {"sum", global_sum},
+        {"cumsum", global_cumsum},
+        {"diff", global_diff},
+        {nullptr, nullptr}
+    };
+    lua_pushglobaltable(L);
+    luaL_setfuncs(L, funcs, 0);
+    lua_pop(L, 1);
+}
+
+//------------------------------------------------------------------------------
+//                              Global functions
+//------------------------------------------------------------------------------
+
 static double impl_cot(double arg) { return 1.0 / qTan(arg); }
 static double impl_acot(double arg) { return qAtan(1.0 / arg); }
 static double impl_coth(double arg) { return 1.0 / tanh(arg); }
@@ -32,8 +572,11 @@ static int global_pi(lua_State *L)
 }
 
 // func should return a number of results
+// Given an array or a table, functions are applied to each element and return a new array
 #define LUA_DEFINE_GLOBAL_FUNC(name, meat) \
     static int global_##name(lua_State *L) { \
+        if (lua_type(L, 1) != LUA_TNUMBER && isArrayArg(L, 1)) \
+            return mapArray(L, [](double d) -> double { return meat(d); }); \
         double d = luaL_checknumber(L, 1); \
         lua_pushnumber(L, meat(d)); \
         return 1; \
@@ -77,16 +620,652 @@ LUA_DEFINE_GLOBAL_FUNC(sqrt, qSqrt)
 LUA_DEFINE_GLOBAL_FUNC(deg2rad, qDegreesToRadians)
 LUA_DEFINE_GLOBAL_FUNC(rad2deg, qRadiansToDegrees)
 
+//------------------------------------------------------------------------------
+//                                  Sandbox
+//------------------------------------------------------------------------------
+
+// Lua runs finalizers with hooks turned off, and the pool collects garbage of a released state
+// without the hook at all, so a finalizer made by user code could never be interrupted.
+// User code can only make tables finalizable via setmetatable, so __gc is not accepted there.
+static void checkNoFinalizer(lua_State *L, int metatableIdx)
+{
+    if (!lua_istable(L, metatableIdx))
+        return;
+    // Lua looks for the finalizer without metamethods too
+    lua_pushliteral(L, "__gc");
+    if (lua_rawget(L, metatableIdx) != LUA_TNIL)
+        luaL_error(L, "finalizers (__gc) are not allowed in formulas");
+    lua_pop(L, 1);
+}
+
+// The same as the standard setmetatable but rejects finalizers
+static int sandbox_setmetatable(lua_State *L)
+{
+    const int t = lua_type(L, 2);
+    luaL_checktype(L, 1, LUA_TTABLE);
+    luaL_argcheck(L, t == LUA_TNIL || t == LUA_TTABLE, 2, "nil or table expected");
+    if (luaL_getmetafield(L, 1, "__metatable") != LUA_TNIL)
+        return luaL_error(L, "cannot change a protected metatable");
+    checkNoFinalizer(L, 2);
+    lua_settop(L, 2);
+    lua_setmetatable(L, 1);
+    return 1;
+}
+
+// The same as debug.setmetatable but rejects finalizers and native arrays
+static int sandbox_debug_setmetatable(lua_State *L)
+{
+    const int t = lua_type(L, 2);
+    luaL_argcheck(L, t == LUA_TNIL || t == LUA_TTABLE, 2, "nil or table expected");
+    if (lua_type(L, 1) == LUA_TUSERDATA)
+        return luaL_error(L, "cannot change metatable of native arrays");
+    checkNoFinalizer(L, 2);
+    lua_settop(L, 2);
+    lua_setmetatable(L, 1);
+    return 1;
+}
+
+// Removes the ways to escape execution limits
+static void registerSandbox(lua_State *L)
+{
+    lua_pushcfunction(L, sandbox_setmetatable);
+    lua_setglobal(L, "setmetatable");
+
+    if (lua_getglobal(L, "debug") == LUA_TTABLE)
+    {
+        lua_pushcfunction(L, sandbox_debug_setmetatable);
+        lua_setfield(L, -2, "setmetatable");
+        // The hook could be removed, and __gc could be added to the protected metatable of arrays
+        for (auto name : {"sethook", "getregistry", "getmetatable"})
+        {
+            lua_pushnil(L);
+            lua_setfield(L, -2, name);
+        }
+    }
+    lua_pop(L, 1);
+}
+
 namespace Z {
 
-Lua::Lua()
+//------------------------------------------------------------------------------
+//                                 State pool
+//------------------------------------------------------------------------------
+
+// Registry keys, only addresses matter
+static char __tablesSnapshotKey;
+static char __typeMetatablesKey;
+static char __chunkCacheKey;
+
+// Chunk cache keys of code and formulas never match each other
+// since they start with different bytes
+static const char CHUNK_KEY_CODE = 'c';
+static const char CHUNK_KEY_FORMULA = 'f';
+
+static int panic(lua_State *L)
+{
+    auto msg = lua_tostring(L, -1);
+    qCritical() << "Unprotected error in Lua:" << (msg ? msg : "unknown error");
+    return 0;
+}
+
+// Pushes a shallow copy of the table at the given index
+static void copyTable(lua_State *L, int idx)
+{
+    idx = lua_absindex(L, idx);
+    lua_newtable(L);
+    lua_pushnil(L);
+    while (lua_next(L, idx))
+    {
+        lua_pushvalue(L, -2); // copy, key, value, key
+        lua_insert(L, -2);    // copy, key, key, value
+        lua_rawset(L, -4);    // copy, key
+    }
+}
+
+// Makes content of the table at idx the same as of its copy at copyIdx
+static void restoreTable(lua_State *L, int idx, int copyIdx)
+{
+    idx = lua_absindex(L, idx);
+    copyIdx = lua_absindex(L, copyIdx);
+
+    // Clearing existing fields is allowed during traversal
+    lua_pushnil(L);
+    while (lua_next(L, idx))
+    {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, copyIdx) == LUA_TNIL)
+        {
+            lua_pushvalue(L, -2);
+            lua_pushnil(L);
+            lua_rawset(L, idx);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, copyIdx))
+    {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, idx);
+    }
+}
+
+// Adds the table at idx and all tables reachable from it through values and metatables
+// to the snapshot at snapIdx as snapshot[table] = { shallow copy, metatable }
+static void snapshotTable(lua_State *L, int idx, int snapIdx)
+{
+    idx = lua_absindex(L, idx);
+    lua_pushvalue(L, idx);
+    if (lua_rawget(L, snapIdx) != LUA_TNIL)
+    {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_pop(L, 1);
+    luaL_checkstack(L, 8, "snapshotTable");
+
+    lua_pushvalue(L, idx);
+    lua_createtable(L, 2, 0);
+    copyTable(L, idx);
+    lua_rawseti(L, -2, 1);
+    if (lua_getmetatable(L, idx))
+        lua_rawseti(L, -2, 2);
+    lua_rawset(L, snapIdx);
+
+    lua_pushnil(L);
+    while (lua_next(L, idx))
+    {
+        if (lua_type(L, -1) == LUA_TTABLE)
+            snapshotTable(L, -1, snapIdx);
+        lua_pop(L, 1);
+    }
+    if (lua_getmetatable(L, idx))
+    {
+        snapshotTable(L, -1, snapIdx);
+        lua_pop(L, 1);
+    }
+}
+
+// Pushes a value of each type that has a single metatable shared by all its values
+static int pushTypeSamples(lua_State *L)
+{
+    lua_pushnil(L);
+    lua_pushboolean(L, 0);
+    lua_pushnumber(L, 0);
+    lua_pushliteral(L, "");
+    lua_pushcfunction(L, panic);
+    return 5;
+}
+
+// Remembers globals and content and metatables of all tables reachable from them
+// (math, string, package.loaded, etc.) just after the state has been initialized,
+// also metatables of types, e.g. the string one, that user code can change via getmetatable or debug
+static void snapshotGlobals(lua_State *L)
+{
+    lua_newtable(L);
+    lua_pushglobaltable(L);
+    snapshotTable(L, -1, 1);
+    lua_pop(L, 1);
+
+    lua_newtable(L);
+    const int count = pushTypeSamples(L);
+    for (int i = 1; i <= count; i++)
+    {
+        if (lua_getmetatable(L, 2 + i))
+        {
+            snapshotTable(L, -1, 1);
+            lua_rawseti(L, 2, i);
+        }
+    }
+    lua_settop(L, 2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &__typeMetatablesKey);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &__tablesSnapshotKey);
+}
+
+static void resetGlobals(lua_State *L)
+{
+    lua_settop(L, 0);
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &__tablesSnapshotKey);
+    lua_pushnil(L);
+    while (lua_next(L, 1)) // snapshot, table, { copy, metatable }
+    {
+        lua_rawgeti(L, -1, 1);
+        restoreTable(L, -3, -1);
+        lua_pop(L, 1);
+        lua_rawgeti(L, -1, 2);
+        lua_setmetatable(L, -3);
+        lua_pop(L, 1);
+    }
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &__typeMetatablesKey);
+    const int count = pushTypeSamples(L);
+    for (int i = 1; i <= count; i++)
+    {
+        lua_rawgeti(L, 2, i);
+        lua_setmetatable(L, 2 + i);
+    }
+
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+}
+
+static lua_State* newState()
+{
+    auto mem = new LuaMemory;
+    lua_State *L = lua_newstate(limitedAlloc, mem);
+    if (!L)
+    {
+        delete mem;
+        return nullptr;
+    }
+    lua_atpanic(L, panic);
+
+    luaL_openlibs(L);
+    registerSandbox(L);
+    Lua::registerGlobalFuncs(L);
+    for (auto name : {"inf", "Inf", "INF"})
+    {
+        lua_pushnumber(L, qInf());
+        lua_setglobal(L, name);
+    }
+    return L;
+}
+
+static void closeState(lua_State *L)
+{
+    auto mem = stateMemory(L);
+    lua_close(L);
+    delete mem;
+}
+
+class LuaStatePool
+{
+public:
+    ~LuaStatePool()
+    {
+        clear();
+    }
+
+    lua_State* acquire()
+    {
+        {
+            QMutexLocker locker(&_mutex);
+            if (!_states.isEmpty())
+                return _states.takeLast();
+        }
+        lua_State *L = newState();
+        if (L) snapshotGlobals(L);
+        return L;
+    }
+
+    void release(lua_State *L)
+    {
+        lua_sethook(L, nullptr, 0, 0);
+        auto mem = stateMemory(L);
+        mem->limit = 0;
+        resetGlobals(L);
+        // Pages of a state are never returned until it's closed,
+        // so a state having taken a lot of memory is not worth keeping
+        if (mem->reserved() <= POOLED_STATE_MEMORY)
+        {
+            QMutexLocker locker(&_mutex);
+            if (_states.size() < qMax(4, QThread::idealThreadCount()))
+            {
+                _states << L;
+                return;
+            }
+        }
+        closeState(L);
+    }
+
+    void clear()
+    {
+        QMutexLocker locker(&_mutex);
+        for (auto L : std::as_const(_states))
+            closeState(L);
+        _states.clear();
+    }
+
+private:
+    QMutex _mutex;
+    QVector<lua_State*> _states;
+};
+
+static LuaStatePool& statePool()
+{
+    static LuaStatePool pool;
+    return pool;
+}
+
+//------------------------------------------------------------------------------
+//                               Globals export
+//------------------------------------------------------------------------------
+
+// Globals having more values are not worth copying into each state
+static const int MAX_EXPORTED_VALUES = 100000;
+
+struct ExportedField;
+
+struct ExportedValue
+{
+    int type = LUA_TNIL;
+    bool integer = false;
+    lua_Integer intValue = 0; // integer or boolean
+    lua_Number number = 0;
+    QByteArray bytes; // string or bytecode of Lua function
+    lua_CFunction cfunc = nullptr;
+    LuaArray array;
+    std::vector<ExportedField> fields; // table
+};
+
+struct ExportedField
+{
+    ExportedValue key;
+    ExportedValue value;
+};
+
+struct Lua::Globals
+{
+    std::vector<ExportedField> vars;
+};
+
+// Returns true when the table at idx has the same content as its copy at copyIdx
+static bool sameTable(lua_State *L, int idx, int copyIdx)
+{
+    idx = lua_absindex(L, idx);
+    copyIdx = lua_absindex(L, copyIdx);
+    qsizetype count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx))
+    {
+        lua_pushvalue(L, -2);
+        lua_rawget(L, copyIdx);
+        const bool same = lua_rawequal(L, -1, -2);
+        lua_pop(L, 2);
+        if (!same)
+        {
+            lua_pop(L, 1);
+            return false;
+        }
+        count++;
+    }
+    lua_pushnil(L);
+    while (lua_next(L, copyIdx))
+    {
+        lua_pop(L, 1);
+        count--;
+    }
+    return count == 0;
+}
+
+// Returns true when code has changed content or metatables of library tables or types,
+// they are not copied to other states. Globals themselves are not checked here.
+static bool librariesChanged(lua_State *L)
+{
+    const int top = lua_gettop(L);
+    bool changed = lua_rawgetp(L, LUA_REGISTRYINDEX, &__tablesSnapshotKey) != LUA_TTABLE;
+    if (!changed)
+    {
+        lua_pushglobaltable(L);
+        lua_pushnil(L);
+        while (!changed && lua_next(L, top + 1)) // snapshot, G, table, { copy, metatable }
+        {
+            if (!lua_rawequal(L, -2, top + 2))
+            {
+                lua_rawgeti(L, -1, 1);
+                changed = !sameTable(L, -3, -1);
+                lua_rawgeti(L, -2, 2);
+                if (!lua_getmetatable(L, -4))
+                    lua_pushnil(L);
+                changed = changed || !lua_rawequal(L, -1, -2);
+                lua_pop(L, 3);
+            }
+            lua_pop(L, 1);
+        }
+    }
+    if (!changed)
+    {
+        lua_settop(L, top);
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &__typeMetatablesKey);
+        const int count = pushTypeSamples(L);
+        for (int i = 1; i <= count && !changed; i++)
+        {
+            lua_rawgeti(L, top + 1, i);
+            if (!lua_getmetatable(L, top + 1 + i))
+                lua_pushnil(L);
+            changed = !lua_rawequal(L, -1, -2);
+            lua_pop(L, 2);
+        }
+    }
+    lua_settop(L, top);
+    return changed;
+}
+
+static int dumpWriter(lua_State*, const void *p, size_t size, void *ud)
+{
+    static_cast<QByteArray*>(ud)->append(static_cast<const char*>(p), static_cast<int>(size));
+    return 0;
+}
+
+class GlobalsExporter
+{
+public:
+    explicit GlobalsExporter(lua_State *L) : L(L) {}
+
+    bool exportValue(int idx, ExportedValue &v)
+    {
+        if (++_count > MAX_EXPORTED_VALUES)
+            return false;
+        idx = lua_absindex(L, idx);
+        v.type = lua_type(L, idx);
+        switch (v.type)
+        {
+        case LUA_TNIL:
+            return true;
+        case LUA_TBOOLEAN:
+            v.intValue = lua_toboolean(L, idx);
+            return true;
+        case LUA_TNUMBER:
+            v.integer = lua_isinteger(L, idx);
+            if (v.integer)
+                v.intValue = lua_tointeger(L, idx);
+            else
+                v.number = lua_tonumber(L, idx);
+            return true;
+        case LUA_TSTRING:
+        {
+            size_t len;
+            auto str = lua_tolstring(L, idx, &len);
+            v.bytes = QByteArray(str, static_cast<int>(len));
+            return true;
+        }
+        case LUA_TUSERDATA:
+            if (auto a = toArray(L, idx); a)
+            {
+                v.array = *a;
+                return true;
+            }
+            return false;
+        case LUA_TFUNCTION:
+            return exportFunction(idx, v);
+        case LUA_TTABLE:
+            return exportTable(idx, v);
+        }
+        return false;
+    }
+
+private:
+    lua_State *L;
+    QSet<const void*> _tables;
+    int _count = 0;
+
+    bool exportFunction(int idx, ExportedValue &v)
+    {
+        if (lua_iscfunction(L, idx))
+        {
+            // Plain C functions, e.g. library ones, work in any state
+            v.cfunc = lua_tocfunction(L, idx);
+            if (!lua_getupvalue(L, idx, 1))
+                return true;
+            lua_pop(L, 1);
+            return false;
+        }
+        // A copy of function can only refer to globals, it can't have other upvalues
+        for (int n = 1; ; n++)
+        {
+            auto name = lua_getupvalue(L, idx, n);
+            if (!name)
+                break;
+            lua_pushglobaltable(L);
+            const bool env = n == 1 && strcmp(name, "_ENV") == 0 && lua_rawequal(L, -1, -2);
+            lua_pop(L, 2);
+            if (!env)
+                return false;
+        }
+        lua_pushvalue(L, idx);
+        const int res = lua_dump(L, dumpWriter, &v.bytes, 0);
+        lua_pop(L, 1);
+        return res == 0;
+    }
+
+    bool exportTable(int idx, ExportedValue &v)
+    {
+        // Shared tables can't be copied as separate ones
+        const void *ptr = lua_topointer(L, idx);
+        if (_tables.contains(ptr))
+            return false;
+        _tables.insert(ptr);
+        if (lua_getmetatable(L, idx))
+        {
+            lua_pop(L, 1);
+            return false;
+        }
+        luaL_checkstack(L, 4, "exportTable");
+        lua_pushnil(L);
+        while (lua_next(L, idx))
+        {
+            ExportedField f;
+            if (!exportValue(-2, f.key) || !exportValue(-1, f.value))
+            {
+                lua_pop(L, 2);
+                return false;
+            }
+            v.fields.push_back(std::move(f));
+            lua_pop(L, 1);
+        }
+        return true;
+    }
+};
+
+static void importValue(lua_State *L, const ExportedValue &v)
+{
+    luaL_checkstack(L, 4, "importValue");
+    switch (v.type)
+    {
+    case LUA_TBOOLEAN:
+        lua_pushboolean(L, static_cast<int>(v.intValue));
+        break;
+    case LUA_TNUMBER:
+        if (v.integer)
+            lua_pushinteger(L, v.intValue);
+        else
+            lua_pushnumber(L, v.number);
+        break;
+    case LUA_TSTRING:
+        lua_pushlstring(L, v.bytes.constData(), static_cast<size_t>(v.bytes.size()));
+        break;
+    case LUA_TUSERDATA:
+    {
+        auto a = newArray(L, 0);
+        *a = v.array;
+        trackArray(L, a, 0);
+        break;
+    }
+    case LUA_TFUNCTION:
+        if (v.cfunc)
+            lua_pushcfunction(L, v.cfunc);
+        // Bytecode is made by exportFunction() of the same build, so it's safe to load
+        else if (luaL_loadbufferx(L, v.bytes.constData(), static_cast<size_t>(v.bytes.size()), FORMULA_ID, "b") != LUA_OK)
+            lua_error(L);
+        break;
+    case LUA_TTABLE:
+        lua_createtable(L, 0, static_cast<int>(v.fields.size()));
+        for (const auto &f : v.fields)
+        {
+            importValue(L, f.key);
+            importValue(L, f.value);
+            lua_rawset(L, -3);
+        }
+        break;
+    default:
+        lua_pushnil(L);
+    }
+}
+
+// Sets globals given as light user data, it's called in protected mode
+static int setImportedGlobals(lua_State *L)
+{
+    auto globals = static_cast<const Lua::Globals*>(lua_touserdata(L, 1));
+    lua_pushglobaltable(L);
+    for (const auto &var : globals->vars)
+    {
+        importValue(L, var.key);
+        importValue(L, var.value);
+        lua_rawset(L, -3);
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//                                    Lua
+//------------------------------------------------------------------------------
+
+Lua::Lua(bool pooled) : _pooled(pooled)
 {
 }
 
 Lua::~Lua()
 {
-    if (_lua)
-        lua_close(_lua);
+    close();
+}
+
+void Lua::close()
+{
+    if (!_lua) return;
+
+    if (_pooled)
+        statePool().release(_lua);
+    else
+        closeState(_lua);
+    _lua = nullptr;
+}
+
+void Lua::clearPool()
+{
+    statePool().clear();
+}
+
+const QStringList& Lua::globalNames()
+{
+    static const QStringList names = []{
+        QStringList res;
+        lua_State *L = newState();
+        if (!L) return res;
+        lua_pushglobaltable(L);
+        lua_pushnil(L);
+        while (lua_next(L, -2))
+        {
+            lua_pop(L, 1);
+            if (lua_type(L, -1) == LUA_TSTRING)
+                res << QString::fromLatin1(lua_tostring(L, -1));
+        }
+        closeState(L);
+        return res;
+    }();
+    return names;
 }
 
 void Lua::registerGlobalFuncs(lua_State* lua)
@@ -126,21 +1305,17 @@ void Lua::registerGlobalFuncs(lua_State* lua)
     LUA_REGISTER_GLOBAL_FUN(lua, rad2deg)
 
     LUA_REGISTER_GLOBAL_FUN(lua, pi)
+
+    registerArrayType(lua);
 }
 
 QString Lua::open()
 {
-    if (_lua) lua_close(_lua);
+    close();
 
-    _lua = luaL_newstate();
+    _lua = _pooled ? statePool().acquire() : newState();
     if (!_lua)
         return qApp->translate("Formula", "Not enough memory to initialize formula parser");
-
-    luaL_openlibs(_lua);
-    registerGlobalFuncs(_lua);
-    setGlobalVar("inf", qInf());
-    setGlobalVar("Inf", qInf());
-    setGlobalVar("INF", qInf());
     return QString();
 }
 
@@ -148,16 +1323,22 @@ Ori::Result<double> Lua::calculate(const QString& formula)
 {
     Q_ASSERT(_lua);
 
-    static QRegularExpression resultVar(RESULT_VAR "\\s*=");
-    QString code = formula;
-    int pos = code.indexOf(resultVar);
-    if (pos < 0) code = (RESULT_VAR "=") + code;
-
-    QString error = setCode(code);
-    if (!error.isEmpty())
-        return Ori::Result<double>::fail(error);
+    // Formulas are cached separately from ordinary code
+    // because the code actually loaded can differ from the formula
+    QByteArray key = CHUNK_KEY_FORMULA + formula.toLatin1();
+    if (!pushCachedChunk(key))
+    {
+        static QRegularExpression resultVar(RESULT_VAR "\\s*=");
+        QString code = formula;
+        int pos = code.indexOf(resultVar);
+        if (pos < 0) code = (RESULT_VAR "=") + code;
+
+        QString error = loadChunk(key, code.toLatin1());
+        if (!error.isEmpty())
+            return Ori::Result<double>::fail(error);
+    }
 
-    error = execute();
+    QString error = execute();
     if (!error.isEmpty())
         return Ori::Result<double>::fail(error);
 
@@ -169,9 +1350,63 @@ QString Lua::setCode(const QString& code)
     Q_ASSERT(_lua);
 
     auto codeBytes = code.toLatin1();
-    int res = luaL_loadbufferx(_lua, codeBytes.data(), static_cast<size_t>(codeBytes.size()), FORMULA_ID, "t");
+    QByteArray key = CHUNK_KEY_CODE + codeBytes;
+    if (pushCachedChunk(key))
+        return QString();
+    return loadChunk(key, codeBytes);
+}
+
+bool Lua::pushCachedChunk(const QByteArray& key)
+{
+    if (lua_rawgetp(_lua, LUA_REGISTRYINDEX, &__chunkCacheKey) != LUA_TTABLE)
+    {
+        lua_pop(_lua, 1);
+        return false;
+    }
+    lua_pushlstring(_lua, key.data(), static_cast<size_t>(key.size()));
+    if (lua_rawget(_lua, -2) != LUA_TFUNCTION)
+    {
+        lua_pop(_lua, 2);
+        return false;
+    }
+    lua_remove(_lua, -2); // leave only the chunk on the stack
+    return true;
+}
+
+QString Lua::loadChunk(const QByteArray& key, const QByteArray& code)
+{
+    int res = luaL_loadbufferx(_lua, code.data(), static_cast<size_t>(code.size()), FORMULA_ID, "t");
     if (res != LUA_OK)
         return getLuaError(res);
+
+    // The cache is a table in the registry, it survives reuse of pooled states.
+    // Its integer slot 1 holds the number of cached chunks, other keys are code strings
+    // prefixed with a kind byte, see CHUNK_KEY_CODE and CHUNK_KEY_FORMULA.
+    if (lua_rawgetp(_lua, LUA_REGISTRYINDEX, &__chunkCacheKey) != LUA_TTABLE)
+    {
+        lua_pop(_lua, 1);
+        lua_newtable(_lua);
+        lua_pushvalue(_lua, -1);
+        lua_rawsetp(_lua, LUA_REGISTRYINDEX, &__chunkCacheKey);
+    }
+    lua_rawgeti(_lua, -1, 1);
+    auto count = lua_tointeger(_lua, -1);
+    lua_pop(_lua, 1);
+    if (count >= CHUNK_CACHE_SIZE)
+    {
+        // Rarely happens, so just start over
+        lua_pop(_lua, 1);
+        lua_newtable(_lua);
+        lua_pushvalue(_lua, -1);
+        lua_rawsetp(_lua, LUA_REGISTRYINDEX, &__chunkCacheKey);
+        count = 0;
+    }
+    lua_pushinteger(_lua, count + 1);
+    lua_rawseti(_lua, -2, 1);
+    lua_pushlstring(_lua, key.data(), static_cast<size_t>(key.size()));
+    lua_pushvalue(_lua, -3);
+    lua_rawset(_lua, -3);
+    lua_pop(_lua, 1); // leave only the chunk on the stack
     return QString();
 }
 
@@ -179,12 +1414,139 @@ QString Lua::execute()
 {
     Q_ASSERT(_lua);
 
+    beginLimited();
     int res = lua_pcall(_lua, 0, 0, 0);
-    if (res != LUA_OK)
-        return getLuaError(res);
+    endLimited();
+
+    if (res != LUA_OK || !_stopReason.isEmpty())
+        return callError(res);
     return QString();
 }
 
+bool Lua::isGlobalFunction(const char* name)
+{
+    Q_ASSERT(_lua);
+
+    bool res = lua_getglobal(_lua, name) == LUA_TFUNCTION;
+    lua_pop(_lua, 1);
+    return res;
+}
+
+QString Lua::callGlobalFunction(const char* name, const double* args, double* results, qsizetype count)
+{
+    Q_ASSERT(_lua);
+
+    if (lua_getglobal(_lua, name) != LUA_TFUNCTION)
+    {
+        lua_pop(_lua, 1);
+        return qApp->translate("Formula", "'%1' is not a function").arg(name);
+    }
+
+    QString err;
+    beginLimited();
+    for (qsizetype i = 0; i < count; i++)
+    {
+        lua_pushvalue(_lua, -1);
+        lua_pushnumber(_lua, args[i]);
+        int res = lua_pcall(_lua, 1, 1, 0);
+        if (res != LUA_OK)
+        {
+            err = callError(res);
+            break;
+        }
+        int isNum;
+        results[i] = lua_tonumberx(_lua, -1, &isNum);
+        lua_pop(_lua, 1);
+        if (!_stopReason.isEmpty())
+        {
+            err = _stopReason;
+            break;
+        }
+        if (!isNum)
+        {
+            err = qApp->translate("Formula", "Function '%1' returned not a number for argument %2").arg(name).arg(args[i]);
+            break;
+        }
+    }
+    endLimited();
+    lua_pop(_lua, 1); // the function
+    return err;
+}
+
+void Lua::beginLimited()
+{
+    _stopReason.clear();
+    if (_limits.instructions > 0 || _limits.timeMs > 0 || _limits.cancel)
+    {
+        *static_cast<Lua**>(lua_getextraspace(_lua)) = this;
+        _instructions = 0;
+        _timer.start();
+        lua_sethook(_lua, countHook, LUA_MASKCOUNT, HOOK_INTERVAL);
+    }
+    auto mem = stateMemory(_lua);
+    mem->limit = static_cast<size_t>(_limits.memoryMb) * 1024 * 1024;
+    mem->peak = mem->used;
+    mem->exceeded = false;
+    if (_limits.job && mem->limit > 0)
+        mem->attachJob(&_limits.job->memory);
+}
+
+void Lua::endLimited()
+{
+    auto mem = stateMemory(_lua);
+    mem->detachJob();
+    mem->limit = 0;
+    if (_limits.stats)
+        _limits.stats->addPeakMemory(static_cast<qint64>(mem->peak));
+    lua_sethook(_lua, nullptr, 0, 0);
+}
+
+QString Lua::callError(int errCode)
+{
+    // User code can catch the interruption error with pcall and return normally
+    if (!_stopReason.isEmpty())
+    {
+        if (errCode != LUA_OK)
+            lua_pop(_lua, 1);
+        return _stopReason;
+    }
+    if ((errCode == LUA_ERRMEM || stateMemory(_lua)->exceeded) && _limits.memoryMb > 0)
+    {
+        lua_pop(_lua, 1);
+        return qApp->translate("Formula", "Formula exceeds the memory limit of %1 MB").arg(_limits.memoryMb);
+    }
+    return getLuaError(errCode);
+}
+
+void Lua::countHook(lua_State *L, lua_Debug*)
+{
+    auto lua = *static_cast<Lua**>(lua_getextraspace(L));
+    // User code can catch the interruption error with pcall and go on,
+    // so once stopped it's interrupted again at each next instruction
+    if (!lua->_stopReason.isEmpty())
+    {
+        lua_pushstring(L, "interrupted");
+        lua_error(L);
+    }
+    const auto &limits = lua->_limits;
+    const qint64 instructions = limits.job
+        ? (limits.job->instructions += HOOK_INTERVAL)
+        : (lua->_instructions += HOOK_INTERVAL);
+    const auto &timer = limits.job ? limits.job->timer : lua->_timer;
+    if (limits.cancel && *limits.cancel)
+        lua->_stopReason = qApp->translate("Formula", "Calculation has been cancelled");
+    else if (limits.instructions > 0 && instructions > limits.instructions)
+        lua->_stopReason = qApp->translate("Formula", "Formula exceeds the limit of %1 instructions").arg(limits.instructions);
+    else if (limits.timeMs > 0 && timer.elapsed() > limits.timeMs)
+        lua->_stopReason = qApp->translate("Formula", "Formula exceeds the time limit of %1 s").arg(limits.timeMs / 1000.0);
+    if (!lua->_stopReason.isEmpty())
+    {
+        lua_sethook(L, countHook, LUA_MASKCOUNT, 1);
+        lua_pushstring(L, "interrupted");
+        lua_error(L);
+    }
+}
+
 QString Lua::getLuaError(int errCode) const
 {
     Q_ASSERT(_lua);
@@ -223,6 +1585,85 @@ QString Lua::refineLuaError(const QString& err) const
     return err;
 }
 
+std::shared_ptr<const Lua::Globals> Lua::exportGlobals(const QStringList& except)
+{
+    Q_ASSERT(_lua);
+
+    // Only pooled states have the snapshot of initial globals to compare with
+    if (!_pooled || librariesChanged(_lua))
+        return {};
+
+    QSet<QByteArray> skip;
+    for (const auto &name : except)
+        skip << name.toLatin1();
+
+    auto globals = std::make_shared<Globals>();
+    GlobalsExporter exporter(_lua);
+    const int top = lua_gettop(_lua);
+    lua_rawgetp(_lua, LUA_REGISTRYINDEX, &__tablesSnapshotKey);
+    lua_pushglobaltable(_lua);
+    lua_pushvalue(_lua, -1);
+    lua_rawget(_lua, top + 1);
+    lua_rawgeti(_lua, -1, 1);
+    lua_replace(_lua, -2); // snapshot, G, initial G
+    const int g = top + 2, initial = top + 3;
+    bool ok = true;
+
+    // Variables set or changed by the code
+    lua_pushnil(_lua);
+    while (ok && lua_next(_lua, g))
+    {
+        lua_pushvalue(_lua, -2);
+        lua_rawget(_lua, initial);
+        const bool same = lua_rawequal(_lua, -1, -2);
+        lua_pop(_lua, 1);
+        const bool skipped = lua_type(_lua, -2) == LUA_TSTRING && skip.contains(lua_tostring(_lua, -2));
+        if (!same && !skipped)
+        {
+            ExportedField var;
+            ok = exporter.exportValue(-2, var.key) && exporter.exportValue(-1, var.value);
+            globals->vars.push_back(std::move(var));
+        }
+        lua_pop(_lua, 1);
+    }
+
+    // Variables removed by the code
+    if (ok)
+    {
+        lua_pushnil(_lua);
+        while (lua_next(_lua, initial))
+        {
+            lua_pop(_lua, 1);
+            lua_pushvalue(_lua, -1);
+            if (lua_rawget(_lua, g) == LUA_TNIL)
+            {
+                ExportedField var;
+                exporter.exportValue(-2, var.key);
+                globals->vars.push_back(std::move(var));
+            }
+            lua_pop(_lua, 1);
+        }
+    }
+    lua_settop(_lua, top);
+    if (!ok)
+        return {};
+    return globals;
+}
+
+QString Lua::importGlobals(const Globals& globals)
+{
+    Q_ASSERT(_lua);
+
+    lua_pushcfunction(_lua, setImportedGlobals);
+    lua_pushlightuserdata(_lua, const_cast<Globals*>(&globals));
+    beginLimited();
+    int res = lua_pcall(_lua, 1, 0, 0);
+    endLimited();
+    if (res != LUA_OK)
+        return callError(res);
+    return QString();
+}
+
 Ori::Result<double> Lua::getGlobalVar(const char* name)
 {
     Q_ASSERT(_lua);
@@ -270,7 +1711,19 @@ Ori::Result<QVector<double>> Lua::getGlobalArray(const char* name)
     Q_ASSERT(_lua);
 
     int valueType = lua_getglobal(_lua, name);
-    
+
+    // Native arrays share their buffer with the result, no copying
+    if (valueType == LUA_TUSERDATA)
+    {
+        auto a = toArray(_lua, -1);
+        if (a)
+        {
+            QVector<double> result = *a;
+            lua_pop(_lua, 1);
+            return Ori::Result<QVector<double>>::ok(result);
+        }
+    }
+
     // Check if the value is a table
     if (valueType != LUA_TTABLE)
     {
@@ -293,24 +1746,24 @@ Ori::Result<QVector<double>> Lua::getGlobalArray(const char* name)
     lua_Integer arrayLen = lua_tointeger(_lua, -1);
     lua_pop(_lua, 1); // Pop the length, keep the table
 
-    QVector<double> result;
-    result.reserve(static_cast<int>(arrayLen));
+    QVector<double> result(static_cast<int>(arrayLen));
+    double *d = result.data();
 
     // Iterate through the array (Lua arrays are 1-indexed)
     for (lua_Integer i = 1; i <= arrayLen; ++i)
     {
         lua_rawgeti(_lua, -1, i); // Push array[i] onto stack
-        
-        if (!lua_isnumber(_lua, -1))
+
+        int isNum;
+        d[i-1] = lua_tonumberx(_lua, -1, &isNum);
+        if (!isNum)
         {
             lua_pop(_lua, 2); // Pop current element and table
             return Ori::Result<QVector<double>>::fail(
                 qApp->translate("Formula", "Array '%1' contains non-numeric value at index %2")
                     .arg(name).arg(i));
         }
-        
-        double value = lua_tonumber(_lua, -1);
-        result.append(value);
+
         lua_pop(_lua, 1); // Pop the current element
     }
 
@@ -318,6 +1771,17 @@ Ori::Result<QVector<double>> Lua::getGlobalArray(const char* name)
     return Ori::Result<QVector<double>>::ok(result);
 }
 
+void Lua::setGlobalArray(const QString& name, const QVector<double>& values)
+{
+    Q_ASSERT(_lua);
+
+    auto nameBytes = name.toLatin1();
+    auto a = newArray(_lua, 0);
+    *a = values;
+    trackArray(_lua, a, 0);
+    lua_setglobal(_lua, nameBytes.data());
+}
+
 void Lua::setGlobalVar(const QString& name, double value)
 {
     if (!_lua) return;
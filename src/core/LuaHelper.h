@@ -5,30 +5,117 @@
 
 #include "core/OriResult.h"
 
+#include <QElapsedTimer>
+#include <QStringList>
+
+#include <atomic>
+#include <memory>
+
 struct lua_State;
+struct lua_Debug;
 
 namespace Z {
 
 class Lua {
 public:
-    Lua();
+    /// Resources used by code, collected over all states executing the same formula.
+    struct Stats
+    {
+        /// Max memory taken by a state during execution, in bytes
+        std::atomic<qint64> peakMemory{0};
+        /// Code has been calculated natively without Lua
+        std::atomic<bool> native{false};
+
+        void addPeakMemory(qint64 bytes)
+        {
+            qint64 peak = peakMemory;
+            while (bytes > peak && !peakMemory.compare_exchange_weak(peak, bytes));
+        }
+    };
+
+    /// Shared by states executing parts of the same job, e.g. chunks of points calculated concurrently.
+    /// Limits having a job are applied to all the states together rather than to each of them.
+    struct Job
+    {
+        Job() { timer.start(); }
+
+        std::atomic<qint64> instructions{0};
+        std::atomic<qint64> memory{0};
+        QElapsedTimer timer;
+    };
+
+    /// Restrictions applied to code being executed, zero values mean unlimited.
+    struct Limits
+    {
+        qint64 instructions = 0;
+        qint64 timeMs = 0;
+        qint64 memoryMb = 0;
+        /// Execution stops when the flag is raised from another thread
+        const std::atomic<bool> *cancel = nullptr;
+        /// Receives resources used by execution, optional
+        Stats *stats = nullptr;
+        /// Counts resources of the whole job, optional
+        Job *job = nullptr;
+    };
+
+    /// Globals made by executed code in a form that can be put into other states, see exportGlobals().
+    struct Globals;
+
+    /// Pooled instance takes an initialized state from a shared pool on open
+    /// and returns it back on destruction instead of closing.
+    /// Globals of a pooled state are reset to their initial values before reuse.
+    explicit Lua(bool pooled = false);
     ~Lua();
 
     QString open();
     Ori::Result<double> calculate(const QString& code);
     QString setCode(const QString& code);
     QString execute();
+    bool isGlobalFunction(const char* name);
+    /// Calls a global function of one argument for each of given values.
+    /// Limits are applied to all the calls together.
+    QString callGlobalFunction(const char* name, const double* args, double* results, qsizetype count);
+    /// Copies globals set or changed by executed code, so they can be put into other states
+    /// even in other threads without running the code again. Returns null when the code has made
+    /// something that can't be copied: tables shared between variables or having metatables,
+    /// functions using local variables of the code, too many values, or changed library tables.
+    std::shared_ptr<const Globals> exportGlobals(const QStringList& except = {});
+    QString importGlobals(const Globals& globals);
     Ori::Result<double> getGlobalVar(const char* name);
     QMap<QString, double> getGlobalVars();
+    /// Returns values of a global native array (see `array` function) or a table of numbers.
     Ori::Result<QVector<double>> getGlobalArray(const char* name);
+    /// Puts values into a global native array, the data is shared, not copied.
+    void setGlobalArray(const QString& name, const QVector<double>& values);
+    void setLimits(const Limits& limits) { _limits = limits; }
     void setGlobalVar(const QString& name, double value);
     void setGlobalVars(const QMap<QString, double>& vars);
     void removeGlobalVar(const QString& name);
 
     static void registerGlobalFuncs(lua_State* lua);
 
+    /// Names of global variables, functions and libraries predefined in formulas.
+    static const QStringList& globalNames();
+
+    /// Closes all idle states kept in the pool.
+    static void clearPool();
+
 private:
     lua_State* _lua = nullptr;
+    bool _pooled;
+    Limits _limits;
+    qint64 _instructions = 0;
+    QElapsedTimer _timer;
+    QString _stopReason;
+
+    void close();
+    void beginLimited();
+    void endLimited();
+    QString callError(int errCode);
+    bool pushCachedChunk(const QByteArray& key);
+    QString loadChunk(const QByteArray& key, const QByteArray& code);
+
+    static void countHook(lua_State* lua, lua_Debug* ar);
 
     QString getLuaError(int errCode) const;
     QString refineLuaError(const QString& err) const;
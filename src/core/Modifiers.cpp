@@ -1,8 +1,14 @@
 #include "Modifiers.h"
 
 #include "CustomPrefs.h"
+#include "app/BackgroundTask.h"
 #include "app/HelpSystem.h"
+#include "core/DataSources.h"
 #include "core/GraphMath.h"
+#include "core/Interpolator.h"
+#include "core/NativeFormula.h"
+#include "core/Project.h"
+#include "widgets/CodeEditor.h"
 
 #include "helpers/OriDialogs.h"
 #include "helpers/OriLayouts.h"
@@ -10,12 +16,21 @@
 #include "widgets/OriValueEdit.h"
 
 #include <QApplication>
+#include <QCheckBox>
+#include <QComboBox>
 #include <QFormLayout>
 #include <QGroupBox>
 #include <QLabel>
+#include <QLineEdit>
+#include <QMutex>
 #include <QRadioButton>
+#include <QRandomGenerator>
+#include <QRegularExpression>
 #include <QSpinBox>
 
+#include <limits>
+#include <optional>
+
 using namespace Ori::Layouts;
 using namespace Ori::Gui;
 using namespace GraphMath;
@@ -37,6 +52,8 @@ Modifier* makeModifier(const QString &type)
         return new InvertModifier;
     if (type == DecimateModifier::_type_())
         return new DecimateModifier;
+    if (type == ResampleModifier::_type_())
+        return new ResampleModifier;
     if (type == AverageModifier::_type_())
         return new AverageModifier;
     if (type == MavgSimpleModifier::_type_())
@@ -49,8 +66,20 @@ Modifier* makeModifier(const QString &type)
         return new FitLimitsModifier;
     if (type == DespikeModifier::_type_())
         return new DespikeModifier;
+    if (type == MedianModifier::_type_())
+        return new MedianModifier;
     if (type == DerivativeModifier::_type_())
         return new DerivativeModifier;
+    if (type == SavGolModifier::_type_())
+        return new SavGolModifier;
+    if (type == SpectrumModifier::_type_())
+        return new SpectrumModifier;
+    if (type == ConvolveModifier::_type_())
+        return new ConvolveModifier;
+    if (type == FormulaModifier::_type_())
+        return new FormulaModifier;
+    if (type == ArithmeticModifier::_type_())
+        return new ArithmeticModifier;
     return nullptr;
 }
 
@@ -177,12 +206,12 @@ public:
 class IntervalOption : public QGroupBox
 {
 public:
-    IntervalOption(const QString &title) : QGroupBox(title)
+    IntervalOption(const QString &title, const QString &stepTitle = tr("Length")) : QGroupBox(title)
     {
         auto layout = new QGridLayout;
         setLayout(layout);
         _usePoints = new QRadioButton(tr("Points"));
-        _useStep = new QRadioButton(tr("Length"));
+        _useStep = new QRadioButton(stepTitle);
         _points = new QSpinBox;
         _points->setRange(1, std::numeric_limits<int>::max());
         _step = makeEditor();
@@ -241,16 +270,20 @@ struct State
 //                               Config dialog
 //------------------------------------------------------------------------------
 
-bool dlg(const QString &title, std::initializer_list<LayoutItem> items, const QString &helpTopic, std::function<void()> apply)
+bool dlg(const QString &title, std::initializer_list<LayoutItem> items, const QString &helpTopic, std::function<void()> apply,
+    std::function<QString()> verify = {})
 {
     Q_UNUSED(helpTopic)
     auto editor = LayoutV(items).setMargin(0).makeWidgetAuto();
+    if (!verify)
+        verify = []{ return QString(); };
     auto ok = Ori::Dlg::Dialog(editor)
         .windowModal()
         .withTitle(title)
         .withOnHelp([helpTopic]{ Z::HelpSystem::topic(helpTopic); })
         .withHelpIcon(":/toolbar/help")
         .withContentToButtonsSpacingFactor(2)
+        .withVerification(verify)
         .exec();
     if (ok)
         apply();
@@ -420,20 +453,60 @@ bool InvertModifier::configure()
 
 bool DecimateModifier::configure()
 {
+    auto mode = new RadioOptions<Decimate::Mode>(qApp->tr("Mode"),
+        {{ Decimate::MODE_NTH, qApp->tr("Every Nth point") },
+         { Decimate::MODE_MINMAX, qApp->tr("Min/max of each interval") },
+         { Decimate::MODE_M4, qApp->tr("First, min, max, last of each interval (M4)") },
+         { Decimate::MODE_LTTB, qApp->tr("Largest triangle of each interval (LTTB)") }});
     auto intv = new IntervalOption(qApp->tr("Interval"));
 
     State state("decimate");
+    mode->setSelection(state["mode"]);
     intv->setPoints(state["points"], 2);
     intv->setStep(state["step"], 1);
     intv->setUseStep(state["useStep"]);
 
-    return dlg(qApp->tr("Decimate"), {intv}, "decimate", [&]{
+    return dlg(qApp->tr("Decimate"), {mode, intv}, "decimate", [&]{
+        state["mode"] = _params.mode = mode->selection();
         state["points"] = _params.points = intv->points();
         state["step"] = _params.step = intv->step();
         state["useStep"] = _params.useStep = intv->useStep();
     });
 }
 
+//------------------------------------------------------------------------------
+//                              ResampleModifier
+//------------------------------------------------------------------------------
+
+bool ResampleModifier::configure()
+{
+    auto method = new RadioOptions<Resample::Method>(qApp->tr("Interpolation"),
+        {{ Resample::METHOD_LINEAR, qApp->tr("Linear") },
+         { Resample::METHOD_SPLINE, qApp->tr("Cubic spline") },
+         { Resample::METHOD_AKIMA, qApp->tr("Akima spline") },
+         { Resample::METHOD_NEAREST, qApp->tr("Nearest point") }});
+    auto intv = new IntervalOption(qApp->tr("Result Points"), qApp->tr("Step"));
+
+    State state("resample");
+    method->setSelection(state["method"]);
+    intv->setPoints(state["points"], 1000);
+    intv->setStep(state["step"], 1);
+    intv->setUseStep(state["useStep"]);
+
+    return dlg(qApp->tr("Resample"), {method, intv}, "resample", [&]{
+        state["method"] = _params.method = method->selection();
+        state["points"] = _params.points = intv->points();
+        state["step"] = _params.step = intv->step();
+        state["useStep"] = _params.useStep = intv->useStep();
+    }, [&]{
+        if (intv->useStep() && !(intv->step() > 0))
+            return qApp->tr("Step must be positive");
+        if (!intv->useStep() && intv->points() < 2)
+            return qApp->tr("At least two points are required");
+        return QString();
+    });
+}
+
 //------------------------------------------------------------------------------
 //                              AverageModifier
 //------------------------------------------------------------------------------
@@ -468,16 +541,19 @@ bool AverageModifier::configure()
 bool MavgSimpleModifier::configure()
 {
     auto intv = new IntervalOption(qApp->tr("Averaging Window"));
+    auto compensated = new QCheckBox(qApp->tr("Compensated summation"));
 
     State state("mavg_simple");
     intv->setPoints(state["points"], 5);
     intv->setStep(state["step"], 10);
     intv->setUseStep(state["useStep"]);
+    compensated->setChecked(state["compensated"].toBool());
 
-    return dlg(qApp->tr("Simple Moving Average"), {intv}, "mavg_simple", [&]{
+    return dlg(qApp->tr("Simple Moving Average"), {intv, compensated}, "mavg_simple", [&]{
         state["points"] = _params.points = intv->points();
         state["step"] = _params.step = intv->step();
         state["useStep"] = _params.useStep = intv->useStep();
+        state["compensated"] = _params.compensated = compensated->isChecked();
     });
 }
 
@@ -575,6 +651,27 @@ bool DespikeModifier::configure()
         state["mode"] = _params.mode = modeRel->isChecked() ? _params.MODE_REL : _params.MODE_ABS;
         state["max"] = _params.max = max->value();
         state["min"] = _params.min = min->value();
+        _params.seed = QRandomGenerator::global()->generate();
+    });
+}
+
+//------------------------------------------------------------------------------
+//                               MedianModifier
+//------------------------------------------------------------------------------
+
+bool MedianModifier::configure()
+{
+    auto intv = new IntervalOption(qApp->tr("Window"));
+
+    State state("median");
+    intv->setPoints(state["points"], 5);
+    intv->setStep(state["step"], 10);
+    intv->setUseStep(state["useStep"]);
+
+    return dlg(qApp->tr("Median Filter"), {intv}, "median", [&]{
+        state["points"] = _params.points = intv->points();
+        state["step"] = _params.step = intv->step();
+        state["useStep"] = _params.useStep = intv->useStep();
     });
 }
 
@@ -600,3 +697,365 @@ bool DerivativeModifier::configure()
         state["tau"] = _params.tau = mode->editor()->value();
     });
 }
+
+//------------------------------------------------------------------------------
+//                               SavGolModifier
+//------------------------------------------------------------------------------
+
+bool SavGolModifier::configure()
+{
+    auto deriv = new RadioOptions<int>(qApp->tr("Result"),
+        {{ 0, qApp->tr("Smoothed graph") },
+         { 1, qApp->tr("First derivative") },
+         { 2, qApp->tr("Second derivative") },
+         { 3, qApp->tr("Third derivative") }});
+    auto points = new QSpinBox;
+    points->setRange(1, std::numeric_limits<int>::max());
+    points->setSingleStep(2);
+    auto order = new QSpinBox;
+    order->setRange(0, SavGol::MAX_ORDER);
+    auto fit = new QGroupBox(qApp->tr("Fitting"));
+    auto layout = new QFormLayout(fit);
+    layout->addRow(qApp->tr("Window (points)"), points);
+    layout->addRow(qApp->tr("Polynomial order"), order);
+
+    State state("savgol");
+    deriv->setSelection(state["deriv"]);
+    points->setValue(state["points"].toInt(11));
+    order->setValue(state["order"].toInt(2));
+
+    return dlg(qApp->tr("Savitzky–Golay Filter"), {deriv, fit}, "savgol", [&]{
+        state["deriv"] = _params.deriv = deriv->selection();
+        state["points"] = _params.points = points->value();
+        state["order"] = _params.order = order->value();
+    }, [&]{
+        if (order->value() < deriv->selection())
+            return qApp->tr("Polynomial order can't be less than the order of derivative");
+        if (points->value() <= order->value())
+            return qApp->tr("Window must have more points than the polynomial order");
+        return QString();
+    });
+}
+
+//------------------------------------------------------------------------------
+//                              SpectrumModifier
+//------------------------------------------------------------------------------
+
+bool SpectrumModifier::configure()
+{
+    auto mode = new RadioOptions<Spectrum::Mode>(qApp->tr("Mode"),
+        {{ Spectrum::MODE_AMPLITUDE, qApp->tr("Amplitude") },
+         { Spectrum::MODE_POWER, qApp->tr("Power") }});
+    auto window = new RadioOptions<Spectrum::Window>(qApp->tr("Window"),
+        {{ Spectrum::WINDOW_NONE, qApp->tr("Rectangular (none)") },
+         { Spectrum::WINDOW_HANN, qApp->tr("Hann") },
+         { Spectrum::WINDOW_HAMMING, qApp->tr("Hamming") },
+         { Spectrum::WINDOW_BLACKMAN, qApp->tr("Blackman") }});
+    auto padding = new QSpinBox;
+    padding->setRange(0, 16);
+    padding->setSpecialValueText(qApp->tr("None"));
+    auto paddingGroup = LayoutV({padding}).makeGroupBox(qApp->tr("Zero-padding Factor"));
+
+    State state("spectrum");
+    mode->setSelection(state["mode"]);
+    window->setSelection(state["window"], Spectrum::WINDOW_HANN);
+    padding->setValue(state["padding"].toInt(0));
+
+    return dlg(qApp->tr("Spectrum"), {mode, window, paddingGroup}, "spectrum", [&]{
+        state["mode"] = _params.mode = mode->selection();
+        state["window"] = _params.window = window->selection();
+        state["padding"] = _params.padding = padding->value();
+    });
+}
+
+//------------------------------------------------------------------------------
+//                              ConvolveModifier
+//------------------------------------------------------------------------------
+
+bool ConvolveModifier::configure()
+{
+    auto operation = new RadioOptions<Convolve::Operation>(qApp->tr("Operation"),
+        {{ Convolve::OP_CONVOLUTION, qApp->tr("Convolution") },
+         { Convolve::OP_CORRELATION, qApp->tr("Cross-correlation") }});
+    auto kernel = new RadioOptions<Convolve::Kernel>(qApp->tr("Kernel"),
+        {{ Convolve::KERNEL_GAUSSIAN, qApp->tr("Gaussian") },
+         { Convolve::KERNEL_SAVGOL, qApp->tr("Savitzky–Golay (quadratic)") },
+         { Convolve::KERNEL_CUSTOM, qApp->tr("Custom values") }});
+    auto points = new QSpinBox;
+    points->setRange(1, std::numeric_limits<int>::max());
+    auto custom = new QLineEdit;
+    custom->setPlaceholderText(qApp->tr("e.g. 0.25 0.5 0.25"));
+    auto normalize = new QCheckBox(qApp->tr("Normalize to unit sum"));
+    auto sizeForm = new QFormLayout;
+    sizeForm->addRow(qApp->tr("Size of preset (points)"), points);
+    static_cast<QVBoxLayout*>(kernel->layout())->addLayout(sizeForm);
+    kernel->layout()->addWidget(custom);
+    kernel->layout()->addWidget(normalize);
+
+    State state("convolve");
+    operation->setSelection(state["operation"]);
+    kernel->setSelection(state["kernel"]);
+    points->setValue(state["points"].toInt(11));
+    custom->setText(state["customKernel"].toString());
+    normalize->setChecked(state["normalize"].toBool(true));
+    QObject::connect(points, qOverload<int>(&QSpinBox::valueChanged), kernel, [kernel]{
+        if (kernel->selection() == Convolve::KERNEL_CUSTOM)
+            kernel->button(Convolve::KERNEL_GAUSSIAN)->setChecked(true);
+    });
+    QObject::connect(custom, &QLineEdit::textEdited, kernel, [kernel]{
+        kernel->button(Convolve::KERNEL_CUSTOM)->setChecked(true);
+    });
+
+    Values customKernel;
+    auto parseCustom = [&]{
+        customKernel.clear();
+        for (const auto &s : custom->text().split(QRegularExpression("[\\s,;]+"), Qt::SkipEmptyParts)) {
+            bool ok;
+            double v = s.toDouble(&ok);
+            if (!ok)
+                return qApp->tr("Invalid kernel value: %1").arg(s);
+            customKernel << v;
+        }
+        if (customKernel.isEmpty())
+            return qApp->tr("Kernel values are not given");
+        return QString();
+    };
+
+    return dlg(qApp->tr("Convolution"), {operation, kernel}, "convolve", [&]{
+        state["operation"] = _params.operation = operation->selection();
+        state["kernel"] = _params.kernel = kernel->selection();
+        state["points"] = _params.points = points->value();
+        state["customKernel"] = custom->text();
+        state["normalize"] = _params.normalize = normalize->isChecked();
+        _params.customKernel = customKernel;
+    }, [&]{
+        return kernel->selection() == Convolve::KERNEL_CUSTOM ? parseCustom() : QString();
+    });
+}
+
+//------------------------------------------------------------------------------
+//                              FormulaModifier
+//------------------------------------------------------------------------------
+
+GraphResult FormulaModifier::modify(const GraphPoints &data) const
+{
+    auto limits = FormulaDataSource::limits();
+    std::optional<GraphResult> res;
+    BackgroundTask::run(qApp->tr("Calculating formula..."), [&](const std::atomic<bool> &cancel){
+        limits.cancel = &cancel;
+        res = exec(_code, data.explicitX(), limits);
+    });
+    return *res;
+}
+
+GraphResult FormulaModifier::exec(const QString &code, const GraphPoints &data, const Z::Lua::Limits &limits)
+{
+    // Elementwise processing is calculated much faster without Lua
+    Z::NativeFormula native;
+    if (native.compile(code, data.size()))
+    {
+        if (limits.stats)
+        {
+            limits.stats->native = true;
+            limits.stats->addPeakMemory(data.size() * 2 * qsizetype(sizeof(double)));
+        }
+        return native.calc(data, limits.cancel);
+    }
+
+    Z::Lua lua(true);
+    lua.setLimits(limits);
+    QString err = lua.open();
+    if (!err.isEmpty())
+        return GraphResult::fail(err);
+
+    // Arrays are shared with Lua, not copied element by element
+    lua.setGlobalArray("X", data.xs);
+    lua.setGlobalArray("Y", data.ys);
+
+    err = lua.setCode(code);
+    if (!err.isEmpty())
+        return GraphResult::fail(err);
+
+    err = lua.execute();
+    if (!err.isEmpty())
+        return GraphResult::fail(err);
+
+    auto resX = lua.getGlobalArray("X");
+    if (!resX.ok())
+        return GraphResult::fail(resX.error());
+
+    auto resY = lua.getGlobalArray("Y");
+    if (!resY.ok())
+        return GraphResult::fail(resY.error());
+
+    auto xs = resX.result();
+    auto ys = resY.result();
+    if (xs.size() != ys.size())
+        return GraphResult::fail(qApp->tr("Arrays of X and Y values have different sizes (%1 vs %2)").arg(xs.size()).arg(ys.size()));
+
+    return GraphResult::ok({xs, ys});
+}
+
+bool FormulaModifier::configure()
+{
+    State state("formula");
+    QString initialCode = state["code"].toString();
+    if (initialCode.isEmpty())
+        initialCode = QStringLiteral("for i = 1, #X do\n  Y[i] = Y[i] * 2\nend\n");
+
+    QSharedPointer<CodeEditor> editor(new CodeEditor("formula_modifier"));
+    editor->setCode(initialCode);
+    // There is no graph yet, so check the code on sample points
+    editor->setVerifier([](const QString &code, Z::Lua::Stats *stats){
+        Values xs(10);
+        for (int i = 0; i < xs.size(); i++)
+            xs[i] = i + 1;
+        auto limits = FormulaDataSource::limits();
+        limits.stats = stats;
+        std::optional<GraphResult> res;
+        BackgroundTask::run(qApp->tr("Checking formula..."), [&](const std::atomic<bool> &cancel){
+            limits.cancel = &cancel;
+            res = exec(code, {xs, xs}, limits);
+        });
+        return *res;
+    });
+
+    if (!Ori::Dlg::Dialog(editor)
+        .windowModal()
+        .withTitle(qApp->tr("User Formula"))
+        .withSkipContentMargins()
+        .withStretchedContent()
+        .withInitialSize({500, 400})
+        .withPersistenceId("formula_modifier_dlg")
+        .exec())
+        return false;
+
+    state["code"] = _code = editor->code();
+    return true;
+}
+
+void FormulaModifier::save(QJsonObject &obj) const
+{
+    obj["type"] = type();
+    obj["code"] = _code;
+}
+
+void FormulaModifier::load(const QJsonObject &obj)
+{
+    _code = obj["code"].toString();
+}
+
+void FormulaModifier::copyParams(Modifier *other)
+{
+    if (auto m = dynamic_cast<FormulaModifier*>(other); m) {
+        _code = m->_code;
+    } else {
+        qWarning() << Q_FUNC_INFO << "Wrong modifier type to copy params from";
+    };
+}
+
+//------------------------------------------------------------------------------
+//                             ArithmeticModifier
+//------------------------------------------------------------------------------
+
+struct ArithmeticModifier::Cache
+{
+    QMutex mutex;
+    Graph *graph = nullptr;
+    quint64 revision = 0;
+    Resample::Method interpolation = Resample::METHOD_LINEAR;
+    std::shared_ptr<const Z::Interpolator> interp;
+};
+
+ArithmeticModifier::ArithmeticModifier() : _cache(std::make_shared<Cache>())
+{
+}
+
+GraphResult ArithmeticModifier::modify(const GraphPoints &data) const
+{
+    Graph *ref = _project ? _project->graph(_reference) : nullptr;
+    if (!ref)
+        return GraphResult::fail(qApp->tr("Reference graph not found"));
+
+    std::shared_ptr<const Z::Interpolator> interp;
+    {
+        // The first of graphs being modified in parallel makes the interpolation, others wait for it
+        QMutexLocker locker(&_cache->mutex);
+        if (!_cache->interp || _cache->graph != ref || _cache->revision != ref->revision() ||
+            _cache->interpolation != _params.interpolation)
+        {
+            _cache->interp = std::make_shared<Z::Interpolator>(ref->data(), Z::Interpolator::Method(_params.interpolation));
+            _cache->graph = ref;
+            _cache->revision = ref->revision();
+            _cache->interpolation = _params.interpolation;
+        }
+        interp = _cache->interp;
+    }
+    if (!interp->isValid())
+        return GraphResult::fail(qApp->tr("Reference graph has no points"));
+
+    auto res = _params.calc(data, *interp);
+    if (res.size() == 0)
+        return GraphResult::fail(qApp->tr("Graph has no points within X range of reference graph <b>%1</b>").arg(ref->title()));
+    return GraphResult::ok(res);
+}
+
+bool ArithmeticModifier::configure()
+{
+    auto reference = new QComboBox;
+    if (_project)
+        for (auto g : _project->graphs())
+            reference->addItem(g->icon(), g->title(), g->id());
+    auto refGroup = LayoutV({reference}).makeGroupBox(qApp->tr("Reference Graph"));
+    auto operation = new RadioOptions<Arithmetic::Operation>(qApp->tr("Operation"),
+        {{ Arithmetic::OP_ADD, qApp->tr("Add (Graph + Reference)") },
+         { Arithmetic::OP_SUB, qApp->tr("Subtract (Graph − Reference)") },
+         { Arithmetic::OP_MUL, qApp->tr("Multiply (Graph × Reference)") },
+         { Arithmetic::OP_DIV, qApp->tr("Divide (Graph ÷ Reference)") },
+         { Arithmetic::OP_RATIO, qApp->tr("Relative deviation ((Graph − Reference) ÷ Reference)") }});
+    auto interpolation = new RadioOptions<Resample::Method>(qApp->tr("Interpolation of Reference"),
+        {{ Resample::METHOD_LINEAR, qApp->tr("Linear") },
+         { Resample::METHOD_SPLINE, qApp->tr("Cubic spline") },
+         { Resample::METHOD_AKIMA, qApp->tr("Akima spline") },
+         { Resample::METHOD_NEAREST, qApp->tr("Nearest point") }});
+
+    State state("arithmetic");
+    operation->setSelection(state["operation"], Arithmetic::OP_SUB);
+    interpolation->setSelection(state["interpolation"]);
+    reference->setCurrentIndex(qMax(0, reference->findData(state["reference"].toString())));
+
+    return dlg(qApp->tr("Graph Arithmetic"), {refGroup, operation, interpolation}, "arithmetic", [&]{
+        state["operation"] = _params.operation = operation->selection();
+        state["interpolation"] = _params.interpolation = interpolation->selection();
+        state["reference"] = _reference = reference->currentData().toString();
+    }, [&]{
+        if (reference->currentIndex() < 0)
+            return qApp->tr("There are no graphs to use as reference");
+        return QString();
+    });
+}
+
+void ArithmeticModifier::save(QJsonObject &obj) const
+{
+    obj["type"] = type();
+    obj["reference"] = _reference;
+    _params.save(obj);
+}
+
+void ArithmeticModifier::load(const QJsonObject &obj)
+{
+    _reference = obj["reference"].toString();
+    _params.load(obj);
+}
+
+void ArithmeticModifier::copyParams(Modifier *other)
+{
+    if (auto m = dynamic_cast<ArithmeticModifier*>(other); m) {
+        _params = m->_params;
+        _reference = m->_reference;
+        _project = m->_project;
+        _cache = m->_cache;
+    } else {
+        qWarning() << Q_FUNC_INFO << "Wrong modifier type to copy params from";
+    };
+}
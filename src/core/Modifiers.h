@@ -3,9 +3,14 @@
 
 #include "BaseTypes.h"
 #include "GraphMath.h"
+#include "LuaHelper.h"
 
 #include <QJsonObject>
 
+#include <memory>
+
+class Project;
+
 class Modifier
 {
 public:
@@ -16,6 +21,12 @@ public:
     virtual void save(QJsonObject &obj) const = 0;
     virtual void load(const QJsonObject &obj) = 0;
     virtual void copyParams(Modifier *other) = 0;
+
+    /// Id of another graph the result is calculated from, if any.
+    virtual QString reference() const { return {}; }
+
+    /// Whether modify() can be called for several graphs from different threads at once.
+    virtual bool isThreadSafe() const { return true; }
 };
 
 template <typename TParams>
@@ -23,7 +34,12 @@ class ModifierBase : public Modifier
 {
 public:
     GraphResult modify(const GraphPoints &data) const override {
-        return GraphResult::ok(_params.calc(data));
+        // Most of calculations expect explicit X values,
+        // those able to process uniform X declare it by a flag
+        if constexpr (requires { requires TParams::supportsUniformX; })
+            return GraphResult::ok(_params.calc(data));
+        else
+            return GraphResult::ok(_params.calc(data.explicitX()));
     }
     void copyParams(Modifier *other) override {
         if (auto m = dynamic_cast<ModifierBase<TParams>*>(other); m) {
@@ -58,13 +74,71 @@ MODIFIER(Scale)
 MODIFIER(Normalize)
 MODIFIER(Invert)
 MODIFIER(Decimate)
+MODIFIER(Resample)
 MODIFIER(Average)
 MODIFIER(MavgSimple)
 MODIFIER(MavgCumul)
 MODIFIER(MavgExp)
 MODIFIER(FitLimits)
 MODIFIER(Despike)
+MODIFIER(Median)
 MODIFIER(Derivative)
+MODIFIER(SavGol)
+MODIFIER(Spectrum)
+MODIFIER(Convolve)
+
+/// Processes graph points with user code.
+/// Points are given to the code as native arrays `X` and `Y`,
+/// and the values of these arrays after execution make the result.
+class FormulaModifier : public Modifier
+{
+public:
+    static QString _type_() { return QStringLiteral("Formula"); }
+    QString type() const override { return _type_(); }
+    GraphResult modify(const GraphPoints& data) const override;
+    bool configure() override;
+    void save(QJsonObject &obj) const override;
+    void load(const QJsonObject &obj) override;
+    void copyParams(Modifier *other) override;
+
+    /// Calculation shows its own progress window, so it can only go in the main thread.
+    bool isThreadSafe() const override { return false; }
+
+    /// Executes code in the calling thread.
+    /// Data must have explicit X values.
+    static GraphResult exec(const QString &code, const GraphPoints& data, const Z::Lua::Limits &limits);
+
+private:
+    QString _code;
+};
+
+/// Combines the graph with another graph of the project, e.g. subtracts a baseline.
+/// The reference is interpolated at X of the graph. Its interpolation is made once
+/// and shared by all copies of the modifier until the reference graph changes.
+class ArithmeticModifier : public Modifier
+{
+public:
+    ArithmeticModifier();
+    static QString _type_() { return QStringLiteral("Arithmetic"); }
+    QString type() const override { return _type_(); }
+    GraphResult modify(const GraphPoints& data) const override;
+    bool configure() override;
+    void save(QJsonObject &obj) const override;
+    void load(const QJsonObject &obj) override;
+    void copyParams(Modifier *other) override;
+    QString reference() const override { return _reference; }
+
+    /// Project where reference graphs are looked for, it must be set before the modifier is used.
+    /// It's copied along with other params.
+    void setProject(Project *project) { _project = project; }
+
+private:
+    struct Cache;
+    GraphMath::Arithmetic _params;
+    QString _reference;
+    Project *_project = nullptr;
+    std::shared_ptr<Cache> _cache;
+};
 
 Modifier* makeModifier(const QString &type);
 
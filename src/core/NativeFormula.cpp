@@ -0,0 +1,1056 @@
+#include "NativeFormula.h"
+
+#include "Parallel.h"
+
+#include <QApplication>
+#include <QHash>
+#include <QMap>
+#include <QSet>
+#include <QtMath>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+
+namespace Z {
+
+namespace {
+
+// Number of elements processed by an instruction at once
+const int BLOCK = 1024;
+
+// Larger formulas are left for Lua, arrays must fit into QVector
+#if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+const qsizetype MAX_POINTS = (std::numeric_limits<int>::max() - 64) / qsizetype(sizeof(double));
+#else
+const qsizetype MAX_POINTS = 1000000000;
+#endif
+
+using Func = double (*)(double);
+
+enum class OpCode { Add, Sub, Mul, Div, Pow, Mod, IDiv, Call };
+
+struct Operand
+{
+    int reg = -1;           // vector register, -1 for scalar
+    double value = 0;       // value of scalar
+    bool integer = false;   // Lua integer subtype, it never gives negative zero
+    bool index = false;     // loop variable plus scalar offset, can be used as array index
+    double offset = 0;
+
+    bool isScalar() const { return reg < 0; }
+};
+
+Operand scalar(double value, bool integer = false)
+{
+    Operand r;
+    r.value = value;
+    r.integer = integer;
+    return r;
+}
+
+struct Instr
+{
+    OpCode op;
+    int dst;
+    Operand a, b;
+    Func func;
+    bool integer;
+};
+
+struct ArrayInit
+{
+    bool done = false;
+    bool native = false; // made by `array`, stores only floats
+    qsizetype size = 0;
+    double fill = 0;
+};
+
+//------------------------------------------------------------------------------
+//                                 Functions
+//------------------------------------------------------------------------------
+
+// Must give the same results as functions registered by Lua::registerGlobalFuncs
+double f_sin(double x) { return qSin(x); }
+double f_sinh(double x) { return sinh(x); }
+double f_asin(double x) { return qAsin(x); }
+double f_cos(double x) { return qCos(x); }
+double f_cosh(double x) { return cosh(x); }
+double f_acos(double x) { return qAcos(x); }
+double f_tan(double x) { return qTan(x); }
+double f_tanh(double x) { return tanh(x); }
+double f_atan(double x) { return qAtan(x); }
+double f_cot(double x) { return 1.0 / qTan(x); }
+double f_coth(double x) { return 1.0 / tanh(x); }
+double f_acot(double x) { return qAtan(1.0 / x); }
+double f_sec(double x) { return 1.0 / qCos(x); }
+double f_sech(double x) { return 1.0 / cosh(x); }
+double f_csc(double x) { return 1.0 / qSin(x); }
+double f_csch(double x) { return 1.0 / sinh(x); }
+double f_abs(double x) { return qAbs(x); }
+double f_floor(double x) { return std::floor(x); }
+double f_ceil(double x) { return std::ceil(x); }
+double f_exp(double x) { return qExp(x); }
+double f_ln(double x) { return qLn(x); }
+double f_lg(double x) { return log10(x); }
+double f_sqrt(double x) { return qSqrt(x); }
+double f_deg2rad(double x) { return qDegreesToRadians(x); }
+double f_rad2deg(double x) { return qRadiansToDegrees(x); }
+
+struct FuncInfo
+{
+    enum Result { Float, Integer, SameAsArg };
+
+    Func func;
+    Result result;
+};
+
+const QHash<QByteArray, FuncInfo>& globalFuncs()
+{
+    // All of them push floats into Lua
+    static const QHash<QByteArray, FuncInfo> funcs {
+        { "sin", { f_sin, FuncInfo::Float } },
+        { "sinh", { f_sinh, FuncInfo::Float } },
+        { "asin", { f_asin, FuncInfo::Float } },
+        { "cos", { f_cos, FuncInfo::Float } },
+        { "cosh", { f_cosh, FuncInfo::Float } },
+        { "acos", { f_acos, FuncInfo::Float } },
+        { "tan", { f_tan, FuncInfo::Float } },
+        { "tanh", { f_tanh, FuncInfo::Float } },
+        { "atan", { f_atan, FuncInfo::Float } },
+        { "cot", { f_cot, FuncInfo::Float } },
+        { "coth", { f_coth, FuncInfo::Float } },
+        { "acot", { f_acot, FuncInfo::Float } },
+        { "sec", { f_sec, FuncInfo::Float } },
+        { "sech", { f_sech, FuncInfo::Float } },
+        { "csc", { f_csc, FuncInfo::Float } },
+        { "csch", { f_csch, FuncInfo::Float } },
+        { "abs", { f_abs, FuncInfo::Float } },
+        { "floor", { f_floor, FuncInfo::Float } },
+        { "ceil", { f_ceil, FuncInfo::Float } },
+        { "exp", { f_exp, FuncInfo::Float } },
+        { "ln", { f_ln, FuncInfo::Float } },
+        { "lg", { f_lg, FuncInfo::Float } },
+        { "sqrt", { f_sqrt, FuncInfo::Float } },
+        { "deg2rad", { f_deg2rad, FuncInfo::Float } },
+        { "rad2deg", { f_rad2deg, FuncInfo::Float } },
+    };
+    return funcs;
+}
+
+const QHash<QByteArray, FuncInfo>& mathFuncs()
+{
+    // Only single-argument functions of the math library
+    static const QHash<QByteArray, FuncInfo> funcs {
+        { "sin", { f_sin, FuncInfo::Float } },
+        { "cos", { f_cos, FuncInfo::Float } },
+        { "tan", { f_tan, FuncInfo::Float } },
+        { "asin", { f_asin, FuncInfo::Float } },
+        { "acos", { f_acos, FuncInfo::Float } },
+        { "atan", { f_atan, FuncInfo::Float } },
+        { "exp", { f_exp, FuncInfo::Float } },
+        { "log", { f_ln, FuncInfo::Float } },
+        { "sqrt", { f_sqrt, FuncInfo::Float } },
+        { "abs", { f_abs, FuncInfo::SameAsArg } },
+        { "floor", { f_floor, FuncInfo::Integer } },
+        { "ceil", { f_ceil, FuncInfo::Integer } },
+    };
+    return funcs;
+}
+
+// Lua's floor modulo: the result has the sign of the divisor
+inline double luaMod(double a, double b)
+{
+    double m = std::fmod(a, b);
+    if ((m > 0) ? b < 0 : (m < 0 && b != m)) m += b;
+    return m;
+}
+
+// Lua uses multiplication for squares
+inline double luaPow(double a, double b)
+{
+    return b == 2 ? a * a : std::pow(a, b);
+}
+
+double calcScalar(OpCode op, double a, double b, Func func)
+{
+    switch (op)
+    {
+    case OpCode::Add: return a + b;
+    case OpCode::Sub: return a - b;
+    case OpCode::Mul: return a * b;
+    case OpCode::Div: return a / b;
+    case OpCode::Pow: return luaPow(a, b);
+    case OpCode::Mod: return luaMod(a, b);
+    case OpCode::IDiv: return std::floor(a / b);
+    case OpCode::Call: return func(a);
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+//                                   Lexer
+//------------------------------------------------------------------------------
+
+struct Token
+{
+    enum Kind { End, Number, Name, Symbol };
+
+    Kind kind = End;
+    QByteArray text;
+    double number = 0;
+    bool integer = false;
+};
+
+inline bool isNameChar(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+bool tokenize(const QByteArray &code, QVector<Token> &tokens, QString &reason)
+{
+    const char *start = code.constData();
+    const char *end = start + code.size();
+    const char *p = start;
+    while (p < end)
+    {
+        const char c = *p;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v')
+        {
+            p++;
+            continue;
+        }
+        if (c == '-' && p+1 < end && p[1] == '-')
+        {
+            p += 2;
+            // Long comment --[[ ]] or --[==[ ]==]
+            if (p < end && *p == '[')
+            {
+                const char *q = p + 1;
+                int level = 0;
+                while (q < end && *q == '=') { level++; q++; }
+                if (q < end && *q == '[')
+                {
+                    QByteArray closing = ']' + QByteArray(level, '=') + ']';
+                    auto pos = code.indexOf(closing, q - start);
+                    if (pos < 0)
+                    {
+                        reason = "unfinished comment";
+                        return false;
+                    }
+                    p = start + pos + closing.size();
+                    continue;
+                }
+            }
+            while (p < end && *p != '\n') p++;
+            continue;
+        }
+        Token t;
+        if (isNameChar(c))
+        {
+            const char *b = p;
+            while (p < end && (isNameChar(*p) || isDigit(*p))) p++;
+            t.kind = Token::Name;
+            t.text = QByteArray(b, p - b);
+        }
+        else if (isDigit(c) || (c == '.' && p+1 < end && isDigit(p[1])))
+        {
+            const char *b = p;
+            bool integer = true;
+            while (p < end && isDigit(*p)) p++;
+            if (p < end && *p == '.')
+            {
+                integer = false;
+                p++;
+                while (p < end && isDigit(*p)) p++;
+            }
+            if (p < end && (*p == 'e' || *p == 'E'))
+            {
+                integer = false;
+                p++;
+                if (p < end && (*p == '+' || *p == '-')) p++;
+                if (p == end || !isDigit(*p))
+                {
+                    reason = "malformed number";
+                    return false;
+                }
+                while (p < end && isDigit(*p)) p++;
+            }
+            // Hexadecimals and whatever else
+            if (p < end && (isNameChar(*p) || *p == '.'))
+            {
+                reason = "unsupported number format";
+                return false;
+            }
+            t.kind = Token::Number;
+            t.text = QByteArray(b, p - b);
+            t.number = t.text.toDouble();
+            // Too large integers are converted to floats by Lua
+            t.integer = integer && t.number < 9.2e18;
+        }
+        else
+        {
+            t.kind = Token::Symbol;
+            if (c == '/' && p+1 < end && p[1] == '/')
+            {
+                t.text = "//";
+                p += 2;
+            }
+            else if (c != 0 && strchr("+-*/^%()[]{},;=.#", c)
+                && !(c == '=' && p+1 < end && p[1] == '=')
+                && !(c == '.' && p+1 < end && p[1] == '.'))
+            {
+                t.text = QByteArray(1, c);
+                p++;
+            }
+            else
+            {
+                reason = QString("unsupported symbol '%1'").arg(QLatin1Char(c));
+                return false;
+            }
+        }
+        tokens << t;
+    }
+    tokens << Token();
+    return true;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+//                                  Program
+//------------------------------------------------------------------------------
+
+struct NativeProgram
+{
+    enum { REG_LOOP, REG_INPUT_X, REG_INPUT_Y };
+
+    QVector<Instr> instrs;
+    int regCount = 1; // register 0 holds the loop variable
+    bool input = false; // registers 1 and 2 hold elements of input arrays
+    double start = 1;
+    qsizetype count = 0;
+    ArrayInit initX, initY;
+    bool hasX = false, hasY = false;
+    Operand x, y;
+
+    qsizetype sizeX() const { return qMax(count, initX.size); }
+    qsizetype sizeY() const { return qMax(count, initY.size); }
+
+    void eliminateDeadCode();
+};
+
+void NativeProgram::eliminateDeadCode()
+{
+    QVector<bool> used(regCount, false);
+    if (!x.isScalar()) used[x.reg] = true;
+    if (!y.isScalar()) used[y.reg] = true;
+    QVector<Instr> live;
+    for (auto it = instrs.crbegin(); it != instrs.crend(); it++)
+    {
+        if (!used.at(it->dst)) continue;
+        if (!it->a.isScalar()) used[it->a.reg] = true;
+        if (!it->b.isScalar()) used[it->b.reg] = true;
+        live << *it;
+    }
+    std::reverse(live.begin(), live.end());
+    instrs = live;
+}
+
+namespace {
+
+//------------------------------------------------------------------------------
+//                                   Parser
+//------------------------------------------------------------------------------
+
+class Parser
+{
+public:
+    Parser(NativeProgram &prog) : _prog(prog) {}
+
+    bool parse(const QByteArray &code);
+    void setInput(qsizetype size);
+    void setParams(const QMap<QString, double> &params);
+
+    QString reason;
+
+private:
+    NativeProgram &_prog;
+    QVector<Token> _tokens;
+    int _pos = 0;
+    QHash<QByteArray, Operand> _consts;
+    QHash<QByteArray, Operand> _temps;
+    QSet<QByteArray> _constsReadInLoop;
+    QByteArray _loopVar;
+    bool _inLoop = false;
+    bool _loopDone = false;
+
+    const Token& tok() const { return _tokens.at(_pos); }
+    bool isSymbol(const char *s) const { return tok().kind == Token::Symbol && tok().text == s; }
+    bool isName(const char *s) const { return tok().kind == Token::Name && tok().text == s; }
+    bool accept(const char *symbol);
+    bool expect(const char *symbol);
+    bool fail(const QString &r);
+
+    bool statement();
+    bool loopStatement();
+    bool forLoop();
+    bool arrayInit(ArrayInit &init);
+    bool checkIndex(const Operand &index);
+    bool name(QByteArray &n);
+    bool variable(const QByteArray &n, Operand &r);
+    bool call(const FuncInfo &f, Operand &r);
+    bool expr(Operand &r);
+    bool mulExpr(Operand &r);
+    bool unaryExpr(Operand &r);
+    bool powExpr(Operand &r);
+    bool primary(Operand &r);
+    Operand emit(OpCode op, const Operand &a, const Operand &b, Func func, bool integer);
+};
+
+bool Parser::accept(const char *symbol)
+{
+    if (!isSymbol(symbol)) return false;
+    _pos++;
+    return true;
+}
+
+bool Parser::expect(const char *symbol)
+{
+    if (accept(symbol)) return true;
+    return fail(QString("'%1' expected").arg(symbol));
+}
+
+bool Parser::fail(const QString &r)
+{
+    if (reason.isEmpty()) reason = r;
+    return false;
+}
+
+void Parser::setInput(qsizetype size)
+{
+    _prog.input = true;
+    _prog.regCount = 3;
+    _prog.initX = _prog.initY = ArrayInit { .done = true, .native = true, .size = size };
+}
+
+void Parser::setParams(const QMap<QString, double> &params)
+{
+    for (auto it = params.constBegin(); it != params.constEnd(); it++)
+        _consts[it.key().toLatin1()] = scalar(it.value());
+}
+
+bool Parser::parse(const QByteArray &code)
+{
+    if (!tokenize(code, _tokens, reason))
+        return false;
+
+    for (auto n : {"inf", "Inf", "INF"})
+        if (!_consts.contains(n))
+            _consts[n] = scalar(qInf());
+
+    while (tok().kind != Token::End)
+        if (!statement())
+            return false;
+
+    if (!_loopDone)
+        return fail("there is no loop");
+    return true;
+}
+
+bool Parser::name(QByteArray &n)
+{
+    static const QSet<QByteArray> keywords {
+        "and", "break", "do", "else", "elseif", "end", "false", "for", "function", "goto", "if", "in",
+        "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while",
+    };
+    if (tok().kind != Token::Name)
+        return fail("name expected");
+    if (keywords.contains(tok().text))
+        return fail(QString("unsupported keyword '%1'").arg(QString::fromLatin1(tok().text)));
+    n = tok().text;
+    _pos++;
+    return true;
+}
+
+bool Parser::statement()
+{
+    if (accept(";")) return true;
+    if (_loopDone)
+        return fail("there is code after the loop");
+    if (isName("for"))
+        return forLoop();
+
+    bool local = false;
+    if (isName("local"))
+    {
+        _pos++;
+        local = true;
+    }
+    QByteArray n;
+    if (!name(n) || !expect("="))
+        return false;
+    if (n == "X" || n == "Y")
+    {
+        if (_prog.input)
+            return fail("input arrays can't be replaced");
+        if (local)
+            return fail("X and Y must be global");
+        return arrayInit(n == "X" ? _prog.initX : _prog.initY);
+    }
+    if (n == "math" || n == "array" || globalFuncs().contains(n))
+        return fail(QString("'%1' is redefined").arg(QString::fromLatin1(n)));
+    // Default value of a parameter: `a = a or 1`
+    bool orDefault = false;
+    if (!local && tok().kind == Token::Name && tok().text == n
+        && _tokens.at(_pos+1).kind == Token::Name && _tokens.at(_pos+1).text == "or")
+    {
+        _pos += 2;
+        orDefault = true;
+    }
+    Operand r;
+    if (!expr(r))
+        return false;
+    r.index = false;
+    if (!orDefault || !_consts.contains(n))
+        _consts[n] = r;
+    return true;
+}
+
+bool Parser::arrayInit(ArrayInit &init)
+{
+    if (accept("{"))
+    {
+        if (!expect("}"))
+            return false;
+        init = ArrayInit { .done = true };
+        return true;
+    }
+    if (!isName("array"))
+        return fail("X and Y can only be initialized with {} or array()");
+    _pos++;
+    Operand size, fill = scalar(0);
+    if (!expect("(") || !expr(size))
+        return false;
+    if (accept(",") && !expr(fill))
+        return false;
+    if (!expect(")"))
+        return false;
+    if (size.value < 0 || size.value > MAX_POINTS || size.value != std::floor(size.value))
+        return fail("invalid array size");
+    init = ArrayInit { .done = true, .native = true, .size = qsizetype(size.value), .fill = fill.value };
+    return true;
+}
+
+bool Parser::forLoop()
+{
+    _pos++;
+    if (!name(_loopVar) || !expect("="))
+        return false;
+    Operand start, limit, step = scalar(1, true);
+    if (!expr(start) || !expect(",") || !expr(limit))
+        return false;
+    if (accept(",") && !expr(step))
+        return false;
+    if (!start.integer || !step.integer)
+        return fail("only integer loops are supported");
+    if (step.value != 1)
+        return fail("loop step must be 1");
+
+    // Integer loop floors its limit
+    double lim = std::floor(limit.value);
+    if (!(lim - start.value < MAX_POINTS))
+        return fail("too many points");
+    _prog.start = start.value;
+    _prog.count = lim >= start.value ? qsizetype(lim - start.value) + 1 : 0;
+    if (_prog.input && _prog.count > _prog.initX.size)
+        return fail("the loop runs beyond input arrays");
+
+    if (!isName("do"))
+        return fail("'do' expected");
+    _pos++;
+    _inLoop = true;
+    while (!isName("end"))
+    {
+        if (tok().kind == Token::End)
+            return fail("'end' expected");
+        if (!loopStatement())
+            return false;
+    }
+    _pos++;
+    _inLoop = false;
+    _loopDone = true;
+
+    if (_prog.input ? !_prog.hasX && !_prog.hasY : !_prog.hasX || !_prog.hasY)
+        return fail(_prog.input ? "the loop must calculate X or Y" : "the loop must calculate both X and Y");
+    if (_prog.sizeX() != _prog.sizeY())
+        return fail("X and Y have different sizes");
+    return true;
+}
+
+bool Parser::loopStatement()
+{
+    if (accept(";")) return true;
+
+    bool local = false;
+    if (isName("local"))
+    {
+        _pos++;
+        local = true;
+    }
+    QByteArray n;
+    if (!name(n))
+        return false;
+    if (n == "X" || n == "Y")
+    {
+        if (local || !expect("["))
+            return fail("X and Y can only be calculated by elements");
+        Operand index, value;
+        if (!expr(index) || !expect("]") || !checkIndex(index) || !expect("=") || !expr(value))
+            return false;
+        bool isX = n == "X";
+        if (!(isX ? _prog.initX : _prog.initY).done)
+            return fail("X or Y is not initialized before the loop");
+        bool &has = isX ? _prog.hasX : _prog.hasY;
+        if (has)
+            return fail("X or Y is calculated twice");
+        has = true;
+        (isX ? _prog.x : _prog.y) = value;
+        return true;
+    }
+    if (n == _loopVar)
+        return fail("loop variable is changed");
+    if (n == "math" || n == "array" || globalFuncs().contains(n))
+        return fail(QString("'%1' is redefined").arg(QString::fromLatin1(n)));
+    if (!expect("="))
+        return false;
+    Operand value;
+    if (!expr(value))
+        return false;
+    // Locals are recreated in each iteration, but globals keep
+    // their values, so reading them before assignment makes a dependency
+    if (!local && _constsReadInLoop.contains(n))
+        return fail(QString("'%1' depends on previous iteration").arg(QString::fromLatin1(n)));
+    _temps[n] = value;
+    return true;
+}
+
+bool Parser::checkIndex(const Operand &index)
+{
+    if (!_inLoop || !index.index || _prog.start + index.offset != 1)
+        return fail("only elements X[i] and Y[i] are supported, where i runs from 1");
+    return true;
+}
+
+bool Parser::variable(const QByteArray &n, Operand &r)
+{
+    if (_inLoop)
+    {
+        if (n == _loopVar)
+        {
+            r = Operand();
+            r.reg = 0;
+            r.integer = true;
+            r.index = true;
+            return true;
+        }
+        auto it = _temps.constFind(n);
+        if (it != _temps.constEnd())
+        {
+            r = it.value();
+            return true;
+        }
+        _constsReadInLoop << n;
+    }
+    auto it = _consts.constFind(n);
+    if (it == _consts.constEnd())
+        return fail(QString("unknown variable '%1'").arg(QString::fromLatin1(n)));
+    r = it.value();
+    return true;
+}
+
+bool Parser::call(const FuncInfo &f, Operand &r)
+{
+    Operand arg;
+    if (!expect("(") || !expr(arg))
+        return false;
+    if (!accept(")"))
+        return fail("only functions of one argument are supported");
+    bool integer = f.result == FuncInfo::Integer || (f.result == FuncInfo::SameAsArg && arg.integer);
+    r = emit(OpCode::Call, arg, Operand(), f.func, integer);
+    return true;
+}
+
+bool Parser::expr(Operand &r)
+{
+    if (!mulExpr(r))
+        return false;
+    while (isSymbol("+") || isSymbol("-"))
+    {
+        auto op = isSymbol("+") ? OpCode::Add : OpCode::Sub;
+        _pos++;
+        Operand b;
+        if (!mulExpr(b))
+            return false;
+        r = emit(op, r, b, nullptr, r.integer && b.integer);
+    }
+    return true;
+}
+
+bool Parser::mulExpr(Operand &r)
+{
+    if (!unaryExpr(r))
+        return false;
+    while (isSymbol("*") || isSymbol("/") || isSymbol("//") || isSymbol("%"))
+    {
+        OpCode op = OpCode::Mul;
+        if (isSymbol("/")) op = OpCode::Div;
+        else if (isSymbol("//")) op = OpCode::IDiv;
+        else if (isSymbol("%")) op = OpCode::Mod;
+        _pos++;
+        Operand b;
+        if (!unaryExpr(b))
+            return false;
+        bool integer = op != OpCode::Div && r.integer && b.integer;
+        // Lua raises an error in this case, variable divisor can be zero at some iteration
+        if (integer && op != OpCode::Mul && b.isScalar() && b.value == 0)
+            return fail("integer division by zero");
+        if (integer && op != OpCode::Mul && !b.isScalar())
+            return fail("integer division by variable");
+        r = emit(op, r, b, nullptr, integer);
+    }
+    return true;
+}
+
+bool Parser::unaryExpr(Operand &r)
+{
+    if (accept("#"))
+    {
+        // Only input arrays have known length
+        if (!_prog.input || !(isName("X") || isName("Y")))
+            return fail("length is only supported for input arrays");
+        _pos++;
+        r = scalar(_prog.initX.size, true);
+        return true;
+    }
+    if (accept("-"))
+    {
+        Operand a;
+        if (!unaryExpr(a))
+            return false;
+        // Integer zero has no sign, but float does
+        if (a.integer)
+            r = emit(OpCode::Sub, scalar(0, true), a, nullptr, true);
+        else
+            r = emit(OpCode::Mul, a, scalar(-1), nullptr, false);
+        return true;
+    }
+    return powExpr(r);
+}
+
+bool Parser::powExpr(Operand &r)
+{
+    if (!primary(r))
+        return false;
+    if (accept("^"))
+    {
+        // Exponentiation is right associative and binds tighter than unary minus on the left
+        Operand b;
+        if (!unaryExpr(b))
+            return false;
+        r = emit(OpCode::Pow, r, b, nullptr, false);
+    }
+    return true;
+}
+
+bool Parser::primary(Operand &r)
+{
+    if (tok().kind == Token::Number)
+    {
+        r = scalar(tok().number, tok().integer);
+        _pos++;
+        return true;
+    }
+    if (accept("("))
+        return expr(r) && expect(")");
+
+    QByteArray n;
+    if (!name(n))
+        return false;
+    if (n == "math")
+    {
+        QByteArray member;
+        if (!expect(".") || !name(member))
+            return false;
+        if (member == "pi")
+        {
+            r = scalar(M_PI);
+            return true;
+        }
+        if (member == "huge")
+        {
+            r = scalar(qInf());
+            return true;
+        }
+        auto f = mathFuncs().constFind(member);
+        if (f == mathFuncs().constEnd())
+            return fail(QString("unsupported function 'math.%1'").arg(QString::fromLatin1(member)));
+        return call(f.value(), r);
+    }
+    if (isSymbol("("))
+    {
+        if (n == "pi")
+        {
+            _pos++;
+            r = scalar(M_PI);
+            return expect(")");
+        }
+        auto f = globalFuncs().constFind(n);
+        if (f == globalFuncs().constEnd())
+            return fail(QString("unsupported function '%1'").arg(QString::fromLatin1(n)));
+        return call(f.value(), r);
+    }
+    if (n == "X" || n == "Y")
+    {
+        Operand index;
+        if (!expect("[") || !expr(index) || !expect("]") || !checkIndex(index))
+            return false;
+        bool isX = n == "X";
+        if (_prog.input && !(isX ? _prog.hasX : _prog.hasY))
+        {
+            r = Operand();
+            r.reg = isX ? NativeProgram::REG_INPUT_X : NativeProgram::REG_INPUT_Y;
+            return true;
+        }
+        if (!(isX ? _prog.hasX : _prog.hasY))
+            return fail("X[i] or Y[i] is used before being calculated");
+        r = isX ? _prog.x : _prog.y;
+        // Native arrays convert integers to floats
+        if ((isX ? _prog.initX : _prog.initY).native)
+            r.integer = false;
+        r.index = false;
+        return true;
+    }
+    return variable(n, r);
+}
+
+Operand Parser::emit(OpCode op, const Operand &a, const Operand &b, Func func, bool integer)
+{
+    Operand r;
+    r.integer = integer;
+    if (a.isScalar() && (op == OpCode::Call || b.isScalar()))
+    {
+        r.value = calcScalar(op, a.value, b.value, func);
+        if (integer) r.value += 0.0;
+    }
+    else
+    {
+        r.reg = _prog.regCount++;
+        _prog.instrs << Instr { op, r.reg, a, b, func, integer };
+    }
+    // Track expressions like i+1 to be used as array indexes
+    if (op == OpCode::Add || op == OpCode::Sub)
+    {
+        if (a.index && b.isScalar() && b.integer)
+        {
+            r.index = true;
+            r.offset = op == OpCode::Add ? a.offset + b.value : a.offset - b.value;
+        }
+        else if (op == OpCode::Add && b.index && a.isScalar() && a.integer)
+        {
+            r.index = true;
+            r.offset = b.offset + a.value;
+        }
+    }
+    return r;
+}
+
+//------------------------------------------------------------------------------
+//                                 Evaluation
+//------------------------------------------------------------------------------
+
+template <typename F>
+inline void binary(double *dst, const double *regs, const Operand &a, const Operand &b, int n, F f)
+{
+    if (a.isScalar())
+    {
+        const double va = a.value;
+        const double *pb = regs + b.reg * BLOCK;
+        for (int j = 0; j < n; j++) dst[j] = f(va, pb[j]);
+    }
+    else if (b.isScalar())
+    {
+        const double *pa = regs + a.reg * BLOCK;
+        const double vb = b.value;
+        for (int j = 0; j < n; j++) dst[j] = f(pa[j], vb);
+    }
+    else
+    {
+        const double *pa = regs + a.reg * BLOCK;
+        const double *pb = regs + b.reg * BLOCK;
+        for (int j = 0; j < n; j++) dst[j] = f(pa[j], pb[j]);
+    }
+}
+
+void execute(const Instr &in, double *regs, int n)
+{
+    double *dst = regs + in.dst * BLOCK;
+    switch (in.op)
+    {
+    case OpCode::Add: binary(dst, regs, in.a, in.b, n, [](double a, double b){ return a + b; }); break;
+    case OpCode::Sub: binary(dst, regs, in.a, in.b, n, [](double a, double b){ return a - b; }); break;
+    case OpCode::Mul: binary(dst, regs, in.a, in.b, n, [](double a, double b){ return a * b; }); break;
+    case OpCode::Div: binary(dst, regs, in.a, in.b, n, [](double a, double b){ return a / b; }); break;
+    case OpCode::Pow: binary(dst, regs, in.a, in.b, n, luaPow); break;
+    case OpCode::Mod: binary(dst, regs, in.a, in.b, n, luaMod); break;
+    case OpCode::IDiv: binary(dst, regs, in.a, in.b, n, [](double a, double b){ return std::floor(a / b); }); break;
+    case OpCode::Call:
+    {
+        const double *src = regs + in.a.reg * BLOCK;
+        const Func func = in.func;
+        for (int j = 0; j < n; j++) dst[j] = func(src[j]);
+        break;
+    }
+    }
+    if (in.integer)
+        for (int j = 0; j < n; j++) dst[j] += 0.0;
+}
+
+void store(const Operand &value, const double *regs, double *dst, int n)
+{
+    if (value.isScalar())
+        std::fill(dst, dst + n, value.value);
+    else
+        memcpy(dst, regs + value.reg * BLOCK, n * sizeof(double));
+}
+
+GraphResult notEnoughMemory(qsizetype size)
+{
+    return GraphResult::fail(qApp->translate("Formula", "Not enough memory for %1 points").arg(size));
+}
+
+/// Calculates the loop, returns false if cancelled.
+/// Outputs are not touched when X or Y is not calculated by the loop.
+bool run(const NativeProgram &p, double *px, double *py, const double *inX, const double *inY, const std::atomic<bool> *cancel)
+{
+    std::atomic<bool> cancelled{false};
+
+    parallelFor(p.count, BLOCK * 16, [&](qsizetype begin, qsizetype end){
+        QVector<double> regs(p.regCount * BLOCK);
+        double *r = regs.data();
+        for (qsizetype b = begin; b < end; b += BLOCK)
+        {
+            if (cancel && *cancel)
+            {
+                cancelled = true;
+                return;
+            }
+            const int n = static_cast<int>(qMin(qsizetype(BLOCK), end - b));
+            const double first = p.start + double(b);
+            for (int j = 0; j < n; j++)
+                r[j] = first + j;
+            if (p.input)
+            {
+                memcpy(r + NativeProgram::REG_INPUT_X * BLOCK, inX + b, n * sizeof(double));
+                memcpy(r + NativeProgram::REG_INPUT_Y * BLOCK, inY + b, n * sizeof(double));
+            }
+            for (const auto &in : p.instrs)
+                execute(in, r, n);
+            if (p.hasX) store(p.x, r, px + b, n);
+            if (p.hasY) store(p.y, r, py + b, n);
+        }
+    });
+
+    return !cancelled;
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+//                               NativeFormula
+//------------------------------------------------------------------------------
+
+NativeFormula::NativeFormula()
+{
+}
+
+NativeFormula::~NativeFormula()
+{
+}
+
+bool NativeFormula::compile(const QString &code)
+{
+    return compile(code, -1);
+}
+
+bool NativeFormula::compile(const QString &code, qsizetype inputSize)
+{
+    _program.reset(new NativeProgram);
+    Parser parser(*_program);
+    parser.setParams(_params);
+    if (inputSize >= 0)
+        parser.setInput(inputSize);
+    if (!parser.parse(code.toLatin1()))
+    {
+        _reason = parser.reason;
+        _program.reset();
+        return false;
+    }
+    _reason.clear();
+    _program->eliminateDeadCode();
+    return true;
+}
+
+qsizetype NativeFormula::size() const
+{
+    return _program ? _program->sizeX() : 0;
+}
+
+GraphResult NativeFormula::calc(const std::atomic<bool> *cancel) const
+{
+    Q_ASSERT(_program && !_program->input);
+    const auto &p = *_program;
+
+    // Without memory limit Lua fails when it can't allocate arrays, so does this
+    Values xs, ys;
+    try
+    {
+        xs = Values(static_cast<int>(p.sizeX()), p.initX.fill);
+        ys = Values(static_cast<int>(p.sizeY()), p.initY.fill);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return notEnoughMemory(p.sizeX());
+    }
+
+    if (!run(p, xs.data(), ys.data(), nullptr, nullptr, cancel))
+        return GraphResult::fail(qApp->translate("Formula", "Calculation has been cancelled"));
+    return GraphResult::ok({xs, ys});
+}
+
+GraphResult NativeFormula::calc(const GraphPoints &input, const std::atomic<bool> *cancel) const
+{
+    Q_ASSERT(_program && _program->input);
+    const auto &p = *_program;
+    Q_ASSERT(input.size() == p.initX.size);
+
+    // Arrays not calculated by the loop are passed through as is
+    Values xs = input.xs;
+    Values ys = input.ys;
+    double *px = nullptr, *py = nullptr;
+    try
+    {
+        // Makes own copies of shared arrays
+        px = p.hasX ? xs.data() : nullptr;
+        py = p.hasY ? ys.data() : nullptr;
+    }
+    catch (const std::bad_alloc&)
+    {
+        return notEnoughMemory(input.size());
+    }
+
+    if (!run(p, px, py, input.xs.constData(), input.ys.constData(), cancel))
+        return GraphResult::fail(qApp->translate("Formula", "Calculation has been cancelled"));
+    return GraphResult::ok({xs, ys});
+}
+
+} // namespace Z
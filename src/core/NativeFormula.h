@@ -0,0 +1,70 @@
+#ifndef Z_NATIVE_FORMULA_H
+#define Z_NATIVE_FORMULA_H
+
+#include "BaseTypes.h"
+
+#include <QMap>
+
+#include <atomic>
+#include <memory>
+
+namespace Z {
+
+struct NativeProgram;
+
+/// Calculates simple formulas natively over whole arrays instead of running them in Lua.
+///
+/// Supported code is a subset of Lua made of scalar constants and a single numeric loop
+/// filling `X` and `Y` element by element without dependencies between iterations:
+/// ```
+/// tau = 2.5
+/// X = {} Y = {}
+/// for i = 1, 1000 do
+///   local x = i / 100
+///   X[i] = x
+///   Y[i] = sin(x) * exp(-x / tau)
+/// end
+/// ```
+/// Expressions can use arithmetic operators, functions available in formulas
+/// (see `Lua::registerGlobalFuncs`) and several functions of the `math` library.
+/// Results are the same as Lua would produce. Any other code is left for Lua.
+class NativeFormula
+{
+public:
+    NativeFormula();
+    ~NativeFormula();
+
+    /// Values of global variables defined before the code, they must be set before compile().
+    void setParams(const QMap<QString, double> &params) { _params = params; }
+
+    /// Returns false when the code can't be calculated natively.
+    bool compile(const QString &code);
+
+    /// Compiles code processing existing arrays, e.g. for formula modifier.
+    /// `X` and `Y` are predefined and have given size, the code can only change
+    /// their elements in the loop `for i = 1, #X do ... end` and read source
+    /// values before overwriting them.
+    bool compile(const QString &code, qsizetype inputSize);
+
+    /// Explains why compile() has rejected the code.
+    QString unsupportedReason() const { return _reason; }
+
+    /// Number of points to be produced, valid after successful compilation.
+    qsizetype size() const;
+
+    /// Calculates compiled code using all available threads.
+    GraphResult calc(const std::atomic<bool> *cancel = nullptr) const;
+
+    /// Calculates code compiled for input arrays.
+    /// Input must be of the size given to compile() and have explicit X values.
+    GraphResult calc(const GraphPoints &input, const std::atomic<bool> *cancel = nullptr) const;
+
+private:
+    std::unique_ptr<NativeProgram> _program;
+    QMap<QString, double> _params;
+    QString _reason;
+};
+
+} // namespace Z
+
+#endif // Z_NATIVE_FORMULA_H
@@ -0,0 +1,50 @@
+#include "Parallel.h"
+
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+#include <atomic>
+
+namespace Z {
+
+void parallelFor(qsizetype count, qsizetype minChunk, const std::function<void(qsizetype begin, qsizetype end)> &body)
+{
+    if (count <= 0) return;
+
+    const int threads = QThread::idealThreadCount();
+    // Make more chunks than threads to balance uneven work
+    const qsizetype chunks = qBound(qsizetype(1), count / qMax(qsizetype(1), minChunk), qsizetype(threads) * 4);
+    if (chunks == 1 || threads < 2)
+    {
+        body(0, count);
+        return;
+    }
+    const qsizetype chunkSize = (count + chunks - 1) / chunks;
+
+    std::atomic<qsizetype> nextChunk{0};
+    auto worker = [&]{
+        for (qsizetype c = nextChunk++; c < chunks; c = nextChunk++)
+        {
+            const qsizetype begin = c * chunkSize;
+            if (begin >= count) break;
+            body(begin, qMin(count, begin + chunkSize));
+        }
+    };
+
+    // Only take free threads, if the pool is busy (e.g. this is a nested loop)
+    // the calling thread just does all the work itself instead of waiting
+    QSemaphore done;
+    int started = 0;
+    const int helpers = static_cast<int>(qMin(qsizetype(threads), chunks)) - 1;
+    for (int i = 0; i < helpers; i++)
+    {
+        if (!QThreadPool::globalInstance()->tryStart([&worker, &done]{ worker(); done.release(); }))
+            break;
+        started++;
+    }
+    worker();
+    done.acquire(started);
+}
+
+} // namespace Z
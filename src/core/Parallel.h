@@ -0,0 +1,18 @@
+#ifndef Z_PARALLEL_H
+#define Z_PARALLEL_H
+
+#include <QtGlobal>
+
+#include <functional>
+
+namespace Z {
+
+/// Calls `body(begin, end)` for consecutive chunks of the range [0, count)
+/// using the global thread pool, the calling thread takes part in the work too.
+/// Chunks are not smaller than `minChunk`, so small ranges are processed in the calling thread.
+/// Returns when all chunks are done. It's safe to call from inside of another parallel loop.
+void parallelFor(qsizetype count, qsizetype minChunk, const std::function<void(qsizetype begin, qsizetype end)> &body);
+
+} // namespace Z
+
+#endif // Z_PARALLEL_H
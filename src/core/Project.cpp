@@ -9,8 +9,11 @@
 #include <QDebug>
 #include <QFileDialog>
 #include <QPainter>
+#include <QSet>
 #include <QUuid>
 
+#include <functional>
+
 //------------------------------------------------------------------------------
 //                                 Project
 //------------------------------------------------------------------------------
@@ -26,8 +29,9 @@ void Project::newDiagram()
     dia->_title = tr("Diagram %1").arg(++_nextDiagramIndex);
     dia->_color = nextDiagramColor();
     _diagrams.insert(dia->id(), dia);
+    registerDiagram(dia);
     qDebug() << "Project::newDiagram" << dia->id();
-    BusEvent::DiagramAdded::send({{"id", dia->id()}});
+    EventBus::send({ .type = BusEvent::DiagramAdded, .diagram = dia });
     markModified("Project::newDiagram");
 }
 
@@ -38,9 +42,11 @@ void Project::deleteDiagram(const QString &id)
         qWarning() << "Project::deleteDiagram: diagram not found" << id;
         return;
     }
+    // Listeners can still access the diagram when handling the event
+    EventBus::send({ .type = BusEvent::DiagramDeleted, .diagram = dia });
     _diagrams.remove(id);
+    unregisterDiagram(dia);
     delete dia;
-    BusEvent::DiagramDeleted::send({{"id", id}});
     markModified("Project::deleteDiagram " + id);
 }
 
@@ -59,10 +65,29 @@ QVector<Diagram*> Project::diagrams() const
 
 Graph* Project::graph(const QString &id)
 {
-    for (auto it = _diagrams.cbegin(); it != _diagrams.cend(); it++)
-        if (auto g = it.value()->graph(id); g)
-            return g;
-    return nullptr;
+    return _graphs.value(id);
+}
+
+void Project::registerDiagram(Diagram *dia)
+{
+    for (auto g : std::as_const(dia->_graphs))
+        registerGraph(g);
+}
+
+void Project::unregisterDiagram(Diagram *dia)
+{
+    for (auto g : std::as_const(dia->_graphs))
+        unregisterGraph(g);
+}
+
+void Project::registerGraph(Graph *g)
+{
+    _graphs.insert(g->id(), g);
+}
+
+void Project::unregisterGraph(Graph *g)
+{
+    _graphs.remove(g->id());
 }
 
 QColor Project::nextDiagramColor()
@@ -76,20 +101,62 @@ void Project::markModified(const QString &reason)
 {
     _modified = true;
     qDebug() << "Project::modified" << reason;
-    BusEvent::ProjectModified::send();
+    EventBus::send({ .type = BusEvent::ProjectModified });
 }
 
 void Project::markUnmodified(const QString &reason)
 {
     _modified = false;
     qDebug() << "Project::unmodified" << reason;
-    BusEvent::ProjectUnmodified::send();
+    EventBus::send({ .type = BusEvent::ProjectUnmodified });
+}
+
+QVector<Graph*> Project::graphs() const
+{
+    QVector<Graph*> res;
+    res.reserve(_graphs.size());
+    for (auto g : _graphs)
+        res << g;
+    return res;
 }
 
 void Project::updateGraph(Graph *graph)
 {
-    BusEvent::GraphUpdated::send({{"id", graph->id()}});
+    EventBus::send({ .type = BusEvent::GraphUpdated, .graph = graph });
     markModified("Project::updateGraph");
+
+    // Other graphs are recalculated from the already loaded data of their sources,
+    // their own modificators are not changed, so the project doesn't get new changes.
+    // Sources calculated from other graphs are reread.
+    for (auto g : dependentGraphs(graph)) {
+        const QString res = g->refreshData(!g->dataSource()->references().isEmpty());
+        if (!res.isEmpty()) {
+            const QString msg = tr("Failed to recalculate graph %1: %2").arg(g->title(), res);
+            EventBus::send({ .type = BusEvent::ErrorMessage, .message = &msg });
+            continue;
+        }
+        EventBus::send({ .type = BusEvent::GraphUpdated, .graph = g });
+    }
+}
+
+QVector<Graph*> Project::dependentGraphs(Graph *graph) const
+{
+    // Depth-first search over references, graphs are prepended when all their
+    // dependents are already collected, which gives the topological order
+    QVector<Graph*> res;
+    QSet<Graph*> visited { graph };
+    const auto all = graphs();
+    std::function<void(Graph*)> visit = [&](Graph *source) {
+        for (auto g : all) {
+            if (visited.contains(g) || !g->refersTo(source->id()))
+                continue;
+            visited.insert(g);
+            visit(g);
+            res.prepend(g);
+        }
+    };
+    visit(graph);
+    return res;
 }
 
 //------------------------------------------------------------------------------
@@ -100,6 +167,11 @@ Diagram::Diagram(Project *project): QObject(project), _prj(project)
 {
 }
 
+Diagram::~Diagram()
+{
+    qDeleteAll(_graphs);
+}
+
 static QIcon makeGraphIcon(QColor color)
 {
     int H, S, L;
@@ -145,18 +217,19 @@ Graph* Diagram::graph(const QString &id)
 void Diagram::addGraph(Graph *g)
 {
     _graphs.insert(g->id(), g);
-    BusEvent::GraphAdded::send({{"id", g->id()}});
+    _prj->registerGraph(g);
+    EventBus::send({ .type = BusEvent::GraphAdded, .diagram = this, .graph = g });
     markModified("Diagram::addGraph");
 }
 
 void Diagram::deleteGraphs(const QVector<Graph*> &graphs)
 {
     for (auto g : std::as_const(graphs)) {
-        QString id = g->id();
-        BusEvent::GraphDeleting::send({{"id", id}});
-        _graphs.remove(id);
+        EventBus::send({ .type = BusEvent::GraphDeleting, .diagram = this, .graph = g });
+        _graphs.remove(g->id());
+        _prj->unregisterGraph(g);
         delete g;
-        BusEvent::GraphDeleted::send({{"id", id}});
+        EventBus::send({ .type = BusEvent::GraphDeleted, .diagram = this, .graph = g });
     }
     markModified("Diagram::deleteGraphs");
 }
@@ -168,7 +241,7 @@ void Diagram::deleteGraphs(const QVector<Graph*> &graphs)
 Graph::Graph(DataSource* dataSource): _dataSource(dataSource)
 {
     _id = QUuid::createUuid().toString(QUuid::Id128);
-    _data = _dataSource->data();
+    setData(_dataSource->data());
     _title = _dataSource->makeTitle();
 }
 
@@ -178,6 +251,26 @@ Graph::~Graph()
     qDeleteAll(_modifiers);
 }
 
+QString Graph::setData(const GraphPoints &data)
+{
+    if (!data.uniformX && data.xs.size() != data.ys.size())
+        return QString("Graph has different number of X and Y values: %1 and %2").arg(data.xs.size()).arg(data.ys.size());
+    PackedPoints packed(data, _storageType);
+    if (packed.ys.size() != data.ys.size() || packed.xs.size() != data.xs.size())
+        return QString("Not enough memory to store %1 points").arg(data.ys.size());
+    _data = std::move(packed);
+    _revision++;
+    return {};
+}
+
+void Graph::setStorageType(ValueStorage::Type type)
+{
+    if (type == _storageType)
+        return;
+    _storageType = type;
+    setData(data());
+}
+
 void Graph::setColor(const QColor& color)
 {
     _color = color;
@@ -198,40 +291,57 @@ QString Graph::canRefreshData() const
 
 QString Graph::refreshData(bool reread)
 {
+    GraphPoints data;
     if (reread)
     {
         auto res = _dataSource->read();
         if (!res.ok())
             return res.error();
 
-        _data = res.result();
+        data = res.result();
     }
     else
-        _data = _dataSource->data();
+        data = _dataSource->data();
 
     if (_autoTitle)
         _title = _dataSource->makeTitle();
 
     foreach (auto mod, _modifiers)
     {
-        auto res = mod->modify(_data);
+        auto res = mod->modify(data);
         if (!res.ok())
             return res.error();
 
-        _data = res.result();
+        data = res.result();
     }
 
-    return QString();
+    return setData(data);
 }
 
 QString Graph::modify(Modifier* mod)
 {
-    auto res = mod->modify(_data);
+    return modify(mod, mod->modify(data()));
+}
+
+QString Graph::modify(Modifier* mod, const GraphResult &res)
+{
     if (!res.ok())
         return res.error();
 
-    _modifiers.append(mod);
+    auto err = setData(res.result());
+    if (!err.isEmpty())
+        return err;
 
-    _data = res.result();
+    _modifiers.append(mod);
     return QString();
 }
+
+bool Graph::refersTo(const QString &graphId) const
+{
+    if (_dataSource->references().contains(graphId))
+        return true;
+    for (auto mod : _modifiers)
+        if (mod->reference() == graphId)
+            return true;
+    return false;
+}
@@ -32,17 +32,34 @@ public:
     void markUnmodified(const QString &reason);
     
     Graph* graph(const QString &id);
+    QVector<Graph*> graphs() const;
+
+    /// Notifies about changed graph and recalculates graphs having modifiers that refer to it.
     void updateGraph(Graph *graph);
+
+    /// Graphs calculated from the given one, directly or through other graphs,
+    /// ordered so that each graph goes after graphs it's calculated from.
+    QVector<Graph*> dependentGraphs(Graph *graph) const;
     
 private:
     QString _fileName;
     QHash<QString, Diagram*> _diagrams;
+
+    // Graphs of all diagrams by id
+    QHash<QString, Graph*> _graphs;
+
     int _nextDiagramIndex = 0;
     int _nextDiagramColorIndex = 0;
     bool _modified = false;
 
     QColor nextDiagramColor();
+
+    void registerDiagram(Diagram *dia);
+    void unregisterDiagram(Diagram *dia);
+    void registerGraph(Graph *g);
+    void unregisterGraph(Graph *g);
     
+    friend class Diagram;
     friend class ProjectFile;
 };
 
@@ -52,8 +69,11 @@ class Diagram : public QObject
     Q_OBJECT
 
 public:
+    ~Diagram();
+
     Project* project() const { return _prj; }
 
+    /// Persistent id, it's only used for storing in project files.
     QString id() const { return _id; }
 
     const QString& title() const { return _title; }
@@ -89,6 +109,7 @@ public:
     Graph(DataSource* dataSource);
     ~Graph();
 
+    /// Persistent id, it's only used for storing in project files.
     QString id() const { return _id; }
 
     const QString& title() const { return _title; }
@@ -99,8 +120,20 @@ public:
     const QIcon& icon();
 
     DataSource* dataSource() const { return _dataSource; }
-    const GraphPoints& data() const { return _data; }
-    int pointsCount() const { return _data.xs.size(); }
+
+    /// Points are kept in packed form, see storageType().
+    /// This unpacks them for calculation or display.
+    /// Unpacks all points into a new array, use packedData() when only some values are needed.
+    GraphPoints data() const { return _data.unpack(); }
+    const PackedPoints& packedData() const { return _data; }
+    double x(int index) const { return _data.x(index); }
+    double y(int index) const { return _data.ys.at(index); }
+    int pointsCount() const { return _data.size(); }
+
+    /// Requested type for keeping graph points, by default the most compact lossless one.
+    /// Calculations are always done in double precision regardless of the storage type.
+    ValueStorage::Type storageType() const { return _storageType; }
+    void setStorageType(ValueStorage::Type type);
 
     QString canRefreshData() const;
     QString refreshData(bool reread = true);
@@ -108,18 +141,34 @@ public:
     /// The graph takes ownership on the modificator.
     QString modify(Modifier* mod);
 
+    /// Appends the modificator whose result is already calculated from data(),
+    /// e.g. for several graphs in parallel. The graph takes ownership on the modificator.
+    QString modify(Modifier* mod, const GraphResult &res);
+
+    /// Returns true when the data source or some modificator uses the graph with given id as a reference.
+    bool refersTo(const QString &graphId) const;
+
+    /// Incremented each time points change, it allows to cache results calculated from them.
+    quint64 revision() const { return _revision; }
+
 private:
     QString _id;
     bool _autoTitle = true;
     DataSource* _dataSource;
     QList<Modifier*> _modifiers;
-    GraphPoints _data;
+    PackedPoints _data;
+    ValueStorage::Type _storageType = ValueStorage::Auto;
     QString _title;
     QIcon _icon;
     QColor _color;
+    quint64 _revision = 0;
   
     Graph() {}
+
+    /// Explicit X must have as many values as Y, other data are rejected, they can't be stored.
+    QString setData(const GraphPoints &data);
     
+    friend class Project;
     friend class ProjectFile;
 };
 
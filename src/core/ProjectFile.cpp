@@ -12,11 +12,20 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 
+#include <memory>
+#include <vector>
+
 #define PROJECT_VERSION "7.0"
 #define FILE_PROPS QStringLiteral("props.json")
 #define FILE_FORMAT QStringLiteral("format.json")
 #define FILE_DATA QStringLiteral("data.bin")
 
+// Older data files have no header and start with point count,
+// values are always stored as doubles there
+#define DATA_MAGIC quint32(0x5A504B31) // "ZPK1"
+// Uniform X is stored as a values block without data, scale is X step and offset is the first X
+#define DATA_UNIFORM quint8(ValueStorage::Auto)
+
 static QColor jsonToColor(const QJsonValue& val, const QColor& def)
 {
     QColor color(val.toString());
@@ -59,6 +68,7 @@ QJsonObject ProjectFile::writeGraph(const Graph *g)
         { "color", g->color().name() },
         { "dataSource", dataSourceJson },
         { "modifiers", modifiersJson },
+        { "storage", ValueStorage::typeName(g->_storageType) },
     });
 }
 
@@ -73,11 +83,15 @@ QByteArray ProjectFile::writeGraphData(const Graph *g)
     #endif
     );
     stream.setVersion(QDataStream::Qt_5_12);
-    stream << quint32(g->pointsCount());
-    for (const auto &v : g->data().xs)
-        stream << v;
-    for (const auto &v : g->data().ys)
-        stream << v;
+    stream << DATA_MAGIC << quint32(g->pointsCount());
+    if (g->_data.uniformX)
+        stream << DATA_UNIFORM << g->_data.dx << g->_data.x0;
+    for (const auto vs : {&g->_data.xs, &g->_data.ys}) {
+        if (vs == &g->_data.xs && g->_data.uniformX)
+            continue;
+        stream << quint8(vs->storage().type) << vs->storage().scale << vs->storage().offset;
+        stream.writeRawData(vs->bytes().constData(), vs->bytes().size());
+    }
     return data;
 }
 
@@ -97,17 +111,20 @@ QString ProjectFile::readDiagram(const QJsonObject &obj, Diagram *d)
     return {};
 }
 
-QString ProjectFile::readGraph(const QJsonObject &obj, Graph *g)
+QString ProjectFile::readGraph(const QJsonObject &obj, Graph *g, Project *p)
 {
     g->_title = obj["title"].toString();
     g->_autoTitle = obj["autoTitle"].toBool();
     g->_color = jsonToColor(obj["color"], Qt::red);
+    g->_storageType = ValueStorage::typeByName(obj["storage"].toString());
     
     auto dsJson = obj["dataSource"].toObject();
     auto ds = makeDataSource(dsJson["type"].toString());
     if (!ds)
         return QString("Unknown data source: %1").arg(dsJson["type"].toString());
     ds->load(dsJson);
+    if (auto e = dynamic_cast<EnsembleDataSource*>(ds); e)
+        e->setProject(p);
     g->_dataSource = ds;
     
     auto arr = obj["modifiers"].toArray();
@@ -119,6 +136,8 @@ QString ProjectFile::readGraph(const QJsonObject &obj, Graph *g)
             continue;
         }
         mod->load(modJson);
+        if (auto m = dynamic_cast<ArithmeticModifier*>(mod); m)
+            m->setProject(p);
         g->_modifiers << mod;
     }
     return {};
@@ -127,8 +146,41 @@ QString ProjectFile::readGraph(const QJsonObject &obj, Graph *g)
 QString ProjectFile::readGraphData(const QByteArray &data, Graph *g)
 {
     QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_12);
     quint32 pointCount;
     stream >> pointCount;
+    if (pointCount == DATA_MAGIC)
+    {
+        stream >> pointCount;
+        PackedValues *values[] = {&g->_data.xs, &g->_data.ys};
+        for (int i = 0; i < 2; i++) {
+            quint8 type;
+            ValueStorage storage;
+            stream >> type >> storage.scale >> storage.offset;
+            if (i == 0 && type == DATA_UNIFORM && stream.status() == QDataStream::Ok) {
+                g->_data.uniformX = true;
+                g->_data.dx = storage.scale;
+                g->_data.x0 = storage.offset;
+                continue;
+            }
+            storage.type = ValueStorage::Type(type);
+            if (stream.status() != QDataStream::Ok || storage.type <= ValueStorage::Auto || storage.type > ValueStorage::I32)
+                return QString("Invalid storage of %1 values").arg(i == 0 ? 'X' : 'Y');
+            // Point count comes from the file, it must not make us allocate more than the file has.
+            // The count is 32-bit and a value is at most 8 bytes, so their product fits into qint64.
+            const qint64 size = qint64(pointCount) * storage.bytesPerValue();
+            const qint64 available = qint64(data.size()) - stream.device()->pos();
+            if (size > available)
+                return QString("Not all %1 values read %2 / %3.").arg(i == 0 ? 'X' : 'Y')
+                    .arg(qMax(available, qint64(0)) / storage.bytesPerValue()).arg(pointCount);
+            QByteArray bytes(size, Qt::Uninitialized);
+            int bytesRead = stream.readRawData(bytes.data(), bytes.size());
+            if (bytesRead != bytes.size() || !values[i]->assign(bytes, pointCount, storage))
+                return QString("Not all %1 values read %2 / %3.").arg(i == 0 ? 'X' : 'Y')
+                    .arg(qMax(bytesRead, 0) / storage.bytesPerValue()).arg(pointCount);
+        }
+        return {};
+    }
     double v;
     Values xs;
     for (quint32 i = 0; i < pointCount && !stream.atEnd(); i++) {
@@ -144,8 +196,7 @@ QString ProjectFile::readGraphData(const QByteArray &data, Graph *g)
     }
     if (ys.size() < (int)pointCount)
         return QString("Not all Y values read %1 / %2.").arg(ys.size()).arg(pointCount);
-    g->_data = { xs, ys };
-    return {};
+    return g->setData({ xs, ys });
 }
 
 namespace {
@@ -395,8 +446,10 @@ QString ProjectFile::loadProject(const QString &fileName, Project *project)
     // Loading is called on empty projects
     // Empty project contains one empty dialgram 
     // that is automatically created after app started
-    for (auto it = project->_diagrams.cbegin(); it != project->_diagrams.cend(); it++)
-        BusEvent::DiagramDeleted::send({{"id", it.key()}});
+    for (auto it = project->_diagrams.cbegin(); it != project->_diagrams.cend(); it++) {
+        EventBus::send({ .type = BusEvent::DiagramDeleted, .diagram = it.value() });
+        project->unregisterDiagram(it.value());
+    }
     qDeleteAll(project->_diagrams);
     project->_diagrams.clear();
 
@@ -439,10 +492,16 @@ QString ProjectFile::loadProject(const QString &fileName, Project *project)
                 return zf.error;
             diagramFormat = zf.json;
         }
-        project->_diagrams.insert(diagramId, diagram.release());
-        BusEvent::DiagramAdded::send({{"id", diagramId}});
-        BusEvent::DiagramFormatLoaded::send({{"id", diagramId}, {"format", diagramFormat}});
+        Diagram *dia = diagram.release();
+        project->_diagrams.insert(diagramId, dia);
+        project->registerDiagram(dia);
+        EventBus::send({ .type = BusEvent::DiagramAdded, .diagram = dia });
+        EventBus::send({ .type = BusEvent::DiagramFormatLoaded, .diagram = dia, .format = &diagramFormat });
         
+        // Graphs are added to the project when all of them are read,
+        // so plot windows get a single event and a failed load leaves no part of the diagram's graphs
+        std::vector<std::unique_ptr<Graph>> loadedGraphs;
+        QVector<QJsonObject> graphFormats;
         for (const QString &graphId : it.value()) {
             std::unique_ptr<Graph> graph(new Graph);
             graph->_id = graphId;
@@ -452,7 +511,7 @@ QString ProjectFile::loadProject(const QString &fileName, Project *project)
                     return zf.error;
                 if (!zf.asJson())
                     return zf.error;
-                QString err = readGraph(zf.json, graph.get());
+                QString err = readGraph(zf.json, graph.get(), project);
                 if (!err.isEmpty())
                     return QString("Failed to read props of graph %1: %2").arg(graphId, err);
             }
@@ -464,20 +523,28 @@ QString ProjectFile::loadProject(const QString &fileName, Project *project)
                 if (!err.isEmpty())
                     return QString("Failed to read data of graph %1: %2").arg(graphId, err);
             }
-            QJsonObject graphFormat;
             {
                 ZipFile zf(zr.zip, diagramId + '/' + graphId + '/' + FILE_FORMAT);
                 if (!zf.error.isEmpty())
                     return zf.error;
                 if (!zf.asJson())
                     return zf.error;
-                graphFormat = zf.json;
+                graphFormats << zf.json;
             }
-            project->_diagrams[diagramId]->_graphs.insert(graphId, graph.release());
-            BusEvent::GraphLoaded::send({{"id", graphId}, {"format", graphFormat}});
+            loadedGraphs.push_back(std::move(graph));
+        }
+        QVector<Graph*> graphs;
+        graphs.reserve(int(loadedGraphs.size()));
+        for (auto &graph : loadedGraphs) {
+            Graph *g = graph.release();
+            dia->_graphs.insert(g->id(), g);
+            project->registerGraph(g);
+            graphs << g;
         }
+        if (!graphs.isEmpty())
+            EventBus::send({ .type = BusEvent::GraphsLoaded, .diagram = dia, .graphs = &graphs, .formats = &graphFormats });
 
-        BusEvent::DiagramLoaded::send({{"id", diagramId}});
+        EventBus::send({ .type = BusEvent::DiagramLoaded, .diagram = dia });
     }
     
     return {};
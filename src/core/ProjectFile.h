@@ -31,7 +31,7 @@ private:
     
     static QString readProject(const QJsonObject &obj, Project *p);
     static QString readDiagram(const QJsonObject &obj, Diagram *d);
-    static QString readGraph(const QJsonObject &obj, Graph *g);
+    static QString readGraph(const QJsonObject &obj, Graph *g, Project *p);
     static QString readGraphData(const QByteArray &data, Graph *g);
 };
 
@@ -227,8 +227,7 @@ CsvOpenResult CsvConfigDialog::openFile()
             auto ds = new CsvFileDataSource;
             ds->_fileName = csvReader.fileName;
             ds->_params = csvReader.makeParams(item);
-            ds->_data.xs = item.xs;
-            ds->_data.ys = item.ys;
+            ds->_data = PackedPoints({item.xs, item.ys});
 
             result.dataSources << ds;
         }
@@ -279,8 +278,7 @@ CsvOpenResult CsvConfigDialog::openClipboard()
         if (item.xs.isEmpty()) continue;
         auto dataSource = new ClipboardCsvDataSource;
         dataSource->_params = csvReader.makeParams(item);
-        dataSource->_data.xs = item.xs;
-        dataSource->_data.ys = item.ys;
+        dataSource->_data = PackedPoints({item.xs, item.ys});
         result.dataSources << dataSource;
     }
 
@@ -4,16 +4,30 @@
 namespace Z {
 namespace Tests {
 
+USE_GROUP(BaseTypesTests)                            // test_BaseTypes.cpp
 USE_GROUP(DataReadersTests)                          // test_DataReaders.cpp
+USE_GROUP(DataSourcesTests)                          // test_DataSources.cpp
+USE_GROUP(EnsembleTests)                             // test_Ensemble.cpp
+USE_GROUP(EventBusTests)                             // test_EventBus.cpp
+USE_GROUP(FftTests)                                  // test_Fft.cpp
 USE_GROUP(GraphMathTests)                            // test_GraphMath.cpp
+USE_GROUP(InterpolatorTests)                         // test_Interpolator.cpp
 USE_GROUP(LuaHelperTests)                            // test_LuaHelper.cpp
+USE_GROUP(NativeFormulaTests)                        // test_NativeFormula.cpp
 USE_GROUP(StringUtilsTests)                          // test_StringUtils.cpp
 
 TEST_SUITE(
     ADD_GROUP(Ori::Tests::All),
+    ADD_GROUP(BaseTypesTests),
     ADD_GROUP(DataReadersTests),
+    ADD_GROUP(DataSourcesTests),
+    ADD_GROUP(EnsembleTests),
+    ADD_GROUP(EventBusTests),
+    ADD_GROUP(FftTests),
     ADD_GROUP(GraphMathTests),
+    ADD_GROUP(InterpolatorTests),
     ADD_GROUP(LuaHelperTests),
+    ADD_GROUP(NativeFormulaTests),
     ADD_GROUP(StringUtilsTests),
 )
 
@@ -0,0 +1,109 @@
+#include "core/BaseTypes.h"
+
+#include "testing/OriTestBase.h"
+
+#include <cmath>
+#include <limits>
+
+namespace Z {
+namespace Tests {
+namespace BaseTypesTests {
+
+namespace PackedValuesTests {
+
+TEST_METHOD(auto_int16)
+{
+    Values vs = {0, -5, 100, 32767, -32767};
+    PackedValues p(vs);
+    ASSERT_IS_TRUE(p.storage().type == ValueStorage::I16);
+    ASSERT_EQ_INT(p.bytes().size(), vs.size() * 2);
+    ASSERT_EQ_LIST(p.unpack(), vs);
+}
+
+TEST_METHOD(auto_int16_offset)
+{
+    // ADC-like data not centered around zero still fits 16 bits
+    Values vs = {60000, 65535, 40000, 35000};
+    PackedValues p(vs);
+    ASSERT_IS_TRUE(p.storage().type == ValueStorage::I16);
+    ASSERT_EQ_LIST(p.unpack(), vs);
+}
+
+TEST_METHOD(auto_int32)
+{
+    Values vs = {0, 100000, -3};
+    PackedValues p(vs);
+    ASSERT_IS_TRUE(p.storage().type == ValueStorage::I32);
+    ASSERT_EQ_LIST(p.unpack(), vs);
+}
+
+TEST_METHOD(auto_float)
+{
+    Values vs = {0.5, 1.25, -3.75};
+    PackedValues p(vs);
+    ASSERT_IS_TRUE(p.storage().type == ValueStorage::F32);
+    ASSERT_EQ_LIST(p.unpack(), vs);
+}
+
+TEST_METHOD(auto_double)
+{
+    Values vs = {0.1, 1, 2};
+    PackedValues p(vs);
+    ASSERT_IS_TRUE(p.storage().type == ValueStorage::F64);
+    ASSERT_EQ_LIST(p.unpack(), vs);
+}
+
+TEST_METHOD(int16_scaled)
+{
+    Values vs = {0.1, 0.25, 0.7, 1.0};
+    PackedValues p(vs, ValueStorage::I16);
+    ASSERT_IS_TRUE(p.storage().type == ValueStorage::I16);
+    auto r = p.unpack();
+    ASSERT_EQ_INT(r.size(), vs.size());
+    for (int i = 0; i < vs.size(); i++)
+        ASSERT_NEAR_DBL(r.at(i), vs.at(i), 1e-4);
+    ASSERT_NEAR_DBL(p.at(2), 0.7, 1e-4);
+}
+
+TEST_METHOD(int16_nan)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    PackedValues p({1, nan, 3}, ValueStorage::I16);
+    auto r = p.unpack();
+    ASSERT_EQ_DBL(r.at(0), 1);
+    ASSERT_IS_TRUE(std::isnan(r.at(1)));
+    ASSERT_EQ_DBL(r.at(2), 3);
+}
+
+TEST_METHOD(assign_bytes)
+{
+    Values vs = {1, 2, 3};
+    PackedValues p(vs, ValueStorage::I32);
+    PackedValues p1;
+    ASSERT_IS_TRUE(p1.assign(p.bytes(), vs.size(), p.storage()));
+    ASSERT_EQ_LIST(p1.unpack(), vs);
+    ASSERT_IS_FALSE(p1.assign(p.bytes(), vs.size() + 1, p.storage()));
+}
+
+TEST_GROUP("Packed Values",
+    ADD_TEST(auto_int16),
+    ADD_TEST(auto_int16_offset),
+    ADD_TEST(auto_int32),
+    ADD_TEST(auto_float),
+    ADD_TEST(auto_double),
+    ADD_TEST(int16_scaled),
+    ADD_TEST(int16_nan),
+    ADD_TEST(assign_bytes),
+)
+
+} // PackedValuesTests
+
+//------------------------------------------------------------------------------
+
+TEST_GROUP("Base Types",
+    ADD_GROUP(PackedValuesTests),
+)
+
+} // BaseTypesTests
+} // Tests
+} // Z
@@ -0,0 +1,170 @@
+#include "../core/DataSources.h"
+
+#include "testing/OriTestBase.h"
+
+#include <QtMath>
+
+namespace Z {
+namespace Tests {
+namespace DataSourcesTests {
+
+// Enough points to be calculated in several chunks when there are several threads
+#define FUNCTION_X "X = {} for i = 1, 10000 do X[i] = i / 100 end\n"
+static const int FUNCTION_POINTS = 10000;
+
+static GraphResult calcFormula(const QString &code, const QMap<QString, double> &params = {}, const Z::Lua::Limits &limits = {})
+{
+    return FormulaDataSource::exec(code, params, limits);
+}
+
+TEST_METHOD(function_of_x)
+{
+    // Helper functions and tables made by the code are available to all chunks
+    auto res = calcFormula(
+        "k = 3\n"
+        "coef = {1, 2, name = 'line'}\n"
+        "function f(x) return coef[1] + coef[2] * x end\n"
+        FUNCTION_X
+        "function Y(x) return f(x) * k + #X end\n");
+    ASSERT_IS_TRUE(res.ok())
+    const auto &data = res.result();
+    ASSERT_EQ_INT(data.size(), FUNCTION_POINTS)
+    for (int i = 0; i < data.size(); i++)
+        ASSERT_NEAR_DBL(data.ys.at(i), (1 + 2 * data.xs.at(i)) * 3 + FUNCTION_POINTS, 1e-9)
+}
+
+TEST_METHOD(function_of_x_uses_locals)
+{
+    // Such a function can't be copied to other states, it's calculated in the state made it
+    auto res = calcFormula(
+        "local k = 2\n"
+        FUNCTION_X
+        "function Y(x) return k * x end\n");
+    ASSERT_IS_TRUE(res.ok())
+    const auto &data = res.result();
+    ASSERT_EQ_INT(data.size(), FUNCTION_POINTS)
+    for (int i = 0; i < data.size(); i++)
+        ASSERT_NEAR_DBL(data.ys.at(i), 2 * data.xs.at(i), 1e-9)
+}
+
+TEST_METHOD(function_of_x_params)
+{
+    auto res = calcFormula(FUNCTION_X "function Y(x) return a * x end\n", {{"a", 5}});
+    ASSERT_IS_TRUE(res.ok())
+    const auto &data = res.result();
+    for (int i = 0; i < data.size(); i++)
+        ASSERT_NEAR_DBL(data.ys.at(i), 5 * data.xs.at(i), 1e-9)
+}
+
+TEST_METHOD(function_of_x_error)
+{
+    // The error of the first failed point is reported
+    auto res = calcFormula(FUNCTION_X
+        "function Y(x) if x > 90 then error('late') end if x > 50 then error('early') end return x end\n");
+    ASSERT_IS_FALSE(res.ok())
+    TEST_LOG(res.error())
+    ASSERT_IS_TRUE(res.error().endsWith("early"))
+}
+
+TEST_METHOD(function_of_x_limits)
+{
+    const char *code =
+        "s = 0 for i = 1, 50000 do s = s + i end\n"
+        FUNCTION_X
+        "function Y(x) local r = 0 for i = 1, 100 do r = r + i end return r end\n";
+
+    auto res = calcFormula(code, {}, { .instructions = 100000000 });
+    ASSERT_IS_TRUE(res.ok())
+    ASSERT_EQ_DBL(res.result().ys.at(0), 5050)
+
+    // Each chunk takes much less instructions than the limit, but all of them together exceed it
+    res = calcFormula(code, {}, { .instructions = 1000000 });
+    ASSERT_IS_FALSE(res.ok())
+    ASSERT_EQ_STR(res.error(), "Formula exceeds the limit of 1000000 instructions")
+
+    // The code is not executed again for each chunk,
+    // it would exceed the limit with enough threads otherwise
+    res = calcFormula(
+        "s = 0 for i = 1, 50000 do s = s + i end\n"
+        FUNCTION_X
+        "function Y(x) return x + s end\n", {}, { .instructions = 1000000 });
+    ASSERT_IS_TRUE(res.ok())
+}
+
+TEST_METHOD(params_in_lua_code)
+{
+    // A function is not supported by native formulas, the code runs in Lua
+    const char *code =
+        "tau = tau or 2\n"
+        "local function f(x) return tau * x end\n"
+        "X = {} Y = {}\n"
+        "for i = 1, 3 do X[i] = i Y[i] = f(i) end\n";
+
+    auto res = calcFormula(code);
+    ASSERT_IS_TRUE(res.ok())
+    ASSERT_EQ_DBL(res.result().ys.at(2), 6)
+
+    res = calcFormula(code, {{"tau", 5}});
+    ASSERT_IS_TRUE(res.ok())
+    ASSERT_EQ_DBL(res.result().ys.at(0), 5)
+    ASSERT_EQ_DBL(res.result().ys.at(2), 15)
+}
+
+TEST_METHOD(sweep_sources)
+{
+    FormulaDataSource source("X = {1, 2} Y = {a * b, a + b}");
+    source.setParams({{"a", 1}, {"b", 2}});
+
+    const auto sources = source.sweep("b", {10, 20, 30});
+    ASSERT_EQ_INT(sources.size(), 3)
+    for (int i = 0; i < sources.size(); i++)
+    {
+        auto ds = sources.at(i);
+        ASSERT_EQ_STR(ds->code(), source.code())
+        ASSERT_EQ_INT(ds->params().size(), 2)
+        ASSERT_EQ_DBL(ds->params().value("a"), 1)
+        ASSERT_EQ_DBL(ds->params().value("b"), 10 * (i + 1))
+        auto res = calcFormula(ds->code(), ds->params());
+        ASSERT_IS_TRUE(res.ok())
+        ASSERT_EQ_DBL(res.result().ys.at(0), 10 * (i + 1))
+    }
+    // The original source is not changed
+    ASSERT_EQ_DBL(source.params().value("b"), 2)
+
+    // A new parameter is added to existing ones
+    const auto added = source.sweep("c", {7});
+    ASSERT_EQ_INT(added.size(), 1)
+    ASSERT_EQ_INT(added.first()->params().size(), 3)
+    ASSERT_EQ_DBL(added.first()->params().value("c"), 7)
+
+    qDeleteAll(sources);
+    qDeleteAll(added);
+}
+
+TEST_METHOD(verify_param_name)
+{
+    ASSERT_IS_TRUE(FormulaDataSource::verifyParamName("tau").isEmpty())
+    ASSERT_IS_TRUE(FormulaDataSource::verifyParamName("_k2").isEmpty())
+    for (auto name : {"", "1a", "a b", "a.b", "end", "nil", "X", "Y", "sin", "math", "print", "inf", "_G"})
+    {
+        TEST_LOG(name)
+        ASSERT_IS_FALSE(FormulaDataSource::verifyParamName(name).isEmpty())
+    }
+}
+
+//------------------------------------------------------------------------------
+
+TEST_GROUP("DataSources",
+    ADD_TEST(function_of_x),
+    ADD_TEST(function_of_x_uses_locals),
+    ADD_TEST(function_of_x_params),
+    ADD_TEST(function_of_x_error),
+    ADD_TEST(function_of_x_limits),
+    ADD_TEST(params_in_lua_code),
+    ADD_TEST(sweep_sources),
+    ADD_TEST(verify_param_name),
+)
+
+} // namespace DataSourcesTests
+} // namespace Tests
+} // namespace Z
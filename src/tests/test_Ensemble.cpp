@@ -0,0 +1,145 @@
+#include "core/Ensemble.h"
+
+#include "testing/OriTestBase.h"
+
+#include <QtMath>
+
+#include <algorithm>
+#include <numeric>
+
+namespace Z {
+namespace Tests {
+namespace EnsembleTests {
+
+using namespace Ensemble;
+
+static QVector<const PackedPoints*> pointers(const QVector<PackedPoints> &graphs)
+{
+    QVector<const PackedPoints*> res;
+    for (const auto &g : graphs)
+        res << &g;
+    return res;
+}
+
+TEST_METHOD(common_range)
+{
+    QVector<PackedPoints> graphs {
+        PackedPoints({{0, 1, 2, 3, 4}, {0, 0, 0, 0, 0}}),
+        PackedPoints(GraphPoints::uniform(1, 0.5, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0})),
+        PackedPoints({{6, -1, 3}, {0, 0, 0}}),
+    };
+    double minX, maxX;
+    ASSERT_IS_TRUE(commonRange(pointers(graphs), minX, maxX))
+    ASSERT_EQ_DBL(minX, 1)
+    ASSERT_EQ_DBL(maxX, 4)
+
+    graphs << PackedPoints({{5, 6}, {0, 0}});
+    ASSERT_IS_FALSE(commonRange(pointers(graphs), minX, maxX))
+    ASSERT_IS_FALSE(commonRange({}, minX, maxX))
+}
+
+TEST_METHOD(mean_std_envelope)
+{
+    // Lines y = k*x for k = 1..4 have at each x: mean 2.5x, sample std 1.291x
+    QVector<PackedPoints> graphs;
+    for (int k = 1; k <= 4; k++)
+        graphs << PackedPoints({{0, 10}, {0, 10.0 * k}});
+    const auto res = calc(pointers(graphs), 0, 2, 6,
+        {{ MEAN }, { MEAN_MINUS_STD }, { MEAN_PLUS_STD }, { MIN }, { MAX }});
+    ASSERT_EQ_INT(res.size(), 5)
+    const double std = qSqrt(5.0 / 3.0);
+    for (int i = 0; i < 6; i++) {
+        const double x = 2 * i;
+        ASSERT_NEAR_DBL(res[0][i], 2.5 * x, 1e-12)
+        ASSERT_NEAR_DBL(res[1][i], (2.5 - std) * x, 1e-12)
+        ASSERT_NEAR_DBL(res[2][i], (2.5 + std) * x, 1e-12)
+        ASSERT_NEAR_DBL(res[3][i], x, 1e-12)
+        ASSERT_NEAR_DBL(res[4][i], 4 * x, 1e-12)
+    }
+}
+
+TEST_METHOD(percentiles)
+{
+    // Constant graphs 0, 10, ..., 100 in shuffled order
+    QVector<PackedPoints> graphs;
+    for (int v : {30, 100, 0, 70, 10, 50, 90, 20, 80, 40, 60})
+        graphs << PackedPoints({{0, 1}, {double(v), double(v)}});
+    const auto res = calc(pointers(graphs), 0, 0.5, 3,
+        {{ PERCENTILE, 50 }, { PERCENTILE, 0 }, { PERCENTILE, 100 }, { PERCENTILE, 25 }, { PERCENTILE, 95 }, { MEAN }});
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ_DBL(res[0][i], 50)
+        ASSERT_EQ_DBL(res[1][i], 0)
+        ASSERT_EQ_DBL(res[2][i], 100)
+        ASSERT_EQ_DBL(res[3][i], 25)
+        ASSERT_NEAR_DBL(res[4][i], 95, 1e-12)
+        // Percentiles reorder values, other statistics are not affected by this
+        ASSERT_NEAR_DBL(res[5][i], 50, 1e-12)
+    }
+}
+
+TEST_METHOD(different_grids)
+{
+    // Graphs with own X are interpolated linearly, unsorted X is allowed
+    QVector<PackedPoints> graphs {
+        PackedPoints(GraphPoints::uniform(0, 1, {0, 1, 2, 3, 4})),
+        PackedPoints({{4, 0, 2}, {8, 0, 4}}),
+        PackedPoints({{0, 0.5, 3, 4}, {0, 1, 6, 8}}, ValueStorage::F32),
+    };
+    double minX, maxX;
+    ASSERT_IS_TRUE(commonRange(pointers(graphs), minX, maxX))
+    const int count = 1001;
+    const double dx = (maxX - minX) / (count - 1);
+    const auto res = calc(pointers(graphs), minX, dx, count, {{ MEAN }, { MIN }, { MAX }});
+    for (int i = 0; i < count; i++) {
+        const double x = minX + i * dx;
+        ASSERT_NEAR_DBL(res[0][i], 5 * x / 3, 1e-9)
+        ASSERT_NEAR_DBL(res[1][i], x, 1e-9)
+        ASSERT_NEAR_DBL(res[2][i], 2 * x, 1e-9)
+    }
+}
+
+TEST_METHOD(many_graphs)
+{
+    // Enough points and graphs for parallel blocks, results are compared with per-point calculation
+    const int graphCount = 101, pointCount = 2000, gridCount = 3333;
+    QVector<PackedPoints> graphs;
+    for (int g = 0; g < graphCount; g++) {
+        Values xs(pointCount), ys(pointCount);
+        for (int i = 0; i < pointCount; i++) {
+            xs[i] = i * (1 + g * 0.001);
+            ys[i] = qSin(xs[i] * 0.01 + g) * (g % 7);
+        }
+        graphs << PackedPoints({xs, ys});
+    }
+    double minX, maxX;
+    ASSERT_IS_TRUE(commonRange(pointers(graphs), minX, maxX))
+    const double dx = (maxX - minX) / (gridCount - 1);
+    const auto res = calc(pointers(graphs), minX, dx, gridCount, {{ MEAN }, { PERCENTILE, 50 }});
+    ASSERT_EQ_INT(res[0].size(), gridCount)
+    for (int i = 0; i < gridCount; i += 37) {
+        const double x = minX + i * dx;
+        Values column;
+        for (int g = 0; g < graphCount; g++) {
+            const auto &p = graphs[g];
+            const double step = 1 + g * 0.001;
+            const int k = qMin(int(x / step), pointCount - 2);
+            const double xa = p.x(k), xb = p.x(k+1);
+            column << p.ys.at(k) + (p.ys.at(k+1) - p.ys.at(k)) * (x - xa) / (xb - xa);
+        }
+        std::sort(column.begin(), column.end());
+        ASSERT_NEAR_DBL(res[0][i], std::accumulate(column.cbegin(), column.cend(), 0.0) / graphCount, 1e-9)
+        ASSERT_NEAR_DBL(res[1][i], column[graphCount / 2], 1e-9)
+    }
+}
+
+TEST_GROUP("Ensemble",
+    ADD_TEST(common_range),
+    ADD_TEST(mean_std_envelope),
+    ADD_TEST(percentiles),
+    ADD_TEST(different_grids),
+    ADD_TEST(many_graphs),
+)
+
+} // namespace EnsembleTests
+} // namespace Tests
+} // namespace Z
@@ -0,0 +1,110 @@
+#include "core/EventBus.h"
+
+#include "testing/OriTestBase.h"
+
+#include <functional>
+
+namespace Z {
+namespace Tests {
+namespace EventBusTests {
+
+struct TestListener : public IEventBusListener
+{
+    TestListener(std::initializer_list<BusEvent::Type> events) : IEventBusListener(events) {}
+
+    QVector<BusEvent::Type> types;
+    QVector<Graph*> graphs;
+    std::function<void()> onEvent;
+
+    void busEvent(const BusEvent &e) override
+    {
+        types << e.type;
+        if (e.type == BusEvent::GraphUpdated)
+            graphs << e.graph;
+        else if (e.type == BusEvent::GraphsUpdated)
+            graphs << *e.graphs;
+        if (onEvent)
+            onEvent();
+    }
+};
+
+// Graphs are only compared by address, so fake pointers are enough
+static Graph* fakeGraph(int n) { return reinterpret_cast<Graph*>(quintptr(n * 16)); }
+
+TEST_METHOD(only_subscribed)
+{
+    TestListener listener({BusEvent::GraphUpdated});
+    EventBus::send({ .type = BusEvent::GraphAdded, .graph = fakeGraph(1) });
+    EventBus::send({ .type = BusEvent::GraphUpdated, .graph = fakeGraph(1) });
+    ASSERT_EQ_INT(listener.types.size(), 1);
+    ASSERT_IS_TRUE(listener.types.first() == BusEvent::GraphUpdated);
+}
+
+TEST_METHOD(batch_single_graph)
+{
+    TestListener listener({BusEvent::GraphUpdated, BusEvent::GraphsUpdated});
+    {
+        EventBus::Batch batch;
+        EventBus::send({ .type = BusEvent::GraphUpdated, .graph = fakeGraph(1) });
+        EventBus::send({ .type = BusEvent::GraphUpdated, .graph = fakeGraph(1) });
+        ASSERT_EQ_INT(listener.types.size(), 0);
+    }
+    ASSERT_EQ_INT(listener.types.size(), 1);
+    ASSERT_IS_TRUE(listener.types.first() == BusEvent::GraphUpdated);
+    ASSERT_IS_TRUE(listener.graphs.first() == fakeGraph(1));
+}
+
+TEST_METHOD(batch_many_graphs)
+{
+    TestListener listener({BusEvent::GraphUpdated, BusEvent::GraphsUpdated, BusEvent::ProjectModified});
+    {
+        EventBus::Batch batch;
+        for (int i = 1; i <= 3; i++) {
+            EventBus::Batch nested;
+            EventBus::send({ .type = BusEvent::GraphUpdated, .graph = fakeGraph(i) });
+            EventBus::send({ .type = BusEvent::GraphUpdated, .graph = fakeGraph(1) });
+            EventBus::send({ .type = BusEvent::ProjectModified });
+        }
+        ASSERT_EQ_INT(listener.types.size(), 0);
+    }
+    ASSERT_EQ_INT(listener.types.size(), 2);
+    ASSERT_IS_TRUE(listener.types.at(0) == BusEvent::GraphsUpdated);
+    ASSERT_IS_TRUE(listener.types.at(1) == BusEvent::ProjectModified);
+    ASSERT_EQ_INT(listener.graphs.size(), 3);
+}
+
+TEST_METHOD(batch_deleted_graph)
+{
+    TestListener listener({BusEvent::GraphUpdated, BusEvent::GraphsUpdated, BusEvent::GraphDeleting});
+    {
+        EventBus::Batch batch;
+        EventBus::send({ .type = BusEvent::GraphUpdated, .graph = fakeGraph(1) });
+        EventBus::send({ .type = BusEvent::GraphDeleting, .graph = fakeGraph(1) });
+        ASSERT_EQ_INT(listener.types.size(), 1);
+    }
+    ASSERT_EQ_INT(listener.types.size(), 1);
+    ASSERT_IS_TRUE(listener.types.first() == BusEvent::GraphDeleting);
+}
+
+TEST_METHOD(delete_listener_in_handler)
+{
+    // Listeners are notified in order of subscription
+    TestListener listener({BusEvent::DiagramDeleted});
+    auto other = new TestListener({BusEvent::DiagramDeleted});
+    listener.onEvent = [&other]{ delete other; other = nullptr; };
+    EventBus::send({ .type = BusEvent::DiagramDeleted });
+    ASSERT_EQ_INT(listener.types.size(), 1);
+    ASSERT_IS_TRUE(other == nullptr);
+}
+
+TEST_GROUP("Event Bus",
+    ADD_TEST(only_subscribed),
+    ADD_TEST(batch_single_graph),
+    ADD_TEST(batch_many_graphs),
+    ADD_TEST(batch_deleted_graph),
+    ADD_TEST(delete_listener_in_handler),
+)
+
+} // EventBusTests
+} // Tests
+} // Z
@@ -0,0 +1,145 @@
+#include "../core/Fft.h"
+
+#include "testing/OriTestBase.h"
+
+#include <QtMath>
+
+namespace Z {
+namespace Tests {
+namespace FftTests {
+
+// Direct calculation by the definition
+static ComplexValues dft(const ComplexValues &x)
+{
+    const qsizetype n = x.size();
+    ComplexValues r(n);
+    for (qsizetype k = 0; k < n; k++)
+        for (qsizetype j = 0; j < n; j++)
+            r[k] += x[j] * std::polar(1.0, -2.0 * M_PI * double((j * k) % n) / double(n));
+    return r;
+}
+
+static ComplexValues sample(qsizetype n)
+{
+    ComplexValues x(n);
+    for (qsizetype i = 0; i < n; i++)
+        x[i] = Complex(qSin(double(i) * 0.7) + double(i % 5), qCos(double(i) * 1.3));
+    return x;
+}
+
+static double maxDiff(const ComplexValues &a, const ComplexValues &b)
+{
+    double d = 0;
+    for (qsizetype i = 0; i < a.size(); i++)
+        d = qMax(d, std::abs(a[i] - b[i]));
+    return d;
+}
+
+TEST_METHOD(forward)
+{
+    for (qsizetype n : {1, 2, 3, 5, 8, 12, 17, 64, 100, 127})
+    {
+        auto x = sample(n);
+        auto y = x;
+        Fft::forward(y);
+        TEST_LOG(QString("size %1: %2").arg(n).arg(maxDiff(y, dft(x))))
+        ASSERT_IS_TRUE(maxDiff(y, dft(x)) < 1e-10)
+    }
+}
+
+TEST_METHOD(inverse)
+{
+    for (qsizetype n : {2, 7, 16, 1000, 1024})
+    {
+        auto x = sample(n);
+        auto y = x;
+        Fft::forward(y);
+        Fft::inverse(y);
+        ASSERT_IS_TRUE(maxDiff(y, x) < 1e-12)
+    }
+}
+
+TEST_METHOD(real)
+{
+    for (qsizetype n : {1, 2, 3, 4, 6, 9, 16, 30, 100, 128})
+    {
+        auto x = sample(n);
+        Values re(n);
+        for (qsizetype i = 0; i < n; i++)
+        {
+            re[i] = x[i].real();
+            x[i] = re[i];
+        }
+        auto spectrum = Fft::forwardReal(re);
+        ASSERT_EQ_INT(spectrum.size(), n / 2 + 1)
+        ASSERT_IS_TRUE(maxDiff(spectrum, dft(x).mid(0, n / 2 + 1)) < 1e-10)
+
+        auto back = Fft::inverseReal(spectrum, n);
+        ASSERT_EQ_INT(back.size(), n)
+        for (qsizetype i = 0; i < n; i++)
+        {
+            ASSERT_NEAR_DBL(back[i], re[i], 1e-12)
+        }
+    }
+}
+
+// Direct calculation by the definition
+static Values convolution(const Values &s, const Values &k)
+{
+    const qsizetype n = s.size(), m = k.size();
+    Values r(n + m - 1);
+    for (qsizetype i = 0; i < r.size(); i++)
+        for (qsizetype j = 0; j < m; j++)
+            if (i - j >= 0 && i - j < n)
+                r[i] += s[i - j] * k[j];
+    return r;
+}
+
+static Values realSample(qsizetype n)
+{
+    Values x(n);
+    for (qsizetype i = 0; i < n; i++)
+        x[i] = qSin(double(i) * 0.37) + double(i % 3);
+    return x;
+}
+
+TEST_METHOD(convolve)
+{
+    // Kernels up to 64 points are applied directly, larger ones via FFT
+    for (auto sizes : QVector<QPair<int, int>>{{1, 1}, {5, 3}, {3, 5}, {100, 64}, {1000, 65}, {5000, 999}, {70, 300}})
+    {
+        auto s = realSample(sizes.first);
+        auto k = realSample(sizes.second);
+        auto r = Fft::convolve(s, k);
+        auto expected = convolution(s, k);
+        ASSERT_EQ_INT(r.size(), expected.size())
+        for (qsizetype i = 0; i < r.size(); i++)
+        {
+            ASSERT_NEAR_DBL(r[i], expected[i], 1e-9)
+        }
+    }
+}
+
+TEST_METHOD(correlate)
+{
+    Values s = {0, 0, 1, 2, 3, 0, 0};
+    Values k = {1, 2, 3};
+    auto r = Fft::correlate(s, k);
+    ASSERT_EQ_INT(r.size(), 9)
+    // The best match is where the kernel is aligned with the same pattern
+    ASSERT_NEAR_DBL(r[4], 14, 1e-12)
+    ASSERT_NEAR_DBL(r[3], 8, 1e-12)
+    ASSERT_NEAR_DBL(r[5], 3, 1e-12)
+}
+
+TEST_GROUP("FFT",
+    ADD_TEST(forward),
+    ADD_TEST(inverse),
+    ADD_TEST(real),
+    ADD_TEST(convolve),
+    ADD_TEST(correlate),
+)
+
+} // namespace FftTests
+} // namespace Tests
+} // namespace Z
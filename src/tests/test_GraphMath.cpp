@@ -1,8 +1,12 @@
 #include "core/GraphMath.h"
+#include "core/Interpolator.h"
 
 #include "testing/OriTestBase.h"
 
 #include <QDebug>
+#include <QtMath>
+
+#include <algorithm>
 
 using namespace GraphMath;
 
@@ -33,7 +37,10 @@ TEST_METHOD(simple_with_points)
     m.points = 5;
     m.useStep = false;
     auto r = m.calc({xs, ys});
-    ASSERT_ARR_SAME(r.xs, xs);
+    ASSERT_ARR(r.xs, 5.0, 6.0, 7.0, 8.0, 9.0, 10.0);
+    ASSERT_ARR(r.ys, 17.0, 24.0, 35.0, 43.0, 45.0, 53.0);
+    m.compensated = true;
+    r = m.calc({xs, ys});
     ASSERT_ARR(r.ys, 17.0, 24.0, 35.0, 43.0, 45.0, 53.0);
 }
 
@@ -46,17 +53,62 @@ TEST_METHOD(simple_with_step)
     m.useStep = true;
     {
         auto r = m.calc({xs, ys});
-        ASSERT_ARR_SAME(r.xs, xs);
+        ASSERT_ARR(r.xs, 5.0, 6.0, 7.0, 8.0, 9.0, 10.0);
         ASSERT_ARR(r.ys,17.0, 24.0, 35.0, 43.0, 45.0, 53.0);
     }
     m.step = 6.5;
     {
         auto r = m.calc({xs, ys});
-        ASSERT_ARR_SAME(r.xs, xs);
+        ASSERT_ARR(r.xs, 6.0, 7.0, 8.0, 9.0, 10.0);
         ASSERT_ARR(r.ys, 21.666666666666664, 31.666666666666664, 37.5, 42.49999999999999, 47.5);
     }
 }
 
+TEST_METHOD(simple_with_step_irregular_x)
+{
+    Values xs = {0, 1.1, 1.9, 3.2, 4, 4.9, 6.1};
+    Values ys = {1, 2, 3, 4, 5, 6, 7};
+    MavgSimple m;
+    m.step = 2;
+    m.useStep = true;
+    auto r = m.calc({xs, ys});
+    ASSERT_ARR(r.xs, 1.1, 1.9, 3.2, 4.0, 4.9, 6.1);
+    ASSERT_ARR(r.ys, 1.5, 2.0, 3.5, 4.5, 5.0, 6.5);
+
+    // Points are sorted by X before averaging
+    Values xs1 = {4, 0, 6.1, 1.9, 1.1, 4.9, 3.2};
+    Values ys1 = {5, 1, 7, 3, 2, 6, 4};
+    r = m.calc({xs1, ys1});
+    ASSERT_ARR(r.xs, 1.1, 1.9, 3.2, 4.0, 4.9, 6.1);
+    ASSERT_ARR(r.ys, 1.5, 2.0, 3.5, 4.5, 5.0, 6.5);
+}
+
+TEST_METHOD(simple_uniform_x)
+{
+    Values ys = {10, 15, 10, 30, 20, 45, 70, 50, 40, 60};
+    MavgSimple m;
+    m.points = 5;
+    m.useStep = false;
+    auto r = m.calc(GraphPoints::uniform(1, 1, ys));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_DBL(r.x0, 5);
+    ASSERT_EQ_DBL(r.dx, 1);
+    ASSERT_ARR(r.ys, 17.0, 24.0, 35.0, 43.0, 45.0, 53.0);
+}
+
+TEST_METHOD(simple_uniform_x_with_step)
+{
+    // The window holds as many points as whole steps of X fit in it
+    Values ys = {10, 15, 10, 30, 20, 45, 70, 50, 40, 60};
+    MavgSimple m;
+    m.step = 5.5;
+    m.useStep = true;
+    auto r = m.calc(GraphPoints::uniform(1, 1, ys));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_DBL(r.x0, 5);
+    ASSERT_ARR(r.ys, 17.0, 24.0, 35.0, 43.0, 45.0, 53.0);
+}
+
 TEST_METHOD(cumulative)
 {
     Values xs = {1,  2,  3,  4,  5,  6,  7,  8,  9,  10};
@@ -83,6 +135,9 @@ TEST_METHOD(exponential)
 TEST_GROUP("MovingAverage",
     ADD_TEST(simple_with_points),
     ADD_TEST(simple_with_step),
+    ADD_TEST(simple_with_step_irregular_x),
+    ADD_TEST(simple_uniform_x),
+    ADD_TEST(simple_uniform_x_with_step),
     ADD_TEST(cumulative),
     ADD_TEST(exponential),
 )
@@ -104,17 +159,623 @@ TEST_METHOD(calc)
     ASSERT_ARR(r.ys, 1.0, 2.0, 4.0, 6.0, 7.0);
 }
 
+TEST_METHOD(uniform_x)
+{
+    Values ys = {0, 1, 4, 9, 16};
+    Derivative d;
+    d.mode = d.MODE_REFINED;
+    auto r = d.calc(GraphPoints::uniform(0, 1, ys));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_ARR(r.ys, 1.0, 2.0, 4.0, 6.0, 7.0);
+    d.mode = d.MODE_SIMPLE_TAU;
+    d.tau = 0.5;
+    r = d.calc(GraphPoints::uniform(0, 1, ys));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_ARR(r.ys, 2.0, 6.0, 10.0, 14.0);
+}
+
 TEST_GROUP("Derivative",
     ADD_TEST(calc),
+    ADD_TEST(uniform_x),
 )
 
 } // DerivativeTests
 
 //------------------------------------------------------------------------------
 
+namespace DecimateTests {
+
+TEST_METHOD(uniform_x)
+{
+    Values ys = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    Decimate d;
+    d.points = 3;
+    d.useStep = false;
+    auto r = d.calc(GraphPoints::uniform(0, 0.5, ys));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_DBL(r.dx, 1.5);
+    ASSERT_ARR(r.ys, 0.0, 3.0, 6.0, 9.0);
+    ASSERT_ARR_SAME(r.ys, d.calc(GraphPoints::uniform(0, 0.5, ys).explicitX()).ys);
+}
+
+static GraphPoints bucketSample()
+{
+    return {{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}, {0, 5, 1, -3, 2, 2, 9, 0, 1, 1}};
+}
+
+TEST_METHOD(min_max)
+{
+    Decimate d;
+    d.mode = d.MODE_MINMAX;
+    d.points = 4;
+    d.useStep = false;
+    auto r = d.calc(bucketSample());
+    ASSERT_IS_FALSE(r.uniformX);
+    ASSERT_ARR(r.xs, 1.0, 3.0, 6.0, 7.0, 8.0);
+    ASSERT_ARR(r.ys, 5.0, -3.0, 9.0, 0.0, 1.0);
+
+    // Buckets of X step give the same on uniform X
+    d.useStep = true;
+    d.step = 2;
+    r = d.calc(GraphPoints::uniform(0, 0.5, bucketSample().ys));
+    ASSERT_ARR(r.xs, 0.5, 1.5, 3.0, 3.5, 4.0);
+    ASSERT_ARR(r.ys, 5.0, -3.0, 9.0, 0.0, 1.0);
+}
+
+TEST_METHOD(m4)
+{
+    Decimate d;
+    d.mode = d.MODE_M4;
+    d.points = 4;
+    d.useStep = false;
+    auto r = d.calc(bucketSample());
+    ASSERT_ARR(r.xs, 0.0, 1.0, 3.0, 4.0, 6.0, 7.0, 8.0, 9.0);
+    ASSERT_ARR(r.ys, 0.0, 5.0, -3.0, 2.0, 9.0, 0.0, 1.0, 1.0);
+
+    // Unsorted points are sorted by X
+    auto data = bucketSample();
+    std::reverse(data.xs.begin(), data.xs.end());
+    std::reverse(data.ys.begin(), data.ys.end());
+    ASSERT_ARR_SAME(d.calc(data).ys, r.ys);
+}
+
+// Straightforward Largest-Triangle-Three-Buckets over buckets of `points` points
+static GraphPoints lttbReference(const GraphPoints &data, int points)
+{
+    const int count = data.size();
+    QVector<int> starts;
+    for (int i = 1; i < count - 1; i += points)
+        starts << i;
+    starts << count - 1;
+    GraphPoints r;
+    r.xs << data.xs.first();
+    r.ys << data.ys.first();
+    int a = 0;
+    for (int b = 0; b < starts.size() - 1; b++) {
+        double xc = data.xs.last(), yc = data.ys.last();
+        if (b + 2 < starts.size()) {
+            xc = yc = 0;
+            for (int i = starts[b+1]; i < starts[b+2]; i++) {
+                xc += data.xs[i];
+                yc += data.ys[i];
+            }
+            xc /= starts[b+2] - starts[b+1];
+            yc /= starts[b+2] - starts[b+1];
+        }
+        int best = starts[b];
+        double bestArea = -1;
+        for (int i = starts[b]; i < starts[b+1]; i++) {
+            double area = qAbs((data.xs[a] - xc) * (data.ys[i] - data.ys[a]) - (data.xs[a] - data.xs[i]) * (yc - data.ys[a]));
+            if (area > bestArea) {
+                bestArea = area;
+                best = i;
+            }
+        }
+        r.xs << data.xs[best];
+        r.ys << data.ys[best];
+        a = best;
+    }
+    r.xs << data.xs.last();
+    r.ys << data.ys.last();
+    return r;
+}
+
+TEST_METHOD(lttb)
+{
+    // Enough buckets for several threads
+    Values xs, ys;
+    for (int i = 0; i < 100003; i++) {
+        xs << i * 0.25;
+        ys << qSin(i * 0.013) + qSin(i * 7.1) * 0.3 + (i == 5000 ? 50 : 0);
+    }
+    Decimate d;
+    d.mode = d.MODE_LTTB;
+    d.points = 37;
+    d.useStep = false;
+    auto r = d.calc({xs, ys});
+    auto expected = lttbReference({xs, ys}, 37);
+    ASSERT_EQ_INT(r.size(), 2 + 100001 / 37 + 1);
+    ASSERT_ARR_SAME(r.xs, expected.xs);
+    ASSERT_ARR_SAME(r.ys, expected.ys);
+    // The spike is not lost
+    ASSERT_IS_TRUE(r.ys.contains(ys[5000]));
+
+    // The same buckets by X step
+    d.useStep = true;
+    d.step = 37 * 0.25;
+    r = d.calc(GraphPoints::uniform(0, 0.25, ys));
+    ASSERT_ARR_SAME(r.xs, expected.xs);
+    ASSERT_ARR_SAME(r.ys, expected.ys);
+}
+
+TEST_GROUP("Decimate",
+    ADD_TEST(uniform_x),
+    ADD_TEST(min_max),
+    ADD_TEST(m4),
+    ADD_TEST(lttb),
+)
+
+} // DecimateTests
+
+//------------------------------------------------------------------------------
+
+namespace DespikeTests {
+
+TEST_METHOD(calc)
+{
+    Values xs = {0, 1, 2, 3, 4, 5, 6};
+    Values ys = {1, 1, 1, 100, 1, -100, 1};
+    Despike d;
+    d.mode = d.MODE_ABS;
+    d.min = 0;
+    d.max = 10;
+    d.seed = 0; // the first visited point is not a spike
+    auto r = d.calc({xs, ys});
+    ASSERT_ARR_SAME(r.xs, xs);
+    ASSERT_ARR(r.ys, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0);
+    d.mode = d.MODE_REL;
+    r = d.calc({xs, ys});
+    ASSERT_ARR(r.ys, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0);
+}
+
+TEST_METHOD(is_repeatable)
+{
+    Values xs, ys;
+    for (int i = 0; i < 1000; i++)
+    {
+        xs << i;
+        ys << (i % 7 == 0 ? 10 : 1) + i * 0.01;
+    }
+    Despike d;
+    d.mode = d.MODE_REL;
+    d.min = 20;
+    d.max = 20;
+    d.seed = 42;
+    auto r1 = d.calc({xs, ys});
+    auto r2 = d.calc({xs, ys});
+    ASSERT_ARR_SAME(r1.ys, r2.ys);
+    d.seed = 43;
+    auto r3 = d.calc({xs, ys});
+    ASSERT_IS_FALSE(r1.ys == r3.ys);
+}
+
+TEST_METHOD(empty)
+{
+    Despike d;
+    d.mode = d.MODE_ABS;
+    d.min = 0;
+    d.max = 10;
+    auto r = d.calc({{}, {}});
+    ASSERT_EQ_INT(r.ys.size(), 0);
+}
+
+TEST_GROUP("Despike",
+    ADD_TEST(calc),
+    ADD_TEST(is_repeatable),
+    ADD_TEST(empty),
+)
+
+} // DespikeTests
+
+//------------------------------------------------------------------------------
+
+namespace MedianTests {
+
+TEST_METHOD(with_points)
+{
+    Values xs = {1, 2, 3, 4, 5,   6, 7, 8};
+    Values ys = {1, 9, 2, 3, 100, 4, 5, 6};
+    Median m;
+    m.points = 3;
+    m.useStep = false;
+    auto r = m.calc({xs, ys});
+    ASSERT_ARR(r.xs, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0);
+    ASSERT_ARR(r.ys, 2.0, 3.0, 3.0, 4.0, 5.0, 5.0);
+
+    // Even window gives the mean of two middle values
+    m.points = 4;
+    r = m.calc({xs, ys});
+    ASSERT_ARR(r.xs, 4.0, 5.0, 6.0, 7.0, 8.0);
+    ASSERT_ARR(r.ys, 2.5, 6.0, 3.5, 4.5, 5.5);
+}
+
+TEST_METHOD(with_step_irregular_x)
+{
+    Values xs = {0, 1.1, 1.9, 3.2, 4, 4.9, 6.1};
+    Values ys = {1, 2,   30,  4,   5, 6,   7};
+    Median m;
+    m.step = 2;
+    m.useStep = true;
+    auto r = m.calc({xs, ys});
+    ASSERT_ARR(r.xs, 1.1, 1.9, 3.2, 4.0, 4.9, 6.1);
+    ASSERT_ARR(r.ys, 1.5, 2.0, 17.0, 4.5, 5.0, 6.5);
+
+    // Points are sorted by X before filtering
+    Values xs1 = {4, 0, 6.1, 1.9, 1.1, 4.9, 3.2};
+    Values ys1 = {5, 1, 7,   30,  2,   6,   4};
+    r = m.calc({xs1, ys1});
+    ASSERT_ARR(r.xs, 1.1, 1.9, 3.2, 4.0, 4.9, 6.1);
+    ASSERT_ARR(r.ys, 1.5, 2.0, 17.0, 4.5, 5.0, 6.5);
+}
+
+TEST_METHOD(uniform_x)
+{
+    Median m;
+    m.points = 3;
+    m.useStep = false;
+    auto r = m.calc(GraphPoints::uniform(1, 1, {1, 9, 2, 3, 100, 4, 5, 6}));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_DBL(r.x0, 3);
+    ASSERT_EQ_DBL(r.dx, 1);
+    ASSERT_ARR(r.ys, 2.0, 3.0, 3.0, 4.0, 5.0, 5.0);
+}
+
+TEST_METHOD(long_graph)
+{
+    // Several blocks are processed in parallel, results must match at their joints
+    const int count = 100000;
+    Values ys(count);
+    for (int i = 0; i < count; i++)
+        ys[i] = (i * 7919) % 101;
+    Median m;
+    m.points = 11;
+    m.useStep = false;
+    auto r = m.calc(GraphPoints::uniform(0, 1, ys));
+    ASSERT_EQ_INT(r.ys.size(), count - 10);
+    for (int i = 10; i < count; i += 997) {
+        Values w = ys.mid(i - 10, 11);
+        std::sort(w.begin(), w.end());
+        ASSERT_EQ_DBL(r.ys[i - 10], w[5]);
+    }
+}
+
+TEST_GROUP("Median",
+    ADD_TEST(with_points),
+    ADD_TEST(with_step_irregular_x),
+    ADD_TEST(uniform_x),
+    ADD_TEST(long_graph),
+)
+
+} // MedianTests
+
+//------------------------------------------------------------------------------
+
+namespace SavGolTests {
+
+TEST_METHOD(coefficients)
+{
+    // Known tables, e.g. from the original paper
+    ASSERT_ARR(SavGol::coefficients(2, 2, 0), -3.0/35, 12.0/35, 17.0/35, 12.0/35, -3.0/35);
+    ASSERT_ARR(SavGol::coefficients(2, 2, 1), -0.2, -0.1, 0.0, 0.1, 0.2);
+    ASSERT_ARR(SavGol::coefficients(3, 2, 2), 5.0/42, 0.0, -3.0/42, -4.0/42, -3.0/42, 0.0, 5.0/42);
+    ASSERT_ARR(SavGol::coefficients(2, 3, 3), -0.5, 1.0, 0.0, -1.0, 0.5);
+}
+
+static double cubic(double x) { return x*x*x - 2*x; }
+
+TEST_METHOD(cubic_uniform_x)
+{
+    // Cubic polynomial is fitted exactly, so are its derivatives
+    Values ys;
+    for (int i = 0; i < 20; i++)
+        ys << cubic(0.5 * i);
+    SavGol s;
+    s.points = 7;
+    s.order = 3;
+    s.deriv = 0;
+    auto r = s.calc(GraphPoints::uniform(0, 0.5, ys));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_INT(r.size(), 14);
+    ASSERT_EQ_DBL(r.x0, 1.5);
+    ASSERT_NEAR_DBL(r.ys[0], cubic(1.5), 1e-9);
+    s.deriv = 1;
+    r = s.calc(GraphPoints::uniform(0, 0.5, ys));
+    ASSERT_NEAR_DBL(r.ys[0], 3*1.5*1.5 - 2, 1e-9);
+    s.deriv = 2;
+    r = s.calc(GraphPoints::uniform(0, 0.5, ys));
+    ASSERT_NEAR_DBL(r.ys[5], 6*4.0, 1e-9);
+    s.deriv = 3;
+    r = s.calc(GraphPoints::uniform(0, 0.5, ys));
+    ASSERT_NEAR_DBL(r.ys[13], 6, 1e-9);
+}
+
+TEST_METHOD(cubic_irregular_x)
+{
+    Values xs, ys;
+    double x = 0;
+    for (int i = 0; i < 20; i++) {
+        x += 0.3 + 0.1 * (i % 4);
+        xs << x;
+        ys << cubic(x);
+    }
+    SavGol s;
+    s.points = 7;
+    s.order = 3;
+    s.deriv = 1;
+    auto r = s.calc({xs, ys});
+    ASSERT_EQ_INT(r.size(), 14);
+    for (int i = 0; i < r.size(); i++) {
+        ASSERT_EQ_DBL(r.xs[i], xs[i+3]);
+        ASSERT_NEAR_DBL(r.ys[i], 3*xs[i+3]*xs[i+3] - 2, 1e-9);
+    }
+}
+
+TEST_GROUP("SavGol",
+    ADD_TEST(coefficients),
+    ADD_TEST(cubic_uniform_x),
+    ADD_TEST(cubic_irregular_x),
+)
+
+} // SavGolTests
+
+//------------------------------------------------------------------------------
+
+namespace ResampleTests {
+
+TEST_METHOD(by_points_and_step)
+{
+    Values xs = {0, 1, 3, 4, 10};
+    Values ys = {0, 1, 3, 4, 10};
+    Resample r;
+    r.method = r.METHOD_LINEAR;
+    r.points = 11;
+    r.useStep = false;
+    auto res = r.calc({xs, ys});
+    ASSERT_IS_TRUE(res.uniformX);
+    ASSERT_EQ_DBL(res.x0, 0);
+    ASSERT_EQ_DBL(res.dx, 1);
+    ASSERT_ARR(res.ys, 0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0, 10.0);
+
+    // The last step doesn't fit in the range
+    r.useStep = true;
+    r.step = 3;
+    res = r.calc({xs, ys});
+    ASSERT_EQ_DBL(res.dx, 3);
+    ASSERT_ARR(res.ys, 0.0, 3.0, 6.0, 9.0);
+}
+
+TEST_GROUP("Resample",
+    ADD_TEST(by_points_and_step),
+)
+
+} // ResampleTests
+
+//------------------------------------------------------------------------------
+
+namespace SpectrumTests {
+
+static Values sine(int count, double dx)
+{
+    // Offset 1 plus sine of amplitude 3 at frequency 5
+    Values ys(count);
+    for (int i = 0; i < count; i++)
+        ys[i] = 1 + 3 * qSin(2 * M_PI * 5 * i * dx);
+    return ys;
+}
+
+TEST_METHOD(amplitude)
+{
+    Spectrum s;
+    s.mode = s.MODE_AMPLITUDE;
+    s.window = s.WINDOW_NONE;
+    s.padding = 0;
+    auto r = s.calc(GraphPoints::uniform(0, 0.01, sine(1000, 0.01)));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_INT(r.ys.size(), 501);
+    ASSERT_EQ_DBL(r.x0, 0);
+    ASSERT_NEAR_DBL(r.dx, 0.1, 1e-12);
+    ASSERT_NEAR_DBL(r.ys[0], 1, 1e-9);
+    ASSERT_NEAR_DBL(r.ys[50], 3, 1e-9);
+    ASSERT_NEAR_DBL(r.ys[49], 0, 1e-9);
+
+    // Window gain is compensated
+    s.window = s.WINDOW_HANN;
+    r = s.calc(GraphPoints::uniform(0, 0.01, sine(1000, 0.01)));
+    ASSERT_NEAR_DBL(r.ys[50], 3, 1e-9);
+
+    s.mode = s.MODE_POWER;
+    r = s.calc(GraphPoints::uniform(0, 0.01, sine(1000, 0.01)));
+    ASSERT_NEAR_DBL(r.ys[50], 9, 1e-9);
+}
+
+TEST_METHOD(padding)
+{
+    Spectrum s;
+    s.mode = s.MODE_AMPLITUDE;
+    s.window = s.WINDOW_NONE;
+    s.padding = 2;
+    auto r = s.calc(GraphPoints::uniform(0, 0.01, sine(1000, 0.01)));
+    ASSERT_EQ_INT(r.ys.size(), 1025);
+    ASSERT_NEAR_DBL(r.dx, 100.0 / 2048, 1e-12);
+}
+
+TEST_METHOD(non_uniform_x)
+{
+    Spectrum s;
+    s.mode = s.MODE_AMPLITUDE;
+    s.window = s.WINDOW_NONE;
+    s.padding = 0;
+    auto u = GraphPoints::uniform(0, 0.01, sine(1000, 0.01));
+    auto r = s.calc(u.explicitX());
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_INT(r.ys.size(), 501);
+    ASSERT_NEAR_DBL(r.ys[50], 3, 1e-6);
+}
+
+TEST_GROUP("Spectrum",
+    ADD_TEST(amplitude),
+    ADD_TEST(padding),
+    ADD_TEST(non_uniform_x),
+)
+
+} // SpectrumTests
+
+//------------------------------------------------------------------------------
+
+namespace ConvolveTests {
+
+TEST_METHOD(custom_kernel)
+{
+    Convolve c;
+    c.operation = c.OP_CONVOLUTION;
+    c.kernel = c.KERNEL_CUSTOM;
+    c.customKernel = {1, 2, 3};
+    c.normalize = false;
+    Values xs = {0, 1, 2, 3, 4, 5};
+    Values ys = {0, 0, 1, 0, 0, 0};
+    auto r = c.calc({xs, ys});
+    ASSERT_ARR(r.xs, 1.0, 2.0, 3.0, 4.0);
+    ASSERT_ARR(r.ys, 1.0, 2.0, 3.0, 0.0);
+
+    c.operation = c.OP_CORRELATION;
+    r = c.calc({xs, ys});
+    ASSERT_ARR(r.xs, 1.0, 2.0, 3.0, 4.0);
+    ASSERT_ARR(r.ys, 3.0, 2.0, 1.0, 0.0);
+
+    c.normalize = true;
+    r = c.calc({xs, ys});
+    ASSERT_ARR(r.ys, 0.5, 1.0/3.0, 1.0/6.0, 0.0);
+}
+
+TEST_METHOD(uniform_x)
+{
+    Convolve c;
+    c.operation = c.OP_CONVOLUTION;
+    c.kernel = c.KERNEL_CUSTOM;
+    c.customKernel = {1, 2, 3};
+    c.normalize = false;
+    auto r = c.calc(GraphPoints::uniform(0, 1, {0, 0, 1, 0, 0, 0}));
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_DBL(r.x0, 1);
+    ASSERT_EQ_DBL(r.dx, 1);
+    ASSERT_ARR(r.ys, 1.0, 2.0, 3.0, 0.0);
+}
+
+TEST_METHOD(savgol_kernel)
+{
+    Convolve c;
+    c.kernel = c.KERNEL_SAVGOL;
+    c.points = 5;
+    auto k = c.makeKernel();
+    ASSERT_ARR(k, -3.0/35, 12.0/35, 17.0/35, 12.0/35, -3.0/35);
+}
+
+TEST_METHOD(gaussian_kernel)
+{
+    Convolve c;
+    c.kernel = c.KERNEL_GAUSSIAN;
+    c.points = 31;
+    auto k = c.makeKernel();
+    ASSERT_EQ_INT(k.size(), 31);
+    double sum = 0;
+    for (auto v : k) sum += v;
+    ASSERT_NEAR_DBL(sum, 1, 1e-12);
+    ASSERT_NEAR_DBL(k[0], k[30], 1e-15);
+    ASSERT_IS_TRUE(k[15] > k[14]);
+}
+
+TEST_GROUP("Convolve",
+    ADD_TEST(custom_kernel),
+    ADD_TEST(uniform_x),
+    ADD_TEST(savgol_kernel),
+    ADD_TEST(gaussian_kernel),
+)
+
+} // ConvolveTests
+
+//------------------------------------------------------------------------------
+
+namespace ArithmeticTests {
+
+TEST_METHOD(operations)
+{
+    // Reference has other X and doesn't cover the first and the last points
+    Z::Interpolator ref({{0.5, 1.5, 2.5, 3.5}, {1, 2, 3, 4}}, Z::Interpolator::LINEAR);
+    Values xs = {0, 1, 2, 3, 4};
+    Values ys = {5, 5, 5, 5, 5};
+    Arithmetic a;
+    a.operation = a.OP_SUB;
+    auto r = a.calc({xs, ys}, ref);
+    ASSERT_ARR(r.xs, 1.0, 2.0, 3.0);
+    ASSERT_ARR(r.ys, 3.5, 2.5, 1.5);
+    a.operation = a.OP_ADD;
+    r = a.calc({xs, ys}, ref);
+    ASSERT_ARR(r.ys, 6.5, 7.5, 8.5);
+    a.operation = a.OP_MUL;
+    r = a.calc({xs, ys}, ref);
+    ASSERT_ARR(r.ys, 7.5, 12.5, 17.5);
+    a.operation = a.OP_DIV;
+    r = a.calc({xs, ys}, ref);
+    ASSERT_ARR(r.ys, 5.0/1.5, 2.0, 5.0/3.5);
+    a.operation = a.OP_RATIO;
+    r = a.calc({xs, ys}, ref);
+    ASSERT_ARR(r.ys, 3.5/1.5, 1.0, 1.5/3.5);
+}
+
+TEST_METHOD(uniform_x)
+{
+    Z::Interpolator ref({{0.5, 3.5}, {1, 4}}, Z::Interpolator::LINEAR);
+    Arithmetic a;
+    a.operation = a.OP_SUB;
+    auto r = a.calc(GraphPoints::uniform(0, 1, {5, 5, 5, 5, 5}), ref);
+    ASSERT_IS_TRUE(r.uniformX);
+    ASSERT_EQ_DBL(r.x0, 1);
+    ASSERT_EQ_DBL(r.dx, 1);
+    ASSERT_ARR(r.ys, 3.5, 2.5, 1.5);
+}
+
+TEST_METHOD(division_by_zero)
+{
+    Z::Interpolator ref({{0, 1, 2}, {1, 0, 1}}, Z::Interpolator::LINEAR);
+    Arithmetic a;
+    a.operation = a.OP_DIV;
+    auto r = a.calc(GraphPoints::uniform(0, 1, {2, 2, 2}), ref);
+    ASSERT_IS_FALSE(r.uniformX);
+    ASSERT_ARR(r.xs, 0.0, 2.0);
+    ASSERT_ARR(r.ys, 2.0, 2.0);
+}
+
+TEST_GROUP("Arithmetic",
+    ADD_TEST(operations),
+    ADD_TEST(uniform_x),
+    ADD_TEST(division_by_zero),
+)
+
+} // ArithmeticTests
+
+//------------------------------------------------------------------------------
+
 TEST_GROUP("Graph Math",
     ADD_GROUP(MovingAverageTests),
     ADD_GROUP(DerivativeTests),
+    ADD_GROUP(DecimateTests),
+    ADD_GROUP(ResampleTests),
+    ADD_GROUP(DespikeTests),
+    ADD_GROUP(MedianTests),
+    ADD_GROUP(SavGolTests),
+    ADD_GROUP(SpectrumTests),
+    ADD_GROUP(ConvolveTests),
+    ADD_GROUP(ArithmeticTests),
 )
 
 
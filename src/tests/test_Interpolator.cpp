@@ -0,0 +1,121 @@
+#include "core/Interpolator.h"
+
+#include "testing/OriTestBase.h"
+
+#include <QtMath>
+
+namespace Z {
+namespace Tests {
+namespace InterpolatorTests {
+
+static GraphPoints cubes()
+{
+    return {{0, 1, 2, 3, 4, 5}, {0, 1, 8, 27, 64, 125}};
+}
+
+TEST_METHOD(linear)
+{
+    Interpolator ip(cubes(), Interpolator::LINEAR);
+    ASSERT_IS_TRUE(ip.isValid())
+    ASSERT_EQ_DBL(ip.minX(), 0)
+    ASSERT_EQ_DBL(ip.maxX(), 5)
+    ASSERT_NEAR_DBL(ip.value(0.4), 0.4, 1e-12)
+    ASSERT_NEAR_DBL(ip.value(1.5), 4.5, 1e-12)
+    ASSERT_NEAR_DBL(ip.value(4.9), 118.9, 1e-12)
+    // End values outside of the range
+    ASSERT_EQ_DBL(ip.value(-1), 0)
+    ASSERT_EQ_DBL(ip.value(7), 125)
+}
+
+TEST_METHOD(nearest)
+{
+    Interpolator ip(cubes(), Interpolator::NEAREST);
+    ASSERT_EQ_DBL(ip.value(0.4), 0)
+    ASSERT_EQ_DBL(ip.value(0.6), 1)
+    ASSERT_EQ_DBL(ip.value(4.9), 125)
+}
+
+TEST_METHOD(spline)
+{
+    Interpolator ip(cubes(), Interpolator::SPLINE);
+    for (int i = 0; i <= 5; i++) {
+        ASSERT_NEAR_DBL(ip.value(i), i*i*i, 1e-12)
+    }
+    // Smooth first derivative at points
+    const double h = 1e-6;
+    for (double x : {1.0, 2.0, 3.0, 4.0}) {
+        const double left = (ip.value(x) - ip.value(x - h)) / h;
+        const double right = (ip.value(x + h) - ip.value(x)) / h;
+        ASSERT_NEAR_DBL(left, right, 1e-4)
+    }
+    // Natural spline is straight at ends
+    const double d2 = (ip.value(0.002) - 2*ip.value(0.001) + ip.value(0)) / 1e-6;
+    ASSERT_NEAR_DBL(d2, 0, 1e-2)
+}
+
+TEST_METHOD(akima)
+{
+    // Straight line is kept exactly
+    Interpolator line({{0, 1, 2, 4, 7}, {1, 3, 5, 9, 15}}, Interpolator::AKIMA);
+    ASSERT_NEAR_DBL(line.value(3), 7, 1e-12)
+    ASSERT_NEAR_DBL(line.value(5.5), 12, 1e-12)
+
+    // Step doesn't make overshoots
+    Interpolator step({{0, 1, 2, 3, 4, 5}, {0, 0, 0, 1, 1, 1}}, Interpolator::AKIMA);
+    for (double x = 0; x <= 5; x += 0.01) {
+        const double y = step.value(x);
+        ASSERT_IS_TRUE(y >= 0 && y <= 1)
+    }
+}
+
+TEST_METHOD(unsorted_and_duplicates)
+{
+    // Points having the same X are averaged
+    Interpolator ip({{2, 0, 1, 1}, {4, 0, 1, 3}}, Interpolator::LINEAR);
+    ASSERT_EQ_DBL(ip.value(1), 2)
+    ASSERT_EQ_DBL(ip.value(1.5), 3)
+}
+
+TEST_METHOD(values_on_grid)
+{
+    Values ys(100000);
+    for (int i = 0; i < ys.size(); i++)
+        ys[i] = qSin(i * 0.01);
+    Interpolator ip(GraphPoints::uniform(0, 1, ys), Interpolator::SPLINE);
+
+    // Sorted grid is traversed, unsorted one is searched, results are the same
+    Values xs(50000);
+    for (int i = 0; i < xs.size(); i++)
+        xs[i] = i * 1.9 - 3;
+    auto sorted = ip.values(xs);
+    auto uniform = ip.values(-3, 1.9, xs.size());
+    std::swap(xs[0], xs[xs.size() - 1]);
+    auto unsorted = ip.values(xs);
+    ASSERT_EQ_INT(sorted.size(), xs.size())
+    for (int i = 1; i < xs.size() - 1; i++) {
+        ASSERT_EQ_DBL(sorted[i], unsorted[i])
+        ASSERT_EQ_DBL(sorted[i], uniform[i])
+        ASSERT_EQ_DBL(sorted[i], ip.value(i * 1.9 - 3))
+    }
+}
+
+TEST_METHOD(invalid)
+{
+    Interpolator ip({}, Interpolator::LINEAR);
+    ASSERT_IS_FALSE(ip.isValid())
+    ASSERT_IS_TRUE(qIsNaN(ip.value(1)))
+}
+
+TEST_GROUP("Interpolator",
+    ADD_TEST(linear),
+    ADD_TEST(nearest),
+    ADD_TEST(spline),
+    ADD_TEST(akima),
+    ADD_TEST(unsorted_and_duplicates),
+    ADD_TEST(values_on_grid),
+    ADD_TEST(invalid),
+)
+
+} // namespace InterpolatorTests
+} // namespace Tests
+} // namespace Z
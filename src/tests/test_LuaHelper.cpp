@@ -2,6 +2,8 @@
 
 #include "testing/OriTestBase.h"
 
+#include <QtMath>
+
 namespace Z {
 namespace Tests {
 namespace LuaHelperTests {
@@ -230,6 +232,234 @@ TEST_METHOD(can_get_global_arrays)
     ASSERT_EQ_LIST(resY.result(), y)
 }
 
+TEST_METHOD(can_use_native_arrays)
+{
+    OPEN_LUA(lua)
+
+    lua.setCode("X = array(3); for i = 1, #X do X[i] = i end; X[#X+1] = 4; Y = array({5, 6, 7, 8})");
+    ASSERT_EQ_STR(lua.execute(), "")
+
+    auto resX = lua.getGlobalArray("X");
+    ASSERT_IS_TRUE(resX.ok())
+    QVector<int> x{1, 2, 3, 4};
+    ASSERT_EQ_LIST(resX.result(), x)
+
+    auto resY = lua.getGlobalArray("Y");
+    ASSERT_IS_TRUE(resY.ok())
+    QVector<int> y{5, 6, 7, 8};
+    ASSERT_EQ_LIST(resY.result(), y)
+
+    lua.setGlobalArray("A", {1, 2, 3});
+    ASSERT_LUA_CALC(lua, "A[2] + #A", 5)
+    ASSERT_LUA_CALC(lua, "A[4] == nil and 1 or 0", 1)
+
+    lua.setCode("A[10] = 1");
+    ASSERT_IS_FALSE(lua.execute().isEmpty())
+
+    // Without memory limit an array QVector can't hold is an ordinary error
+    lua.setCode("ok = pcall(array, 1 << 40) and 1 or 0");
+    ASSERT_LUA_EXEC(lua, "ok", 0)
+    ASSERT_EQ_STR(lua.setCode("a = array(1 << 40)"), "")
+    ASSERT_IS_FALSE(lua.execute().isEmpty())
+}
+
+TEST_METHOD(can_use_array_functions)
+{
+    OPEN_LUA(lua)
+
+    lua.setCode(
+        "X = linspace(0, 1, 5)\n"
+        "Y = sqrt({1, 4, 9, 16, 25}) * 2 - X / 0.25 + 1\n"
+        "R = range(1, 2, 0.25)\n"
+        "C = cumsum(-R)\n"
+        "D = diff(R ^ 2)\n"
+        "s = sum(Y)\n");
+    ASSERT_EQ_STR(lua.execute(), "")
+
+    auto resX = lua.getGlobalArray("X");
+    ASSERT_IS_TRUE(resX.ok())
+    ASSERT_EQ_LIST(resX.result(), QVector<double>({0, 0.25, 0.5, 0.75, 1}))
+
+    auto resY = lua.getGlobalArray("Y");
+    ASSERT_IS_TRUE(resY.ok())
+    ASSERT_EQ_LIST(resY.result(), QVector<double>({3, 4, 5, 6, 7}))
+
+    auto resR = lua.getGlobalArray("R");
+    ASSERT_IS_TRUE(resR.ok())
+    ASSERT_EQ_LIST(resR.result(), QVector<double>({1, 1.25, 1.5, 1.75, 2}))
+
+    auto resC = lua.getGlobalArray("C");
+    ASSERT_IS_TRUE(resC.ok())
+    ASSERT_EQ_LIST(resC.result(), QVector<double>({-1, -2.25, -3.75, -5.5, -7.5}))
+
+    auto resD = lua.getGlobalArray("D");
+    ASSERT_IS_TRUE(resD.ok())
+    ASSERT_EQ_LIST(resD.result(), QVector<double>({0.5625, 0.6875, 0.8125, 0.9375}))
+
+    ASSERT_EQ_DBL(lua.getGlobalVar("s").result(), 25)
+    ASSERT_LUA_CALC(lua, "sin(0)", 0)
+    ASSERT_LUA_CALC(lua, "#range(3, 1)", 0)
+    ASSERT_LUA_CALC(lua, "#range(3, 1, -1)", 3)
+
+    lua.setCode("Z = array(3) + array(4)");
+    ASSERT_IS_FALSE(lua.execute().isEmpty())
+
+    // Huge results are ordinary errors even without memory limit
+    ASSERT_LUA_CALC(lua, "pcall(linspace, 0, 1, 1 << 40) and 1 or 0", 0)
+    ASSERT_LUA_CALC(lua, "pcall(range, 0, 1 << 40) and 1 or 0", 0)
+}
+
+TEST_METHOD(cached_code_uses_current_globals)
+{
+    OPEN_LUA(lua)
+
+    lua.setGlobalVar("a", 2);
+    ASSERT_LUA_CALC(lua, "a * a", 4)
+    lua.setGlobalVar("a", 3);
+    ASSERT_LUA_CALC(lua, "a * a", 9)
+
+    for (int i = 1; i <= 3; i++)
+    {
+        lua.setGlobalVar("b", i);
+        ASSERT_EQ_STR(lua.setCode("res = b + 1"), "")
+        ASSERT_LUA_EXEC(lua, "res", i + 1)
+    }
+
+    // Code never gets a chunk cached for a formula
+    ASSERT_LUA_CALC(lua, "a + 1", 4)
+    ASSERT_IS_FALSE(lua.setCode("=a + 1").isEmpty())
+}
+
+TEST_METHOD(execution_limits)
+{
+    OPEN_LUA(lua)
+
+    lua.setLimits({ .instructions = 100000 });
+    lua.setCode("while true do end");
+    ASSERT_EQ_STR(lua.execute(), "Formula exceeds the limit of 100000 instructions")
+
+    // Interruption can't be suppressed by user code
+    lua.setCode("while true do pcall(function() while true do end end) end");
+    ASSERT_EQ_STR(lua.execute(), "Formula exceeds the limit of 100000 instructions")
+    lua.setCode("while true do pcall(function() while true do xpcall(function() while true do end end, "
+        "function() while true do end end) end end) end");
+    ASSERT_EQ_STR(lua.execute(), "Formula exceeds the limit of 100000 instructions")
+
+    std::atomic<bool> cancel{true};
+    lua.setLimits({ .cancel = &cancel });
+    lua.setCode("while true do end");
+    ASSERT_EQ_STR(lua.execute(), "Calculation has been cancelled")
+
+    lua.setLimits({ .memoryMb = 1 });
+    lua.setCode("t = {} for i = 1, 1000000 do t[i] = i end");
+    ASSERT_EQ_STR(lua.execute(), "Formula exceeds the memory limit of 1 MB")
+
+    // Finalizers run without hooks, so user code can't make them
+    lua.setLimits({ .instructions = 100000 });
+    for (auto code : {
+        "t = setmetatable({}, { __gc = function() while true do end end }) t = nil collectgarbage()",
+        "t = setmetatable({}, { __gc = true })",
+        "t = debug.setmetatable({}, { __gc = function() while true do end end })",
+    }) {
+        TEST_LOG(code)
+        lua.setCode(code);
+        auto err = lua.execute();
+        ASSERT_IS_TRUE(err.endsWith("finalizers (__gc) are not allowed in formulas"))
+    }
+    // Neither the hook nor the protected metatable of arrays can be reached
+    ASSERT_LUA_CALC(lua, "(debug.sethook == nil and debug.getregistry == nil and debug.getmetatable == nil) and 1 or 0", 1)
+    lua.setCode("debug.setmetatable(array(1), {})");
+    ASSERT_IS_TRUE(lua.execute().endsWith("cannot change metatable of native arrays"))
+    // Other metatables are still allowed
+    ASSERT_LUA_CALC(lua, "setmetatable({}, { __index = function() return 5 end }).x", 5)
+
+    lua.setLimits({});
+    ASSERT_LUA_CALC(lua, "2+2", 4)
+}
+
+TEST_METHOD(reports_peak_memory)
+{
+    Z::Lua lua;
+    ASSERT_EQ_STR(lua.open(), "")
+
+    Z::Lua::Stats tableStats;
+    lua.setLimits({ .stats = &tableStats });
+    lua.setCode("t = {} for i = 1, 100000 do t[i] = i end");
+    ASSERT_EQ_STR(lua.execute(), "")
+    const qint64 tablePeak = tableStats.peakMemory;
+    TEST_LOG(QString("Peak memory for table: %1").arg(tablePeak))
+    ASSERT_IS_TRUE(tablePeak > 100000 * qint64(sizeof(double)))
+
+    // Native arrays are counted too
+    Z::Lua::Stats arrayStats;
+    lua.setLimits({ .stats = &arrayStats });
+    lua.setCode("a = array(1000000)");
+    ASSERT_EQ_STR(lua.execute(), "")
+    ASSERT_IS_TRUE(arrayStats.peakMemory > 1000000 * qint64(sizeof(double)))
+
+    // Huge native array fails before allocation
+    lua.setLimits({ .memoryMb = 1 });
+    lua.setCode("t = nil a = nil collectgarbage() b = array(10000000)");
+    ASSERT_EQ_STR(lua.execute(), "Formula exceeds the memory limit of 1 MB")
+    lua.setCode("b = nil collectgarbage() b = array(10) for i = 11, 1000000 do b[i] = i end");
+    ASSERT_EQ_STR(lua.execute(), "Formula exceeds the memory limit of 1 MB")
+}
+
+TEST_METHOD(pooled_state_resets_globals)
+{
+    Z::Lua::clearPool();
+    {
+        Z::Lua lua(true);
+        ASSERT_EQ_STR(lua.open(), "")
+        lua.setCode("a = 5; inf = 1; math.pi = 3; sin = nil; setmetatable(_G, {}); "
+            "math.sin = nil; string.x = 1; setmetatable(math, {}); "
+            "package.loaded.math.cos = nil; getmetatable('').__index = nil; "
+            "debug.setmetatable(0, { __index = math })");
+        ASSERT_EQ_STR(lua.execute(), "")
+    }
+    Z::Lua lua(true);
+    ASSERT_EQ_STR(lua.open(), "")
+    ASSERT_IS_FALSE(lua.getGlobalVar("a").ok())
+    ASSERT_LUA_CALC(lua, "inf", qInf())
+    ASSERT_LUA_CALC(lua, "math.pi", M_PI)
+    ASSERT_LUA_CALC(lua, "sin(0)", 0)
+    ASSERT_LUA_CALC(lua, "getmetatable(_G) == nil and 1 or 0", 1)
+    ASSERT_LUA_CALC(lua, "math.sin(0) + math.cos(0)", 1)
+    ASSERT_LUA_CALC(lua, "string.x == nil and 1 or 0", 1)
+    ASSERT_LUA_CALC(lua, "getmetatable(math) == nil and 1 or 0", 1)
+    ASSERT_LUA_CALC(lua, "('abc'):len()", 3)
+    ASSERT_LUA_CALC(lua, "getmetatable(0) == nil and 1 or 0", 1)
+}
+
+TEST_METHOD(can_call_global_function)
+{
+    OPEN_LUA(lua)
+
+    lua.setCode("k = 2 function Y(x) return k * x + 1 end");
+    ASSERT_EQ_STR(lua.execute(), "")
+    ASSERT_IS_TRUE(lua.isGlobalFunction("Y"))
+    ASSERT_IS_FALSE(lua.isGlobalFunction("k"))
+
+    double xs[] = { 1, 2, 3 };
+    double ys[3];
+    ASSERT_EQ_STR(lua.callGlobalFunction("Y", xs, ys, 3), "")
+    ASSERT_EQ_DBL(ys[0], 3)
+    ASSERT_EQ_DBL(ys[1], 5)
+    ASSERT_EQ_DBL(ys[2], 7)
+
+    lua.setCode("function Y(x) if x > 1 then return nil end return x end");
+    ASSERT_EQ_STR(lua.execute(), "")
+    ASSERT_EQ_STR(lua.callGlobalFunction("Y", xs, ys, 3), "Function 'Y' returned not a number for argument 2")
+
+    lua.setLimits({ .instructions = 100000 });
+    lua.setCode("function Y(x) while true do end end");
+    ASSERT_EQ_STR(lua.execute(), "")
+    ASSERT_EQ_STR(lua.callGlobalFunction("Y", xs, ys, 3), "Formula exceeds the limit of 100000 instructions")
+
+    lua.setLimits({});
+    ASSERT_LUA_CALC(lua, "2+2", 4)
+}
+
 //------------------------------------------------------------------------------
 
 TEST_GROUP("LuaHelper",
@@ -246,6 +476,13 @@ TEST_GROUP("LuaHelper",
     ADD_TEST(can_remove_global),
     ADD_TEST(can_show_refined_error_messages),
     ADD_TEST(can_get_global_arrays),
+    ADD_TEST(can_use_native_arrays),
+    ADD_TEST(can_use_array_functions),
+    ADD_TEST(cached_code_uses_current_globals),
+    ADD_TEST(execution_limits),
+    ADD_TEST(reports_peak_memory),
+    ADD_TEST(pooled_state_resets_globals),
+    ADD_TEST(can_call_global_function),
 )
 
 } // namespace LuaHelperTests
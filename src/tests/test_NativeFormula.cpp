@@ -0,0 +1,193 @@
+#include "../core/NativeFormula.h"
+
+#include "testing/OriTestBase.h"
+
+#include <QtMath>
+
+namespace Z {
+namespace Tests {
+namespace NativeFormulaTests {
+
+#define CALC_NATIVE(code) \
+    Z::NativeFormula formula; \
+    { \
+        bool ok = formula.compile(code); \
+        TEST_LOG(formula.unsupportedReason()) \
+        ASSERT_IS_TRUE(ok) \
+    } \
+    auto res = formula.calc(); \
+    ASSERT_IS_TRUE(res.ok()) \
+    const auto &data = res.result();
+
+#define ASSERT_UNSUPPORTED(code) { \
+    Z::NativeFormula formula; \
+    ASSERT_IS_FALSE(formula.compile(code)) \
+    TEST_LOG(formula.unsupportedReason()) \
+}
+
+TEST_METHOD(simple_loop)
+{
+    CALC_NATIVE("X = {} Y = {}\n for i = 1, 5 do X[i] = i Y[i] = i^2 end")
+    ASSERT_EQ_INT(data.size(), 5)
+    ASSERT_EQ_LIST(data.xs, Values({1, 2, 3, 4, 5}))
+    ASSERT_EQ_LIST(data.ys, Values({1, 4, 9, 16, 25}))
+}
+
+TEST_METHOD(constants_and_locals)
+{
+    CALC_NATIVE(
+        "tau = 2.5 -- comment\n"
+        "local n = 3000\n"
+        "X = {}; Y = {}\n"
+        "for i = 1, n do\n"
+        "  local x = i / 100\n"
+        "  X[i] = x\n"
+        "  Y[i] = sin(X[i]) * exp(-X[i] / tau)\n"
+        "end\n")
+    ASSERT_EQ_INT(data.size(), 3000)
+    for (int i = 0; i < data.size(); i++)
+    {
+        double x = (i + 1) / 100.0;
+        ASSERT_EQ_DBL(data.xs.at(i), x)
+        ASSERT_EQ_DBL(data.ys.at(i), qSin(x) * qExp(-x / 2.5))
+    }
+}
+
+TEST_METHOD(index_offset)
+{
+    CALC_NATIVE("X = array(6) Y = array(6, 1)\n for i = 0, 3 do X[i+1] = i * 2 Y[1+i] = X[i+1] end")
+    ASSERT_EQ_LIST(data.xs, Values({0, 2, 4, 6, 0, 0}))
+    ASSERT_EQ_LIST(data.ys, Values({0, 2, 4, 6, 1, 1}))
+}
+
+TEST_METHOD(lua_arithmetics)
+{
+    CALC_NATIVE("X = {} Y = {} for i = 1, 4 do X[i] = -i % 3 Y[i] = -i // 2 + 2^-1 - -2^2 + math.floor(i/3) end")
+    ASSERT_EQ_LIST(data.xs, Values({2, 1, 0, 2}))
+    ASSERT_EQ_LIST(data.ys, Values({3.5, 3.5, 3.5, 3.5}))
+}
+
+TEST_METHOD(float_division_by_zero)
+{
+    // Unlike integer division, Lua gives inf and nan for float divisor
+    CALC_NATIVE("X = {} Y = {} for i = 1, 3 do X[i] = 6 // (i - 2.0) Y[i] = 6 % (i - 2.0) end")
+    ASSERT_EQ_LIST(data.xs, Values({-6, qInf(), 6}))
+    ASSERT_IS_TRUE(qIsNaN(data.ys.at(1)))
+}
+
+TEST_METHOD(signed_zero)
+{
+    // Integer zero has no sign, float zero has
+    CALC_NATIVE("X = {} Y = {} for i = 1, 2 do X[i] = 1 / -(i-1) Y[i] = 1 / -(i*0.5-0.5) end")
+    ASSERT_IS_TRUE(qIsInf(data.xs.at(0)) && data.xs.at(0) > 0)
+    ASSERT_IS_TRUE(qIsInf(data.ys.at(0)) && data.ys.at(0) < 0)
+}
+
+TEST_METHOD(float_limit)
+{
+    CALC_NATIVE("--[[ long\n comment ]] c = 2 X = {} Y = {} for i = 1, 3.9 do X[i] = c Y[i] = c*i end")
+    ASSERT_EQ_LIST(data.xs, Values({2, 2, 2}))
+    ASSERT_EQ_LIST(data.ys, Values({2, 4, 6}))
+}
+
+TEST_METHOD(local_shadows_global)
+{
+    CALC_NATIVE("a = 1 X = {} Y = {} for i = 1, 3 do local a = a + i X[i] = i Y[i] = a end")
+    ASSERT_EQ_LIST(data.ys, Values({2, 3, 4}))
+}
+
+TEST_METHOD(unsupported)
+{
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = math.random() end")
+    ASSERT_UNSUPPORTED("x = 0 X = {} Y = {} for i = 1, 3 do x = x + 1 X[i] = x Y[i] = i end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = X[i-1] end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do if i > 1 then X[i] = i end Y[i] = i end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 0, 3 do X[i] = i Y[i] = i end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3, 2 do X[i] = i Y[i] = i end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1.0, 3 do X[i] = i Y[i] = i end")
+    ASSERT_UNSUPPORTED("X = {} for i = 1, 3 do X[i] = i Y[i] = i end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = a end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = i end print(X)")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = i // 0 end")
+    // Lua raises an error when a variable integer divisor becomes zero
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = 6 // (i - 2) end")
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = 6 % (2 - i) end")
+    ASSERT_UNSUPPORTED("X = array(5) Y = {} for i = 1, 3 do X[i] = i Y[i] = i end")
+}
+
+TEST_METHOD(input_arrays)
+{
+    GraphPoints input { Values({1, 2, 3, 4}), Values({10, 20, 30, 40}) };
+    Z::NativeFormula formula;
+    ASSERT_IS_TRUE(formula.compile("k = 3 for i = 1, #Y do local x = X[i] X[i] = -x Y[i] = X[i] * k + Y[i] end", input.size()))
+    auto res = formula.calc(input);
+    ASSERT_IS_TRUE(res.ok())
+    ASSERT_EQ_LIST(res.result().xs, Values({-1, -2, -3, -4}))
+    ASSERT_EQ_LIST(res.result().ys, Values({7, 14, 21, 28}))
+    ASSERT_EQ_LIST(input.xs, Values({1, 2, 3, 4}))
+}
+
+TEST_METHOD(input_arrays_partial)
+{
+    GraphPoints input { Values({1, 2, 3, 4}), Values({10, 20, 30, 40}) };
+    Z::NativeFormula formula;
+    ASSERT_IS_TRUE(formula.compile("for i = 1, 2 do Y[i] = Y[i] / 2 end", input.size()))
+    auto res = formula.calc(input);
+    ASSERT_IS_TRUE(res.ok())
+    ASSERT_EQ_LIST(res.result().xs, Values({1, 2, 3, 4}))
+    ASSERT_EQ_LIST(res.result().ys, Values({5, 10, 30, 40}))
+}
+
+TEST_METHOD(input_arrays_unsupported)
+{
+    const char* codes[] = {
+        "for i = 1, #X + 1 do X[i] = 1 end",
+        "X = {} for i = 1, #X do X[i] = 1 end",
+        "for i = 1, #X do Y[i] = Y[i+1] end",
+        "for i = 1, #X do end",
+    };
+    for (auto code : codes)
+    {
+        Z::NativeFormula formula;
+        ASSERT_IS_FALSE(formula.compile(code, 4))
+        TEST_LOG(formula.unsupportedReason())
+    }
+    ASSERT_UNSUPPORTED("X = {} Y = {} for i = 1, #X do X[i] = i Y[i] = i end")
+}
+
+TEST_METHOD(params)
+{
+    const char *code = "tau = tau or 2 X = {} Y = {} for i = 1, 3 do X[i] = i Y[i] = i * tau end";
+    {
+        CALC_NATIVE(code)
+        ASSERT_EQ_LIST(data.ys, Values({2, 4, 6}))
+    }
+    Z::NativeFormula formula;
+    formula.setParams({{"tau", 10}});
+    ASSERT_IS_TRUE(formula.compile(code))
+    auto res = formula.calc();
+    ASSERT_IS_TRUE(res.ok())
+    ASSERT_EQ_LIST(res.result().ys, Values({10, 20, 30}))
+}
+
+//------------------------------------------------------------------------------
+
+TEST_GROUP("NativeFormula",
+    ADD_TEST(simple_loop),
+    ADD_TEST(constants_and_locals),
+    ADD_TEST(index_offset),
+    ADD_TEST(lua_arithmetics),
+    ADD_TEST(float_division_by_zero),
+    ADD_TEST(signed_zero),
+    ADD_TEST(float_limit),
+    ADD_TEST(local_shadows_global),
+    ADD_TEST(params),
+    ADD_TEST(unsupported),
+    ADD_TEST(input_arrays),
+    ADD_TEST(input_arrays_partial),
+    ADD_TEST(input_arrays_unsupported),
+)
+
+} // namespace NativeFormulaTests
+} // namespace Tests
+} // namespace Z
@@ -13,6 +13,7 @@
 
 #include <QApplication>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QMenu>
 #include <QPlainTextEdit>
 #include <QSplitter>
@@ -23,7 +24,7 @@
 using namespace Ori::Gui;
 using namespace Ori::Layouts;
 
-CodeEditor::CodeEditor() : QWidget()
+CodeEditor::CodeEditor(const QString &helpTopic) : QWidget()
 {
     _editor = new Ori::Widgets::CodeEditor;
     setFontMonospace(_editor);
@@ -50,7 +51,7 @@ CodeEditor::CodeEditor() : QWidget()
         0,
         butSavePreset,
         0,
-        action(tr("Help"), this, []{ Z::HelpSystem::topic("add_formula"); }, ":/toolbar/help", "F1"),
+        action(tr("Help"), this, [helpTopic]{ Z::HelpSystem::topic(helpTopic); }, ":/toolbar/help", "F1"),
     });
     
     _log = new QPlainTextEdit;
@@ -76,11 +77,21 @@ void CodeEditor::setCode(const QString &code)
  
 GraphResult CodeEditor::verify()
 {
-    auto res = FormulaDataSource::exec(_editor->code());
+    Z::Lua::Stats stats;
+    QElapsedTimer timer;
+    timer.start();
+    auto res = _verifier ? _verifier(_editor->code(), &stats) : FormulaDataSource::exec(_editor->code(), {}, &stats);
+    const auto elapsed = timer.elapsed();
     if (res.ok())
     {
-        auto [xs, ys] = res.result();
-        logLine(QStringLiteral("Executed successfully. Points: %1").arg(xs.size()));
+        const auto &data = res.result();
+        const auto xs = data.xValues();
+        const auto &ys = data.ys;
+        logLine(QStringLiteral("Executed successfully in %1 ms. Points: %2").arg(elapsed).arg(xs.size()));
+        if (stats.native)
+            logLine(QStringLiteral("Calculated natively. Memory: %1 KB").arg(stats.peakMemory / 1024));
+        else
+            logLine(QStringLiteral("Peak memory: %1 KB").arg(stats.peakMemory / 1024));
         QStringList strX, strY;
         if (xs.size() < 10)
         {
@@ -4,6 +4,9 @@
 #include <QWidget>
 
 #include "core/BaseTypes.h"
+#include "core/LuaHelper.h"
+
+#include <functional>
 
 QT_BEGIN_NAMESPACE
 class QAction;
@@ -21,10 +24,15 @@ class CodeEditor : public QWidget
     Q_OBJECT
 
 public:
-    CodeEditor();
+    explicit CodeEditor(const QString &helpTopic = QStringLiteral("add_formula"));
     
     QString code() const;
     void setCode(const QString &code);
+
+    /// Replaces the default verification that runs code as a formula data source.
+    /// The verifier collects resources used by the code into `stats`.
+    using Verifier = std::function<GraphResult(const QString &code, Z::Lua::Stats *stats)>;
+    void setVerifier(Verifier verifier) { _verifier = verifier; }
     
     GraphResult verify();
     
@@ -34,6 +42,7 @@ private:
     QStringList _presets;
     QMenu *_menuPresets;
     QAction *_actnSavePreset;
+    Verifier _verifier;
     
     enum LogLevel { INFO, ERROR };
     void logLine(const QString &msg, LogLevel level = INFO);
@@ -2,19 +2,282 @@
 
 #include "core/Project.h"
 
+#include "helpers/OriDialogs.h"
 #include "helpers/OriLayouts.h"
+#include "helpers/OriWidgets.h"
+#include "widgets/OriValueEdit.h"
 
-#include "qcpl_graph_grid.h"
-
-#include <QLabel>
+#include <QAbstractTableModel>
+#include <QApplication>
+#include <QClipboard>
 #include <QDebug>
+#include <QHeaderView>
+#include <QLabel>
+#include <QMimeData>
+#include <QTableView>
+#include <QTextStream>
+
+#include <algorithm>
 
 using namespace Ori::Layouts;
 
-DataGridPanel::DataGridPanel(Project *project, QWidget *parent)
-    : QWidget(parent), Ori::IMessageBusListener(), _project(project)
+//------------------------------------------------------------------------------
+//                               GraphDataModel
+//------------------------------------------------------------------------------
+
+/// Table model that reads values directly from the graph's buffers.
+/// Only rows which are currently visible get formatted by the view,
+/// so showing a graph of any size costs nothing until it is scrolled.
+class GraphDataModel : public QAbstractTableModel
+{
+public:
+    enum Column { COL_X, COL_Y, COL_COUNT };
+
+    GraphDataModel(QObject *parent) : QAbstractTableModel(parent) {}
+
+    const Graph* graph() const { return _graph; }
+
+    void setGraph(const Graph *graph)
+    {
+        beginResetModel();
+        _graph = graph;
+        _rowCount = graph ? graph->pointsCount() : 0;
+        _order = ORDER_UNKNOWN;
+        endResetModel();
+    }
+
+    /// Notifies views that points of the same graph have changed.
+    /// Only the change of size is reported as inserted or removed rows,
+    /// so views keep their scroll position and selection.
+    void refresh()
+    {
+        const int oldCount = _rowCount;
+        const int newCount = _graph ? _graph->pointsCount() : 0;
+        _order = ORDER_UNKNOWN;
+        if (newCount > oldCount)
+        {
+            beginInsertRows(QModelIndex(), oldCount, newCount - 1);
+            _rowCount = newCount;
+            endInsertRows();
+        }
+        else if (newCount < oldCount)
+        {
+            beginRemoveRows(QModelIndex(), newCount, oldCount - 1);
+            _rowCount = newCount;
+            endRemoveRows();
+        }
+        const int changed = qMin(oldCount, newCount);
+        if (changed > 0)
+            emit dataChanged(index(0, 0), index(changed - 1, COL_COUNT - 1), {Qt::DisplayRole});
+    }
+
+    double value(int row, int col) const
+    {
+        return col == COL_X ? _graph->x(row) : _graph->y(row);
+    }
+
+    static QString formatValue(double v)
+    {
+        return QString::number(v, 'g', 10);
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        if (parent.isValid() || !_graph) return 0;
+        return _rowCount;
+    }
+
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override
+    {
+        return parent.isValid() ? 0 : COL_COUNT;
+    }
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override
+    {
+        // Points can be changed a bit earlier than the model is notified
+        if (!_graph || !index.isValid() || index.row() >= _graph->pointsCount())
+            return QVariant();
+        if (role == Qt::DisplayRole)
+            return formatValue(value(index.row(), index.column()));
+        if (role == Qt::TextAlignmentRole)
+            return int(Qt::AlignRight | Qt::AlignVCenter);
+        return QVariant();
+    }
+
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override
+    {
+        if (role == Qt::DisplayRole && orientation == Qt::Horizontal)
+            return section == COL_X ? QStringLiteral("X") : QStringLiteral("Y");
+        return QAbstractTableModel::headerData(section, orientation, role);
+    }
+
+    /// Returns the row having X value nearest to the given one.
+    /// Sorted data (which is the most common case) are searched with bisection,
+    /// arbitrary ordered data have to be scanned through.
+    int findRowX(double x) const
+    {
+        if (!_graph) return -1;
+        const int count = _graph->pointsCount();
+        if (count == 0) return -1;
+        if (_order == ORDER_UNKNOWN)
+            _order = detectOrder();
+        int row;
+        switch (_order) {
+        case ORDER_ASC:
+            row = lowerBoundX([x](double v){ return v < x; });
+            break;
+        case ORDER_DESC:
+            row = lowerBoundX([x](double v){ return v > x; });
+            break;
+        default:
+            row = 0;
+            for (int i = 1; i < count; i++)
+                if (qAbs(_graph->x(i) - x) < qAbs(_graph->x(row) - x))
+                    row = i;
+            return row;
+        }
+        if (row >= count)
+            return count - 1;
+        if (row > 0 && qAbs(_graph->x(row-1) - x) <= qAbs(_graph->x(row) - x))
+            return row - 1;
+        return row;
+    }
+
+private:
+    enum Order { ORDER_UNKNOWN, ORDER_ASC, ORDER_DESC, ORDER_NONE };
+
+    const Graph *_graph = nullptr;
+    // Number of rows known to views, it's updated only along with notifications
+    int _rowCount = 0;
+    mutable Order _order = ORDER_UNKNOWN;
+
+    Order detectOrder() const
+    {
+        bool asc = true, desc = true;
+        const int count = _graph->pointsCount();
+        for (int i = 1; i < count && (asc || desc); i++) {
+            double x0 = _graph->x(i-1), x1 = _graph->x(i);
+            if (x1 < x0) asc = false;
+            if (x1 > x0) desc = false;
+        }
+        return asc ? ORDER_ASC : (desc ? ORDER_DESC : ORDER_NONE);
+    }
+
+    /// Returns the first row for which the predicate is false,
+    /// points are read one by one to avoid unpacking the whole graph.
+    template <typename Pred> int lowerBoundX(Pred before) const
+    {
+        int lo = 0, hi = _graph->pointsCount();
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (before(_graph->x(mid)))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+};
+
+//------------------------------------------------------------------------------
+//                               GraphDataMime
+//------------------------------------------------------------------------------
+
+/// Clipboard data being formatted only when some application asks for them.
+/// Points are kept in packed form sharing buffers with the graph,
+/// so putting even a huge graph into the clipboard costs almost nothing,
+/// and the data stay valid after the graph is changed or deleted.
+class GraphDataMime : public QMimeData
+{
+public:
+    struct Range { int top, bottom, left, right; };
+
+    GraphDataMime(const PackedPoints &data, const QVector<Range> &ranges) : _data(data), _ranges(ranges) {}
+
+    QStringList formats() const override
+    {
+        return { QStringLiteral("text/plain") };
+    }
+
+    bool hasFormat(const QString &mimeType) const override
+    {
+        return mimeType == QLatin1String("text/plain");
+    }
+
+protected:
+#if (QT_VERSION < QT_VERSION_CHECK(6, 0, 0))
+    QVariant retrieveData(const QString &mimeType, QVariant::Type type) const override
+#else
+    QVariant retrieveData(const QString &mimeType, QMetaType type) const override
+#endif
+    {
+        Q_UNUSED(type)
+        if (mimeType != QLatin1String("text/plain"))
+            return QVariant();
+        if (_text.isNull())
+            _text = format();
+        return _text;
+    }
+
+private:
+    PackedPoints _data;
+    QVector<Range> _ranges;
+    mutable QString _text;
+
+    QString format() const
+    {
+        qsizetype rowCount = 0;
+        for (const auto &range : _ranges)
+            rowCount += range.bottom - range.top + 1;
+        QString text;
+        text.reserve(rowCount * 2 * 18);
+        QTextStream stream(&text);
+        for (const auto &range : _ranges)
+            for (int row = range.top; row <= range.bottom; row++)
+            {
+                for (int col = range.left; col <= range.right; col++)
+                {
+                    if (col > range.left)
+                        stream << '\t';
+                    double v = col == GraphDataModel::COL_X ? _data.x(row) : _data.ys.at(row);
+                    stream << GraphDataModel::formatValue(v);
+                }
+                stream << '\n';
+            }
+        stream.flush();
+        return text;
+    }
+};
+
+//------------------------------------------------------------------------------
+//                               DataGridPanel
+//------------------------------------------------------------------------------
+
+// Copying more points than this is confirmed because of the size of the text
+static const qsizetype COPY_CONFIRM_ROWS = 1000000;
+
+DataGridPanel::DataGridPanel(QWidget *parent)
+    : QWidget(parent), IEventBusListener({
+        BusEvent::DiagramRenamed, BusEvent::DiagramDeleted, BusEvent::GraphUpdated,
+        BusEvent::GraphsUpdated, BusEvent::GraphRenamed, BusEvent::GraphDeleting,
+    })
 {
-    _dataGrid = new QCPL::GraphDataGrid;
+    _dataModel = new GraphDataModel(this);
+
+    _dataGrid = new QTableView;
+    _dataGrid->setModel(_dataModel);
+    _dataGrid->setWordWrap(false);
+    _dataGrid->setSelectionMode(QAbstractItemView::ContiguousSelection);
+    _dataGrid->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    _dataGrid->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    _dataGrid->verticalHeader()->setDefaultSectionSize(_dataGrid->fontMetrics().height() + 4);
+    Ori::Gui::setFontMonospace(_dataGrid);
+
+    _gotoX = new Ori::Widgets::ValueEdit;
+    _gotoX->setPlaceholderText(tr("Go to X"));
+    _gotoX->setToolTip(tr("Enter X value and press Enter to scroll to the nearest point"));
+    connect(_gotoX, &QLineEdit::returnPressed, this, &DataGridPanel::gotoX);
+
     _iconPlot = new QLabel;
     _iconGraph = new QLabel;
     _titlePlot = new QLabel("<span style='color:gray'>no diagram selected</span>");
@@ -23,6 +286,7 @@ DataGridPanel::DataGridPanel(Project *project, QWidget *parent)
     LayoutV({
                 LayoutH({_iconPlot, _titlePlot, Stretch()}).setMargin(3).setSpacing(6),
                 LayoutH({_iconGraph, _titleGraph, Stretch()}).setMargin(3).setSpacing(6),
+                LayoutH({_gotoX}).setMargin(3),
                 _dataGrid
             })
             .setMargin(0)
@@ -30,17 +294,38 @@ DataGridPanel::DataGridPanel(Project *project, QWidget *parent)
             .useFor(this);
 }
 
-void DataGridPanel::messageBusEvent(int event, const QMap<QString, QVariant>& params)
+void DataGridPanel::busEvent(const BusEvent &e)
 {
-    switch (event) {
-    case BusEvent::DiagramRenamed::id:
-        if (isVisible() && params.value("id") == _plotId)
-            showData(_project->diagram(_plotId), nullptr);
+    switch (e.type) {
+    case BusEvent::DiagramRenamed:
+        if (isVisible() && e.diagram == _diagram)
+            showData(_diagram, nullptr);
+        break;
+    case BusEvent::DiagramDeleted:
+        if (e.diagram == _diagram) {
+            clearData();
+            _diagram = nullptr;
+        }
+        break;
+    case BusEvent::GraphUpdated:
+        if (_graph && e.graph == _graph)
+            updateGraph();
+        break;
+    case BusEvent::GraphRenamed:
+        if (isVisible() && _graph && e.graph == _graph)
+            showGraphTitle();
+        break;
+    case BusEvent::GraphsUpdated:
+        if (_graph && e.graphs->contains(_graph))
+            updateGraph();
+        break;
+    case BusEvent::GraphDeleting:
+        // The model refers to the graph's buffers, so it must be released
+        // before the graph is deleted, regardless of panel visibility
+        if (_graph && e.graph == _graph)
+            clearData();
         break;
-    case BusEvent::GraphUpdated::id:
-    case BusEvent::GraphRenamed::id:
-        if (isVisible() && params.value("id") == _graphId)
-            showData(nullptr, _project->graph(_graphId));
+    default:
         break;
     }
 }
@@ -49,22 +334,71 @@ void DataGridPanel::showData(Diagram *dia, Graph *graph)
 {
     if (dia)
     {
-        _plotId = dia->id();
+        _diagram = dia;
         _iconPlot->setPixmap(dia->icon().pixmap(16, 16));
         _titlePlot->setText(dia->title());
     }
     if (graph)
     {
-        _graphId = graph->id();
-        _iconGraph->setPixmap(graph->icon().pixmap(16, 16));
-        _titleGraph->setText(graph->title());
-        _dataGrid->setData(graph->data().xs, graph->data().ys);
+        _graph = graph;
+        showGraphTitle();
+        _dataModel->setGraph(graph);
     }
 }
 
+void DataGridPanel::showGraphTitle()
+{
+    _iconGraph->setPixmap(_graph->icon().pixmap(16, 16));
+    _titleGraph->setText(_graph->title());
+}
+
+void DataGridPanel::updateGraph()
+{
+    // The model must know the new number of points even when the panel is hidden,
+    // otherwise the view and the panel's commands would read past the end of the graph
+    _dataModel->refresh();
+    if (isVisible())
+        showGraphTitle();
+}
+
+void DataGridPanel::clearData()
+{
+    _graph = nullptr;
+    _iconGraph->clear();
+    _titleGraph->setText("<span style='color:gray'>no graph selected</span>");
+    _dataModel->setGraph(nullptr);
+}
+
+void DataGridPanel::gotoX()
+{
+    int row = _dataModel->findRowX(_gotoX->value());
+    if (row < 0) return;
+    auto index = _dataModel->index(row, GraphDataModel::COL_X);
+    _dataGrid->setCurrentIndex(index);
+    _dataGrid->scrollTo(index, QAbstractItemView::PositionAtCenter);
+}
+
 void DataGridPanel::copyData()
 {
-    _dataGrid->copy();
+    auto graph = _dataModel->graph();
+    if (!graph) return;
+
+    auto selection = _dataGrid->selectionModel()->selection();
+    if (selection.isEmpty())
+        selection.select(_dataModel->index(0, 0),
+                         _dataModel->index(_dataModel->rowCount()-1, GraphDataModel::COL_COUNT-1));
+    QVector<GraphDataMime::Range> ranges;
+    qsizetype rowCount = 0;
+    for (const auto &r : std::as_const(selection))
+    {
+        ranges << GraphDataMime::Range{ r.top(), r.bottom(), r.left(), r.right() };
+        rowCount += r.height();
+    }
+    if (rowCount > COPY_CONFIRM_ROWS &&
+        !Ori::Dlg::yes(tr("Copy %1 points? The text can take a lot of memory.").arg(rowCount)))
+        return;
+    std::sort(ranges.begin(), ranges.end(), [](const auto &a, const auto &b){ return a.top < b.top; });
+    qApp->clipboard()->setMimeData(new GraphDataMime(graph->packedData(), ranges));
 }
 
 bool DataGridPanel::hasFocus() const
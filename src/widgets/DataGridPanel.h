@@ -1,45 +1,53 @@
 #ifndef DATA_GRID_PANEL_H
 #define DATA_GRID_PANEL_H
 
-#include "tools/OriMessageBus.h"
+#include "core/EventBus.h"
 
 #include <QWidget>
 
 QT_BEGIN_NAMESPACE
 class QLabel;
+class QTableView;
 QT_END_NAMESPACE
 
-class Project;
 class Diagram;
 class Graph;
+class GraphDataModel;
 
-namespace QCPL {
-class GraphDataGrid;
+namespace Ori::Widgets {
+class ValueEdit;
 }
 
-class DataGridPanel : public QWidget, public Ori::IMessageBusListener
+class DataGridPanel : public QWidget, public IEventBusListener
 {
     Q_OBJECT
 
 public:
-    explicit DataGridPanel(Project *project, QWidget *parent = nullptr);
+    explicit DataGridPanel(QWidget *parent = nullptr);
 
-    // Ori::IMessageBusListener
-    void messageBusEvent(int event, const QMap<QString, QVariant>& params) override;
+    // IEventBusListener
+    void busEvent(const BusEvent &e) override;
 
     bool hasFocus() const;
     void showData(Diagram* dia, Graph* graph);
     void copyData();
 
-    QString plotId() const { return _plotId; }
-    QString graphId() const { return _graphId; }
+    Diagram* diagram() const { return _diagram; }
+    Graph* graph() const { return _graph; }
 
 private:
-    Project *_project;
     QLabel *_titlePlot, *_titleGraph;
     QLabel *_iconPlot, *_iconGraph;
-    QCPL::GraphDataGrid* _dataGrid;
-    QString _plotId, _graphId;
+    QTableView *_dataGrid;
+    GraphDataModel *_dataModel;
+    Ori::Widgets::ValueEdit *_gotoX;
+    Diagram *_diagram = nullptr;
+    Graph *_graph = nullptr;
+
+    void clearData();
+    void gotoX();
+    void showGraphTitle();
+    void updateGraph();
 };
 
 #endif // DATA_GRID_PANEL_H
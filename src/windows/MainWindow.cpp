@@ -56,14 +56,16 @@ enum StatusPanels
     [this]{ auto plot = activePlot(); if (plot) plot->do_func(); }
 
 MainWindow::MainWindow(const QString &fileName, QWidget *parent)
-    : QMainWindow(parent), Ori::IMessageBusListener()
+    : QMainWindow(parent), IEventBusListener({
+        BusEvent::ProjectModified, BusEvent::ProjectUnmodified, BusEvent::DiagramAdded, BusEvent::ErrorMessage,
+    })
 {
     setObjectName("mainWindow");
     Ori::Wnd::setWindowIcon(this, ":/window_icons/main");
     
     _project = new Project(this);
 
-    _panelDataGrid = new DataGridPanel(_project, this);
+    _panelDataGrid = new DataGridPanel(this);
 
     _operations = new Operations(_project, this);
     _operations->getSelectedGraphs = [this]{ return selectedGraphs(); };
@@ -218,9 +220,12 @@ void MainWindow::createActions()
     auto actGraphProps = A1_(tr("Line Format..."), tr("Set line format of selected graph"), this, IN_ACTIVE_PLOT(formatGraph), ":/toolbar/graph_format");
     auto actGraphDelete = A1_(tr("Delete"), tr("Delete selected graphs"), this, IN_ACTIVE_PLOT(deleteGraph), ":/toolbar/graph_delete", QKeySequence("Del"));
     auto actGraphAxes = A1_(tr("Change Axes..."), this, IN_ACTIVE_PLOT(changeGraphAxes));
+    auto actGraphStorage = A0_(tr("Data Storage..."), _operations, SLOT(graphStorage()));
+    auto actGraphSweep = A0_(tr("Parameter Sweep..."), tr("Make graphs of formula for a range of parameter values"), _operations, SLOT(graphSweep()));
+    auto actGraphEnsemble = A0_(tr("Ensemble Statistics..."), tr("Make graphs of mean, deviation and percentiles over selected graphs"), _operations, SLOT(graphEnsemble()));
 
     menuBar->addMenu(Ori::Gui::menu(tr("Graph"), this, {
-        actnGraphRefresh, actGraphReopen, 0, actGraphTitle, actGraphProps, actGraphAxes, 0, actGraphDelete,
+        actnGraphRefresh, actGraphReopen, actGraphSweep, actGraphEnsemble, 0, actGraphTitle, actGraphProps, actGraphAxes, actGraphStorage, 0, actGraphDelete,
     }));
 
     // By default the Graph toolbar is in the second row, should be added after all others
@@ -236,22 +241,29 @@ void MainWindow::createActions()
     auto actScale = A0_(tr("Scale (Graph × Const)..."), _operations, SLOT(modifyScale()), ":/toolbar/graph_scale", Qt::Key_Asterisk);
     auto actNormalize = A0_(tr("Normalize (Graph ÷ Const)..."), _operations, SLOT(modifyNormalize()), ":/toolbar/graph_norm", Qt::Key_Slash);
     auto actInvert = A0_(tr("Invert (Const ÷ Graph)..."), _operations, SLOT(modifyInvert()), ":/toolbar/graph_inv");
+    auto actArithmetic = A0_(tr("Graph Arithmetic..."), _operations, SLOT(modifyArithmetic()));
     auto actDecimate = A0_(tr("Decimate..."), _operations, SLOT(modifyDecimate()), ":/toolbar/graph_decim");
+    auto actResample = A0_(tr("Resample..."), _operations, SLOT(modifyResample()));
     // auto actAverage = A0_(tr("Average..."), _operations, SLOT(modifyAverage()), ":/toolbar/graph_avg");
     auto actMavgSimple = A0_(tr("Moving Average (simple)..."), _operations, SLOT(modifyMavgSimple()), ":/toolbar/graph_mavg");
     auto actMavgCumul = A0_(tr("Moving Average (cumulative)"), _operations, SLOT(modifyMavgCumul()));
     auto actMavgExp = A0_(tr("Moving Average (exponential)..."), _operations, SLOT(modifyMavgExp()));
     auto actFitLimits = A0_(tr("Fit Limits..."), _operations, SLOT(modifyFitLimits()), ":/toolbar/graph_fit");
     auto actDespike = A0_(tr("Remove Spikes..."), _operations, SLOT(modifyDespike()), ":/toolbar/graph_despike");
+    auto actMedian = A0_(tr("Median Filter..."), _operations, SLOT(modifyMedian()));
     auto actDerivatie = A0_(tr("First Derivative..."), _operations, SLOT(modifyDerivative()));
+    auto actSavGol = A0_(tr("Savitzky–Golay Filter..."), _operations, SLOT(modifySavGol()));
+    auto actSpectrum = A0_(tr("Spectrum (FFT)..."), _operations, SLOT(modifySpectrum()));
+    auto actConvolve = A0_(tr("Convolution..."), _operations, SLOT(modifyConvolve()));
+    auto actFormula = A0_(tr("User Formula..."), _operations, SLOT(modifyFormula()));
 
     menuBar->addMenu(Ori::Gui::menu(tr("Modify"), this, {
         actOffset,
         // actFlip, actReflect,
-        0, actScale, actNormalize, actInvert, 0, actDecimate,
+        0, actScale, actNormalize, actInvert, actArithmetic, 0, actDecimate, actResample,
         // actAverage,
         0, actMavgSimple, actMavgCumul, actMavgExp,
-        0, actFitLimits, 0, actDespike, 0, actDerivatie
+        0, actFitLimits, 0, actDespike, actMedian, 0, actDerivatie, actSavGol, 0, actSpectrum, actConvolve, 0, actFormula
     }));
 
     addToolBar(Ori::Gui::toolbar(tr("Modify"), "modify", {
@@ -416,19 +428,21 @@ void MainWindow::closeEvent(QCloseEvent* ce)
         ce->ignore();
 }
 
-void MainWindow::messageBusEvent(int event, const QMap<QString, QVariant>& params)
+void MainWindow::busEvent(const BusEvent &e)
 {
-    switch (event)
+    switch (e.type)
     {
-    case BusEvent::ProjectModified::id:
-    case BusEvent::ProjectUnmodified::id:
+    case BusEvent::ProjectModified:
+    case BusEvent::ProjectUnmodified:
         updateStatusBar();
         break;
-    case BusEvent::DiagramAdded::id:
-        handleDiagramAdded(params.value("id").toString());
+    case BusEvent::DiagramAdded:
+        handleDiagramAdded(e.diagram);
+        break;
+    case BusEvent::ErrorMessage:
+        Ori::Dlg::error(*e.message);
         break;
-    case BusEvent::ErrorMessage::id:
-        Ori::Dlg::error(params.value("error").toString());
+    default:
         break;
     }
 }
@@ -490,13 +504,8 @@ QVector<Graph*> MainWindow::selectedGraphs(bool warn) const
     return {};
 }
 
-void MainWindow::handleDiagramAdded(const QString& id)
+void MainWindow::handleDiagramAdded(Diagram *dia)
 {
-    auto dia = _project->diagram(id);
-    if (!dia) {
-        qWarning() << "MainWindow::handleDiagramAdded: Diagram not found" << id;
-        return;
-    }
     auto plotWindow = new PlotWindow(_operations, dia);
     connect(plotWindow, &PlotWindow::graphSelected, this, &MainWindow::graphSelected);
 
@@ -1,7 +1,7 @@
 #ifndef MAIN_WINDOW_H
 #define MAIN_WINDOW_H
 
-#include "tools/OriMessageBus.h"
+#include "core/EventBus.h"
 
 #include <QMainWindow>
 #include <QJsonObject>
@@ -13,6 +13,7 @@ class QMdiArea;
 class QMdiSubWindow;
 QT_END_NAMESPACE
 
+class Diagram;
 class Graph;
 class PlotObj;
 class DataGridPanel;
@@ -25,7 +26,7 @@ class StatusBar;
 class MdiToolBar;
 }
 
-class MainWindow : public QMainWindow, public Ori::IMessageBusListener
+class MainWindow : public QMainWindow, public IEventBusListener
 {
     Q_OBJECT
 
@@ -33,8 +34,8 @@ public:
     MainWindow(const QString &fileName, QWidget *parent = nullptr);
     ~MainWindow();
 
-    // Ori::IMessageBusListener
-    void messageBusEvent(int event, const QMap<QString, QVariant>& params) override;
+    // IEventBusListener
+    void busEvent(const BusEvent &e) override;
 
 protected:
     void closeEvent(class QCloseEvent*) override;
@@ -67,7 +68,7 @@ private:
 
     void deletePlot();
     
-    void handleDiagramAdded(const QString& id);
+    void handleDiagramAdded(Diagram *dia);
 
     /// Returns formats of all plots and all graphs.
     /// Used for saving project files.
@@ -25,7 +25,11 @@
 using Ori::Gui::PopupMessage;
 
 PlotWindow::PlotWindow(Operations *operations, Diagram *diagram, QWidget *parent)
-    : QWidget(parent), Ori::IMessageBusListener(), _diagram(diagram), _operations(operations)
+    : QWidget(parent), IEventBusListener({
+        BusEvent::DiagramDeleted, BusEvent::DiagramRenamed, BusEvent::DiagramFormatLoaded, BusEvent::DiagramLoaded,
+        BusEvent::GraphAdded, BusEvent::GraphsLoaded, BusEvent::GraphRenamed, BusEvent::GraphUpdated,
+        BusEvent::GraphsUpdated, BusEvent::GraphDeleting,
+    }), _diagram(diagram), _operations(operations)
 {
     _plot = new QCPL::Plot({.replaceDefaultAxes=true});
     _plot->formatAxisTitleAfterFactorSet = true;
@@ -143,13 +147,13 @@ void PlotWindow::closeEvent(class QCloseEvent* ce)
         ce->ignore();
 }
 
-void PlotWindow::messageBusEvent(int event, const QMap<QString, QVariant>& params)
+void PlotWindow::busEvent(const BusEvent &e)
 {
     if (_autoClosing)
         return;
-    switch (event) {
-    case BusEvent::DiagramDeleted::id:
-        if (!_userClosing && params.value("id") == _diagram->id()) {
+    switch (e.type) {
+    case BusEvent::DiagramDeleted:
+        if (!_userClosing && e.diagram == _diagram) {
             auto parent = parentWidget();
             while (parent) {
                 if (auto mdi = qobject_cast<QMdiSubWindow*>(parent); mdi) {
@@ -157,36 +161,51 @@ void PlotWindow::messageBusEvent(int event, const QMap<QString, QVariant>& param
                     mdi->close();
                     break;
                 }
-                parent->parentWidget();
+                parent = parent->parentWidget();
             }
         }
         break;
-    case BusEvent::DiagramRenamed::id:
-        if (params.value("id") == _diagram->id())
+    case BusEvent::DiagramRenamed:
+        if (e.diagram == _diagram)
             handleDiagramRenamed();
         break;
-    case BusEvent::DiagramFormatLoaded::id:
-        if (params.value("id") == _diagram->id())
-            handleDiagramFormatLoaded(params.value("format").toJsonObject());
+    case BusEvent::DiagramFormatLoaded:
+        if (e.diagram == _diagram)
+            handleDiagramFormatLoaded(*e.format);
         break;
-    case BusEvent::DiagramLoaded::id:
-        if (params.value("id") == _diagram->id())
+    case BusEvent::DiagramLoaded:
+        if (e.diagram == _diagram)
             _plot->replot();
         break;
-    case BusEvent::GraphAdded::id:
-        handleGraphAdded(params.value("id").toString());
+    case BusEvent::GraphAdded:
+        if (e.diagram == _diagram)
+            handleGraphAdded(e.graph);
         break;
-    case BusEvent::GraphLoaded::id:
-        handleGraphLoaded(params.value("id").toString(), params.value("format").toJsonObject());
+    case BusEvent::GraphsLoaded:
+        if (e.diagram == _diagram)
+            for (int i = 0; i < e.graphs->size(); i++)
+                handleGraphLoaded(e.graphs->at(i), e.formats->at(i));
         break;
-    case BusEvent::GraphRenamed::id:
-        handleGraphRenamed(params.value("id").toString());
+    case BusEvent::GraphRenamed:
+        handleGraphRenamed(e.graph);
         break;
-    case BusEvent::GraphUpdated::id:
-        handleGraphUpdated(params.value("id").toString());
+    case BusEvent::GraphUpdated:
+        if (updateGraphLine(e.graph))
+            _plot->replot();
         break;
-    case BusEvent::GraphDeleting::id:
-        handleGraphDeleting(params.value("id").toString());
+    case BusEvent::GraphsUpdated: {
+        bool changed = false;
+        for (auto g : *e.graphs)
+            changed = updateGraphLine(g) || changed;
+        if (changed)
+            _plot->replot();
+        break;
+    }
+    case BusEvent::GraphDeleting:
+        if (e.diagram == _diagram)
+            handleGraphDeleting(e.graph);
+        break;
+    default:
         break;
     }
 }
@@ -237,16 +256,22 @@ int PlotWindow::graphCount() const
     return _plot->userGraphsCount();
 }
 
-void PlotWindow::handleGraphAdded(const QString &id)
+PlotItem* PlotWindow::makeItem(Graph *g)
 {
-    auto g = _diagram->graph(id);
-    if (!g) return;
-
     auto item = new PlotItem;
     item->graph = g;
-
-    item->line = _plot->makeNewGraph(g->title(), {g->data().xs, g->data().ys}, false);
+    auto data = g->data();
+    item->line = _plot->makeNewGraph(g->title(), {data.xValues(), data.ys}, false);
     connect(item->line, SIGNAL(selectionChanged(bool)), this, SLOT(graphLineSelected(bool)));
+    _items.append(item);
+    _itemsByLine.insert(item->line, item);
+    _itemsByGraph.insert(g, item);
+    return item;
+}
+
+void PlotWindow::handleGraphAdded(Graph *g)
+{
+    auto item = makeItem(g);
 
     g->setColor(item->line->pen().color());
 
@@ -259,22 +284,14 @@ void PlotWindow::handleGraphAdded(const QString &id)
         selectGraphLine(item->line, false);
 
     _plot->replot();
-    _items.append(item);
 
     if (AppSettings::instance().selectNewGraph)
         emit graphSelected(g);
 }
 
-void PlotWindow::handleGraphLoaded(const QString &id, const QJsonObject &fmt)
+void PlotWindow::handleGraphLoaded(Graph *g, const QJsonObject &fmt)
 {
-    auto g = _diagram->graph(id);
-    if (!g) return;
-
-    auto item = new PlotItem;
-    item->graph = g;
-
-    item->line = _plot->makeNewGraph(g->title(), {g->data().xs, g->data().ys}, false);
-    connect(item->line, SIGNAL(selectionChanged(bool)), this, SLOT(graphLineSelected(bool)));
+    auto item = makeItem(g);
 
     auto pen = item->line->pen();
     pen.setColor(g->color());
@@ -291,29 +308,23 @@ void PlotWindow::handleGraphLoaded(const QString &id, const QJsonObject &fmt)
         if (auto a = _plot->findAxisById(fmt["axis_v"].toString()); a)
             item->line->setValueAxis(a);
 
-    _items.append(item);
-
     // do not replot, all graphs will be loaded
     // then DiagramLoaded happens, do replot there
 }
 
-void PlotWindow::handleGraphUpdated(const QString &id)
+bool PlotWindow::updateGraphLine(Graph *graph)
 {
-    auto graph = _diagram->graph(id);
-    if (!graph) return;
-
     auto item = itemForGraph(graph);
-    if (!item) return;
+    if (!item) return false;
 
     item->line->setName(graph->title());
-    _plot->updateGraph(item->line, {graph->data().xs, graph->data().ys});
+    auto data = graph->data();
+    _plot->updateGraph(item->line, {data.xValues(), data.ys}, false);
+    return true;
 }
 
-void PlotWindow::handleGraphRenamed(const QString &id)
+void PlotWindow::handleGraphRenamed(Graph *graph)
 {
-    auto graph = _diagram->graph(id);
-    if (!graph) return;
-
     auto item = itemForGraph(graph);
     if (!item) return;
 
@@ -321,16 +332,15 @@ void PlotWindow::handleGraphRenamed(const QString &id)
     _plot->replot();
 }
 
-void PlotWindow::handleGraphDeleting(const QString &id)
+void PlotWindow::handleGraphDeleting(Graph *graph)
 {
-    auto graph = _diagram->graph(id);
-    if (!graph) return;
-
     auto item = itemForGraph(graph);
     if (!item) return;
 
+    _itemsByLine.remove(item->line);
+    _itemsByGraph.remove(graph);
+    _items.removeOne(item);
     _plot->removeGraph(item->line);
-    _items.removeAll(item);
     delete item;
 
     _plot->updateAxesInteractivity();
@@ -403,7 +413,7 @@ void PlotWindow::limitsToSelection(bool x, bool y)
         if (!it) continue; 
         
         // TODO: process only visible part
-        auto minMax = GraphMath::minMax(g->data());
+        auto minMax = GraphMath::minMax(g->packedData());
         
         if (x)
         {
@@ -481,18 +491,12 @@ void PlotWindow::graphLineSelected(bool selected)
 
 PlotItem* PlotWindow::itemForLine(QCPGraph* line) const
 {
-    for (auto item : _items)
-        if (item->line == line)
-            return item;
-    return nullptr;
+    return _itemsByLine.value(line);
 }
 
 PlotItem* PlotWindow::itemForGraph(Graph* graph) const
 {
-    for (auto item : _items)
-        if (item->graph == graph)
-            return item;
-    return nullptr;
+    return _itemsByGraph.value(graph);
 }
 
 Graph* PlotWindow::selectedGraph(bool warn) const
@@ -820,7 +824,7 @@ void PlotWindow::renamePlot()
     QString newTitle = Ori::Dlg::inputText(tr("Diagram title:"), _diagram->title());
     if (newTitle.isEmpty() || newTitle == _diagram->title()) return;
     _diagram->setTitle(newTitle);
-    BusEvent::DiagramRenamed::send({{"id", _diagram->id()}});
+    EventBus::send({ .type = BusEvent::DiagramRenamed, .diagram = _diagram });
     _diagram->markModified("PlotWindow::renamePlot");
 }
 
@@ -831,7 +835,7 @@ void PlotWindow::renameGraph()
     QString newTitle = Ori::Dlg::inputText(tr("Graph title:"), graph->title());
     if (newTitle.isEmpty() || newTitle == graph->title()) return;
     graph->setTitle(newTitle);
-    BusEvent::GraphRenamed::send({{"id", graph->id()}});
+    EventBus::send({ .type = BusEvent::GraphRenamed, .diagram = _diagram, .graph = graph });
     _diagram->markModified("PlotWindow::renameGraph");
 }
 
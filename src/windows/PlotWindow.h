@@ -2,9 +2,9 @@
 #define PLOT_WINDOW_H
 
 #include "app/AppSettings.h"
+#include "core/EventBus.h"
 
-#include "tools/OriMessageBus.h"
-
+#include <QHash>
 #include <QWidget>
 
 namespace QCPL {
@@ -26,7 +26,7 @@ public:
     QCPGraph* line;
 };
 
-class PlotWindow : public QWidget, public IAppSettingsListener, public Ori::IMessageBusListener
+class PlotWindow : public QWidget, public IAppSettingsListener, public IEventBusListener
 {
     Q_OBJECT
 
@@ -39,8 +39,8 @@ public:
     // Implements IAppSettingsListener
     void settingsChanged() override;
 
-    // Ori::IMessageBusListener
-    void messageBusEvent(int event, const QMap<QString, QVariant>& params) override;
+    // IEventBusListener
+    void busEvent(const BusEvent &e) override;
 
     int graphCount() const;
 
@@ -128,12 +128,15 @@ private:
     //QCPL::Cursor* _cursor;
     //QCPL::CursorPanel* _cursorPanel;
     QList<PlotItem*> _items;
+    QHash<QCPGraph*, PlotItem*> _itemsByLine;
+    QHash<Graph*, PlotItem*> _itemsByGraph;
     Operations *_operations;
     bool _userClosing = false;
     bool _autoClosing = false;
 
     PlotItem* itemForLine(QCPGraph* line) const;
     PlotItem* itemForGraph(Graph* graph) const;
+    PlotItem* makeItem(Graph *g);
 
     void createContextMenus();
     void addAxisVars(QCPAxis* axis);
@@ -142,11 +145,14 @@ private:
 
     void handleDiagramRenamed();
     void handleDiagramFormatLoaded(const QJsonObject &fmt);
-    void handleGraphAdded(const QString &id);
-    void handleGraphLoaded(const QString &id, const QJsonObject &fmt);
-    void handleGraphUpdated(const QString &id);
-    void handleGraphRenamed(const QString &id);
-    void handleGraphDeleting(const QString &id);
+    void handleGraphAdded(Graph *g);
+    void handleGraphLoaded(Graph *g, const QJsonObject &fmt);
+    void handleGraphRenamed(Graph *graph);
+    void handleGraphDeleting(Graph *graph);
+
+    /// Puts new graph data into its plot line without replotting.
+    /// Returns false when the graph is not on this plot.
+    bool updateGraphLine(Graph *graph);
 };
 
 #endif // PLOT_WINDOW_H